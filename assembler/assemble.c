@@ -1,18 +1,20 @@
 #include "parse.h"
 
+#include "core/symbols.h"
+
 #include <assert.h>
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static uint8_t dumb_opcode(dolly_opcode op);
+static uint8_t dumb_opcode(dolly_opcode op, dolly_6502_variant variant);
 
 // TODO: Better approach
-static uint8_t dumb_opcode(dolly_opcode op)
+static uint8_t dumb_opcode(dolly_opcode op, dolly_6502_variant variant)
 {
     for (int i = 0; i < 256; ++i) {
-        dolly_opcode o = dolly_resolve_opcode(i);
+        dolly_opcode o = dolly_resolve_opcode_variant(i, variant);
         if (o.a_mode == op.a_mode && o.instr == op.instr) return i;
     }
     assert(0); // Shouldn't be reached
@@ -23,19 +25,37 @@ bool dolly_asm_make_executable(dolly_asm_syntax_tree* input,
                                dolly_executable* output)
 {
     dolly_executable_init(output);
-    output->header.arch = DOLLY_ARCH_6502;
+    output->header.arch = input->undocumented ? DOLLY_ARCH_6502_NMOS
+                                              : DOLLY_ARCH_6502;
+    dolly_6502_variant variant = dolly_executable_variant(output);
+
+    // Sections are compressed once everything is assembled into them
+    size_t* to_compress = dolly_malloc(sizeof(size_t) * input->size);
+    if (to_compress == NULL) return false;
+    size_t compress_count = 0;
+
+    // At most one per section directive, and the symbol table
+    size_t section_count = 1;
+    for (size_t index = 0; index < input->size; ++index) {
+        if (input->nodes[index].type & DOLLY_ASM_NODE_SECTION)
+            ++section_count;
+    }
+    if (dolly_executable_reserve(output, section_count, 0)
+        != DOLLY_EXEC_OKAY) {
+        dolly_free(to_compress);
+        return false;
+    }
 
     // First pass - map out sections
     for (size_t index = 0; index < input->size; ++index) {
         if (index == input->size - 1) continue;
 
         dolly_asm_syntax_node* sect_node = &input->nodes[index];
-        if (sect_node->type != DOLLY_ASM_NODE_SECTION_TEXT
-            && sect_node->type != DOLLY_ASM_NODE_SECTION_DATA) continue;
+        if (!(sect_node->type & DOLLY_ASM_NODE_SECTION)) continue;
 
         dolly_asm_syntax_node* node
             = dolly_asm_syntax_tree_find(input, sect_node + 1,
-                DOLLY_ASM_NODE_WRITABLE | DOLLY_ASM_NODE_SECTION);
+                DOLLY_ASM_NODE_SIZED | DOLLY_ASM_NODE_SECTION);
         if (node == NULL) break;
         if (node->type & DOLLY_ASM_NODE_SECTION) continue;
 
@@ -46,7 +66,7 @@ bool dolly_asm_make_executable(dolly_asm_syntax_tree* input,
         }
 
         last = dolly_asm_syntax_tree_rfind(input, last,
-            DOLLY_ASM_NODE_WRITABLE);
+            DOLLY_ASM_NODE_SIZED);
         if (last == NULL) continue;
         ++last;
 
@@ -62,17 +82,37 @@ bool dolly_asm_make_executable(dolly_asm_syntax_tree* input,
             n->section_number = output->header.section_count;
         }
 
+        // The bank, if any, goes in the top byte of the load address
+        const dolly_asm_syntax_node* bank_node
+            = dolly_asm_syntax_tree_find(input, sect_node + 1,
+                DOLLY_ASM_NODE_BANK | DOLLY_ASM_NODE_SECTION);
+        uint32_t bank = bank_node && bank_node->type == DOLLY_ASM_NODE_BANK
+                      ? bank_node->bank : 0;
+
         dolly_executable_section sect = {
             .type = sect_node->type == DOLLY_ASM_NODE_SECTION_TEXT
                                   ? DOLLY_SECTION_TEXT
-                                  : DOLLY_SECTION_DATA,
+                  : sect_node->type == DOLLY_ASM_NODE_SECTION_DATA
+                                  ? DOLLY_SECTION_DATA
+                                  : DOLLY_SECTION_BSS,
             .size = section_size,
-            .load_address = node->bin_offset
+            .load_address = (bank << 16) | node->bin_offset
         };
 
         strlcpy(sect.name, sect_node->section_name,
                 DOLLY_EXECUTABLE_SECTION_NAME_MAX_LENGTH - 1);
-        dolly_executable_add_section(output, &sect, NULL);
+
+        const dolly_asm_syntax_node* compress_node
+            = dolly_asm_syntax_tree_find(input, sect_node + 1,
+                DOLLY_ASM_NODE_COMPRESS | DOLLY_ASM_NODE_SECTION);
+        if (compress_node && compress_node->type == DOLLY_ASM_NODE_COMPRESS)
+            to_compress[compress_count++] = output->header.section_count;
+
+        if (dolly_executable_add_section(output, &sect, NULL)
+            != DOLLY_EXEC_OKAY) {
+            dolly_free(to_compress);
+            return false;
+        }
     }
 
     // Second pass - assemble
@@ -81,7 +121,7 @@ bool dolly_asm_make_executable(dolly_asm_syntax_tree* input,
         dolly_executable_section* section =
             &output->sections[node->section_number];
         uint32_t write_pos = section->offset +
-            (node->bin_offset - section->load_address);
+            (node->bin_offset - dolly_section_address(section));
 
         switch (node->type) {
         case DOLLY_ASM_NODE_INSTRUCTION: {
@@ -89,7 +129,7 @@ bool dolly_asm_make_executable(dolly_asm_syntax_tree* input,
                 .instr = node->instruction.instr,
                 .a_mode = node->instruction.a_mode
             };
-            output->program_data[write_pos] = dumb_opcode(opcode);
+            output->program_data[write_pos] = dumb_opcode(opcode, variant);
             uint16_t to_write;
             if (node->instruction.operand.is_identifier) {
                 const tb_hash_node* entry
@@ -119,8 +159,9 @@ bool dolly_asm_make_executable(dolly_asm_syntax_tree* input,
                 = node->type == DOLLY_ASM_NODE_STRING ?
                     (const void*)node->identifier.name
                     : (const void*)node->directive.data;
+            // Strings take their terminator with them
             size_t len = node->type == DOLLY_ASM_NODE_STRING ?
-                strlen(node->identifier.name)
+                strlen(node->identifier.name) + 1
                 : node->directive.size;
             memcpy(output->program_data + write_pos, src, len);
             break;
@@ -132,5 +173,43 @@ bool dolly_asm_make_executable(dolly_asm_syntax_tree* input,
             break;
         }
     }
-    return false;
+
+    // Labels are named by their full address, bank included
+    dolly_symbols_builder symbols;
+    dolly_symbols_builder_init(&symbols);
+    for (size_t index = 0; index < input->size; ++index) {
+        dolly_asm_syntax_node* node = &input->nodes[index];
+        if (node->type == DOLLY_ASM_NODE_CONSTANT) {
+            dolly_symbols_builder_add(&symbols, DOLLY_SYMBOL_CONSTANT
+                                      | node->identifier.addr_or_const,
+                                      node->identifier.name);
+        }
+        if (node->type != DOLLY_ASM_NODE_LABEL) continue;
+
+        uint32_t bank = 0;
+        dolly_asm_syntax_node* sect_node
+            = dolly_asm_syntax_tree_rfind(input, node, DOLLY_ASM_NODE_SECTION);
+        if (sect_node) {
+            const dolly_asm_syntax_node* bank_node
+                = dolly_asm_syntax_tree_find(input, sect_node + 1,
+                    DOLLY_ASM_NODE_BANK | DOLLY_ASM_NODE_SECTION);
+            if (bank_node && bank_node->type == DOLLY_ASM_NODE_BANK)
+                bank = bank_node->bank;
+        }
+        dolly_symbols_builder_add(&symbols, (bank << 16) | node->bin_offset,
+                                  node->identifier.name);
+    }
+    dolly_executable_status status
+        = dolly_symbols_builder_emit(&symbols, output);
+    dolly_symbols_builder_destroy(&symbols);
+    if (status != DOLLY_EXEC_OKAY) {
+        dolly_free(to_compress);
+        return false;
+    }
+
+    // Left uncompressed where that would not make them smaller
+    for (size_t i = 0; i < compress_count; ++i)
+        dolly_executable_compress_section(output, to_compress[i]);
+    dolly_free(to_compress);
+    return true;
 }
@@ -21,8 +21,6 @@ static void dolly_asm_delimit_token(dolly_asm_context* ctx,
 static int strcmp_ignorecase(const char* a, const char* b);
 /* ======= */
 
-tb_hash_table INSTRUCTION_TABLE;
-
 static int strcmp_ignorecase(const char* a, const char* b)
 {
     size_t i;
@@ -33,67 +31,90 @@ static int strcmp_ignorecase(const char* a, const char* b)
     return toupper((uchar_t) a[i]) - toupper((uchar_t) b[i]);
 }
 
-void init_instruction_table(void)
+tb_hash_table dolly_asm_instruction_table_new(void)
 {
-    INSTRUCTION_TABLE = tb_hash_table_new(67);
+    tb_hash_table table = tb_hash_table_new(97);
+
+    tb_hash_table_add_int(&table, "ADC", ADC);
+    tb_hash_table_add_int(&table, "AND", AND);
+    tb_hash_table_add_int(&table, "ASL", ASL);
+    tb_hash_table_add_int(&table, "BCC", BCC);
+    tb_hash_table_add_int(&table, "BCS", BCS);
+    tb_hash_table_add_int(&table, "BEQ", BEQ);
+    tb_hash_table_add_int(&table, "BIT", BIT);
+    tb_hash_table_add_int(&table, "BMI", BMI);
+    tb_hash_table_add_int(&table, "BNE", BNE);
+    tb_hash_table_add_int(&table, "BPL", BPL);
+    tb_hash_table_add_int(&table, "BRK", BRK);
+    tb_hash_table_add_int(&table, "BVC", BVC);
+    tb_hash_table_add_int(&table, "BVS", BVS);
+    tb_hash_table_add_int(&table, "CLC", CLC);
+    tb_hash_table_add_int(&table, "CLI", CLI);
+    tb_hash_table_add_int(&table, "CLV", CLV);
+    tb_hash_table_add_int(&table, "CMP", CMP);
+    tb_hash_table_add_int(&table, "CPX", CPX);
+    tb_hash_table_add_int(&table, "CPY", CPY);
+    tb_hash_table_add_int(&table, "DEC", DEC);
+    tb_hash_table_add_int(&table, "DEX", DEX);
+    tb_hash_table_add_int(&table, "DEY", DEY);
+    tb_hash_table_add_int(&table, "EOR", EOR);
+    tb_hash_table_add_int(&table, "INC", INC);
+    tb_hash_table_add_int(&table, "INX", INX);
+    tb_hash_table_add_int(&table, "INY", INY);
+    tb_hash_table_add_int(&table, "JMP", JMP);
+    tb_hash_table_add_int(&table, "JSR", JSR);
+    tb_hash_table_add_int(&table, "LDX", LDX);
+    tb_hash_table_add_int(&table, "LDY", LDY);
+    tb_hash_table_add_int(&table, "LSR", LSR);
+    tb_hash_table_add_int(&table, "NOP", NOP);
+    tb_hash_table_add_int(&table, "ORA", ORA);
+    tb_hash_table_add_int(&table, "PHA", PHA);
+    tb_hash_table_add_int(&table, "PHP", PHP);
+    tb_hash_table_add_int(&table, "PLA", PLA);
+    tb_hash_table_add_int(&table, "PLP", PLP);
+    tb_hash_table_add_int(&table, "ROL", ROL);
+    tb_hash_table_add_int(&table, "ROR", ROR);
+    tb_hash_table_add_int(&table, "RTI", RTI);
+    tb_hash_table_add_int(&table, "RTS", RTS);
+    tb_hash_table_add_int(&table, "SBC", SBC);
+    tb_hash_table_add_int(&table, "SED", SED);
+    tb_hash_table_add_int(&table, "SEI", SEI);
+    tb_hash_table_add_int(&table, "STA", STA);
+    tb_hash_table_add_int(&table, "STX", STX);
+    tb_hash_table_add_int(&table, "STY", STY);
+    tb_hash_table_add_int(&table, "TAX", TAX);
+    tb_hash_table_add_int(&table, "TAY", TAY);
+    tb_hash_table_add_int(&table, "TSX", TSX);
+    tb_hash_table_add_int(&table, "TXA", TXA);
+    tb_hash_table_add_int(&table, "TXS", TXS);
+    tb_hash_table_add_int(&table, "TYA", TYA);
+    tb_hash_table_add_int(&table, "SEC", SEC);
+    tb_hash_table_add_int(&table, "LDA", LDA);
+    tb_hash_table_add_int(&table, "CLD", CLD);
+    tb_hash_table_add_int(&table, "BRA", BRA);
+    tb_hash_table_add_int(&table, "STZ", STZ);
+    tb_hash_table_add_int(&table, "PHX", PHX);
+    tb_hash_table_add_int(&table, "PLX", PLX);
+    tb_hash_table_add_int(&table, "PHY", PHY);
+    tb_hash_table_add_int(&table, "PLY", PLY);
+    tb_hash_table_add_int(&table, "TRB", TRB);
+    tb_hash_table_add_int(&table, "TSB", TSB);
+    tb_hash_table_add_int(&table, "WAI", WAI);
+    tb_hash_table_add_int(&table, "STP", STP);
+    tb_hash_table_add_int(&table, "SLO", SLO);
+    tb_hash_table_add_int(&table, "RLA", RLA);
+    tb_hash_table_add_int(&table, "SRE", SRE);
+    tb_hash_table_add_int(&table, "RRA", RRA);
+    tb_hash_table_add_int(&table, "SAX", SAX);
+    tb_hash_table_add_int(&table, "LAX", LAX);
+    tb_hash_table_add_int(&table, "DCP", DCP);
+    tb_hash_table_add_int(&table, "ISC", ISC);
+    tb_hash_table_add_int(&table, "ANC", ANC);
+    tb_hash_table_add_int(&table, "ALR", ALR);
+    tb_hash_table_add_int(&table, "ARR", ARR);
+    tb_hash_table_add_int(&table, "SBX", SBX);
 
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "ADC", ADC);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "AND", AND);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "ASL", ASL);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "BCC", BCC);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "BCS", BCS);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "BEQ", BEQ);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "BIT", BIT);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "BMI", BMI);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "BNE", BNE);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "BPL", BPL);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "BRK", BRK);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "BVC", BVC);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "BVS", BVS);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "CLC", CLC);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "CLI", CLI);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "CLV", CLV);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "CMP", CMP);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "CPX", CPX);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "CPY", CPY);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "DEC", DEC);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "DEX", DEX);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "DEY", DEY);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "EOR", EOR);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "INC", INC);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "INX", INX);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "INY", INY);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "JMP", JMP);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "JSR", JSR);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "LDX", LDX);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "LDY", LDY);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "LSR", LSR);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "NOP", NOP);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "ORA", ORA);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "PHA", PHA);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "PHP", PHP);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "PLA", PLA);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "PLP", PLP);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "ROL", ROL);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "ROR", ROR);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "RTI", RTI);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "RTS", RTS);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "SBC", SBC);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "SED", SED);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "SEI", SEI);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "STA", STA);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "STX", STX);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "STY", STY);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "TAX", TAX);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "TAY", TAY);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "TSX", TSX);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "TXA", TXA);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "TXS", TXS);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "TYA", TYA);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "SEC", SEC);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "LDA", LDA);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "CLD", CLD);
-    tb_hash_table_add_int(&INSTRUCTION_TABLE, "BRA", BRA);
+    return table;
 }
 
 static bool dolly_asm_parse_string(dolly_asm_context* ctx,
@@ -103,12 +124,13 @@ static bool dolly_asm_parse_string(dolly_asm_context* ctx,
     out->type = DOLLY_ASM_TOKEN_STRING;
     out->line = ctx->line;
     out->column = ctx->column;
+    bool copied = true;
     size_t i = 1;
     for (i = 1; start[i] != '"'; ++i) {
         ++ctx->column;
         if (!isprint((uchar_t) start[i])) {
             dolly_asm_report_error(ctx);
-            printf("Illegal character in string\n");
+            dolly_asm_print(ctx, "Illegal character in string\n");
             tb_stringbuf_clear(&ctx->current_token_text);
             return false;
         }
@@ -116,7 +138,7 @@ static bool dolly_asm_parse_string(dolly_asm_context* ctx,
         if (start[i] == '\\') {
             if (i + 1 >= end) {
                 dolly_asm_report_error(ctx);
-                printf("Unexpected end of string\n");
+                dolly_asm_print(ctx, "Unexpected end of string\n");
                 tb_stringbuf_clear(&ctx->current_token_text);
                 return false;
             }
@@ -128,18 +150,20 @@ static bool dolly_asm_parse_string(dolly_asm_context* ctx,
             case '"': to_cat = '"'; break;
             default:
                 dolly_asm_report_error(ctx);
-                printf("Unrecognised escape character\n");
+                dolly_asm_print(ctx, "Unrecognised escape character\n");
                 tb_stringbuf_clear(&ctx->current_token_text);
                 return false;
             }
-            tb_stringbuf_cat_char(&ctx->current_token_text, to_cat);
+            copied &= tb_stringbuf_cat_char(&ctx->current_token_text, to_cat);
             ++i;
         } else {
-            tb_stringbuf_cat_char(&ctx->current_token_text, start[i]);
+            copied &= tb_stringbuf_cat_char(&ctx->current_token_text,
+                                            start[i]);
         }
     }
     *index += i;
-    out->string_or_identifier = strdup_or_abort(ctx->current_token_text.data);
+    out->string_or_identifier
+        = copied ? dolly_strdup(ctx->current_token_text.data) : NULL;
     tb_stringbuf_clear(&ctx->current_token_text);
     return true;
 }
@@ -198,9 +222,20 @@ static bool dolly_asm_parse_multichar(dolly_asm_context* ctx,
             out->directive_type = DOLLY_ASM_DIRECTIVE_DATA;
         } else if (strcmp_ignorecase(text, ".WORD") == 0) {
             out->directive_type = DOLLY_ASM_DIRECTIVE_WORD;
+        } else if (strcmp_ignorecase(text, ".BANK") == 0) {
+            out->directive_type = DOLLY_ASM_DIRECTIVE_BANK;
+        } else if (strcmp_ignorecase(text, ".UNDOCUMENTED") == 0) {
+            out->directive_type = DOLLY_ASM_DIRECTIVE_UNDOCUMENTED;
+        } else if (strcmp_ignorecase(text, ".BSS") == 0) {
+            out->directive_type = DOLLY_ASM_DIRECTIVE_BSS;
+        } else if (strcmp_ignorecase(text, ".RES") == 0) {
+            out->directive_type = DOLLY_ASM_DIRECTIVE_RESERVE;
+        } else if (strcmp_ignorecase(text, ".COMPRESS") == 0) {
+            out->directive_type = DOLLY_ASM_DIRECTIVE_COMPRESS;
         } else {
             dolly_asm_report_error(ctx);
-            printf("Unrecognised or unsupported directive '%s'\n", text);
+            dolly_asm_print(ctx, "Unrecognised or unsupported directive '%s'\n",
+                            text);
             return false;
         }
         out->type = DOLLY_ASM_TOKEN_DIRECTIVE;
@@ -215,7 +250,7 @@ static bool dolly_asm_parse_multichar(dolly_asm_context* ctx,
             instruction_text[i] = toupper((uchar_t) instruction_text[i]);
 
         const tb_hash_node* node
-            = tb_hash_table_get(&INSTRUCTION_TABLE, instruction_text);
+            = tb_hash_table_get(&ctx->instructions, instruction_text);
         if (node != NULL) {
             out->type = DOLLY_ASM_TOKEN_INSTRUCTION;
             out->instruction = (dolly_instruction) node->int_value;
@@ -237,7 +272,7 @@ static bool dolly_asm_parse_multichar(dolly_asm_context* ctx,
         if (items_read > 0) {
             if (value > UINT16_MAX || value < INT16_MIN) {
                 dolly_asm_report_error(ctx);
-                printf("Integer overflow: '%s'\n", text);
+                dolly_asm_print(ctx, "Integer overflow: '%s'\n", text);
                 return false;
             }
             out->type = DOLLY_ASM_TOKEN_INTEGER;
@@ -272,12 +307,12 @@ static bool dolly_asm_parse_multichar(dolly_asm_context* ctx,
 
     if (valid_identifier) {
         out->type = DOLLY_ASM_TOKEN_IDENTIFIER;
-        out->string_or_identifier = strdup_or_abort(text);
+        out->string_or_identifier = dolly_strdup(text);
         return true;
     }
 
     dolly_asm_report_error(ctx);
-    printf("Unrecognised token '%s'\n", text);
+    dolly_asm_print(ctx, "Unrecognised token '%s'\n", text);
 
     return false;
 }
@@ -295,13 +330,17 @@ static void dolly_asm_delimit_token(dolly_asm_context* ctx,
 bool dolly_asm_lex(dolly_asm_context* ctx, const char* text, size_t size,
                    dolly_asm_token_list* output)
 {
+    // Only a context whose buffer and mnemonics were allocated can lex
+    if (ctx->current_token_text.data == NULL || ctx->instructions.out_of_memory)
+        output->out_of_memory = true;
+
     ctx->line = 1;
     ctx->column = 1;
     dolly_asm_token base_token = {
         .line = ctx->line,
         .column = ctx->column
     };
-    for (size_t index = 0; index < size; ++index) {
+    for (size_t index = 0; index < size && !output->out_of_memory; ++index) {
         switch (text[index]) {
         // Single character self-delimiting tokens
         case '(':
@@ -371,11 +410,12 @@ bool dolly_asm_lex(dolly_asm_context* ctx, const char* text, size_t size,
         }
         // Multi-character tokens
         default:
-            tb_stringbuf_cat_char(&ctx->current_token_text, text[index]);
+            if (!tb_stringbuf_cat_char(&ctx->current_token_text, text[index]))
+                output->out_of_memory = true;
             break;
         }
         ++ctx->column;
     }
 
-    return ctx->errors == 0;
+    return ctx->errors == 0 && !output->out_of_memory;
 }
@@ -3,6 +3,9 @@
 #include <errno.h>
 #include <string.h>
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "core/core.h"
 #include "assembler/parse.h"
 
@@ -33,8 +36,6 @@ int main(int argc, char** argv)
 
     dolly_asm_token_list tokens = dolly_asm_token_list_new();
 
-    init_instruction_table();
-
     bool success = dolly_asm_lex(&ctx, filebuf.data, filebuf.size, &tokens);
     tb_streambuf_destroy(&filebuf);
 
@@ -50,25 +51,34 @@ int main(int argc, char** argv)
         printf("%zu errors generated.\n", ctx.errors);
         dolly_asm_syntax_tree_destroy(&syntax_tree);
         dolly_asm_token_list_destroy(&tokens);
+        dolly_asm_context_destroy(&ctx);
         return 1;
     }
 
+    // With no errors, a stage only fails for want of memory, which ends the
+    // tool as running out anywhere else does
     dolly_executable exec;
-
-    if (success)
-        success = dolly_asm_make_executable(&syntax_tree, &exec);
+    if (!success || !dolly_asm_make_executable(&syntax_tree, &exec))
+        abort_no_mem();
 
     const char* out_filename = argc > 2 ? argv[2] : "out.bin";
-    FILE* out = fopen(out_filename, "w");
-    if (!out) {
+    int out = open(out_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out == -1) {
         printf("Failed to open file for writing: %s\n", strerror(errno));
     } else {
-        dolly_executable_write(&exec, out);
-        printf("Assembled executable %s\n", out_filename);
+        bool written = dolly_executable_write(&exec, out) == DOLLY_EXEC_OKAY;
+        if (close(out) != 0) written = false;
+        if (written) {
+            printf("Assembled executable %s\n", out_filename);
+        } else {
+            printf("Failed to write file: %s\n", strerror(errno));
+            success = false;
+        }
     }
 
     dolly_asm_syntax_tree_destroy(&syntax_tree);
     dolly_executable_destroy(&exec);
     dolly_asm_token_list_destroy(&tokens);
+    dolly_asm_context_destroy(&ctx);
     return success ? 0 : 1;
 }
@@ -1,23 +1,28 @@
 #include "parse.h"
 
+#include <stdarg.h>
 #include <stdlib.h>
 
+static void dolly_asm_token_free(dolly_asm_token* token);
+static void dolly_asm_syntax_node_free(dolly_asm_syntax_node* node);
+
 dolly_asm_context dolly_asm_context_new(const char* filename)
 {
     dolly_asm_context ctx = {
         .current_token_text = tb_stringbuf_new(32),
+        .instructions = dolly_asm_instruction_table_new(),
         .errors = 0,
-        .filename = filename
+        .filename = filename,
+        .diagnostics = stdout
     };
 
-    if (ctx.current_token_text.data == NULL) abort_no_mem();
-
     return ctx;
 }
 
 void dolly_asm_context_destroy(dolly_asm_context* ctx)
 {
     tb_stringbuf_destroy(&ctx->current_token_text);
+    tb_hash_table_destroy(&ctx->instructions);
 }
 
 const char* dolly_asm_token_type_str(const dolly_asm_token* token)
@@ -44,62 +49,92 @@ const char* dolly_asm_token_type_str(const dolly_asm_token* token)
 
 void dolly_asm_report_error(dolly_asm_context* ctx)
 {
-    printf("%s:%zu:%zu: \x1b[1;31mError: \x1b[1;0m",
-           ctx->filename, ctx->line,
-           ctx->column - ctx->current_token_text.size - 1);
+    dolly_asm_print(ctx, "%s:%zu:%zu: \x1b[1;31mError: \x1b[1;0m",
+                    ctx->filename, ctx->line,
+                    ctx->column - ctx->current_token_text.size - 1);
     ++ctx->errors;
 }
 
 void dolly_asm_report_error_token(dolly_asm_context* ctx,
                                          const dolly_asm_token* token)
 {
-    printf("%s:%zu:%zu: \x1b[1;31mError: \x1b[1;0m",
-           ctx->filename, token->line, token->column);
+    dolly_asm_print(ctx, "%s:%zu:%zu: \x1b[1;31mError: \x1b[1;0m",
+                    ctx->filename, token->line, token->column);
     ++ctx->errors;
 }
 
 void dolly_asm_report_error_node(dolly_asm_context* ctx,
                                  const dolly_asm_syntax_node* node)
 {
-    printf("%s:%zu:%zu: \x1b[1;31mError: \x1b[1;0m",
-           ctx->filename, node->line, node->column);
+    dolly_asm_print(ctx, "%s:%zu:%zu: \x1b[1;31mError: \x1b[1;0m",
+                    ctx->filename, node->line, node->column);
     ++ctx->errors;
 }
 
+void dolly_asm_print(dolly_asm_context* ctx, const char* format, ...)
+{
+    if (ctx->diagnostics == NULL) return;
+
+    va_list args;
+    va_start(args, format);
+    vfprintf(ctx->diagnostics, format, args);
+    va_end(args);
+}
+
 dolly_asm_token_list dolly_asm_token_list_new(void)
 {
     const static size_t START_CAPACITY = 32;
     dolly_asm_token_list list = {
-        .tokens = malloc_or_abort(sizeof(dolly_asm_token) * START_CAPACITY),
+        .tokens = dolly_malloc(sizeof(dolly_asm_token) * START_CAPACITY),
         .size = 0,
         .capacity = START_CAPACITY
     };
+    list.out_of_memory = list.tokens == NULL;
 
     return list;
 }
 
+// Tokens own the text of strings and identifiers
+static void dolly_asm_token_free(dolly_asm_token* token)
+{
+    if (token->type & (DOLLY_ASM_TOKEN_STRING | DOLLY_ASM_TOKEN_IDENTIFIER))
+        dolly_free(token->string_or_identifier);
+}
+
 void dolly_asm_token_list_add(dolly_asm_token_list* list,
                               const dolly_asm_token* token)
 {
-    if (list->size >= list->capacity) {
-        if (list->capacity == 0) ++list->capacity;
-        else list->capacity *= 2;
+    // The lexer leaves the text NULL when it couldn't be copied
+    if ((token->type & (DOLLY_ASM_TOKEN_STRING | DOLLY_ASM_TOKEN_IDENTIFIER))
+        && token->string_or_identifier == NULL) {
+        list->out_of_memory = true;
+    }
 
-        list->tokens = realloc_or_abort(list->tokens,
-            sizeof(dolly_asm_token) * list->capacity);
+    if (list->size >= list->capacity && !list->out_of_memory) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 1;
+        dolly_asm_token* tokens = dolly_realloc(list->tokens,
+            sizeof(dolly_asm_token) * capacity);
+        if (tokens == NULL) {
+            list->out_of_memory = true;
+        } else {
+            list->tokens = tokens;
+            list->capacity = capacity;
+        }
     }
 
+    if (list->out_of_memory) {
+        dolly_asm_token dropped = *token;
+        dolly_asm_token_free(&dropped);
+        return;
+    }
     list->tokens[list->size++] = *token;
 }
 
 void dolly_asm_token_list_destroy(dolly_asm_token_list* list)
 {
-    for (size_t i = 0; i < list->size; ++i) {
-        if (list->tokens[i].type
-            & (DOLLY_ASM_TOKEN_STRING | DOLLY_ASM_TOKEN_IDENTIFIER)) {
-            free(list->tokens[i].string_or_identifier);
-        }
-    }
+    for (size_t i = 0; i < list->size; ++i)
+        dolly_asm_token_free(&list->tokens[i]);
+    dolly_free(list->tokens);
 }
 
 dolly_asm_syntax_tree dolly_asm_syntax_tree_new(void)
@@ -108,26 +143,48 @@ dolly_asm_syntax_tree dolly_asm_syntax_tree_new(void)
     dolly_asm_syntax_tree tree = {
         .identifiers = tb_hash_table_new(67),
         .section_names = tb_hash_table_new(31),
-        .nodes =
-            malloc_or_abort(sizeof(dolly_asm_syntax_node) * START_CAPACITY),
+        .nodes = dolly_malloc(sizeof(dolly_asm_syntax_node) * START_CAPACITY),
         .size = 0,
-        .capacity = START_CAPACITY
+        .capacity = START_CAPACITY,
+        .undocumented = false
     };
+    tree.out_of_memory = tree.nodes == NULL || tree.identifiers.out_of_memory
+                       || tree.section_names.out_of_memory;
 
     return tree;
 }
 
+static void dolly_asm_syntax_node_free(dolly_asm_syntax_node* node)
+{
+    if (node->type == DOLLY_ASM_NODE_BYTE_DATA) {
+        dolly_free(node->directive.data);
+    } else if (node->type == DOLLY_ASM_NODE_LABEL) {
+        // Labels own a copy of their name, where constants and strings share
+        // the token's
+        dolly_free((char*) node->identifier.name);
+    }
+}
+
 void dolly_asm_syntax_tree_add(dolly_asm_syntax_tree* tree,
                                const dolly_asm_syntax_node* node)
 {
-    if (tree->size >= tree->capacity) {
-        if (tree->capacity == 0) ++tree->capacity;
-        else tree->capacity *= 2;
-
-        tree->nodes = realloc_or_abort(tree->nodes,
-            sizeof(dolly_asm_syntax_node) * tree->capacity);
+    if (tree->size >= tree->capacity && !tree->out_of_memory) {
+        size_t capacity = tree->capacity ? tree->capacity * 2 : 1;
+        dolly_asm_syntax_node* nodes = dolly_realloc(tree->nodes,
+            sizeof(dolly_asm_syntax_node) * capacity);
+        if (nodes == NULL) {
+            tree->out_of_memory = true;
+        } else {
+            tree->nodes = nodes;
+            tree->capacity = capacity;
+        }
     }
 
+    if (tree->out_of_memory) {
+        dolly_asm_syntax_node dropped = *node;
+        dolly_asm_syntax_node_free(&dropped);
+        return;
+    }
     tree->nodes[tree->size++] = *node;
 }
 
@@ -158,13 +215,10 @@ dolly_asm_syntax_tree_rfind(dolly_asm_syntax_tree* tree,
 
 void dolly_asm_syntax_tree_destroy(dolly_asm_syntax_tree* tree)
 {
-    for (size_t i = 0; i < tree->size; ++i) {
-        if (tree->nodes[i].type
-            & (DOLLY_ASM_NODE_STRING | DOLLY_ASM_NODE_BYTE_DATA)) {
-            free(tree->nodes[i].directive.data);
-        }
-    }
+    for (size_t i = 0; i < tree->size; ++i)
+        dolly_asm_syntax_node_free(&tree->nodes[i]);
 
+    dolly_free(tree->nodes);
     tb_hash_table_destroy(&tree->identifiers);
     tb_hash_table_destroy(&tree->section_names);
 }
@@ -2,6 +2,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include "core/core.h"
 
 enum dolly_asm_token_type
@@ -34,7 +35,12 @@ enum dolly_asm_directive
     DOLLY_ASM_DIRECTIVE_STRING,
     DOLLY_ASM_DIRECTIVE_TEXT,
     DOLLY_ASM_DIRECTIVE_DATA,
-    DOLLY_ASM_DIRECTIVE_WORD
+    DOLLY_ASM_DIRECTIVE_WORD,
+    DOLLY_ASM_DIRECTIVE_BANK,
+    DOLLY_ASM_DIRECTIVE_UNDOCUMENTED,
+    DOLLY_ASM_DIRECTIVE_BSS,
+    DOLLY_ASM_DIRECTIVE_RESERVE,
+    DOLLY_ASM_DIRECTIVE_COMPRESS
 };
 
 enum dolly_asm_node_type
@@ -48,10 +54,17 @@ enum dolly_asm_node_type
     DOLLY_ASM_NODE_ORIGIN = 1 << 5,
     DOLLY_ASM_NODE_SECTION_TEXT = 1 << 6,
     DOLLY_ASM_NODE_SECTION_DATA = 1 << 7,
+    DOLLY_ASM_NODE_BANK = 1 << 8,
+    DOLLY_ASM_NODE_SECTION_BSS = 1 << 9,
+    DOLLY_ASM_NODE_RESERVE = 1 << 10,
+    DOLLY_ASM_NODE_COMPRESS = 1 << 11,
     DOLLY_ASM_NODE_WRITABLE = DOLLY_ASM_NODE_INSTRUCTION
                             | DOLLY_ASM_NODE_BYTE_DATA | DOLLY_ASM_NODE_STRING,
+    // Nodes which take up space in their section
+    DOLLY_ASM_NODE_SIZED = DOLLY_ASM_NODE_WRITABLE | DOLLY_ASM_NODE_RESERVE,
     DOLLY_ASM_NODE_SECTION = DOLLY_ASM_NODE_SECTION_TEXT
                            | DOLLY_ASM_NODE_SECTION_DATA
+                           | DOLLY_ASM_NODE_SECTION_BSS
 
 };
 
@@ -103,6 +116,9 @@ struct dolly_asm_token_list
     dolly_asm_token* tokens;
     size_t size;
     size_t capacity;
+    // Set when growing fails, which drops the token, or when a token's text
+    // couldn't be copied
+    bool out_of_memory;
 };
 
 typedef struct dolly_asm_token_list dolly_asm_token_list;
@@ -158,10 +174,12 @@ struct dolly_asm_syntax_node
         dolly_asm_data_directive directive;
         dolly_asm_instruction instruction;
         uint16_t origin_offset;
+        uint16_t reserve_size;
+        uint8_t bank;
     };
     dolly_asm_node_type type;
     uint32_t bin_offset;
-    uint8_t section_number;
+    uint16_t section_number;
 };
 
 typedef struct dolly_asm_syntax_node dolly_asm_syntax_node;
@@ -173,6 +191,11 @@ struct dolly_asm_syntax_tree
     dolly_asm_syntax_node* nodes;
     size_t size;
     size_t capacity;
+    // Set when growing fails, which drops the node, or a name can't be added
+    bool out_of_memory;
+    // Set by .undocumented anywhere in the file, which allows the
+    // undocumented NMOS opcodes in place of WAI and STP
+    bool undocumented;
 };
 
 typedef struct dolly_asm_syntax_tree dolly_asm_syntax_tree;
@@ -180,14 +203,17 @@ typedef struct dolly_asm_syntax_tree dolly_asm_syntax_tree;
 struct dolly_asm_context
 {
     tb_stringbuf current_token_text;
+    tb_hash_table instructions; // Mnemonic to dolly_instruction
     const char* filename;
+    FILE* diagnostics; // Where errors are reported, stdout by default, or NULL
     size_t errors;
     size_t line, column;
 };
 
 typedef struct dolly_asm_context dolly_asm_context;
 
-void init_instruction_table(void);
+// The table of mnemonics the lexer matches, which each context holds
+tb_hash_table dolly_asm_instruction_table_new(void);
 dolly_asm_context dolly_asm_context_new(const char* filename);
 void dolly_asm_context_destroy(dolly_asm_context* ctx);
 
@@ -202,6 +228,8 @@ bool dolly_asm_make_syntax_tree(dolly_asm_context* ctx,
 bool dolly_asm_verify_semantics(dolly_asm_context* ctx,
                                 dolly_asm_syntax_tree* input);
 
+// Returns false only when out of memory. The executable is made either way,
+// so must be destroyed.
 bool dolly_asm_make_executable(dolly_asm_syntax_tree* input,
                                dolly_executable* output);
 /* =============== */
@@ -212,6 +240,8 @@ void dolly_asm_report_error_token(dolly_asm_context* ctx,
 void dolly_asm_report_error_node(dolly_asm_context* ctx,
                                  const dolly_asm_syntax_node* node);
 void dolly_asm_report_error(dolly_asm_context* ctx);
+// Continues a report on the context's diagnostics stream
+void dolly_asm_print(dolly_asm_context* ctx, const char* format, ...);
 /* =============== */
 
 /* Dynamic arrays */
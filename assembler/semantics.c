@@ -47,8 +47,13 @@ dolly_addressing_mode get_amode(const dolly_asm_instruction* instr,
         return (is_label || (value > UINT8_MAX && (int16_t)value < INT8_MIN))
                 ? DOLLY_INVALID_ADDR_MODE : IMMEDIATE;
     case DOLLY_ASM_OPERAND_INDIRECT_INT:
+        if (instr->instr == JMP) return INDIRECT;
+        return value > UINT8_MAX ? DOLLY_INVALID_ADDR_MODE
+                                 : ZERO_PAGE_INDIRECT;
     case DOLLY_ASM_OPERAND_INDIRECT_IDEN:
-        return INDIRECT;
+        if (instr->instr == JMP) return INDIRECT;
+        return (is_label || value > UINT8_MAX) ? DOLLY_INVALID_ADDR_MODE
+                                               : ZERO_PAGE_INDIRECT;
     case DOLLY_ASM_OPERAND_IMPLICIT:
         return IMPLICIT;
     default: return DOLLY_INVALID_ADDR_MODE;
@@ -62,6 +67,11 @@ bool only_absolute(dolly_instruction instr)
 
 const dolly_addressing_mode AMODE_GROUP_1
     = IMMEDIATE | ZERO_PAGE | ZERO_PAGE_X | ABSOLUTE | ABSOLUTE_X | ABSOLUTE_Y
+    | INDIRECT_X | INDIRECT_Y | ZERO_PAGE_INDIRECT;
+
+// The undocumented read-modify-write instructions
+const dolly_addressing_mode AMODE_GROUP_UNDOCUMENTED
+    = ZERO_PAGE | ZERO_PAGE_X | ABSOLUTE | ABSOLUTE_X | ABSOLUTE_Y
     | INDIRECT_X | INDIRECT_Y;
 
 const dolly_addressing_mode COMPATIBLE_ADDR_MODES[DOLLY_6502_INSTRUCTION_COUNT] = {
@@ -71,7 +81,7 @@ const dolly_addressing_mode COMPATIBLE_ADDR_MODES[DOLLY_6502_INSTRUCTION_COUNT]
     [BCC] = RELATIVE,
     [BCS] = RELATIVE,
     [BEQ] = RELATIVE,
-    [BIT] = ZERO_PAGE | ABSOLUTE,
+    [BIT] = IMMEDIATE | ZERO_PAGE | ZERO_PAGE_X | ABSOLUTE | ABSOLUTE_X,
     [BMI] = RELATIVE,
     [BNE] = RELATIVE,
     [BPL] = RELATIVE,
@@ -84,11 +94,11 @@ const dolly_addressing_mode COMPATIBLE_ADDR_MODES[DOLLY_6502_INSTRUCTION_COUNT]
     [CMP] = AMODE_GROUP_1,
     [CPX] = IMMEDIATE | ZERO_PAGE | ABSOLUTE,
     [CPY] = IMMEDIATE | ZERO_PAGE | ABSOLUTE,
-    [DEC] = ZERO_PAGE | ZERO_PAGE_X | ABSOLUTE | ABSOLUTE_X,
+    [DEC] = ACCUMULATOR | ZERO_PAGE | ZERO_PAGE_X | ABSOLUTE | ABSOLUTE_X,
     [DEX] = IMMEDIATE,
     [DEY] = IMMEDIATE,
     [EOR] = AMODE_GROUP_1,
-    [INC] = ZERO_PAGE | ZERO_PAGE_X | ABSOLUTE | ABSOLUTE_X,
+    [INC] = ACCUMULATOR | ZERO_PAGE | ZERO_PAGE_X | ABSOLUTE | ABSOLUTE_X,
     [INX] = IMMEDIATE,
     [INY] = IMMEDIATE,
     [JMP] = ABSOLUTE | INDIRECT,
@@ -121,29 +131,61 @@ const dolly_addressing_mode COMPATIBLE_ADDR_MODES[DOLLY_6502_INSTRUCTION_COUNT]
     [SEC] = IMMEDIATE,
     [LDA] = AMODE_GROUP_1,
     [CLD] = IMMEDIATE,
-    [BRA] = RELATIVE
+    [BRA] = RELATIVE,
+    [STZ] = ZERO_PAGE | ZERO_PAGE_X | ABSOLUTE | ABSOLUTE_X,
+    [PHX] = IMMEDIATE,
+    [PLX] = IMMEDIATE,
+    [PHY] = IMMEDIATE,
+    [PLY] = IMMEDIATE,
+    [TRB] = ZERO_PAGE | ABSOLUTE,
+    [TSB] = ZERO_PAGE | ABSOLUTE,
+    [WAI] = IMMEDIATE,
+    [STP] = IMMEDIATE,
+    [SLO] = AMODE_GROUP_UNDOCUMENTED,
+    [RLA] = AMODE_GROUP_UNDOCUMENTED,
+    [SRE] = AMODE_GROUP_UNDOCUMENTED,
+    [RRA] = AMODE_GROUP_UNDOCUMENTED,
+    [SAX] = ZERO_PAGE | ZERO_PAGE_Y | ABSOLUTE | INDIRECT_X,
+    [LAX] = ZERO_PAGE | ZERO_PAGE_Y | ABSOLUTE | ABSOLUTE_Y | INDIRECT_X
+          | INDIRECT_Y,
+    [DCP] = AMODE_GROUP_UNDOCUMENTED,
+    [ISC] = AMODE_GROUP_UNDOCUMENTED,
+    [ANC] = IMMEDIATE,
+    [ALR] = IMMEDIATE,
+    [ARR] = IMMEDIATE,
+    [SBX] = IMMEDIATE
 };
 
 bool dolly_asm_verify_semantics(dolly_asm_context* ctx,
                                 dolly_asm_syntax_tree* input)
 {
     uint32_t bin_offset = 0;
-    uint8_t section_number = 0;
+    uint16_t section_number = 0;
+    bool section_has_bank = false;
+    bool section_has_data = false;
+    bool section_is_bss = false;
+    bool section_overflowed = false;
     // First pass
     for (size_t index = 0; index < input->size; ++index) {
         dolly_asm_syntax_node* node = &input->nodes[index];
         node->bin_offset = bin_offset;
         node->section_number = section_number;
+        if (node->type & DOLLY_ASM_NODE_SIZED) section_has_data = true;
+        if ((node->type & DOLLY_ASM_NODE_WRITABLE) && section_is_bss) {
+            dolly_asm_report_error_node(ctx, node);
+            dolly_asm_print(ctx, "Sections declared with .bss can only reserve "
+                                 "space, with .res\n");
+        }
         switch (node->type) {
         case DOLLY_ASM_NODE_ORIGIN: {
             const dolly_asm_syntax_node* last
                 = dolly_asm_syntax_tree_rfind(input, node,
-                    DOLLY_ASM_NODE_WRITABLE);
+                    DOLLY_ASM_NODE_SIZED);
             if (last != NULL && last->bin_offset >= node->origin_offset
                 && node->section_number == last->section_number) {
                 dolly_asm_report_error_node(ctx, node);
-                printf("Origin directives cannot go backwards within "
-                       "a section\n");
+                dolly_asm_print(ctx, "Origin directives cannot go backwards "
+                                     "within a section\n");
                 break;
             }
 
@@ -153,12 +195,34 @@ bool dolly_asm_verify_semantics(dolly_asm_context* ctx,
         case DOLLY_ASM_NODE_BYTE_DATA:
             bin_offset += node->directive.size;
             break;
+        case DOLLY_ASM_NODE_RESERVE:
+            if (!section_is_bss) {
+                dolly_asm_report_error_node(ctx, node);
+                dolly_asm_print(ctx, "The .res directive can only be used in "
+                                     "sections declared with .bss\n");
+            }
+            bin_offset += node->reserve_size;
+            break;
         case DOLLY_ASM_NODE_STRING: {
             uint32_t string_bytes_len = strlen(node->identifier.name) + 1;
             bin_offset += string_bytes_len;
             break;
         }
         case DOLLY_ASM_NODE_INSTRUCTION: {
+            dolly_instruction instr = node->instruction.instr;
+            if (dolly_is_undocumented(instr) && !input->undocumented) {
+                dolly_asm_report_error_node(ctx, node);
+                dolly_asm_print(ctx, "Instruction '%s' is an undocumented NMOS "
+                                     "opcode, which requires the .undocumented "
+                                     "directive\n",
+                                dolly_get_instr_name(instr));
+            } else if ((instr == WAI || instr == STP) && input->undocumented) {
+                // Their opcodes are undocumented ones on the NMOS 6502
+                dolly_asm_report_error_node(ctx, node);
+                dolly_asm_print(ctx, "Instruction '%s' is unavailable with the "
+                                     ".undocumented directive\n",
+                                dolly_get_instr_name(instr));
+            }
             if (node->instruction.operand_type == DOLLY_ASM_OPERAND_IMPLICIT) {
                 node->instruction.a_mode = IMPLICIT;
                 bin_offset += 1;
@@ -173,7 +237,8 @@ bool dolly_asm_verify_semantics(dolly_asm_context* ctx,
                     = tb_hash_table_get(&input->identifiers, iden_name);
                 if (entry == NULL) {
                     dolly_asm_report_error_node(ctx, node);
-                    printf("No identifier named '%s' defined\n", iden_name);
+                    dolly_asm_print(ctx, "No identifier named '%s' defined\n",
+                                    iden_name);
                     break;
                 }
                 const dolly_asm_syntax_node* iden_node
@@ -188,10 +253,11 @@ bool dolly_asm_verify_semantics(dolly_asm_context* ctx,
 
             if (!(COMPATIBLE_ADDR_MODES[node->instruction.instr] & amode)) {
                 dolly_asm_report_error_node(ctx, node);
-                printf("Incompatible addressing mode: Instruction '%s' "
-                       "does not support %s mode\n",
-                       dolly_get_instr_name(node->instruction.instr),
-                       dolly_get_amode_name(amode));
+                dolly_asm_print(ctx, "Incompatible addressing mode: "
+                                     "Instruction '%s' does not support %s "
+                                     "mode\n",
+                                dolly_get_instr_name(node->instruction.instr),
+                                dolly_get_amode_name(amode));
             }
             node->instruction.a_mode = amode;
             uint32_t advance_by = 1 + dolly_get_operand_size(amode);
@@ -204,11 +270,52 @@ bool dolly_asm_verify_semantics(dolly_asm_context* ctx,
             break;
         case DOLLY_ASM_NODE_SECTION_TEXT:
         case DOLLY_ASM_NODE_SECTION_DATA:
+        case DOLLY_ASM_NODE_SECTION_BSS:
+            section_is_bss = node->type == DOLLY_ASM_NODE_SECTION_BSS;
+            if (section_number == DOLLY_EXECUTABLE_MAX_SECTIONS) {
+                dolly_asm_report_error_node(ctx, node);
+                dolly_asm_print(ctx, "Too many sections, at most %d are "
+                                     "allowed\n",
+                                DOLLY_EXECUTABLE_MAX_SECTIONS);
+                break;
+            }
             ++section_number;
+            section_has_bank = false;
+            section_has_data = false;
+            section_overflowed = false;
+            break;
+        case DOLLY_ASM_NODE_COMPRESS:
+            if (section_is_bss) {
+                dolly_asm_report_error_node(ctx, node);
+                dolly_asm_print(ctx, "Sections declared with .bss have no data "
+                                     "to compress\n");
+            }
+            break;
+        case DOLLY_ASM_NODE_BANK:
+            // The bank applies to the whole section
+            if (section_has_bank) {
+                dolly_asm_report_error_node(ctx, node);
+                dolly_asm_print(ctx, "Only one bank directive is allowed per "
+                                     "section\n");
+            } else if (section_has_data) {
+                dolly_asm_report_error_node(ctx, node);
+                dolly_asm_print(ctx, "Bank directives must come before any "
+                                     "code or data in a section\n");
+            }
+            section_has_bank = true;
             break;
         default:
             break;
         }
+
+        // Reported once, at the node which takes the section past $FFFF
+        if (bin_offset > 0x10000 && bin_offset > node->bin_offset
+            && !section_overflowed) {
+            dolly_asm_report_error_node(ctx, node);
+            dolly_asm_print(ctx, "Section runs past the end of the address "
+                                 "space, at $FFFF\n");
+            section_overflowed = true;
+        }
     }
 
     if (ctx->errors > 0) return false;
@@ -231,9 +338,10 @@ bool dolly_asm_verify_semantics(dolly_asm_context* ctx,
             = (int)iden_node->bin_offset - (int)node->bin_offset;
         if (branch_distance < -126 || branch_distance > 129) {
             dolly_asm_report_error_node(ctx, node);
-            printf("Label '%s' is out of range of branch\n",
-                    iden_name);
-            printf("  (Branch distance: %d bytes)\n", abs(branch_distance));
+            dolly_asm_print(ctx, "Label '%s' is out of range of branch\n",
+                            iden_name);
+            dolly_asm_print(ctx, "  (Branch distance: %d bytes)\n",
+                            abs(branch_distance));
         }
     }
 
@@ -57,10 +57,10 @@ static void dolly_asm_read_identifier(dolly_asm_context* ctx,
         const dolly_asm_syntax_node* prev_def
             = &output->nodes[hash_entry->int_value];
         dolly_asm_report_error_token(ctx, token);
-        printf("Duplicate symbol definition '%s'\n",
-               token->string_or_identifier);
-        printf("  (Previous definition in %s at line %zu:%zu)\n",
-               ctx->filename, prev_def->line, prev_def->column);
+        dolly_asm_print(ctx, "Duplicate symbol definition '%s'\n",
+                        token->string_or_identifier);
+        dolly_asm_print(ctx, "  (Previous definition in %s at line %zu:%zu)\n",
+                        ctx->filename, prev_def->line, prev_def->column);
         if (dolly_asm_match_token(input, *index + 1,
             DOLLY_ASM_TOKEN_EQUALS | DOLLY_ASM_TOKEN_COLON)) {
             *index += 1;
@@ -72,18 +72,19 @@ static void dolly_asm_read_identifier(dolly_asm_context* ctx,
         if (!dolly_asm_match_token(input, *index + 2,
             DOLLY_ASM_TOKEN_INTEGER)) {
             dolly_asm_report_error_token(ctx, token);
-            printf("Expected integer for constant definition");
+            dolly_asm_print(ctx, "Expected integer for constant definition");
             if (*index + 2 < input->size - 1) {
-                printf(", got '%s' instead\n",
-                       dolly_asm_token_type_str(&input->tokens[*index + 2]));
+                dolly_asm_print(ctx, ", got '%s' instead\n",
+                    dolly_asm_token_type_str(&input->tokens[*index + 2]));
             }
-            putchar('\n');
+            dolly_asm_print(ctx, "\n");
             *index += 1;
             return;
         }
         tb_hash_table_add_int(&output->identifiers,
                               token->string_or_identifier,
                               (int)output->size);
+        if (output->identifiers.out_of_memory) output->out_of_memory = true;
         dolly_asm_syntax_node node = {
             .identifier = {
                 .name = token->string_or_identifier,
@@ -102,17 +103,22 @@ static void dolly_asm_read_identifier(dolly_asm_context* ctx,
 
         dolly_asm_syntax_node node = {
             .identifier = {
-                .name = strdup_or_abort(token->string_or_identifier)
+                .name = dolly_strdup(token->string_or_identifier)
             },
             .line = token->line,
             .column = token->column,
             .type = DOLLY_ASM_NODE_LABEL
         };
+        if (node.identifier.name == NULL) {
+            output->out_of_memory = true;
+            return;
+        }
 
         dolly_asm_syntax_tree_add(output, &node);
         tb_hash_table_add_int(&output->identifiers,
                               token->string_or_identifier,
                               (int)output->size - 1);
+        if (output->identifiers.out_of_memory) output->out_of_memory = true;
     }
 }
 
@@ -129,12 +135,12 @@ static void dolly_asm_read_directive(dolly_asm_context* ctx,
         if (!dolly_asm_match_token(input, *index + 1,
             DOLLY_ASM_TOKEN_INTEGER)) {
             dolly_asm_report_error_token(ctx, post_token);
-            printf("Expected address after .origin directive");
+            dolly_asm_print(ctx, "Expected address after .origin directive");
             if (*index + 1 < input->size - 1) {
-                printf(", got %s instead",
+                dolly_asm_print(ctx, ", got %s instead",
                     dolly_asm_token_type_str(post_token));
             }
-            putchar('\n');
+            dolly_asm_print(ctx, "\n");
             return;
         }
 
@@ -149,6 +155,36 @@ static void dolly_asm_read_directive(dolly_asm_context* ctx,
         *index += 1;
         break;
     }
+    case DOLLY_ASM_DIRECTIVE_BANK: {
+        if (!dolly_asm_match_token(input, *index + 1,
+            DOLLY_ASM_TOKEN_INTEGER)) {
+            dolly_asm_report_error_token(ctx, post_token);
+            dolly_asm_print(ctx, "Expected bank number after .bank directive");
+            if (*index + 1 < input->size - 1) {
+                dolly_asm_print(ctx, ", got %s instead",
+                    dolly_asm_token_type_str(post_token));
+            }
+            dolly_asm_print(ctx, "\n");
+            return;
+        }
+        if (post_token->integer_value > UINT8_MAX) {
+            dolly_asm_report_error_token(ctx, post_token);
+            dolly_asm_print(ctx, "Bank numbers must be 8-bit integers\n");
+            *index += 1;
+            return;
+        }
+
+        dolly_asm_syntax_node node = {
+            .bank = post_token->integer_value,
+            .line = token->line,
+            .column = token->column,
+            .type = DOLLY_ASM_NODE_BANK
+        };
+
+        dolly_asm_syntax_tree_add(output, &node);
+        *index += 1;
+        break;
+    }
     case DOLLY_ASM_DIRECTIVE_BYTE:
     case DOLLY_ASM_DIRECTIVE_WORD: {
         size_t matches
@@ -158,13 +194,13 @@ static void dolly_asm_read_directive(dolly_asm_context* ctx,
         const char* directive_name =  is_byte ? ".byte" : ".word";
         if (matches < 1) {
             dolly_asm_report_error_token(ctx, post_token);
-            printf("Expected at least one integer after %s directive",
-                   directive_name);
+            dolly_asm_print(ctx, "Expected at least one integer after %s "
+                                 "directive", directive_name);
             if (*index + 1 < input->size - 1) {
-                printf(", got %s instead",
+                dolly_asm_print(ctx, ", got %s instead",
                     dolly_asm_token_type_str(post_token));
             }
-            putchar('\n');
+            dolly_asm_print(ctx, "\n");
             return;
         }
 
@@ -173,18 +209,25 @@ static void dolly_asm_read_directive(dolly_asm_context* ctx,
                 int16_t val = input->tokens[*index + 1 + i].integer_value;
                 if (val > UINT8_MAX || (int16_t)val < INT8_MIN) {
                     dolly_asm_report_error_token(ctx, token);
-                    printf(".byte directive requires 8-bit integers\n");
+                    dolly_asm_print(ctx, ".byte directive requires 8-bit "
+                                         "integers\n");
                     *index += i + 1;
                     return;
                 }
             }
         }
 
+        size_t data_size = matches * (is_byte ? 1 : 2);
+        uint8_t* data = dolly_malloc(data_size);
+        if (data == NULL) {
+            output->out_of_memory = true;
+            return;
+        }
         dolly_asm_syntax_node node = {
             .directive = {
                 .directive_type = token->directive_type,
-                .data = malloc_or_abort(matches * sizeof(uint8_t)),
-                .size = matches * (is_byte ? 1 : 2)
+                .data = data,
+                .size = data_size
             },
             .line = token->line,
             .column = token->column,
@@ -196,8 +239,8 @@ static void dolly_asm_read_directive(dolly_asm_context* ctx,
             if (is_byte) {
                 node.directive.data[i] = val;
             } else {
-                node.directive.data[i] = (uint8_t)(val & 0x00FF);
-                node.directive.data[i + 1] = (uint8_t)(val >> 8);
+                node.directive.data[2 * i] = (uint8_t)(val & 0x00FF);
+                node.directive.data[2 * i + 1] = (uint8_t)(val >> 8);
             }
         }
 
@@ -209,12 +252,12 @@ static void dolly_asm_read_directive(dolly_asm_context* ctx,
         if (!dolly_asm_match_token(input, *index + 1,
             DOLLY_ASM_TOKEN_STRING)) {
             dolly_asm_report_error_token(ctx, token);
-            printf("Expected string after .string directive");
+            dolly_asm_print(ctx, "Expected string after .string directive");
             if (*index + 1 < input->size - 1) {
-                printf(", got %s instead",
+                dolly_asm_print(ctx, ", got %s instead",
                     dolly_asm_token_type_str(post_token));
             }
-            putchar('\n');
+            dolly_asm_print(ctx, "\n");
             *index += 1;
             return;
         }
@@ -230,20 +273,47 @@ static void dolly_asm_read_directive(dolly_asm_context* ctx,
         dolly_asm_syntax_tree_add(output, &node);
         *index += 1;
         break;
+    case DOLLY_ASM_DIRECTIVE_RESERVE: {
+        if (!dolly_asm_match_token(input, *index + 1,
+            DOLLY_ASM_TOKEN_INTEGER)) {
+            dolly_asm_report_error_token(ctx, post_token);
+            dolly_asm_print(ctx, "Expected byte count after .res directive");
+            if (*index + 1 < input->size - 1) {
+                dolly_asm_print(ctx, ", got %s instead",
+                    dolly_asm_token_type_str(post_token));
+            }
+            dolly_asm_print(ctx, "\n");
+            return;
+        }
+
+        dolly_asm_syntax_node node = {
+            .reserve_size = post_token->integer_value,
+            .line = token->line,
+            .column = token->column,
+            .type = DOLLY_ASM_NODE_RESERVE
+        };
+
+        dolly_asm_syntax_tree_add(output, &node);
+        *index += 1;
+        break;
+    }
     case DOLLY_ASM_DIRECTIVE_TEXT:
-    case DOLLY_ASM_DIRECTIVE_DATA: {
+    case DOLLY_ASM_DIRECTIVE_DATA:
+    case DOLLY_ASM_DIRECTIVE_BSS: {
         if (!dolly_asm_match_token(input, *index + 1,
             DOLLY_ASM_TOKEN_STRING)) {
             dolly_asm_report_error_token(ctx, token);
-            printf("Expected section name string after %s directive",
+            dolly_asm_print(ctx, "Expected section name string after %s "
+                                 "directive",
                 token->directive_type == DOLLY_ASM_DIRECTIVE_TEXT
                     ? ".text"
-                    : ".data");
+                    : token->directive_type == DOLLY_ASM_DIRECTIVE_DATA
+                    ? ".data" : ".bss");
             if (*index + 1 < input->size - 1) {
-                printf(", got %s instead",
+                dolly_asm_print(ctx, ", got %s instead",
                     dolly_asm_token_type_str(post_token));
             }
-            putchar('\n');
+            dolly_asm_print(ctx, "\n");
             *index += 1;
             break;
         }
@@ -254,33 +324,50 @@ static void dolly_asm_read_directive(dolly_asm_context* ctx,
             const dolly_asm_syntax_node* prev_def
                 = &output->nodes[hash_entry->int_value];
             dolly_asm_report_error_token(ctx, token);
-            printf("Duplicate section name '%s'\n",
+            dolly_asm_print(ctx, "Duplicate section name '%s'\n",
                 post_token->string_or_identifier);
-            printf("  (Previous definition in %s @ line %zu:%zu)\n",
+            dolly_asm_print(ctx, "  (Previous definition in %s @ line "
+                                 "%zu:%zu)\n",
                 ctx->filename, prev_def->line, prev_def->column);
             *index += 1;
             break;
         }
         tb_hash_table_add_int(&output->section_names,
             post_token->string_or_identifier, (int)output->size);
+        if (output->section_names.out_of_memory) output->out_of_memory = true;
         dolly_asm_syntax_node node = {
             .section_name = post_token->string_or_identifier,
             .line = token->line,
             .column = token->column,
             .type = token->directive_type == DOLLY_ASM_DIRECTIVE_TEXT ?
-                    DOLLY_ASM_NODE_SECTION_TEXT : DOLLY_ASM_NODE_SECTION_DATA
+                    DOLLY_ASM_NODE_SECTION_TEXT :
+                    token->directive_type == DOLLY_ASM_DIRECTIVE_DATA ?
+                    DOLLY_ASM_NODE_SECTION_DATA : DOLLY_ASM_NODE_SECTION_BSS
         };
         dolly_asm_syntax_tree_add(output, &node);
         *index += 1;
         break;
     }
+    case DOLLY_ASM_DIRECTIVE_UNDOCUMENTED:
+        output->undocumented = true;
+        break;
+    case DOLLY_ASM_DIRECTIVE_COMPRESS: {
+        dolly_asm_syntax_node node = {
+            .line = token->line,
+            .column = token->column,
+            .type = DOLLY_ASM_NODE_COMPRESS
+        };
+        dolly_asm_syntax_tree_add(output, &node);
+        break;
+    }
     }
 }
 
-const dolly_instruction IMPLIED_ONLY[25] = {
+const dolly_instruction IMPLIED_ONLY[31] = {
     BRK, CLC, CLD, CLI, CLV, DEY, DEX, INY, INX, NOP,
     PHP, PLA, PLP, RTI, RTS, SEC, SED, SEI, TAX, TAY,
-    TSX, TYA, TXA, PHA, TXS
+    TSX, TYA, TXA, PHA, TXS, PHX, PLX, PHY, PLY, WAI,
+    STP
 };
 
 const dolly_asm_token_type
@@ -365,7 +452,7 @@ static void dolly_asm_read_instruction(dolly_asm_context* ctx,
         .type = DOLLY_ASM_NODE_INSTRUCTION
     };
 
-    for (size_t i = 0; i < 25; ++i) {
+    for (size_t i = 0; i < 31; ++i) {
         if (token->instruction == IMPLIED_ONLY[i]) {
             node.instruction.operand_type = DOLLY_ASM_OPERAND_IMPLICIT;
             dolly_asm_syntax_tree_add(output, &node);
@@ -389,7 +476,7 @@ static void dolly_asm_read_instruction(dolly_asm_context* ctx,
 
     if (!found_match) {
         dolly_asm_report_error_token(ctx, &input->tokens[*index + 1]);
-        printf("Invalid operand type\n");
+        dolly_asm_print(ctx, "Invalid operand type\n");
         return;
     }
 
@@ -448,7 +535,9 @@ bool dolly_asm_make_syntax_tree(dolly_asm_context* ctx,
     };
     dolly_asm_syntax_tree_add(output, &default_section);
 
-    for (size_t index = 0; index < input->size; ++index) {
+    // Identifiers are indexed by node, so none can be added once one is lost
+    for (size_t index = 0; index < input->size && !output->out_of_memory;
+         ++index) {
         dolly_asm_token* token = &input->tokens[index];
         switch (token->type) {
         case DOLLY_ASM_TOKEN_DIRECTIVE:
@@ -462,7 +551,8 @@ bool dolly_asm_make_syntax_tree(dolly_asm_context* ctx,
             break;
         default:
             dolly_asm_report_error_token(ctx, token);
-            printf("Unexpected %s\n", dolly_asm_token_type_str(token));
+            dolly_asm_print(ctx, "Unexpected %s\n",
+                            dolly_asm_token_type_str(token));
             break;
         }
     }
@@ -472,5 +562,5 @@ bool dolly_asm_make_syntax_tree(dolly_asm_context* ctx,
     };
     dolly_asm_syntax_tree_add(output, &sentinel);
 
-    return ctx->errors == 0;
+    return ctx->errors == 0 && !output->out_of_memory;
 }
@@ -1,19 +1,33 @@
 #!/bin/sh
 
-COMPILE_FLAGS="-I. -Wall -Werror"
+COMPILE_FLAGS="-I. -O2 -Wall -Werror"
 CC=cc
 
 # Virtual machine
 echo "Building virtual machine..." &&
-$CC   virtual-machine/main.c virtual-machine/cpu.c \
+$CC   virtual-machine/main.c virtual-machine/cpu.c virtual-machine/cpu65816.c \
+      virtual-machine/vm.c virtual-machine/stats.c \
+      virtual-machine/profiler.c virtual-machine/trace.c \
+      virtual-machine/replay.c virtual-machine/history.c \
+      virtual-machine/debugger.c virtual-machine/breakpoint.c \
+      virtual-machine/fuzz.c virtual-machine/coverage.c \
+      virtual-machine/heatmap.c virtual-machine/mapper.c \
+      virtual-machine/image.c virtual-machine/state.c \
       core/asm6502.c core/memory.c core/streambuf.c \
-      core/object.c $COMPILE_FLAGS -o dolly-vm &&
+      core/object.c core/lz.c core/trace.c core/symbols.c \
+      $COMPILE_FLAGS -pthread -o dolly-vm &&
 
 # Disassembler
 echo "Building disassembler..." &&
 $CC   disassembler/main.c disassembler/disassemble.c \
       core/asm6502.c core/memory.c core/streambuf.c \
-      core/object.c $COMPILE_FLAGS -o dolly-dsm &&
+      core/object.c core/lz.c core/symbols.c $COMPILE_FLAGS -o dolly-dsm &&
+
+# Trace decoder
+echo "Building trace decoder..." &&
+$CC   trace-decoder/main.c disassembler/disassemble.c \
+      core/asm6502.c core/memory.c core/streambuf.c core/object.c \
+      core/lz.c core/trace.c core/symbols.c $COMPILE_FLAGS -o dolly-trace &&
 
 # Assembler
 echo "Building assembler..." &&
@@ -21,5 +35,24 @@ $CC   assembler/main.c assembler/assemble.c \
       assembler/lexer.c assembler/parse.c assembler/syntax.c \
       assembler/semantics.c \
       core/asm6502.c core/memory.c core/streambuf.c \
-      core/object.c core/stringbuf.c core/hash.c \
-      $COMPILE_FLAGS -o dolly-asm
+      core/object.c core/lz.c core/stringbuf.c core/hash.c core/symbols.c \
+      $COMPILE_FLAGS -o dolly-asm &&
+
+# Library, with the public interface in libdolly/dolly.h. The shared library
+# only exports that interface, as listed in libdolly/libdolly.map.
+LIBDOLLY_SOURCES="libdolly/dolly.c \
+      assembler/assemble.c assembler/lexer.c assembler/parse.c \
+      assembler/syntax.c assembler/semantics.c disassembler/disassemble.c \
+      virtual-machine/cpu.c virtual-machine/cpu65816.c virtual-machine/vm.c \
+      virtual-machine/replay.c virtual-machine/history.c \
+      virtual-machine/mapper.c virtual-machine/image.c virtual-machine/state.c \
+      core/asm6502.c core/memory.c core/streambuf.c core/object.c core/lz.c \
+      core/stringbuf.c core/hash.c core/symbols.c" &&
+echo "Building libdolly..." &&
+mkdir -p libdolly-objects &&
+(cd libdolly-objects &&
+ $CC -c $(for source in $LIBDOLLY_SOURCES; do echo ../$source; done) \
+      $COMPILE_FLAGS -I.. -fPIC) &&
+rm -f libdolly.a && ar rcs libdolly.a libdolly-objects/*.o &&
+$CC -shared libdolly-objects/*.o \
+      -Wl,--version-script=libdolly/libdolly.map -o libdolly.so
@@ -37,10 +37,113 @@ const dolly_instruction group_4[] = {
 };
 
 const dolly_instruction group_5[] = {
-    TXA, TXS, TAX, TSX, DOLLY_INVALID_INSTRUCTION, DEX,
-    DOLLY_INVALID_INSTRUCTION, NOP
+    TXA, TXS, TAX, TSX, DEX, PHX /* 65C02 */, NOP, PLX /* 65C02 */
 };
 
+const dolly_instruction family_group_undocumented[] = {
+    SLO, RLA, SRE, RRA, SAX, LAX, DCP, ISC
+};
+
+const dolly_instruction undocumented_immediates[] = {
+    ANC, ANC, ALR, ARR, DOLLY_INVALID_INSTRUCTION, DOLLY_INVALID_INSTRUCTION,
+    SBX, SBC
+};
+
+static bool dolly_resolve_65c02_opcode(uint8_t opcode_byte,
+                                       dolly_opcode* result);
+static dolly_opcode dolly_resolve_undocumented_opcode(uint8_t opcode_byte);
+
+// The 65C02 additions mostly fill gaps in the NMOS encoding, but some take
+// opcodes that the regular patterns below would otherwise decode as
+// something else, so they are resolved first
+static bool dolly_resolve_65c02_opcode(uint8_t opcode_byte,
+                                       dolly_opcode* result)
+{
+    // (zp) sits in the otherwise unused mode slot of family 2, for the
+    // family 1 instructions
+    if ((opcode_byte & 0b00011111) == 0b00010010) {
+        result->instr = family_group_1[opcode_byte >> 5];
+        result->a_mode = ZERO_PAGE_INDIRECT;
+        return true;
+    }
+
+    switch (opcode_byte) {
+    case 0x04: *result = (dolly_opcode) { TSB, ZERO_PAGE };   return true;
+    case 0x0C: *result = (dolly_opcode) { TSB, ABSOLUTE };    return true;
+    case 0x14: *result = (dolly_opcode) { TRB, ZERO_PAGE };   return true;
+    case 0x1C: *result = (dolly_opcode) { TRB, ABSOLUTE };    return true;
+    case 0x1A: *result = (dolly_opcode) { INC, ACCUMULATOR }; return true;
+    case 0x3A: *result = (dolly_opcode) { DEC, ACCUMULATOR }; return true;
+    case 0x5A: *result = (dolly_opcode) { PHY, IMPLICIT };    return true;
+    case 0x7A: *result = (dolly_opcode) { PLY, IMPLICIT };    return true;
+    case 0x64: *result = (dolly_opcode) { STZ, ZERO_PAGE };   return true;
+    case 0x74: *result = (dolly_opcode) { STZ, ZERO_PAGE_X }; return true;
+    case 0x9C: *result = (dolly_opcode) { STZ, ABSOLUTE };    return true;
+    case 0x9E: *result = (dolly_opcode) { STZ, ABSOLUTE_X };  return true;
+    case 0x89: *result = (dolly_opcode) { BIT, IMMEDIATE };   return true;
+    case 0xCB: *result = (dolly_opcode) { WAI, IMPLICIT };    return true;
+    case 0xDB: *result = (dolly_opcode) { STP, IMPLICIT };    return true;
+    default:   return false;
+    }
+}
+
+// Undocumented opcodes fill the family 0b11 column, each combining the
+// family 1 and 2 instructions of the same row and addressing mode. Only the
+// ones that behave the same on every NMOS part are decoded.
+static dolly_opcode dolly_resolve_undocumented_opcode(uint8_t opcode_byte)
+{
+    uint8_t instr     = (opcode_byte & 0b11100000) >> 5;
+    uint8_t addr_mode = (opcode_byte & 0b00011100) >> 2;
+
+    dolly_opcode result = {
+        .instr = family_group_undocumented[instr],
+        .a_mode = family_modes_1[addr_mode]
+    };
+
+    if (result.a_mode == IMMEDIATE) {
+        result.instr = undocumented_immediates[instr];
+        if (result.instr == DOLLY_INVALID_INSTRUCTION)
+            result.a_mode = DOLLY_INVALID_ADDR_MODE;
+        return result;
+    }
+
+    // SAX and LAX index by Y like STX and LDX, and the rest of their row is
+    // unstable
+    if (result.instr == SAX || result.instr == LAX) {
+        switch (result.a_mode) {
+        case ZERO_PAGE_X:
+            result.a_mode = ZERO_PAGE_Y;
+            break;
+        case ABSOLUTE_X:
+            result.a_mode = result.instr == LAX ? ABSOLUTE_Y
+                                                : DOLLY_INVALID_ADDR_MODE;
+            break;
+        case ABSOLUTE_Y:
+            result.a_mode = DOLLY_INVALID_ADDR_MODE;
+            break;
+        case INDIRECT_Y:
+            if (result.instr == SAX) result.a_mode = DOLLY_INVALID_ADDR_MODE;
+            break;
+        default:
+            break;
+        }
+        if (result.a_mode == DOLLY_INVALID_ADDR_MODE)
+            result.instr = DOLLY_INVALID_INSTRUCTION;
+    }
+
+    return result;
+}
+
+dolly_opcode dolly_resolve_opcode_variant(uint8_t opcode_byte,
+                                          dolly_6502_variant variant)
+{
+    if (variant == DOLLY_6502_VARIANT_NMOS
+        && (opcode_byte & 0b00000011) == 0b00000011) {
+        return dolly_resolve_undocumented_opcode(opcode_byte);
+    }
+    return dolly_resolve_opcode(opcode_byte);
+}
+
 dolly_opcode dolly_resolve_opcode(uint8_t opcode_byte)
 {
     // 6502 opcode bits are usually in the pattern aaabbbcc
@@ -54,14 +157,17 @@ dolly_opcode dolly_resolve_opcode(uint8_t opcode_byte)
     // Group 4 encompasses INY, INX, DEY, DEX, TAY, TYA, the set/clear flag
     // and the push/pull stack instructions
     bool is_group_4     = (opcode_byte & 0b00001111) == 0b00001000;
-    // Group 5 encompasses the rest of the transfer instructions, DEX and NOP
-    bool is_group_5     = (opcode_byte & 0b10001010) == 0b10001010;
+    // Group 5 encompasses the rest of the transfer instructions, DEX, NOP and
+    // the 65C02 PHX and PLX
+    bool is_group_5     = (opcode_byte & 0b10001111) == 0b10001010;
 
     dolly_opcode result = {
         .instr = DOLLY_INVALID_INSTRUCTION,
         .a_mode = DOLLY_INVALID_ADDR_MODE
     };
 
+    if (dolly_resolve_65c02_opcode(opcode_byte, &result)) return result;
+
     if (is_cond_branch) {
         result.instr = conditional_branches[instr];
         result.a_mode = RELATIVE;
@@ -153,6 +259,8 @@ int dolly_get_mode_cycles(dolly_addressing_mode a_mode, bool page_crossed)
         return 4;
     case INDIRECT_Y:
         return 3 + (page_crossed ? 1 : 0);
+    case ZERO_PAGE_INDIRECT:
+        return 3;
     case RELATIVE:
         return (page_crossed ? 2 : 0);
     }
@@ -172,6 +280,7 @@ int dolly_get_operand_size(dolly_addressing_mode a_mode)
     case INDIRECT:
     case INDIRECT_X:
     case INDIRECT_Y:
+    case ZERO_PAGE_INDIRECT:
     case RELATIVE:
         return 1;
     case ABSOLUTE:
@@ -242,6 +351,27 @@ const char* dolly_get_instr_name(dolly_instruction instr)
     case SED: return "SED";
     case NOP: return "NOP";
     case BRA: return "BRA";
+    case STZ: return "STZ";
+    case PHX: return "PHX";
+    case PLX: return "PLX";
+    case PHY: return "PHY";
+    case PLY: return "PLY";
+    case TRB: return "TRB";
+    case TSB: return "TSB";
+    case WAI: return "WAI";
+    case STP: return "STP";
+    case SLO: return "SLO";
+    case RLA: return "RLA";
+    case SRE: return "SRE";
+    case RRA: return "RRA";
+    case SAX: return "SAX";
+    case LAX: return "LAX";
+    case DCP: return "DCP";
+    case ISC: return "ISC";
+    case ANC: return "ANC";
+    case ALR: return "ALR";
+    case ARR: return "ARR";
+    case SBX: return "SBX";
     default:  return "~~~";
     }
 }
@@ -262,6 +392,7 @@ const char* dolly_get_amode_name(dolly_addressing_mode a_mode)
     case INDIRECT_X: return "indexed indirect (X indirect)";
     case INDIRECT_Y: return "indirect indexed (Y indirect)";
     case RELATIVE: return "relative";
+    case ZERO_PAGE_INDIRECT: return "zero-page indirect";
     default: return "(invalid addressing mode)";
     }
 }
@@ -283,3 +414,36 @@ bool dolly_is_branch(dolly_instruction instr)
         return false;
     }
 }
+
+bool dolly_writes_memory(dolly_instruction instr)
+{
+    switch (instr) {
+    case STA:
+    case STX:
+    case STY:
+    case ASL:
+    case LSR:
+    case ROL:
+    case ROR:
+    case INC:
+    case DEC:
+    case STZ:
+    case TRB:
+    case TSB:
+    case SLO:
+    case RLA:
+    case SRE:
+    case RRA:
+    case SAX:
+    case DCP:
+    case ISC:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool dolly_is_undocumented(dolly_instruction instr)
+{
+    return instr >= SLO && instr <= SBX;
+}
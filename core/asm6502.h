@@ -6,7 +6,8 @@
 #define DOLLY_INVALID_ADDR_MODE 0
 #define DOLLY_INVALID_INSTRUCTION -1
 
-#define DOLLY_6502_INSTRUCTION_COUNT 57
+#define DOLLY_6502_INSTRUCTION_COUNT 78
+#define DOLLY_ADDRESSING_MODE_COUNT 14
 
 enum dolly_addressing_mode
 {
@@ -22,7 +23,8 @@ enum dolly_addressing_mode
     INDIRECT = 1 << 9,
     INDIRECT_X = 1 << 10,
     INDIRECT_Y = 1 << 11,
-    RELATIVE = 1 << 12
+    RELATIVE = 1 << 12,
+    ZERO_PAGE_INDIRECT = 1 << 13 // 65C02
 };
 
 typedef enum dolly_addressing_mode dolly_addressing_mode;
@@ -33,11 +35,25 @@ enum dolly_instruction
     CLI, CLV, CMP, CPX, CPY, DEC, DEX, DEY, EOR, INC, INX, INY, JMP, JSR,
     LDX, LDY, LSR, NOP, ORA, PHA, PHP, PLA, PLP, ROL, ROR, RTI, RTS, SBC,
     SED, SEI, STA, STX, STY, TAX, TAY, TSX, TXA, TXS, TYA, SEC, LDA, CLD,
-    BRA
+    BRA,
+    // 65C02
+    STZ, PHX, PLX, PHY, PLY, TRB, TSB, WAI, STP,
+    // Undocumented NMOS
+    SLO, RLA, SRE, RRA, SAX, LAX, DCP, ISC, ANC, ALR, ARR, SBX
 };
 
 typedef enum dolly_instruction dolly_instruction;
 
+enum dolly_6502_variant
+{
+    DOLLY_6502_VARIANT_DEFAULT, // The 6502 with the 65C02 additions
+    // Decodes the stable undocumented NMOS opcodes instead, which take the
+    // place of the 65C02's WAI and STP
+    DOLLY_6502_VARIANT_NMOS
+};
+
+typedef enum dolly_6502_variant dolly_6502_variant;
+
 struct dolly_opcode
 {
     dolly_instruction instr;
@@ -47,8 +63,12 @@ struct dolly_opcode
 typedef struct dolly_opcode dolly_opcode;
 
 dolly_opcode dolly_resolve_opcode(uint8_t opcode);
+dolly_opcode dolly_resolve_opcode_variant(uint8_t opcode,
+                                          dolly_6502_variant variant);
 int dolly_get_mode_cycles(dolly_addressing_mode a_mode, bool page_crossed);
 int dolly_get_operand_size(dolly_addressing_mode a_mode);
 const char* dolly_get_instr_name(dolly_instruction instr);
 const char* dolly_get_amode_name(dolly_addressing_mode a_mode);
 bool dolly_is_branch(dolly_instruction instr);
+bool dolly_writes_memory(dolly_instruction instr);
+bool dolly_is_undocumented(dolly_instruction instr);
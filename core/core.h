@@ -7,3 +7,5 @@
 #include "core/object.h"
 #include "core/hash.h"
 #include "core/stringbuf.h"
+#include "core/lz.h"
+#include "core/trace.h"
@@ -9,11 +9,15 @@
 tb_hash_table tb_hash_table_new(size_t buckets)
 {
     tb_hash_table table = {
-        .buckets = malloc_or_abort(buckets * sizeof(tb_hash_node*)),
+        .buckets = dolly_malloc(buckets * sizeof(tb_hash_node*)),
         .bucket_count = buckets
     };
+    if (table.buckets == NULL) {
+        table.bucket_count = 0;
+        table.out_of_memory = true;
+    }
 
-    for (size_t i = 0; i < buckets; ++i) {
+    for (size_t i = 0; i < table.bucket_count; ++i) {
         table.buckets[i] = NULL;
     }
 
@@ -33,6 +37,7 @@ static size_t compute_hash(const char* string)
 static tb_hash_node* tb_hash_table_new_node(tb_hash_table* table,
     const char* key)
 {
+    if (table->bucket_count == 0) return NULL;
     size_t index = compute_hash(key) % table->bucket_count;
 
     tb_hash_node** node = &(table->buckets[index]);
@@ -41,28 +46,37 @@ static tb_hash_node* tb_hash_table_new_node(tb_hash_table* table,
         node = &((*node)->next);
     }
 
-    *node = malloc_or_abort(sizeof(tb_hash_node));
-    (*node)->key = strdup_or_abort(key);
-    (*node)->next = NULL;
-    return *node;
+    tb_hash_node* added = dolly_malloc(sizeof(tb_hash_node));
+    char* copy = dolly_strdup(key);
+    if (added == NULL || copy == NULL) {
+        dolly_free(added);
+        dolly_free(copy);
+        table->out_of_memory = true;
+        return NULL;
+    }
+    added->key = copy;
+    added->next = NULL;
+    *node = added;
+    return added;
 }
 
 void tb_hash_table_add_ptr(tb_hash_table* table, const char* key,
                            void* ptr_val)
 {
     tb_hash_node* node = tb_hash_table_new_node(table, key);
-    node->ptr_value = ptr_val;
+    if (node) node->ptr_value = ptr_val;
 }
 
 void tb_hash_table_add_int(tb_hash_table* table, const char* key, int int_val)
 {
     tb_hash_node* node = tb_hash_table_new_node(table, key);
-    node->int_value = int_val;
+    if (node) node->int_value = int_val;
 }
 
 const tb_hash_node* tb_hash_table_get(const tb_hash_table* table,
                                       const char* key)
 {
+    if (table->bucket_count == 0) return NULL;
     size_t index = compute_hash(key) % table->bucket_count;
 
     tb_hash_node* node = table->buckets[index];
@@ -79,10 +93,10 @@ void tb_hash_table_destroy(tb_hash_table* table)
     for (size_t i = 0; i < table->bucket_count; ++i) {
         for (tb_hash_node* node = table->buckets[i]; node;) {
             tb_hash_node* next_node = node->next;
-            free(node->key);
-            free(node);
+            dolly_free(node->key);
+            dolly_free(node);
             node = next_node;
         }
     }
-    free(table->buckets);
+    dolly_free(table->buckets);
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 
 struct tb_hash_node
@@ -18,11 +19,14 @@ struct tb_hash_table
 {
     tb_hash_node** buckets;
     size_t bucket_count;
+    bool out_of_memory; // Set when an allocation fails, which drops the entry
 };
 
 typedef struct tb_hash_table tb_hash_table;
 
+// A table whose buckets couldn't be allocated is out of memory, and empty
 tb_hash_table tb_hash_table_new(size_t buckets);
+// Keys already in the table aren't added again
 void tb_hash_table_add_ptr(tb_hash_table* table, const char* key,
                            void* ptr_val);
 void tb_hash_table_add_int(tb_hash_table* table, const char* key, int int_val);
@@ -0,0 +1,252 @@
+#include "core/lz.h"
+
+#include <string.h>
+
+#define TB_LZ_HASH_BITS     12
+#define TB_LZ_MAX_OFFSET    0xFFFF
+// Matches may not start in the last bytes of a block, so that the decoder
+// can always finish on a literal run
+#define TB_LZ_END_LITERALS  5
+#define TB_LZ_MATCH_LIMIT   12
+
+static uint32_t tb_lz_read32(const uint8_t* p);
+static uint32_t tb_lz_hash(uint32_t sequence);
+static bool     tb_lz_write_length(uint8_t** op, const uint8_t* oend,
+                                   size_t length);
+
+static uint32_t tb_lz_read32(const uint8_t* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t tb_lz_hash(uint32_t sequence)
+{
+    return (sequence * 2654435761U) >> (32 - TB_LZ_HASH_BITS);
+}
+
+static bool tb_lz_write_length(uint8_t** op, const uint8_t* oend,
+                               size_t length)
+{
+    for (; length >= 255; length -= 255) {
+        if (*op >= oend) return false;
+        *(*op)++ = 255;
+    }
+    if (*op >= oend) return false;
+    *(*op)++ = (uint8_t) length;
+    return true;
+}
+
+size_t tb_lz_compress_bound(size_t size)
+{
+    return size + size / 255 + 16;
+}
+
+size_t tb_lz_compress(const uint8_t* src, size_t size,
+                      uint8_t* dst, size_t capacity)
+{
+    uint32_t table[1 << TB_LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    uint8_t* op = dst;
+    const uint8_t* oend = dst + capacity;
+    size_t ip = 0, anchor = 0;
+    size_t limit = size > TB_LZ_MATCH_LIMIT ? size - TB_LZ_MATCH_LIMIT : 0;
+
+    while (ip < limit) {
+        uint32_t sequence = tb_lz_read32(src + ip);
+        uint32_t hash = tb_lz_hash(sequence);
+        size_t ref = table[hash];
+        table[hash] = (uint32_t) ip;
+
+        if (ref >= ip || ip - ref > TB_LZ_MAX_OFFSET
+            || tb_lz_read32(src + ref) != sequence) {
+            // Skip ahead faster through data that is not compressing
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+
+        size_t match_end = ip + TB_LZ_MIN_MATCH;
+        size_t match_limit = size - TB_LZ_END_LITERALS;
+        while (match_end < match_limit
+               && src[match_end] == src[ref + (match_end - ip)]) {
+            ++match_end;
+        }
+
+        size_t literals = ip - anchor;
+        size_t match_length = match_end - ip - TB_LZ_MIN_MATCH;
+        if (op >= oend) return 0;
+        uint8_t* token = op++;
+        *token = (uint8_t)((literals < 15 ? literals : 15) << 4)
+               | (uint8_t)(match_length < 15 ? match_length : 15);
+        if (literals >= 15 && !tb_lz_write_length(&op, oend, literals - 15))
+            return 0;
+        if ((size_t)(oend - op) < literals + 2) return 0;
+        memcpy(op, src + anchor, literals);
+        op += literals;
+        *op++ = (uint8_t)((ip - ref) & 0xFF);
+        *op++ = (uint8_t)((ip - ref) >> 8);
+        if (match_length >= 15
+            && !tb_lz_write_length(&op, oend, match_length - 15))
+            return 0;
+
+        ip = anchor = match_end;
+        // Index a position inside the match to help the next search
+        if (ip - 2 < limit)
+            table[tb_lz_hash(tb_lz_read32(src + ip - 2))] = (uint32_t)(ip - 2);
+    }
+
+    size_t literals = size - anchor;
+    if (op >= oend) return 0;
+    *op++ = (uint8_t)((literals < 15 ? literals : 15) << 4);
+    if (literals >= 15 && !tb_lz_write_length(&op, oend, literals - 15))
+        return 0;
+    if ((size_t)(oend - op) < literals) return 0;
+    memcpy(op, src + anchor, literals);
+    op += literals;
+
+    return op - dst;
+}
+
+bool tb_lz_decompress(const uint8_t* src, size_t size,
+                      uint8_t* dst, size_t dst_size)
+{
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + size;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + dst_size;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t extra;
+            do {
+                if (ip >= iend) return false;
+                extra = *ip++;
+                literals += extra;
+            } while (extra == 255);
+        }
+        if ((size_t)(iend - ip) < literals || (size_t)(oend - op) < literals)
+            return false;
+        if (literals <= 16 && iend - ip >= 16 && oend - op >= 16) {
+            // Short runs are the common case, and a fixed-size copy beats a
+            // call to memcpy with a variable length
+            memcpy(op, ip, 16);
+        } else {
+            memcpy(op, ip, literals);
+        }
+        op += literals;
+        ip += literals;
+
+        if (ip == iend) break; // Last sequence has no match
+
+        if (iend - ip < 2) return false;
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) return false;
+
+        size_t length = (token & 0x0F);
+        if (length == 15) {
+            uint8_t extra;
+            do {
+                if (ip >= iend) return false;
+                extra = *ip++;
+                length += extra;
+            } while (extra == 255);
+        }
+        length += TB_LZ_MIN_MATCH;
+        if ((size_t)(oend - op) < length) return false;
+
+        const uint8_t* match = op - offset;
+        if (offset >= 16 && (size_t)(oend - op) >= length + 16) {
+            // Copy in 16-byte chunks; the overshoot lands in space that
+            // later sequences overwrite anyway
+            uint8_t* copy_end = op + length;
+            while (op < copy_end) {
+                memcpy(op, match, 16);
+                op += 16;
+                match += 16;
+            }
+            op = copy_end;
+        } else if (offset >= 8 && (size_t)(oend - op) >= length + 8) {
+            uint8_t* copy_end = op + length;
+            while (op < copy_end) {
+                memcpy(op, match, 8);
+                op += 8;
+                match += 8;
+            }
+            op = copy_end;
+        } else if (offset == 1) {
+            // A run of one byte, common in tables and zero fill
+            memset(op, match[0], length);
+            op += length;
+        } else if ((size_t)(oend - op) >= length + 16) {
+            // The match repeats its first offset bytes. Written out to a
+            // whole number of repeats at least 8 long, the rest can be
+            // copied 8 bytes at a time from that far back without overlap.
+            size_t period = offset;
+            while (period < 8) period += offset;
+            uint8_t* copy_end = op + length;
+            for (size_t i = 0; i < period; ++i) op[i] = match[i];
+            for (op += period; op < copy_end; op += 8)
+                memcpy(op, op - period, 8);
+            op = copy_end;
+        } else {
+            // Near the end of the block there's no room to overshoot
+            for (size_t i = 0; i < length; ++i) op[i] = match[i];
+            op += length;
+        }
+    }
+
+    return op == oend;
+}
+
+bool tb_lz_validate(const uint8_t* src, size_t size, size_t dst_size)
+{
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + size;
+    size_t written = 0;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t extra;
+            do {
+                if (ip >= iend) return false;
+                extra = *ip++;
+                literals += extra;
+            } while (extra == 255);
+        }
+        if ((size_t)(iend - ip) < literals || dst_size - written < literals)
+            return false;
+        written += literals;
+        ip += literals;
+
+        if (ip == iend) break;
+
+        if (iend - ip < 2) return false;
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > written) return false;
+
+        size_t length = (token & 0x0F);
+        if (length == 15) {
+            uint8_t extra;
+            do {
+                if (ip >= iend) return false;
+                extra = *ip++;
+                length += extra;
+            } while (extra == 255);
+        }
+        length += TB_LZ_MIN_MATCH;
+        if (dst_size - written < length) return false;
+        written += length;
+    }
+
+    return written == dst_size;
+}
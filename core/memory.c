@@ -4,6 +4,48 @@
 #include <stdlib.h>
 #include <string.h>
 
+static _Thread_local const dolly_allocator* current_allocator = NULL;
+
+const dolly_allocator* dolly_use_allocator(const dolly_allocator* allocator)
+{
+    const dolly_allocator* previous = current_allocator;
+    current_allocator = allocator;
+    return previous;
+}
+
+void* dolly_malloc(size_t size)
+{
+    return dolly_realloc(NULL, size);
+}
+
+void* dolly_realloc(void* old_pointer, size_t size)
+{
+    // Zero-sized requests still get a unique pointer, as from malloc
+    if (size == 0) size = 1;
+    if (current_allocator) {
+        return current_allocator->realloc(current_allocator->context,
+                                          old_pointer, size);
+    }
+    return realloc(old_pointer, size);
+}
+
+void dolly_free(void* pointer)
+{
+    if (pointer == NULL) return;
+    if (current_allocator) {
+        current_allocator->realloc(current_allocator->context, pointer, 0);
+    } else {
+        free(pointer);
+    }
+}
+
+char* dolly_strdup(const char* str)
+{
+    size_t size = strlen(str) + 1;
+    char* copy = dolly_malloc(size);
+    return copy ? memcpy(copy, str, size) : NULL;
+}
+
 void abort_no_mem(void)
 {
     fprintf(stderr, "Aborting: out of memory\n");
@@ -12,22 +54,21 @@ void abort_no_mem(void)
 
 void* malloc_or_abort(size_t size)
 {
-    void* p = malloc(size);
+    void* p = dolly_malloc(size);
     if (!p) abort_no_mem();
     return p;
 }
 
 void* realloc_or_abort(void* old_pointer, size_t size)
 {
-    void* p = realloc(old_pointer, size);
+    void* p = dolly_realloc(old_pointer, size);
     if (!p) abort_no_mem();
     return p;
 }
 
 char* strdup_or_abort(const char* str)
 {
-    char* new_str = strdup(str);
-    if (!new_str) abort_no_mem();
-    return new_str;
+    char* copy = dolly_strdup(str);
+    if (!copy) abort_no_mem();
+    return copy;
 }
-
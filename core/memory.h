@@ -2,6 +2,27 @@
 
 #include <stddef.h>
 
+// Where memory comes from. realloc behaves as the C library's, except that a
+// size of 0 always frees pointer and returns NULL.
+struct dolly_allocator
+{
+    void* (*realloc)(void* context, void* pointer, size_t size);
+    void* context;
+};
+
+typedef struct dolly_allocator dolly_allocator;
+
+// Makes every allocation on the calling thread go through allocator, or the
+// C library again if it is NULL, returning the allocator it replaces. Memory
+// must be freed under the allocator which allocated it.
+const dolly_allocator* dolly_use_allocator(const dolly_allocator* allocator);
+
+// These return NULL when out of memory
+void* dolly_malloc(size_t size);
+void* dolly_realloc(void* old_pointer, size_t size);
+void  dolly_free(void* pointer);
+char* dolly_strdup(const char* str);
+
 void abort_no_mem(void);
 
 void* malloc_or_abort(size_t size);
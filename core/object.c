@@ -1,133 +1,625 @@
 #include "core/object.h"
 
+#include "core/lz.h"
 #include "core/memory.h"
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
 const char DOLLY_MAGIC_NUMBER[] = { 0x7F, 'D', 'O', 'L', 'L', 'Y' };
 
+static uint16_t dolly_read_le16(const uint8_t* src)
+{
+    return (uint16_t)(src[0] | src[1] << 8);
+}
+
+static uint32_t dolly_read_le32(const uint8_t* src)
+{
+    return (uint32_t)src[0] | (uint32_t)src[1] << 8
+         | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+static void dolly_write_le16(uint8_t* dest, uint16_t value)
+{
+    dest[0] = value & 0xFF;
+    dest[1] = value >> 8;
+}
+
+static void dolly_write_le32(uint8_t* dest, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i) dest[i] = (value >> (8 * i)) & 0xFF;
+}
+
 void dolly_executable_init(dolly_executable* exec)
 {
     memset(exec, 0, sizeof(dolly_executable));
     exec->header.version = DOLLY_EXECUTABLE_VERSION;
 }
 
-void dolly_executable_add_section(dolly_executable* exec,
-                                  const dolly_executable_section* section,
-                                  const uint8_t* data)
+static uint32_t dolly_section_alignment(const dolly_executable_section* s)
+{
+    // Compressed sections can't be mapped straight from the file anyway
+    return s->size >= DOLLY_EXECUTABLE_PAGE_ALIGNMENT
+           && !(s->flags & DOLLY_SECTION_FLAG_COMPRESSED)
+         ? DOLLY_EXECUTABLE_PAGE_ALIGNMENT
+         : DOLLY_EXECUTABLE_SECTION_ALIGNMENT;
+}
+
+// Bytes the section takes up in the program data
+static uint32_t dolly_section_stored_size(const uint8_t* program_data,
+                                          const dolly_executable_section* s)
+{
+    if (!dolly_section_has_data(s)) return 0;
+    if (s->flags & DOLLY_SECTION_FLAG_COMPRESSED)
+        return sizeof(uint32_t) + dolly_read_le32(program_data + s->offset);
+    return s->size;
+}
+
+// Grows the program data geometrically, so appending sections one at a time
+// doesn't copy everything before them each time. Returns false, leaving it
+// as it was, when out of memory.
+static bool dolly_executable_grow_data(dolly_executable* exec, size_t size)
 {
-    if (exec->header.section_count >= exec->sections_array_capacity) {
-        if (exec->sections_array_capacity == 0)
-            exec->sections_array_capacity = 1;
-        exec->sections_array_capacity *= 2;
-        exec->sections = realloc_or_abort(exec->sections,
-            sizeof(dolly_executable_section) * exec->sections_array_capacity);
+    if (size <= exec->program_capacity) return true;
+    size_t capacity = exec->program_capacity ? exec->program_capacity
+                                             : DOLLY_EXECUTABLE_PAGE_ALIGNMENT;
+    while (capacity < size) capacity *= 2;
+    uint8_t* data = dolly_realloc(exec->program_data, capacity);
+    if (data == NULL) return false;
+    exec->program_data = data;
+    exec->program_capacity = capacity;
+    return true;
+}
+
+static bool dolly_executable_grow_sections(dolly_executable* exec,
+                                           size_t count)
+{
+    if (count <= exec->sections_array_capacity) return true;
+    dolly_executable_section* sections = dolly_realloc(exec->sections,
+        sizeof(dolly_executable_section) * count);
+    if (sections == NULL) return false;
+    exec->sections = sections;
+    uint16_t* load_order = dolly_realloc(exec->load_order,
+        sizeof(uint16_t) * count);
+    if (load_order == NULL) return false;
+    exec->load_order = load_order;
+    exec->sections_array_capacity = count;
+    return true;
+}
+
+// Places a section's stored bytes at the end of the program data, aligned,
+// or zeroes if data is NULL. Returns false, adding nothing, when out of
+// memory.
+static bool dolly_executable_append_data(dolly_executable* exec,
+                                         dolly_executable_section* section,
+                                         const uint8_t* data,
+                                         uint32_t stored_size)
+{
+    uint32_t alignment = dolly_section_alignment(section);
+    size_t old_size = exec->program_size;
+    size_t offset = (old_size + alignment - 1) & ~(size_t)(alignment - 1);
+    if (!dolly_executable_grow_data(exec, offset + stored_size)) return false;
+    section->offset = offset;
+    exec->program_size = offset + stored_size;
+
+    // Padding is zeroed so output is reproducible
+    memset(exec->program_data + old_size, 0, offset - old_size);
+    if (data != NULL) memcpy(exec->program_data + offset, data, stored_size);
+    else memset(exec->program_data + offset, 0, stored_size);
+    return true;
+}
+
+// Section numbers sort stably, so sections at the same address keep the
+// order they were added in
+static void dolly_executable_insert_load_order(dolly_executable* exec,
+                                               uint16_t number)
+{
+    uint32_t address = exec->sections[number].load_address;
+    size_t at = number;
+    while (at > 0
+           && exec->sections[exec->load_order[at - 1]].load_address
+              > address) {
+        exec->load_order[at] = exec->load_order[at - 1];
+        --at;
     }
+    exec->load_order[at] = number;
+}
 
-    uint32_t offset = 0;
-    for (size_t i = 0; i < exec->header.section_count; ++i) {
-        const dolly_executable_section* prev_section = &exec->sections[i];
-        if (offset < prev_section->offset + prev_section->size) {
-            offset = prev_section->offset + prev_section->size;
-        }
+dolly_executable_status
+dolly_executable_add_section(dolly_executable* exec,
+                             const dolly_executable_section* section,
+                             const uint8_t* data)
+{
+    if (exec->header.section_count >= exec->sections_array_capacity
+        && !dolly_executable_grow_sections(exec,
+               exec->sections_array_capacity
+               ? exec->sections_array_capacity * 2 : 2)) {
+        return DOLLY_EXEC_OUT_OF_MEMORY;
     }
 
-    memcpy(&exec->sections[exec->header.section_count++], section,
+    // Only counted once its data is in, so a failure leaves no trace
+    uint16_t number = exec->header.section_count;
+    memcpy(&exec->sections[number], section,
            sizeof(dolly_executable_section));
-    exec->sections[exec->header.section_count - 1].offset = offset;
+    exec->sections[number].flags &= ~DOLLY_SECTION_FLAG_COMPRESSED;
+    if (!dolly_section_has_data(section)) {
+        exec->sections[number].offset = 0;
+    } else if (!dolly_executable_append_data(exec, &exec->sections[number],
+                                             data, section->size)) {
+        return DOLLY_EXEC_OUT_OF_MEMORY;
+    }
 
-    exec->program_size += section->size;
-    exec->program_data = realloc_or_abort(exec->program_data,
-        exec->program_size);
-    if (data != NULL) memcpy(exec->program_data + offset, data, section->size);
+    ++exec->header.section_count;
+    dolly_executable_insert_load_order(exec, number);
+    return DOLLY_EXEC_OKAY;
 }
 
-dolly_executable_status dolly_executable_read(dolly_executable* exec,
-                                              const uint8_t* src,
-                                              size_t size)
+dolly_executable_status dolly_executable_reserve(dolly_executable* exec,
+                                                 size_t section_count,
+                                                 size_t data_size)
 {
-    const size_t HEADER_SIZE = sizeof(dolly_architecture)
-                             + sizeof(uint8_t) + sizeof(uint8_t);
-
-    if (size < HEADER_SIZE + sizeof(DOLLY_MAGIC_NUMBER))
-        return DOLLY_EXEC_INCOMPLETE_HEADER;
+    if (!dolly_executable_grow_sections(exec, section_count)
+        || !dolly_executable_grow_data(exec, data_size)) {
+        return DOLLY_EXEC_OUT_OF_MEMORY;
+    }
+    return DOLLY_EXEC_OKAY;
+}
 
-    if (memcmp(src, DOLLY_MAGIC_NUMBER, sizeof(DOLLY_MAGIC_NUMBER)) != 0)
-        return DOLLY_EXEC_INVALID_FORMAT;
+const dolly_executable_section*
+dolly_executable_find(const dolly_executable* exec, uint32_t address)
+{
+    // Find the first section loaded above address
+    size_t low = 0, high = exec->header.section_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (exec->sections[exec->load_order[mid]].load_address <= address)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    while (low > 0
+           && !dolly_section_is_loaded(
+                  &exec->sections[exec->load_order[low - 1]])) {
+        --low;
+    }
+    if (low == 0) return NULL;
 
-    // Const is casted away as fmemopen has no const-qualified version
-    FILE* buffer = fmemopen((uint8_t*) src + sizeof(DOLLY_MAGIC_NUMBER),
-                            size - sizeof(DOLLY_MAGIC_NUMBER),
-                            "r");
-    // TODO: Endianness
-    fread(&exec->header.arch, sizeof(dolly_architecture), 1, buffer);
-    fread(&exec->header.version, sizeof(uint8_t), 1, buffer);
-    fread(&exec->header.section_count, sizeof(uint8_t), 1, buffer);
+    const dolly_executable_section* section
+        = &exec->sections[exec->load_order[low - 1]];
+    return address - section->load_address < section->size ? section : NULL;
+}
 
-    exec->sections_array_capacity = exec->header.section_count;
+bool dolly_executable_compress_section(dolly_executable* exec,
+                                       size_t number)
+{
+    dolly_executable_section* section = &exec->sections[number];
+    if (!dolly_section_has_data(section)
+        || (section->flags & DOLLY_SECTION_FLAG_COMPRESSED)) {
+        return false;
+    }
 
-    if (exec->sections != NULL) free(exec->sections);
-    exec->sections = malloc_or_abort(sizeof(dolly_executable_section)
-                                     * exec->header.section_count);
+    // Left uncompressed when there isn't the memory to try
+    size_t capacity = tb_lz_compress_bound(section->size);
+    uint8_t* stored = dolly_malloc(sizeof(uint32_t) + capacity);
+    if (stored == NULL) return false;
+    size_t block_size = tb_lz_compress(exec->program_data + section->offset,
+                                       section->size,
+                                       stored + sizeof(uint32_t), capacity);
+    if (block_size == 0 || sizeof(uint32_t) + block_size >= section->size) {
+        dolly_free(stored);
+        return false;
+    }
+    dolly_write_le32(stored, block_size);
 
+    // Everything is laid out again, as the data after the section moves up
+    // and the section itself may need less alignment
+    uint8_t* old_data = exec->program_data;
+    size_t old_size = exec->program_size;
+    size_t old_capacity = exec->program_capacity;
+    exec->program_data = NULL;
     exec->program_size = 0;
+    exec->program_capacity = 0;
+    if (!dolly_executable_grow_data(exec, old_size)) {
+        exec->program_data = old_data;
+        exec->program_size = old_size;
+        exec->program_capacity = old_capacity;
+        dolly_free(stored);
+        return false;
+    }
+    // Nothing grows past old_size, so the appends below cannot fail
     for (size_t i = 0; i < exec->header.section_count; ++i) {
-        fread(exec->sections[i].name,
-              DOLLY_EXECUTABLE_SECTION_NAME_MAX_LENGTH, 1, buffer);
-        fread(&exec->sections[i].type, sizeof(dolly_exec_section_type), 1,
-              buffer);
-        fread(&exec->sections[i].offset, sizeof(uint32_t), 1, buffer);
-        fread(&exec->sections[i].size, sizeof(uint32_t), 1, buffer);
-        fread(&exec->sections[i].load_address, sizeof(uint32_t), 1, buffer);
-        if (feof(buffer)) {
-            fclose(buffer);
-            return DOLLY_EXEC_EOF_SECTION_TABLE;
+        dolly_executable_section* s = &exec->sections[i];
+        if (!dolly_section_has_data(s)) continue;
+        if (i == number) {
+            s->flags |= DOLLY_SECTION_FLAG_COMPRESSED;
+            dolly_executable_append_data(exec, s, stored,
+                                         sizeof(uint32_t) + block_size);
+        } else {
+            dolly_executable_append_data(exec, s, old_data + s->offset,
+                dolly_section_stored_size(old_data, s));
         }
-        exec->program_size += exec->sections[i].size;
     }
 
-    if (exec->program_data) free(exec->program_data);
-    exec->program_data = malloc_or_abort((size_t) exec->program_size);
+    dolly_free(old_data);
+    dolly_free(stored);
+    return true;
+}
+
+void dolly_executable_load_section(const dolly_executable* exec,
+                                   const dolly_executable_section* section,
+                                   uint8_t* dest)
+{
+    const uint8_t* stored = exec->program_data + section->offset;
+    if (!dolly_section_has_data(section)) {
+        memset(dest, 0, section->size);
+    } else if (section->flags & DOLLY_SECTION_FLAG_COMPRESSED) {
+        tb_lz_decompress(stored + sizeof(uint32_t), dolly_read_le32(stored),
+                         dest, section->size);
+    } else {
+        memcpy(dest, stored, section->size);
+    }
+
+    // The mapped pages just read are clean, so the kernel can drop them and
+    // read them in again should the section be loaded once more
+    if (exec->mapping != NULL && dolly_section_has_data(section)) {
+        size_t stored_size = section->flags & DOLLY_SECTION_FLAG_COMPRESSED
+                           ? sizeof(uint32_t) + dolly_read_le32(stored)
+                           : section->size;
+        uintptr_t page_mask = (uintptr_t)sysconf(_SC_PAGESIZE) - 1;
+        uintptr_t start = (uintptr_t)stored & ~page_mask;
+        madvise((void*)start, (uintptr_t)stored + stored_size - start,
+                MADV_DONTNEED);
+    }
+}
+
+// Copies n bytes at *pos into out, failing rather than reading past size
+static bool dolly_executable_take(const uint8_t* src, size_t size,
+                                  size_t* pos, void* out, size_t n)
+{
+    if (size - *pos < n) return false;
+    memcpy(out, src + *pos, n);
+    *pos += n;
+    return true;
+}
+
+static void dolly_executable_release(dolly_executable* exec)
+{
+    if (exec->mapping != NULL) {
+        munmap(exec->mapping, exec->mapping_size);
+        exec->mapping = NULL;
+    } else if (exec->program_data != NULL) {
+        dolly_free(exec->program_data);
+    }
+    exec->program_data = NULL;
+    exec->program_capacity = 0;
+}
 
+static dolly_executable_status
+dolly_executable_alloc_sections(dolly_executable* exec)
+{
+    if (exec->sections != NULL) dolly_free(exec->sections);
+    if (exec->load_order != NULL) dolly_free(exec->load_order);
+    exec->sections = dolly_malloc(sizeof(dolly_executable_section)
+                                  * exec->header.section_count);
+    exec->load_order = dolly_malloc(sizeof(uint16_t)
+                                    * exec->header.section_count);
+    if (exec->sections == NULL || exec->load_order == NULL) {
+        exec->header.section_count = 0;
+        exec->sections_array_capacity = 0;
+        return DOLLY_EXEC_OUT_OF_MEMORY;
+    }
+    exec->sections_array_capacity = exec->header.section_count;
+    return DOLLY_EXEC_OKAY;
+}
+
+// Leaves program_data pointing at the section data in src, once every
+// section is known to lie within it
+static dolly_executable_status
+dolly_executable_set_data(dolly_executable* exec, const uint8_t* src,
+                          size_t size, size_t data_offset)
+{
+    const uint8_t* data = src + data_offset;
+    size_t available = size - data_offset;
+    size_t program_size = 0;
     for (size_t i = 0; i < exec->header.section_count; ++i) {
-        fread(exec->program_data + exec->sections[i].offset,
-              exec->sections[i].size, 1, buffer);
-        if (feof(buffer)) {
-            fclose(buffer);
-            return DOLLY_EXEC_EOF_SECTION;
+        const dolly_executable_section* section = &exec->sections[i];
+        if (!dolly_section_has_data(section)) continue;
+
+        uint64_t stored_size = section->size;
+        if (section->flags & DOLLY_SECTION_FLAG_COMPRESSED) {
+            if ((uint64_t)section->offset + sizeof(uint32_t) > available)
+                return DOLLY_EXEC_EOF_SECTION;
+            stored_size = sizeof(uint32_t)
+                        + dolly_read_le32(data + section->offset);
+        }
+
+        uint64_t end = (uint64_t)section->offset + stored_size;
+        if (end > available) return DOLLY_EXEC_EOF_SECTION;
+        if (end > program_size) program_size = end;
+
+        // Checked once here so loading never has to fail
+        if ((section->flags & DOLLY_SECTION_FLAG_COMPRESSED)
+            && !tb_lz_validate(data + section->offset + sizeof(uint32_t),
+                               stored_size - sizeof(uint32_t),
+                               section->size)) {
+            return DOLLY_EXEC_CORRUPT_SECTION;
         }
     }
 
-    fclose(buffer);
+    dolly_executable_release(exec);
+    // Const is cast away, but nothing writes to a parsed executable's data
+    exec->program_data = (uint8_t*) src + data_offset;
+    exec->program_size = program_size;
     return DOLLY_EXEC_OKAY;
 }
 
-void dolly_executable_write(const dolly_executable* exec, FILE* file)
+static dolly_executable_status dolly_executable_parse_v1(
+    dolly_executable* exec, const uint8_t* src, size_t size)
 {
-    fwrite(DOLLY_MAGIC_NUMBER, sizeof(DOLLY_MAGIC_NUMBER), 1, file);
-    fwrite(&exec->header.arch, sizeof(dolly_architecture), 1, file);
-    fwrite(&exec->header.version, sizeof(uint8_t), 1, file);
-    fwrite(&exec->header.section_count, sizeof(uint8_t), 1, file);
+    const size_t HEADER_SIZE = sizeof(DOLLY_MAGIC_NUMBER)
+                             + sizeof(dolly_architecture)
+                             + sizeof(uint8_t) + sizeof(uint8_t);
+
+    if (size < HEADER_SIZE) return DOLLY_EXEC_INCOMPLETE_HEADER;
+
+    size_t pos = sizeof(DOLLY_MAGIC_NUMBER);
+    uint8_t section_count;
+    dolly_executable_take(src, size, &pos, &exec->header.arch,
+                          sizeof(dolly_architecture));
+    dolly_executable_take(src, size, &pos, &exec->header.version,
+                          sizeof(uint8_t));
+    dolly_executable_take(src, size, &pos, &section_count, sizeof(uint8_t));
+
+    exec->header.section_count = section_count;
+    dolly_executable_status status = dolly_executable_alloc_sections(exec);
+    if (status != DOLLY_EXEC_OKAY) return status;
 
     for (size_t i = 0; i < exec->header.section_count; ++i) {
+        dolly_executable_section* section = &exec->sections[i];
+        if (!dolly_executable_take(src, size, &pos, section->name,
+                                   DOLLY_EXECUTABLE_SECTION_NAME_MAX_LENGTH)
+            || !dolly_executable_take(src, size, &pos, &section->type,
+                                      sizeof(dolly_exec_section_type))
+            || !dolly_executable_take(src, size, &pos, &section->offset,
+                                      sizeof(uint32_t))
+            || !dolly_executable_take(src, size, &pos, &section->size,
+                                      sizeof(uint32_t))
+            || !dolly_executable_take(src, size, &pos, &section->load_address,
+                                      sizeof(uint32_t))) {
+            return DOLLY_EXEC_EOF_SECTION_TABLE;
+        }
+        section->name[DOLLY_EXECUTABLE_SECTION_NAME_MAX_LENGTH - 1] = '\0';
+        section->flags = 0;
+        dolly_executable_insert_load_order(exec, i);
+    }
+
+    // Section data follows the table directly
+    return dolly_executable_set_data(exec, src, size, pos);
+}
+
+static dolly_executable_status dolly_executable_parse_v2(
+    dolly_executable* exec, const uint8_t* src, size_t size)
+{
+    const size_t HEADER_SIZE = sizeof(DOLLY_MAGIC_NUMBER) + 12;
+    const size_t ENTRY_SIZE = DOLLY_EXECUTABLE_SECTION_NAME_MAX_LENGTH + 16;
+
+    if (size < HEADER_SIZE) return DOLLY_EXEC_INCOMPLETE_HEADER;
+
+    const uint8_t* header = src + sizeof(DOLLY_MAGIC_NUMBER);
+    exec->header.arch = dolly_read_le32(header);
+    exec->header.version = header[4];
+    exec->header.section_count = dolly_read_le16(header + 6);
+    uint32_t data_offset = dolly_read_le32(header + 8);
+
+    size_t count = exec->header.section_count;
+    size_t table_end = HEADER_SIZE + count * (ENTRY_SIZE + sizeof(uint16_t));
+    if (table_end > size) return DOLLY_EXEC_EOF_SECTION_TABLE;
+    if (data_offset < table_end || data_offset > size)
+        return DOLLY_EXEC_INVALID_SECTION_TABLE;
+
+    dolly_executable_status status = dolly_executable_alloc_sections(exec);
+    if (status != DOLLY_EXEC_OKAY) return status;
+
+    const uint8_t* entry = src + HEADER_SIZE;
+    for (size_t i = 0; i < count; ++i, entry += ENTRY_SIZE) {
+        dolly_executable_section* section = &exec->sections[i];
+        memcpy(section->name, entry, DOLLY_EXECUTABLE_SECTION_NAME_MAX_LENGTH);
+        section->name[DOLLY_EXECUTABLE_SECTION_NAME_MAX_LENGTH - 1] = '\0';
+
+        const uint8_t* fields
+            = entry + DOLLY_EXECUTABLE_SECTION_NAME_MAX_LENGTH;
+        section->flags = dolly_read_le16(fields + 2);
+        if (section->flags & ~DOLLY_SECTION_FLAGS_KNOWN)
+            return DOLLY_EXEC_INVALID_SECTION_TABLE;
+        section->type = dolly_read_le16(fields);
+        section->offset = dolly_read_le32(fields + 4);
+        section->size = dolly_read_le32(fields + 8);
+        section->load_address = dolly_read_le32(fields + 12);
+        // Only a size is stored, so nothing else bounds the memory asked for
+        if (section->type == DOLLY_SECTION_BSS
+            && section->size > DOLLY_EXECUTABLE_BSS_MAX_SIZE) {
+            return DOLLY_EXEC_INVALID_SECTION_TABLE;
+        }
+    }
+
+    // The load order must be a permutation sorted by load address for the
+    // binary search to find every section
+    bool* seen = dolly_malloc(count + 1);
+    if (seen == NULL) return DOLLY_EXEC_OUT_OF_MEMORY;
+    memset(seen, 0, count + 1);
+    for (size_t i = 0; i < count; ++i, entry += sizeof(uint16_t)) {
+        uint16_t number = dolly_read_le16(entry);
+        if (number >= count || seen[number]
+            || (i > 0 && exec->sections[exec->load_order[i - 1]].load_address
+                         > exec->sections[number].load_address)) {
+            status = DOLLY_EXEC_INVALID_SECTION_TABLE;
+            break;
+        }
+        seen[number] = true;
+        exec->load_order[i] = number;
+    }
+    dolly_free(seen);
+    if (status != DOLLY_EXEC_OKAY) return status;
+
+    return dolly_executable_set_data(exec, src, size, data_offset);
+}
+
+// Parses the header and section table, leaving program_data pointing into src
+static dolly_executable_status dolly_executable_parse(dolly_executable* exec,
+                                                      const uint8_t* src,
+                                                      size_t size)
+{
+    // The version byte is at the same offset in every version
+    const size_t VERSION_OFFSET = sizeof(DOLLY_MAGIC_NUMBER)
+                                + sizeof(uint32_t);
+
+    if (size <= VERSION_OFFSET) return DOLLY_EXEC_INCOMPLETE_HEADER;
+
+    if (memcmp(src, DOLLY_MAGIC_NUMBER, sizeof(DOLLY_MAGIC_NUMBER)) != 0)
+        return DOLLY_EXEC_INVALID_FORMAT;
+
+    switch (src[VERSION_OFFSET]) {
+    case 1: return dolly_executable_parse_v1(exec, src, size);
+    case DOLLY_EXECUTABLE_VERSION:
+        return dolly_executable_parse_v2(exec, src, size);
+    default: return DOLLY_EXEC_UNSUPPORTED_VERSION;
+    }
+}
+
+dolly_executable_status dolly_executable_read(dolly_executable* exec,
+                                              const uint8_t* src,
+                                              size_t size)
+{
+    dolly_executable_status status = dolly_executable_parse(exec, src, size);
+    if (status != DOLLY_EXEC_OKAY) return status;
+
+    const uint8_t* data = exec->program_data;
+    exec->program_data = dolly_malloc(exec->program_size);
+    if (exec->program_data == NULL) return DOLLY_EXEC_OUT_OF_MEMORY;
+    exec->program_capacity = exec->program_size;
+    if (exec->program_size > 0)
+        memcpy(exec->program_data, data, exec->program_size);
+    return DOLLY_EXEC_OKAY;
+}
+
+dolly_executable_status dolly_executable_map(dolly_executable* exec,
+                                             const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return DOLLY_EXEC_IO_ERROR;
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        return DOLLY_EXEC_IO_ERROR;
+    }
+    if (file_stat.st_size == 0) {
+        close(fd);
+        return DOLLY_EXEC_INCOMPLETE_HEADER;
+    }
+
+    size_t size = file_stat.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return DOLLY_EXEC_IO_ERROR;
+
+    dolly_executable_status status
+        = dolly_executable_parse(exec, mapping, size);
+    if (status != DOLLY_EXEC_OKAY) {
+        munmap(mapping, size);
+        return status;
+    }
+
+    exec->mapping = mapping;
+    exec->mapping_size = size;
+    return DOLLY_EXEC_OKAY;
+}
+
+dolly_executable_status dolly_executable_write(const dolly_executable* exec,
+                                               int fd)
+{
+    const size_t HEADER_SIZE = sizeof(DOLLY_MAGIC_NUMBER) + 12;
+    const size_t ENTRY_SIZE = DOLLY_EXECUTABLE_SECTION_NAME_MAX_LENGTH + 16;
+
+    size_t count = exec->header.section_count;
+    size_t table_end = HEADER_SIZE + count * (ENTRY_SIZE + sizeof(uint16_t));
+
+    uint32_t alignment = DOLLY_EXECUTABLE_SECTION_ALIGNMENT;
+    for (size_t i = 0; i < count; ++i) {
+        if (dolly_section_has_data(&exec->sections[i])
+            && dolly_section_alignment(&exec->sections[i]) > alignment)
+            alignment = dolly_section_alignment(&exec->sections[i]);
+    }
+    size_t data_offset = (table_end + alignment - 1) & ~(size_t)(alignment - 1);
+
+    // Everything before the section data is built up front, padding included
+    uint8_t* header = dolly_malloc(data_offset);
+    if (header == NULL) return DOLLY_EXEC_OUT_OF_MEMORY;
+    memset(header, 0, data_offset);
+    memcpy(header, DOLLY_MAGIC_NUMBER, sizeof(DOLLY_MAGIC_NUMBER));
+    uint8_t* fields = header + sizeof(DOLLY_MAGIC_NUMBER);
+    dolly_write_le32(fields, exec->header.arch);
+    fields[4] = DOLLY_EXECUTABLE_VERSION;
+    dolly_write_le16(fields + 6, exec->header.section_count);
+    dolly_write_le32(fields + 8, data_offset);
+
+    uint8_t* entry = header + HEADER_SIZE;
+    for (size_t i = 0; i < count; ++i, entry += ENTRY_SIZE) {
         const dolly_executable_section* section = &exec->sections[i];
-        fwrite(section->name, DOLLY_EXECUTABLE_SECTION_NAME_MAX_LENGTH, 1,
-               file);
-        fwrite(&section->type, sizeof(dolly_exec_section_type), 1,
-               file);
-        fwrite(&section->offset, sizeof(uint32_t), 1, file);
-        fwrite(&section->size, sizeof(uint32_t), 1, file);
-        fwrite(&section->load_address, sizeof(uint32_t), 1, file);
+        memcpy(entry, section->name, DOLLY_EXECUTABLE_SECTION_NAME_MAX_LENGTH);
+        fields = entry + DOLLY_EXECUTABLE_SECTION_NAME_MAX_LENGTH;
+        dolly_write_le16(fields, section->type);
+        dolly_write_le16(fields + 2, section->flags);
+        dolly_write_le32(fields + 4, section->offset);
+        dolly_write_le32(fields + 8, section->size);
+        dolly_write_le32(fields + 12, section->load_address);
+    }
+    for (size_t i = 0; i < count; ++i, entry += sizeof(uint16_t))
+        dolly_write_le16(entry, exec->load_order[i]);
+
+    // One system call for the whole file, unless the kernel writes less
+    struct iovec parts[2] = {
+        { .iov_base = header, .iov_len = data_offset },
+        { .iov_base = exec->program_data, .iov_len = exec->program_size }
+    };
+    struct iovec* part = parts;
+    int part_count = exec->program_size ? 2 : 1;
+    dolly_executable_status status = DOLLY_EXEC_OKAY;
+    while (part_count > 0) {
+        ssize_t written = writev(fd, part, part_count);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            status = DOLLY_EXEC_IO_ERROR;
+            break;
+        }
+        while (part_count > 0 && (size_t)written >= part->iov_len) {
+            written -= part->iov_len;
+            ++part;
+            --part_count;
+        }
+        if (part_count > 0) {
+            part->iov_base = (uint8_t*) part->iov_base + written;
+            part->iov_len -= written;
+        }
     }
 
-    fwrite(exec->program_data, exec->program_size, 1, file);
+    dolly_free(header);
+    return status;
 }
 
 void dolly_executable_destroy(dolly_executable* exec)
 {
-    if (exec->sections != NULL) free(exec->sections);
-    if (exec->program_data != NULL) free(exec->program_data);
+    if (exec->sections != NULL) dolly_free(exec->sections);
+    if (exec->load_order != NULL) dolly_free(exec->load_order);
+    dolly_executable_release(exec);
 }
 
 const char* dolly_executable_error_msg(dolly_executable_status status)
@@ -136,9 +628,15 @@ const char* dolly_executable_error_msg(dolly_executable_status status)
     default: case DOLLY_EXEC_OKAY: return "";
     case DOLLY_EXEC_INVALID_FORMAT: return "not dolly executable";
     case DOLLY_EXEC_INCOMPLETE_HEADER: return "incomplete executable header";
-    case DOLLY_EXEC_EOF_SECTION_TABLE: return "unexpected end of file"
+    case DOLLY_EXEC_EOF_SECTION_TABLE: return "unexpected end of file "
                                               "in section table";
     case DOLLY_EXEC_EOF_SECTION: return "unexpected end of file in section";
+    case DOLLY_EXEC_IO_ERROR: return "couldn't map or write file";
+    case DOLLY_EXEC_UNSUPPORTED_VERSION: return "unsupported executable "
+                                                "version";
+    case DOLLY_EXEC_INVALID_SECTION_TABLE: return "invalid section table";
+    case DOLLY_EXEC_CORRUPT_SECTION: return "corrupt compressed section";
+    case DOLLY_EXEC_OUT_OF_MEMORY: return "out of memory";
     }
 }
 
@@ -148,6 +646,8 @@ const char* dolly_exec_sect_type_str(dolly_exec_section_type type)
     case DOLLY_SECTION_TEXT: return "text";
     case DOLLY_SECTION_DATA: return "data";
     case DOLLY_SECTION_STRING: return "string";
+    case DOLLY_SECTION_BSS: return "bss";
+    case DOLLY_SECTION_SYMBOLS: return "symbols";
     default: return "(unknown)";
     }
 }
@@ -1,66 +1,184 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
-#define DOLLY_EXECUTABLE_VERSION 1
+#include "core/asm6502.h"
+
+#define DOLLY_EXECUTABLE_VERSION 2
 #define DOLLY_EXECUTABLE_SECTION_NAME_MAX_LENGTH 32
+#define DOLLY_EXECUTABLE_MAX_SECTIONS UINT16_MAX
+#define DOLLY_EXECUTABLE_BSS_MAX_SIZE 0x10000 // One bank
+// Section data alignment in the file. Sections of at least a page are page
+// aligned so they can be mapped straight from the file.
+#define DOLLY_EXECUTABLE_SECTION_ALIGNMENT 64
+#define DOLLY_EXECUTABLE_PAGE_ALIGNMENT    4096
+
+// Version 2 layout, all fields little-endian:
+//
+//   magic[6]  arch:u32  version:u8 (= 2)  reserved:u8  section_count:u16
+//   data_offset:u32
+//   section table, section_count entries of
+//     name[32]  type:u16  flags:u16  offset:u32  size:u32  load_address:u32
+//   load order, section_count section numbers (u16) sorted by load address
+//   padding up to data_offset
+//   section data, each section at data_offset + offset
+//
+// BSS sections have no data, an offset of 0, and a size of at most
+// DOLLY_EXECUTABLE_BSS_MAX_SIZE. The data of a section flagged
+// DOLLY_SECTION_FLAG_COMPRESSED is its compressed length (u32) followed by a
+// core/lz block, which decompresses to size bytes.
+//
+// data_offset is a multiple of the largest section alignment used. Version 1
+// executables, with host-endian enums for arch and type, a u8 section count
+// straight after the version byte, and unaligned data after the table, are
+// still read.
 
 enum dolly_architecture
 {
-    DOLLY_ARCH_6502, DOLLY_ARCH_65816
+    DOLLY_ARCH_6502, DOLLY_ARCH_65816,
+    DOLLY_ARCH_6502_NMOS // The 6502 with undocumented opcodes
 };
 
 typedef enum dolly_architecture dolly_architecture;
 
 enum dolly_exec_section_type
 {
-    DOLLY_SECTION_TEXT, DOLLY_SECTION_DATA, DOLLY_SECTION_STRING
+    DOLLY_SECTION_TEXT, DOLLY_SECTION_DATA, DOLLY_SECTION_STRING,
+    DOLLY_SECTION_BSS, // Zero-filled, with no bytes in the file
+    DOLLY_SECTION_SYMBOLS // Names for tools, never loaded (core/symbols.h)
 };
 
 typedef enum dolly_exec_section_type dolly_exec_section_type;
 
+#define DOLLY_SECTION_FLAG_COMPRESSED (1 << 0)
+#define DOLLY_SECTION_FLAGS_KNOWN     DOLLY_SECTION_FLAG_COMPRESSED
+
 struct dolly_executable_section
 {
     char name[DOLLY_EXECUTABLE_SECTION_NAME_MAX_LENGTH];
     dolly_exec_section_type type;
-    uint32_t offset, size, load_address;
+    uint16_t flags;
+    uint32_t offset, size, load_address; // Size as loaded
 };
 
 typedef struct dolly_executable_section dolly_executable_section;
 
+// Load addresses are 24 bits, the top byte being the bank as on the 65816.
+// On the 6502, the bank selects which physical bank of a bank window the
+// section is loaded into.
+static inline uint8_t dolly_section_bank(const dolly_executable_section* s)
+{
+    return (s->load_address >> 16) & 0xFF;
+}
+
+static inline uint16_t dolly_section_address(const dolly_executable_section* s)
+{
+    return s->load_address & 0xFFFF;
+}
+
+// Whether the section has bytes in the program data, at its offset
+static inline bool dolly_section_has_data(const dolly_executable_section* s)
+{
+    return s->type != DOLLY_SECTION_BSS;
+}
+
+// Whether the section is loaded into guest memory, at its load address
+static inline bool dolly_section_is_loaded(const dolly_executable_section* s)
+{
+    return s->type != DOLLY_SECTION_SYMBOLS;
+}
+
 struct dolly_executable
 {
+    // Points into the file mapping, read-only, for mapped executables
     uint8_t* program_data;
     size_t   program_size; // Not serialised
+    size_t   program_capacity; // Not serialised, 0 unless owned
     dolly_executable_section* sections;
     size_t sections_array_capacity; // Not serialised
+    // Section numbers sorted by load address, for dolly_executable_find
+    uint16_t* load_order;
+    void*  mapping; // Not serialised, NULL unless mapped
+    size_t mapping_size;
     struct {
         dolly_architecture arch;
-        uint8_t section_count;
+        uint16_t section_count;
         uint8_t version;
     } header;
 };
 
 typedef struct dolly_executable dolly_executable;
 
+static inline bool dolly_executable_is_6502(const dolly_executable* exec)
+{
+    return exec->header.arch == DOLLY_ARCH_6502
+        || exec->header.arch == DOLLY_ARCH_6502_NMOS;
+}
+
+static inline dolly_6502_variant
+dolly_executable_variant(const dolly_executable* exec)
+{
+    return exec->header.arch == DOLLY_ARCH_6502_NMOS
+         ? DOLLY_6502_VARIANT_NMOS : DOLLY_6502_VARIANT_DEFAULT;
+}
+
 enum dolly_executable_status
 {
     DOLLY_EXEC_OKAY, DOLLY_EXEC_INVALID_FORMAT, DOLLY_EXEC_INCOMPLETE_HEADER,
-    DOLLY_EXEC_EOF_SECTION_TABLE, DOLLY_EXEC_EOF_SECTION
+    DOLLY_EXEC_EOF_SECTION_TABLE, DOLLY_EXEC_EOF_SECTION, DOLLY_EXEC_IO_ERROR,
+    DOLLY_EXEC_UNSUPPORTED_VERSION, DOLLY_EXEC_INVALID_SECTION_TABLE,
+    DOLLY_EXEC_CORRUPT_SECTION, DOLLY_EXEC_OUT_OF_MEMORY
 };
 
 typedef enum dolly_executable_status dolly_executable_status;
 
 void dolly_executable_init(dolly_executable* exec);
-void dolly_executable_add_section(dolly_executable* exec,
-                                  const dolly_executable_section* section,
-                                  const uint8_t* data);
+// The section's offset is assigned here, aligned as it will be in the file.
+// Data is added uncompressed, and ignored for BSS sections. At most
+// DOLLY_EXECUTABLE_MAX_SECTIONS sections can be added. On
+// DOLLY_EXEC_OUT_OF_MEMORY, the executable is left as it was.
+dolly_executable_status
+dolly_executable_add_section(dolly_executable* exec,
+                             const dolly_executable_section* section,
+                             const uint8_t* data);
+// Makes room for section_count sections and data_size bytes of program data
+// in all, so building an executable of known size doesn't reallocate
+dolly_executable_status dolly_executable_reserve(dolly_executable* exec,
+                                                 size_t section_count,
+                                                 size_t data_size);
+// The loaded section at the 24-bit address, found by binary search, or NULL
+// if none covers it
+const dolly_executable_section*
+dolly_executable_find(const dolly_executable* exec, uint32_t address);
+// Compresses a section's data if that makes it smaller, returning whether it
+// did. Only for executables being built, as the program data is laid out
+// again, which invalidates pointers into it.
+bool dolly_executable_compress_section(dolly_executable* exec,
+                                       size_t number);
+// Writes the section as loaded, size bytes, to dest: copied, decompressed
+// straight into dest, or zeroed for BSS sections. Compressed data is
+// checked when the executable is read, so this cannot fail. For mapped
+// executables, the section's pages in the mapping are given back afterwards.
+void dolly_executable_load_section(const dolly_executable* exec,
+                                   const dolly_executable_section* section,
+                                   uint8_t* dest);
+// Copies the program data out of src, which may be freed afterwards
 dolly_executable_status dolly_executable_read(dolly_executable* exec,
                                               const uint8_t* src,
                                               size_t size);
-void dolly_executable_write(const dolly_executable* exec, FILE* file);
+// Maps the file and validates it in place. Section data is left in the
+// mapping, which lives until the executable is destroyed, so pages are only
+// read in once something touches them. Sections cannot be added afterwards.
+// On DOLLY_EXEC_IO_ERROR, errno is set.
+dolly_executable_status dolly_executable_map(dolly_executable* exec,
+                                             const char* path);
+// Writes the whole file with a single writev where the kernel allows. On
+// DOLLY_EXEC_IO_ERROR, errno is set.
+dolly_executable_status dolly_executable_write(const dolly_executable* exec,
+                                               int fd);
 void dolly_executable_destroy(dolly_executable* exec);
 
 const char* dolly_executable_error_msg(dolly_executable_status status);
@@ -1,11 +1,13 @@
 #include "core/streambuf.h"
 
+#include "core/memory.h"
+
 #include <stdlib.h>
 
 tb_streambuf tb_streambuf_new(size_t capacity)
 {
     tb_streambuf buffer = {
-        .data = capacity ? malloc(capacity) : NULL,
+        .data = capacity ? dolly_malloc(capacity) : NULL,
         .size = 0,
         .capacity = capacity
     };
@@ -15,7 +17,7 @@ tb_streambuf tb_streambuf_new(size_t capacity)
 
 tb_streambuf_status tb_streambuf_init(tb_streambuf* buffer, size_t capacity)
 {
-    buffer->data = capacity ? malloc(capacity) : NULL;
+    buffer->data = capacity ? dolly_malloc(capacity) : NULL;
     buffer->size = 0;
     buffer->capacity = capacity;
 
@@ -38,7 +40,7 @@ tb_streambuf_status tb_streambuf_read_all(tb_streambuf* buffer, FILE* file)
     while (feof(file) == false) {
         if (buffer->size >= buffer->capacity) {
             buffer->capacity *= 2;
-            char* new_ptr = realloc(buffer->data, buffer->capacity);
+            char* new_ptr = dolly_realloc(buffer->data, buffer->capacity);
             if (new_ptr == NULL) return TB_STREAMBUF_NOMEM;
             buffer->data = new_ptr;
         }
@@ -60,7 +62,7 @@ tb_streambuf_status tb_streambuf_read_some(tb_streambuf* buffer, FILE* file,
 {
     if (buffer->size + bytes > buffer->capacity) {
         buffer->capacity = buffer->size + bytes;
-        char* new_ptr = realloc(buffer->data, buffer->capacity);
+        char* new_ptr = dolly_realloc(buffer->data, buffer->capacity);
         if (new_ptr == NULL) return TB_STREAMBUF_NOMEM;
         buffer->data = new_ptr;
     }
@@ -86,6 +88,6 @@ tb_streambuf_status tb_streambuf_write(const tb_streambuf* buffer, FILE* file)
 
 void tb_streambuf_destroy(tb_streambuf* buffer)
 {
-    if (buffer->data) free(buffer->data);
+    if (buffer->data) dolly_free(buffer->data);
 }
 
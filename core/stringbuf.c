@@ -1,5 +1,7 @@
 #include "stringbuf.h"
 
+#include "core/memory.h"
+
 #include <stdlib.h>
 #include <string.h>
 
@@ -13,7 +15,7 @@ static size_t min(size_t a, size_t b)
 tb_stringbuf tb_stringbuf_new(size_t capacity)
 {
     tb_stringbuf buffer = {
-        .data = capacity ? malloc(capacity) : NULL,
+        .data = capacity ? dolly_malloc(capacity) : NULL,
         .size = 0,
         .capacity = capacity
     };
@@ -26,10 +28,11 @@ bool tb_stringbuf_cat(tb_stringbuf* buffer, const char* src, size_t len)
     size_t len_to_copy = min(strlen(src), len);
 
     if (buffer->size + len_to_copy + 1 >= buffer->capacity) {
-        buffer->capacity += len_to_copy + 1;
-        void* ptr = realloc(buffer->data, buffer->capacity);
+        size_t capacity = buffer->capacity + len_to_copy + 1;
+        void* ptr = dolly_realloc(buffer->data, capacity);
         if (!ptr) return false;
         buffer->data = ptr;
+        buffer->capacity = capacity;
     }
 
     memcpy(buffer->data + buffer->size, src, len_to_copy);
@@ -42,10 +45,11 @@ bool tb_stringbuf_cat(tb_stringbuf* buffer, const char* src, size_t len)
 bool tb_stringbuf_cat_char(tb_stringbuf* buffer, char character)
 {
     if (buffer->size + 1 >= buffer->capacity) {
-        buffer->capacity *= 2;
-        void* ptr = realloc(buffer->data, buffer->capacity);
+        size_t capacity = buffer->capacity * 2;
+        void* ptr = dolly_realloc(buffer->data, capacity);
         if (!ptr) return false;
         buffer->data = ptr;
+        buffer->capacity = capacity;
     }
 
     buffer->data[buffer->size++] = character;
@@ -67,5 +71,5 @@ bool tb_stringbuf_empty(const tb_stringbuf* buffer)
 
 void tb_stringbuf_destroy(tb_stringbuf* buffer)
 {
-    if (buffer->data) free(buffer->data);
+    if (buffer->data) dolly_free(buffer->data);
 }
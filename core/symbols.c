@@ -0,0 +1,207 @@
+#include "core/symbols.h"
+
+#include "core/memory.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define DOLLY_SYMBOLS_ENTRY_SIZE 8
+
+static uint32_t dolly_symbols_read32(const uint8_t* src)
+{
+    return (uint32_t)src[0] | (uint32_t)src[1] << 8
+         | (uint32_t)src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+static void dolly_symbols_write32(uint8_t* dest, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i) dest[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static uint32_t dolly_symbols_value(const dolly_symbols* symbols,
+                                    uint32_t index)
+{
+    return dolly_symbols_read32(symbols->entries
+                                + index * DOLLY_SYMBOLS_ENTRY_SIZE);
+}
+
+static const char* dolly_symbols_name(const dolly_symbols* symbols,
+                                      uint32_t index)
+{
+    uint32_t offset = dolly_symbols_read32(symbols->entries
+                                           + index * DOLLY_SYMBOLS_ENTRY_SIZE
+                                           + 4);
+    // The pool ends in a terminator, so any offset inside it is a string
+    return offset < symbols->names_size ? symbols->names + offset : NULL;
+}
+
+// Index of the first entry with a value above address
+static uint32_t dolly_symbols_upper_bound(const dolly_symbols* symbols,
+                                          uint32_t address)
+{
+    uint32_t low = 0, high = symbols->count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (dolly_symbols_value(symbols, mid) <= address) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+bool dolly_symbols_open(dolly_symbols* symbols, const dolly_executable* exec)
+{
+    memset(symbols, 0, sizeof(dolly_symbols));
+
+    const dolly_executable_section* section = NULL;
+    for (size_t i = 0; i < exec->header.section_count; ++i) {
+        if (exec->sections[i].type == DOLLY_SECTION_SYMBOLS) {
+            section = &exec->sections[i];
+            break;
+        }
+    }
+    if (section == NULL) return false;
+
+    const uint8_t* data = exec->program_data + section->offset;
+    if (section->flags & DOLLY_SECTION_FLAG_COMPRESSED) {
+        symbols->decompressed = dolly_malloc(section->size);
+        if (symbols->decompressed == NULL) {
+            symbols->out_of_memory = true;
+            return false;
+        }
+        dolly_executable_load_section(exec, section, symbols->decompressed);
+        data = symbols->decompressed;
+    }
+
+    if (section->size < sizeof(uint32_t)) {
+        dolly_symbols_close(symbols);
+        return false;
+    }
+    uint64_t count = dolly_symbols_read32(data);
+    uint64_t names_offset = sizeof(uint32_t)
+                          + count * DOLLY_SYMBOLS_ENTRY_SIZE;
+    if (names_offset >= section->size
+        || data[section->size - 1] != '\0') {
+        dolly_symbols_close(symbols);
+        return false;
+    }
+
+    symbols->entries = data + sizeof(uint32_t);
+    symbols->count = count;
+    symbols->names = (const char*) data + names_offset;
+    symbols->names_size = section->size - names_offset;
+    return true;
+}
+
+void dolly_symbols_close(dolly_symbols* symbols)
+{
+    if (symbols->decompressed) dolly_free(symbols->decompressed);
+    memset(symbols, 0, sizeof(dolly_symbols));
+}
+
+const char* dolly_symbols_find(const dolly_symbols* symbols,
+                               uint32_t address)
+{
+    if (address & DOLLY_SYMBOL_CONSTANT) return NULL;
+
+    // Back up to the first of any labels at the same address
+    uint32_t index = dolly_symbols_upper_bound(symbols, address);
+    while (index > 0 && dolly_symbols_value(symbols, index - 1) == address)
+        --index;
+    if (index == symbols->count
+        || dolly_symbols_value(symbols, index) != address) {
+        return NULL;
+    }
+    return dolly_symbols_name(symbols, index);
+}
+
+const char* dolly_symbols_nearest(const dolly_symbols* symbols,
+                                  uint32_t address, uint32_t* offset)
+{
+    if (address & DOLLY_SYMBOL_CONSTANT) return NULL;
+
+    uint32_t index = dolly_symbols_upper_bound(symbols, address);
+    if (index == 0) return NULL;
+
+    *offset = address - dolly_symbols_value(symbols, index - 1);
+    return dolly_symbols_name(symbols, index - 1);
+}
+
+void dolly_symbols_builder_init(dolly_symbols_builder* builder)
+{
+    memset(builder, 0, sizeof(dolly_symbols_builder));
+}
+
+void dolly_symbols_builder_add(dolly_symbols_builder* builder,
+                               uint32_t value, const char* name)
+{
+    if (builder->count == builder->capacity && !builder->out_of_memory) {
+        size_t capacity = builder->capacity ? builder->capacity * 2 : 16;
+        dolly_symbols_entry* entries
+            = dolly_realloc(builder->entries,
+                            capacity * sizeof(dolly_symbols_entry));
+        if (entries == NULL) {
+            builder->out_of_memory = true;
+        } else {
+            builder->entries = entries;
+            builder->capacity = capacity;
+        }
+    }
+    if (builder->out_of_memory) return;
+
+    builder->entries[builder->count] = (dolly_symbols_entry) {
+        .value = value, .name = name, .order = builder->count
+    };
+    ++builder->count;
+    builder->names_size += strlen(name) + 1;
+}
+
+static int dolly_symbols_compare_entries(const void* a, const void* b)
+{
+    const dolly_symbols_entry* lhs = a;
+    const dolly_symbols_entry* rhs = b;
+    if (lhs->value != rhs->value) return lhs->value < rhs->value ? -1 : 1;
+    return lhs->order < rhs->order ? -1 : lhs->order > rhs->order;
+}
+
+dolly_executable_status dolly_symbols_builder_emit(
+    dolly_symbols_builder* builder, dolly_executable* exec)
+{
+    if (builder->out_of_memory) return DOLLY_EXEC_OUT_OF_MEMORY;
+    if (builder->count == 0) return DOLLY_EXEC_OKAY;
+
+    qsort(builder->entries, builder->count, sizeof(dolly_symbols_entry),
+          dolly_symbols_compare_entries);
+
+    size_t names_offset = sizeof(uint32_t)
+                        + builder->count * DOLLY_SYMBOLS_ENTRY_SIZE;
+    size_t size = names_offset + builder->names_size;
+    uint8_t* data = dolly_malloc(size);
+    if (data == NULL) return DOLLY_EXEC_OUT_OF_MEMORY;
+
+    dolly_symbols_write32(data, builder->count);
+    size_t name = 0;
+    for (size_t i = 0; i < builder->count; ++i) {
+        uint8_t* entry = data + sizeof(uint32_t)
+                       + i * DOLLY_SYMBOLS_ENTRY_SIZE;
+        size_t length = strlen(builder->entries[i].name) + 1;
+        dolly_symbols_write32(entry, builder->entries[i].value);
+        dolly_symbols_write32(entry + 4, name);
+        memcpy(data + names_offset + name, builder->entries[i].name, length);
+        name += length;
+    }
+
+    dolly_executable_section section = {
+        .name = DOLLY_SYMBOLS_SECTION_NAME,
+        .type = DOLLY_SECTION_SYMBOLS,
+        .size = size
+    };
+    dolly_executable_status status
+        = dolly_executable_add_section(exec, &section, data);
+    dolly_free(data);
+    return status;
+}
+
+void dolly_symbols_builder_destroy(dolly_symbols_builder* builder)
+{
+    if (builder->entries) dolly_free(builder->entries);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core/object.h"
+
+#define DOLLY_SYMBOLS_SECTION_NAME "__symbols"
+// Set in the value of constants, so they sort after every address and
+// address lookups never find them
+#define DOLLY_SYMBOL_CONSTANT (1U << 31)
+
+// Symbol sections map addresses to names. All fields are little-endian:
+//
+//   count:u32
+//   count entries of  value:u32  name:u32 (offset into the pool)
+//   pool of NUL-terminated names
+//
+// Entries are sorted by value. A label's value is its 24-bit address, and a
+// constant's is its value with DOLLY_SYMBOL_CONSTANT set.
+//
+// A symbol table is a view of the section where it lies in the executable,
+// so opening one only finds the section, and lookups binary-search it.
+
+struct dolly_symbols
+{
+    const uint8_t* entries;
+    uint32_t count;
+    const char* names;
+    uint32_t names_size;
+    uint8_t* decompressed; // Owned, if the section was compressed
+    bool out_of_memory; // Set if it couldn't be decompressed
+};
+
+typedef struct dolly_symbols dolly_symbols;
+
+struct dolly_symbols_entry
+{
+    uint32_t value;
+    const char* name;
+    size_t order; // Keeps symbols with the same value in the order added
+};
+
+typedef struct dolly_symbols_entry dolly_symbols_entry;
+
+struct dolly_symbols_builder
+{
+    dolly_symbols_entry* entries;
+    size_t count, capacity;
+    size_t names_size;
+    bool out_of_memory; // Set when growing fails, which drops the symbol
+};
+
+typedef struct dolly_symbols_builder dolly_symbols_builder;
+
+// Returns false, leaving a table which finds nothing, if the executable has
+// no symbol section, it is malformed, or there was no memory to decompress
+// it, in which case symbols->out_of_memory is set
+bool dolly_symbols_open(dolly_symbols* symbols, const dolly_executable* exec);
+void dolly_symbols_close(dolly_symbols* symbols);
+
+// The first label at exactly address, or NULL
+const char* dolly_symbols_find(const dolly_symbols* symbols,
+                               uint32_t address);
+// The last label at or below address, or NULL. *offset is set to the
+// distance from it.
+const char* dolly_symbols_nearest(const dolly_symbols* symbols,
+                                  uint32_t address, uint32_t* offset);
+
+void dolly_symbols_builder_init(dolly_symbols_builder* builder);
+// The name must stay valid until the table is emitted
+void dolly_symbols_builder_add(dolly_symbols_builder* builder,
+                               uint32_t value, const char* name);
+// Adds the symbol section to the executable, unless there are no symbols.
+// Returns DOLLY_EXEC_OUT_OF_MEMORY if any symbol couldn't be added.
+dolly_executable_status dolly_symbols_builder_emit(
+    dolly_symbols_builder* builder, dolly_executable* exec);
+void dolly_symbols_builder_destroy(dolly_symbols_builder* builder);
@@ -0,0 +1,246 @@
+#include "core/trace.h"
+
+#include "core/asm6502.h"
+#include "core/lz.h"
+#include "core/memory.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+const uint8_t DOLLY_TRACE_MAGIC[7] = { 0x7F, 'D', 'T', 'R', 'A', 'C', 'E' };
+
+static int    dolly_trace_instruction_size(uint8_t opcode,
+                                           dolly_6502_variant variant);
+static size_t dolly_trace_write_varint(uint8_t* out, uint32_t value);
+static size_t dolly_trace_read_varint(const uint8_t* in, size_t size,
+                                      uint32_t* value);
+static uint32_t dolly_trace_read_u32(const uint8_t* in);
+static dolly_trace_status dolly_trace_reader_load_block(
+    dolly_trace_reader* reader);
+
+static int dolly_trace_instruction_size(uint8_t opcode,
+                                        dolly_6502_variant variant)
+{
+    dolly_opcode op = dolly_resolve_opcode_variant(opcode, variant);
+    int operand_size = dolly_get_operand_size(op.a_mode);
+    return 1 + (operand_size > 0 ? operand_size : 0);
+}
+
+static size_t dolly_trace_write_varint(uint8_t* out, uint32_t value)
+{
+    size_t i = 0;
+    for (; value >= 0x80; value >>= 7) out[i++] = (value & 0x7F) | 0x80;
+    out[i++] = (uint8_t) value;
+    return i;
+}
+
+static size_t dolly_trace_read_varint(const uint8_t* in, size_t size,
+                                      uint32_t* value)
+{
+    *value = 0;
+    for (size_t i = 0; i < size && i < 5; ++i) {
+        *value |= (uint32_t)(in[i] & 0x7F) << (7 * i);
+        if ((in[i] & 0x80) == 0) return i + 1;
+    }
+    return 0;
+}
+
+static uint32_t dolly_trace_read_u32(const uint8_t* in)
+{
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+void dolly_trace_state_reset(dolly_trace_state* state)
+{
+    dolly_6502_variant variant = state->variant;
+    memset(state, 0, sizeof(dolly_trace_state));
+    state->block_start = true;
+    state->variant = variant;
+}
+
+size_t dolly_trace_encode(dolly_trace_state* state,
+                          const dolly_trace_record* record, uint8_t* out)
+{
+    const dolly_trace_record* last = &state->last;
+    bool all = state->block_start;
+    uint8_t flags = 0;
+
+    if (all || record->program_counter != state->expected_pc)
+        flags |= DOLLY_TRACE_HAS_PC;
+    if (all || record->reg_a != last->reg_a) flags |= DOLLY_TRACE_HAS_A;
+    if (all || record->reg_x != last->reg_x) flags |= DOLLY_TRACE_HAS_X;
+    if (all || record->reg_y != last->reg_y) flags |= DOLLY_TRACE_HAS_Y;
+    if (all || record->stack_ptr != last->stack_ptr)
+        flags |= DOLLY_TRACE_HAS_SP;
+    if (all || record->flags_byte != last->flags_byte)
+        flags |= DOLLY_TRACE_HAS_FLAGS;
+    if (record->has_store) flags |= DOLLY_TRACE_HAS_STORE;
+
+    size_t size = 0;
+    out[size++] = flags;
+    if (flags & DOLLY_TRACE_HAS_PC) {
+        int32_t delta = (int32_t)record->program_counter
+                      - (int32_t)state->expected_pc;
+        uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+        size += dolly_trace_write_varint(out + size, zigzag);
+    }
+
+    int instruction_size
+        = dolly_trace_instruction_size(record->instruction[0], state->variant);
+    memcpy(out + size, record->instruction, instruction_size);
+    size += instruction_size;
+
+    if (flags & DOLLY_TRACE_HAS_A) out[size++] = record->reg_a;
+    if (flags & DOLLY_TRACE_HAS_X) out[size++] = record->reg_x;
+    if (flags & DOLLY_TRACE_HAS_Y) out[size++] = record->reg_y;
+    if (flags & DOLLY_TRACE_HAS_SP) out[size++] = record->stack_ptr;
+    if (flags & DOLLY_TRACE_HAS_FLAGS) out[size++] = record->flags_byte;
+    if (flags & DOLLY_TRACE_HAS_STORE) {
+        out[size++] = record->store_address & 0xFF;
+        out[size++] = record->store_address >> 8;
+        out[size++] = record->store_value;
+    }
+
+    state->last = *record;
+    state->expected_pc = record->program_counter + instruction_size;
+    state->block_start = false;
+    return size;
+}
+
+size_t dolly_trace_decode(dolly_trace_state* state, const uint8_t* in,
+                          size_t size, dolly_trace_record* record)
+{
+    size_t pos = 0;
+    if (size < 2) return 0;
+
+    uint8_t flags = in[pos++];
+    *record = state->last;
+    record->program_counter = state->expected_pc;
+    record->has_store = false;
+
+    if (flags & DOLLY_TRACE_HAS_PC) {
+        uint32_t zigzag;
+        size_t read = dolly_trace_read_varint(in + pos, size - pos, &zigzag);
+        if (read == 0) return 0;
+        pos += read;
+        int32_t delta = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+        record->program_counter = state->expected_pc + delta;
+    }
+
+    if (pos >= size) return 0;
+    int instruction_size
+        = dolly_trace_instruction_size(in[pos], state->variant);
+    size_t register_count = __builtin_popcount(flags & 0x3E);
+    size_t needed = instruction_size + register_count
+                  + ((flags & DOLLY_TRACE_HAS_STORE) ? 3 : 0);
+    if (size - pos < needed) return 0;
+
+    memset(record->instruction, 0, sizeof(record->instruction));
+    memcpy(record->instruction, in + pos, instruction_size);
+    pos += instruction_size;
+
+    if (flags & DOLLY_TRACE_HAS_A) record->reg_a = in[pos++];
+    if (flags & DOLLY_TRACE_HAS_X) record->reg_x = in[pos++];
+    if (flags & DOLLY_TRACE_HAS_Y) record->reg_y = in[pos++];
+    if (flags & DOLLY_TRACE_HAS_SP) record->stack_ptr = in[pos++];
+    if (flags & DOLLY_TRACE_HAS_FLAGS) record->flags_byte = in[pos++];
+    if (flags & DOLLY_TRACE_HAS_STORE) {
+        record->has_store = true;
+        record->store_address = in[pos] | (in[pos + 1] << 8);
+        record->store_value = in[pos + 2];
+        pos += 3;
+    }
+
+    state->last = *record;
+    state->expected_pc = record->program_counter + instruction_size;
+    state->block_start = false;
+    return pos;
+}
+
+dolly_trace_status dolly_trace_reader_open(dolly_trace_reader* reader,
+                                           FILE* file)
+{
+    memset(reader, 0, sizeof(dolly_trace_reader));
+    reader->file = file;
+
+    uint8_t header[sizeof(DOLLY_TRACE_MAGIC) + 2];
+    if (fread(header, sizeof(header), 1, file) != 1
+        || memcmp(header, DOLLY_TRACE_MAGIC, sizeof(DOLLY_TRACE_MAGIC)) != 0
+        || header[sizeof(DOLLY_TRACE_MAGIC)] != DOLLY_TRACE_VERSION
+        || header[sizeof(DOLLY_TRACE_MAGIC) + 1] > DOLLY_6502_VARIANT_NMOS) {
+        return DOLLY_TRACE_INVALID_FORMAT;
+    }
+    reader->state.variant = header[sizeof(DOLLY_TRACE_MAGIC) + 1];
+
+    return DOLLY_TRACE_OKAY;
+}
+
+static dolly_trace_status dolly_trace_reader_load_block(
+    dolly_trace_reader* reader)
+{
+    uint8_t block_header[8];
+    size_t read = fread(block_header, 1, sizeof(block_header), reader->file);
+    if (read == 0) return DOLLY_TRACE_EOF;
+    if (read < sizeof(block_header)) return DOLLY_TRACE_CORRUPT_BLOCK;
+
+    size_t raw_size = dolly_trace_read_u32(block_header);
+    size_t stored_size = dolly_trace_read_u32(block_header + 4);
+
+    if (raw_size > reader->block_capacity) {
+        reader->block_capacity = raw_size;
+        reader->block = realloc_or_abort(reader->block, raw_size);
+    }
+
+    if (stored_size == raw_size) {
+        if (fread(reader->block, 1, raw_size, reader->file) != raw_size)
+            return DOLLY_TRACE_CORRUPT_BLOCK;
+    } else {
+        if (stored_size > reader->stored_capacity) {
+            reader->stored_capacity = stored_size;
+            reader->stored = realloc_or_abort(reader->stored, stored_size);
+        }
+        if (fread(reader->stored, 1, stored_size, reader->file) != stored_size
+            || !tb_lz_decompress(reader->stored, stored_size,
+                                 reader->block, raw_size)) {
+            return DOLLY_TRACE_CORRUPT_BLOCK;
+        }
+    }
+
+    reader->block_size = raw_size;
+    reader->position = 0;
+    dolly_trace_state_reset(&reader->state);
+    return DOLLY_TRACE_OKAY;
+}
+
+dolly_trace_status dolly_trace_reader_next(dolly_trace_reader* reader,
+                                           dolly_trace_record* record)
+{
+    while (reader->position >= reader->block_size) {
+        dolly_trace_status status = dolly_trace_reader_load_block(reader);
+        if (status != DOLLY_TRACE_OKAY) return status;
+    }
+
+    size_t used = dolly_trace_decode(&reader->state,
+                                     reader->block + reader->position,
+                                     reader->block_size - reader->position,
+                                     record);
+    if (used == 0) return DOLLY_TRACE_CORRUPT_BLOCK;
+    reader->position += used;
+    return DOLLY_TRACE_OKAY;
+}
+
+void dolly_trace_reader_destroy(dolly_trace_reader* reader)
+{
+    if (reader->block) dolly_free(reader->block);
+    if (reader->stored) dolly_free(reader->stored);
+}
+
+const char* dolly_trace_error_msg(dolly_trace_status status)
+{
+    switch (status) {
+    default: case DOLLY_TRACE_OKAY: return "";
+    case DOLLY_TRACE_EOF: return "end of trace";
+    case DOLLY_TRACE_INVALID_FORMAT: return "not a dolly trace";
+    case DOLLY_TRACE_CORRUPT_BLOCK: return "corrupt or truncated trace block";
+    }
+}
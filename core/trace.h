@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "core/asm6502.h"
+
+// Binary execution trace format
+//
+// A trace file starts with DOLLY_TRACE_MAGIC, a version byte and the
+// dolly_6502_variant the guest ran as, which decides the size of each
+// instruction, followed by blocks. Each block has a little-endian 32-bit raw
+// size and stored size; if they differ the block data is compressed with
+// tb_lz. Delta state resets at the start of every block, so blocks can be
+// decoded independently.
+//
+// Each record describes one retired instruction:
+//   flags        DOLLY_TRACE_HAS_* bits
+//   [pc delta]   zigzag varint from the expected PC, if DOLLY_TRACE_HAS_PC
+//   opcode       followed by its operand bytes
+//   [a x y sp p] one byte for each register whose flag is set
+//   [address]    little-endian 16-bit address then value, if a store
+//                changed a byte of memory
+//
+// Registers are recorded after the instruction executes. Stack pushes are
+// implied by SP and the other registers so are not recorded as stores.
+
+#define DOLLY_TRACE_VERSION 2
+#define DOLLY_TRACE_MAX_RECORD_SIZE 16
+
+extern const uint8_t DOLLY_TRACE_MAGIC[7];
+
+enum dolly_trace_flag
+{
+    DOLLY_TRACE_HAS_PC = 1 << 0,
+    DOLLY_TRACE_HAS_A = 1 << 1,
+    DOLLY_TRACE_HAS_X = 1 << 2,
+    DOLLY_TRACE_HAS_Y = 1 << 3,
+    DOLLY_TRACE_HAS_SP = 1 << 4,
+    DOLLY_TRACE_HAS_FLAGS = 1 << 5,
+    DOLLY_TRACE_HAS_STORE = 1 << 6
+};
+
+struct dolly_trace_record
+{
+    uint16_t program_counter;
+    uint8_t  instruction[3]; // Opcode and operand bytes
+    uint8_t  reg_a, reg_x, reg_y, stack_ptr, flags_byte;
+    bool     has_store;
+    uint16_t store_address;
+    uint8_t  store_value;
+};
+
+typedef struct dolly_trace_record dolly_trace_record;
+
+// Delta state shared by the encoder and the decoder
+struct dolly_trace_state
+{
+    dolly_trace_record last;
+    uint16_t expected_pc;
+    bool block_start;
+    dolly_6502_variant variant; // Kept across resets
+};
+
+typedef struct dolly_trace_state dolly_trace_state;
+
+enum dolly_trace_status
+{
+    DOLLY_TRACE_OKAY, DOLLY_TRACE_EOF, DOLLY_TRACE_INVALID_FORMAT,
+    DOLLY_TRACE_CORRUPT_BLOCK
+};
+
+typedef enum dolly_trace_status dolly_trace_status;
+
+void dolly_trace_state_reset(dolly_trace_state* state);
+
+// Returns the number of bytes written, at most DOLLY_TRACE_MAX_RECORD_SIZE
+size_t dolly_trace_encode(dolly_trace_state* state,
+                          const dolly_trace_record* record, uint8_t* out);
+
+// Returns the number of bytes consumed, 0 if the record is truncated
+size_t dolly_trace_decode(dolly_trace_state* state, const uint8_t* in,
+                          size_t size, dolly_trace_record* record);
+
+struct dolly_trace_reader
+{
+    FILE* file;
+    uint8_t* block;
+    size_t block_size, block_capacity;
+    size_t position;
+    uint8_t* stored;
+    size_t stored_capacity;
+    dolly_trace_state state;
+};
+
+typedef struct dolly_trace_reader dolly_trace_reader;
+
+dolly_trace_status dolly_trace_reader_open(dolly_trace_reader* reader,
+                                           FILE* file);
+dolly_trace_status dolly_trace_reader_next(dolly_trace_reader* reader,
+                                           dolly_trace_record* record);
+void dolly_trace_reader_destroy(dolly_trace_reader* reader);
+
+const char* dolly_trace_error_msg(dolly_trace_status status);
@@ -3,25 +3,31 @@
 #include "core/core.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 const char* dolly_dsm_error_msg(dolly_dsm_status status)
 {
     switch (status) {
     default: case DOLLY_DSM_OKAY: return "";
     case DOLLY_DSM_INVALID_OPCODE: return "invalid opcode encountered";
+    case DOLLY_DSM_OUT_OF_MEMORY: return "out of memory";
     }
 }
 
-dolly_dsm_list dolly_dsm_list_new(void)
+dolly_dsm_list dolly_dsm_list_new(dolly_6502_variant variant)
 {
     static const size_t DSM_START_CAPACITY = 16;
     dolly_dsm_list list = {
-        .data = malloc_or_abort(sizeof(dolly_dsm_opcode) * DSM_START_CAPACITY),
+        .data = dolly_malloc(sizeof(dolly_dsm_opcode) * DSM_START_CAPACITY),
         .size = 0,
         .capacity = DSM_START_CAPACITY,
         .last_offset = 0,
-        .label_num = 0
+        .label_num = 0,
+        .variant = variant,
+        .symbols = NULL,
+        .base_address = 0
     };
+    if (list.data == NULL) list.capacity = 0;
 
     return list;
 }
@@ -29,10 +35,12 @@ dolly_dsm_list dolly_dsm_list_new(void)
 dolly_dsm_opcode* dolly_dsm_list_append_empty(dolly_dsm_list* list)
 {
     if (list->size >= list->capacity) {
-        list->capacity *= 2;
-        list->data
-            = realloc_or_abort(list->data,
-                               sizeof(dolly_dsm_opcode) * list->capacity);
+        size_t capacity = list->capacity ? list->capacity * 2 : 16;
+        dolly_dsm_opcode* data
+            = dolly_realloc(list->data, sizeof(dolly_dsm_opcode) * capacity);
+        if (data == NULL) return NULL;
+        list->data = data;
+        list->capacity = capacity;
     }
 
     return list->data + ++list->size - 1;
@@ -44,6 +52,17 @@ static bool is_valid_opcode(dolly_opcode op)
              || op.a_mode == DOLLY_INVALID_ADDR_MODE);
 }
 
+// Operands inside the code being read are in its bank, and any others are
+// taken to be in bank 0
+static const char* dolly_dsm_operand_symbol(const dolly_dsm_list* list,
+                                            uint16_t operand)
+{
+    uint16_t base = list->base_address & 0xFFFF;
+    uint32_t bank = (uint32_t)operand - base < list->last_offset
+                  ? list->base_address & 0xFF0000 : 0;
+    return dolly_symbols_find(list->symbols, bank | operand);
+}
+
 dolly_dsm_status dolly_dsm_list_read(dolly_dsm_list* list,
                                      const uint8_t* instructions, size_t len)
 {
@@ -51,7 +70,9 @@ dolly_dsm_status dolly_dsm_list_read(dolly_dsm_list* list,
     size_t i = 0;
     while (i < len) {
         dolly_dsm_opcode* d_op = dolly_dsm_list_append_empty(list);
-        d_op->op = dolly_resolve_opcode(instructions[i]);
+        if (d_op == NULL) return DOLLY_DSM_OUT_OF_MEMORY;
+        d_op->op = dolly_resolve_opcode_variant(instructions[i],
+                                                list->variant);
         d_op->label = NULL;
         d_op->operand_label = NULL;
         d_op->offset = list->last_offset + i;
@@ -73,7 +94,26 @@ dolly_dsm_status dolly_dsm_list_read(dolly_dsm_list* list,
     }
     list->last_offset += i;
 
-    // Second pass: label generation
+    // Second pass: label generation, from the symbols where there are any
+    for (size_t j = 0; list->symbols && j < list->size; ++j) {
+        dolly_dsm_opcode* d_op = &list->data[j];
+        const char* name = dolly_symbols_find(list->symbols,
+                                              list->base_address
+                                              + d_op->offset);
+        if (name) {
+            d_op->label = dolly_strdup(name);
+            if (d_op->label == NULL) return DOLLY_DSM_OUT_OF_MEMORY;
+        }
+
+        switch (d_op->op.a_mode) {
+        case ABSOLUTE: case ABSOLUTE_X: case ABSOLUTE_Y: case INDIRECT:
+            d_op->operand_label = dolly_dsm_operand_symbol(list,
+                                                           d_op->operand);
+            break;
+        default: break;
+        }
+    }
+
     for (size_t j = 0; j < list->size; ++j) {
         if (list->data[j].op.a_mode != RELATIVE) continue;
 
@@ -83,7 +123,9 @@ dolly_dsm_status dolly_dsm_list_read(dolly_dsm_list* list,
             if (list->data[k].offset != offs_to_find) continue;
 
             if (list->data[k].label == NULL) {
-                list->data[k].label = malloc_or_abort(24);
+                list->data[k].label = dolly_malloc(24);
+                if (list->data[k].label == NULL)
+                    return DOLLY_DSM_OUT_OF_MEMORY;
                 sprintf(list->data[k].label, "LBL_%d", list->label_num++);
             }
             list->data[j].operand_label = list->data[k].label;
@@ -108,9 +150,9 @@ void dolly_dsm_list_write(const dolly_dsm_list* list, FILE* stream,
 void dolly_dsm_list_destroy(dolly_dsm_list* list)
 {
     for (size_t i = 0; i < list->size; ++i) {
-        if (list->data[i].label) free(list->data[i].label);
+        if (list->data[i].label) dolly_free(list->data[i].label);
     }
-    free(list->data);
+    dolly_free(list->data);
 }
 
 void dolly_dsm_opcode_str(const dolly_dsm_opcode* dolly_dsm_op, FILE* stream)
@@ -127,6 +169,7 @@ void dolly_dsm_opcode_str(const dolly_dsm_opcode* dolly_dsm_op, FILE* stream)
         break;
     case ACCUMULATOR:
         fprintf(stream, "A");
+        break;
     case ZERO_PAGE:
         fprintf(stream, "$%02x", dolly_dsm_op->operand);
         break;
@@ -137,16 +180,28 @@ void dolly_dsm_opcode_str(const dolly_dsm_opcode* dolly_dsm_op, FILE* stream)
         fprintf(stream, "$%02x,y", dolly_dsm_op->operand);
         break;
     case ABSOLUTE:
-        fprintf(stream, "$%04x", dolly_dsm_op->operand);
+        if (dolly_dsm_op->operand_label)
+            fprintf(stream, "%s", dolly_dsm_op->operand_label);
+        else
+            fprintf(stream, "$%04x", dolly_dsm_op->operand);
         break;
     case INDIRECT:
-        fprintf(stream, "($%04x)", dolly_dsm_op->operand);
+        if (dolly_dsm_op->operand_label)
+            fprintf(stream, "(%s)", dolly_dsm_op->operand_label);
+        else
+            fprintf(stream, "($%04x)", dolly_dsm_op->operand);
         break;
     case ABSOLUTE_X:
-        fprintf(stream, "$%04x,x", dolly_dsm_op->operand);
+        if (dolly_dsm_op->operand_label)
+            fprintf(stream, "%s,x", dolly_dsm_op->operand_label);
+        else
+            fprintf(stream, "$%04x,x", dolly_dsm_op->operand);
         break;
     case ABSOLUTE_Y:
-        fprintf(stream, "$%04x,y", dolly_dsm_op->operand);
+        if (dolly_dsm_op->operand_label)
+            fprintf(stream, "%s,y", dolly_dsm_op->operand_label);
+        else
+            fprintf(stream, "$%04x,y", dolly_dsm_op->operand);
         break;
     case INDIRECT_X:
         fprintf(stream, "($%02x,x)", dolly_dsm_op->operand);
@@ -154,5 +209,53 @@ void dolly_dsm_opcode_str(const dolly_dsm_opcode* dolly_dsm_op, FILE* stream)
     case INDIRECT_Y:
         fprintf(stream, "($%02x),y", dolly_dsm_op->operand);
         break;
+    case ZERO_PAGE_INDIRECT:
+        fprintf(stream, "($%02x)", dolly_dsm_op->operand);
+        break;
+    }
+}
+
+dolly_dsm_status dolly_dsm_write_executable(const dolly_executable* exec,
+                                            FILE* stream)
+{
+    dolly_symbols symbols;
+    dolly_symbols_open(&symbols, exec);
+    if (symbols.out_of_memory) return DOLLY_DSM_OUT_OF_MEMORY;
+
+    dolly_dsm_status status = DOLLY_DSM_OKAY;
+    for (size_t i = 0; i < exec->header.section_count; ++i) {
+        const dolly_executable_section* section = &exec->sections[i];
+        // TODO: Implement disassembly of data sections
+        if (section->type != DOLLY_SECTION_TEXT) continue;
+        dolly_dsm_list dsm
+            = dolly_dsm_list_new(dolly_executable_variant(exec));
+        dsm.symbols = &symbols;
+        dsm.base_address = section->load_address;
+        const uint8_t* data = exec->program_data + section->offset;
+        uint8_t* decompressed = NULL;
+        if (section->flags & DOLLY_SECTION_FLAG_COMPRESSED) {
+            decompressed = dolly_malloc(section->size);
+            if (decompressed == NULL) {
+                dolly_dsm_list_destroy(&dsm);
+                status = DOLLY_DSM_OUT_OF_MEMORY;
+                break;
+            }
+            dolly_executable_load_section(exec, section, decompressed);
+            data = decompressed;
+        }
+        status = dolly_dsm_list_read(&dsm, data, section->size);
+        if (decompressed) dolly_free(decompressed);
+        if (status != DOLLY_DSM_OKAY) {
+            dolly_dsm_list_destroy(&dsm);
+            break;
+        }
+        fprintf(stream, "== Section: %s, Name: %s, Load address: 0x%x, "
+                        "Offset: 0x%x ==\n",
+                dolly_exec_sect_type_str(section->type), section->name,
+                section->load_address, section->offset);
+        dolly_dsm_list_write(&dsm, stream, section->offset);
+        dolly_dsm_list_destroy(&dsm);
     }
+    dolly_symbols_close(&symbols);
+    return status;
 }
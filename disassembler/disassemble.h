@@ -5,6 +5,7 @@
 
 #include "virtual-machine/cpu.h"
 #include "core/core.h"
+#include "core/symbols.h"
 
 struct dolly_dsm_opcode
 {
@@ -24,20 +25,28 @@ struct dolly_dsm_list
     size_t capacity;
     uint16_t last_offset;
     int label_num;
+    dolly_6502_variant variant;
+    // Optional, for naming labels and operands. The symbols must outlive
+    // the list, and base_address is the 24-bit address of the first byte
+    // read.
+    const dolly_symbols* symbols;
+    uint32_t base_address;
 };
 
 typedef struct dolly_dsm_list dolly_dsm_list;
 
 enum dolly_dsm_status
 {
-    DOLLY_DSM_OKAY, DOLLY_DSM_INVALID_OPCODE
+    DOLLY_DSM_OKAY, DOLLY_DSM_INVALID_OPCODE, DOLLY_DSM_OUT_OF_MEMORY
 };
 
 typedef enum dolly_dsm_status dolly_dsm_status;
 
 const char* dolly_dsm_error_msg(dolly_dsm_status status);
 
-dolly_dsm_list    dolly_dsm_list_new(void);
+// Lists are made and grown with dolly_malloc. Appending returns NULL, and
+// reading DOLLY_DSM_OUT_OF_MEMORY, when that fails.
+dolly_dsm_list    dolly_dsm_list_new(dolly_6502_variant variant);
 dolly_dsm_opcode* dolly_dsm_list_append_empty(dolly_dsm_list* list);
 dolly_dsm_status  dolly_dsm_list_read(dolly_dsm_list* list,
                                       const uint8_t* instructions,
@@ -48,3 +57,8 @@ void dolly_dsm_list_write(const dolly_dsm_list* list, FILE* stream,
 void dolly_dsm_list_destroy(dolly_dsm_list* list);
 
 void dolly_dsm_opcode_str(const dolly_dsm_opcode* dsm_op, FILE* stream);
+
+// Writes a listing of every text section, named from the executable's
+// symbols if it has any
+dolly_dsm_status dolly_dsm_write_executable(const dolly_executable* exec,
+                                            FILE* stream);
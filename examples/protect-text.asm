@@ -0,0 +1,49 @@
+; dolly-6502 --protect-text example
+;
+; The counter is stored to, and lies on the same page as the code before it.
+; Only pages holding nothing but text are made read-only, so this prints its
+; message with or without --protect-text.
+
+PRINT_ADDR = $0500
+PRINT_ADDR_HI = $05
+PRINT_ADDR_LO = $00
+
+.text "_start"
+.org $8000
+
+main:
+    lda #$03
+    sta counter
+_count_loop:
+    dec counter
+    bne _count_loop
+
+    ldx #$ff
+_copy_loop:
+    inx
+    lda message,x
+    sta PRINT_ADDR,x
+    bne _copy_loop
+
+    lda #PRINT_ADDR_HI
+    sta $FF
+    lda #PRINT_ADDR_LO
+    sta $FE
+    lda #$01
+    brk
+    lda #$00
+    brk
+
+.data "counter"
+counter: .byte $00
+
+.data "strings"
+message: .string "stored to data beside text\n"
+
+.text "__interrupt"
+.org $FF7F
+interrupt: rti
+
+.data "__interrupt_vector"
+.org $FFFE
+.word $FF7F
@@ -0,0 +1,307 @@
+#include "libdolly/dolly.h"
+
+#include "assembler/parse.h"
+#include "core/core.h"
+#include "disassembler/disassemble.h"
+#include "virtual-machine/image.h"
+#include "virtual-machine/vm.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct dolly_context
+{
+    dolly_allocator allocator;
+    const dolly_allocator* use; // NULL for the C library
+    const char* error;
+    char message[64]; // For errors which have to be put together
+};
+
+struct dolly_program
+{
+    dolly_executable exec;
+    dolly_image image; // Shared by every machine running the program
+};
+
+struct dolly_machine
+{
+    dolly_vm vm;
+};
+
+// Every entry point allocates from the context's allocator, restoring the
+// caller's on the way out, so calls can be nested in another allocator's
+static const dolly_allocator* dolly_enter(dolly_context* ctx);
+static dolly_status dolly_leave(dolly_context* ctx,
+                                const dolly_allocator* previous,
+                                dolly_status status, const char* error);
+static void dolly_program_init(dolly_program* program);
+static dolly_status dolly_exec_status(dolly_executable_status status);
+
+static const dolly_allocator* dolly_enter(dolly_context* ctx)
+{
+    return dolly_use_allocator(ctx->use);
+}
+
+static dolly_status dolly_leave(dolly_context* ctx,
+                                const dolly_allocator* previous,
+                                dolly_status status, const char* error)
+{
+    if (status != DOLLY_OKAY) ctx->error = error;
+    dolly_use_allocator(previous);
+    return status;
+}
+
+// Images are made once the executable is complete. Without one, machines
+// each copy the program in instead.
+static void dolly_program_init(dolly_program* program)
+{
+    if (dolly_image_init(&program->image, &program->exec) != DOLLY_IMAGE_OKAY)
+        program->image.fd = -1;
+}
+
+static dolly_status dolly_exec_status(dolly_executable_status status)
+{
+    switch (status) {
+    case DOLLY_EXEC_OKAY: return DOLLY_OKAY;
+    case DOLLY_EXEC_IO_ERROR: return DOLLY_IO_ERROR;
+    case DOLLY_EXEC_OUT_OF_MEMORY: return DOLLY_OUT_OF_MEMORY;
+    default: return DOLLY_INVALID_PROGRAM;
+    }
+}
+
+int dolly_api_version(void)
+{
+    return DOLLY_API_VERSION;
+}
+
+dolly_context* dolly_context_new(dolly_realloc_fn allocate, void* user)
+{
+    dolly_context* ctx = allocate ? allocate(user, NULL, sizeof(dolly_context))
+                                  : malloc(sizeof(dolly_context));
+    if (ctx == NULL) return NULL;
+
+    ctx->allocator = (dolly_allocator) { .realloc = allocate, .context = user };
+    ctx->use = allocate ? &ctx->allocator : NULL;
+    ctx->error = "";
+    return ctx;
+}
+
+void dolly_context_free(dolly_context* ctx)
+{
+    if (ctx->use) ctx->allocator.realloc(ctx->allocator.context, ctx, 0);
+    else free(ctx);
+}
+
+const char* dolly_context_error(const dolly_context* ctx)
+{
+    return ctx->error;
+}
+
+dolly_status dolly_assemble(dolly_context* ctx, const char* name,
+                            const char* source, size_t size,
+                            FILE* diagnostics, dolly_program** program)
+{
+    const dolly_allocator* previous = dolly_enter(ctx);
+
+    dolly_asm_context asm_ctx = dolly_asm_context_new(name);
+    asm_ctx.diagnostics = diagnostics;
+    dolly_asm_token_list tokens = dolly_asm_token_list_new();
+    dolly_asm_syntax_tree syntax_tree = dolly_asm_syntax_tree_new();
+
+    bool success = dolly_asm_lex(&asm_ctx, source, size, &tokens);
+    if (success)
+        success = dolly_asm_make_syntax_tree(&asm_ctx, &tokens, &syntax_tree);
+    if (success) success = dolly_asm_verify_semantics(&asm_ctx, &syntax_tree);
+    dolly_status status = tokens.out_of_memory || syntax_tree.out_of_memory
+                        ? DOLLY_OUT_OF_MEMORY
+                        : success && asm_ctx.errors == 0
+                        ? DOLLY_OKAY : DOLLY_ASSEMBLY_FAILED;
+
+    dolly_program* result = NULL;
+    if (status == DOLLY_OKAY) {
+        result = dolly_malloc(sizeof(dolly_program));
+        if (result == NULL) {
+            status = DOLLY_OUT_OF_MEMORY;
+        } else if (dolly_asm_make_executable(&syntax_tree, &result->exec)) {
+            dolly_program_init(result);
+        } else {
+            dolly_executable_destroy(&result->exec);
+            dolly_free(result);
+            result = NULL;
+            status = DOLLY_OUT_OF_MEMORY;
+        }
+    }
+
+    dolly_asm_syntax_tree_destroy(&syntax_tree);
+    dolly_asm_token_list_destroy(&tokens);
+    dolly_asm_context_destroy(&asm_ctx);
+
+    if (status != DOLLY_OKAY) {
+        return dolly_leave(ctx, previous, status,
+                           status == DOLLY_OUT_OF_MEMORY
+                           ? "out of memory" : "the source has errors");
+    }
+    *program = result;
+    return dolly_leave(ctx, previous, DOLLY_OKAY, NULL);
+}
+
+dolly_status dolly_program_read(dolly_context* ctx, const void* data,
+                                size_t size, dolly_program** program)
+{
+    const dolly_allocator* previous = dolly_enter(ctx);
+
+    dolly_program* result = dolly_malloc(sizeof(dolly_program));
+    if (result == NULL) {
+        return dolly_leave(ctx, previous, DOLLY_OUT_OF_MEMORY,
+                           "out of memory");
+    }
+    dolly_executable_init(&result->exec);
+    dolly_executable_status status
+        = dolly_executable_read(&result->exec, data, size);
+    if (status != DOLLY_EXEC_OKAY) {
+        dolly_executable_destroy(&result->exec);
+        dolly_free(result);
+        return dolly_leave(ctx, previous, dolly_exec_status(status),
+                           dolly_executable_error_msg(status));
+    }
+
+    dolly_program_init(result);
+    *program = result;
+    return dolly_leave(ctx, previous, DOLLY_OKAY, NULL);
+}
+
+dolly_status dolly_program_open(dolly_context* ctx, const char* path,
+                                dolly_program** program)
+{
+    const dolly_allocator* previous = dolly_enter(ctx);
+
+    dolly_program* result = dolly_malloc(sizeof(dolly_program));
+    if (result == NULL) {
+        return dolly_leave(ctx, previous, DOLLY_OUT_OF_MEMORY,
+                           "out of memory");
+    }
+    dolly_executable_init(&result->exec);
+    dolly_executable_status status = dolly_executable_map(&result->exec, path);
+    if (status != DOLLY_EXEC_OKAY) {
+        const char* error = status == DOLLY_EXEC_IO_ERROR
+                          ? strerror(errno)
+                          : dolly_executable_error_msg(status);
+        dolly_executable_destroy(&result->exec);
+        dolly_free(result);
+        return dolly_leave(ctx, previous, dolly_exec_status(status), error);
+    }
+
+    dolly_program_init(result);
+    *program = result;
+    return dolly_leave(ctx, previous, DOLLY_OKAY, NULL);
+}
+
+dolly_status dolly_program_write(dolly_context* ctx,
+                                 const dolly_program* program, int fd)
+{
+    const dolly_allocator* previous = dolly_enter(ctx);
+    dolly_executable_status status
+        = dolly_executable_write(&program->exec, fd);
+    if (status != DOLLY_EXEC_OKAY) {
+        return dolly_leave(ctx, previous, dolly_exec_status(status),
+                           status == DOLLY_EXEC_IO_ERROR
+                           ? strerror(errno)
+                           : dolly_executable_error_msg(status));
+    }
+    return dolly_leave(ctx, previous, DOLLY_OKAY, NULL);
+}
+
+dolly_status dolly_disassemble(dolly_context* ctx,
+                               const dolly_program* program, FILE* stream)
+{
+    const dolly_allocator* previous = dolly_enter(ctx);
+    dolly_dsm_status status
+        = dolly_dsm_write_executable(&program->exec, stream);
+    if (status != DOLLY_DSM_OKAY) {
+        return dolly_leave(ctx, previous, status == DOLLY_DSM_OUT_OF_MEMORY
+                                          ? DOLLY_OUT_OF_MEMORY
+                                          : DOLLY_INVALID_PROGRAM,
+                           dolly_dsm_error_msg(status));
+    }
+    return dolly_leave(ctx, previous, DOLLY_OKAY, NULL);
+}
+
+void dolly_program_free(dolly_context* ctx, dolly_program* program)
+{
+    const dolly_allocator* previous = dolly_enter(ctx);
+    dolly_image_destroy(&program->image);
+    dolly_executable_destroy(&program->exec);
+    dolly_free(program);
+    dolly_leave(ctx, previous, DOLLY_OKAY, NULL);
+}
+
+dolly_status dolly_machine_new(dolly_context* ctx,
+                               const dolly_program* program, FILE* input,
+                               FILE* output, dolly_machine** machine)
+{
+    const dolly_allocator* previous = dolly_enter(ctx);
+
+    dolly_machine* result = dolly_malloc(sizeof(dolly_machine));
+    if (result == NULL) {
+        return dolly_leave(ctx, previous, DOLLY_OUT_OF_MEMORY,
+                           "out of memory");
+    }
+    dolly_vm_init(&result->vm);
+    result->vm.input = input;
+    result->vm.output = output;
+    result->vm.errors = NULL; // Faults are described by the context instead
+    result->vm.silent = output == NULL;
+
+    dolly_vm_status status = dolly_vm_load_image(&result->vm, &program->image);
+    if (status != DOLLY_VM_OKAY) {
+        dolly_vm_destroy(&result->vm);
+        dolly_free(result);
+        return dolly_leave(ctx, previous, status == DOLLY_VM_OUT_OF_MEMORY
+                                          ? DOLLY_OUT_OF_MEMORY
+                                          : DOLLY_LOAD_FAILED,
+                           dolly_vm_error_msg(status));
+    }
+
+    *machine = result;
+    return dolly_leave(ctx, previous, DOLLY_OKAY, NULL);
+}
+
+dolly_status dolly_machine_run(dolly_context* ctx, dolly_machine* machine,
+                               uint64_t max_cycles)
+{
+    const dolly_allocator* previous = dolly_enter(ctx);
+
+    dolly_vm* vm = &machine->vm;
+    if (!vm->running) {
+        // Nothing to do for a guest which has exited
+    } else if (max_cycles == 0) {
+        dolly_vm_run(vm);
+    } else {
+        dolly_vm_run_until(vm, vm->cycles + max_cycles);
+    }
+
+    if (vm->faulted) {
+        dolly_vm_describe_fault(vm, ctx->message, sizeof(ctx->message));
+        return dolly_leave(ctx, previous, DOLLY_GUEST_FAULTED, ctx->message);
+    }
+    return dolly_leave(ctx, previous, DOLLY_OKAY, NULL);
+}
+
+bool dolly_machine_running(const dolly_machine* machine)
+{
+    return machine->vm.running;
+}
+
+uint64_t dolly_machine_cycles(const dolly_machine* machine)
+{
+    return machine->vm.cycles;
+}
+
+void dolly_machine_free(dolly_context* ctx, dolly_machine* machine)
+{
+    const dolly_allocator* previous = dolly_enter(ctx);
+    dolly_vm_destroy(&machine->vm);
+    dolly_free(machine);
+    dolly_leave(ctx, previous, DOLLY_OKAY, NULL);
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// libdolly: the assembler, disassembler and virtual machine, for hosts which
+// would rather call them than run the tools
+//
+// Everything is done in a context, which holds the allocator its objects come
+// from and a message for its last failure. Nothing else is shared, so threads
+// can each use their own context at the same time. A context and the objects
+// made in it must only be used by one thread at a time, and objects are only
+// passed back to the context they were made in.
+//
+// The types are opaque and the functions below are the whole interface. The
+// API version only changes when one of them does.
+
+#define DOLLY_API_VERSION 1
+
+typedef struct dolly_context dolly_context;
+typedef struct dolly_program dolly_program; // An assembled executable
+typedef struct dolly_machine dolly_machine; // A guest running a program
+
+// Behaves as the C library's realloc, except that a size of 0 only ever
+// comes with a pointer to free, and the result is then ignored
+typedef void* (*dolly_realloc_fn)(void* user, void* pointer, size_t size);
+
+enum dolly_status
+{
+    DOLLY_OKAY, DOLLY_ASSEMBLY_FAILED, DOLLY_INVALID_PROGRAM, DOLLY_IO_ERROR,
+    DOLLY_LOAD_FAILED, DOLLY_GUEST_FAULTED, DOLLY_OUT_OF_MEMORY
+};
+
+typedef enum dolly_status dolly_status;
+
+// The DOLLY_API_VERSION the library was built with
+int dolly_api_version(void);
+
+// With a NULL allocate, memory comes from the C library. Calls return
+// DOLLY_OUT_OF_MEMORY, having allocated nothing, when any allocation for the
+// program, the assembler or the disassembler fails, or one made while loading
+// a machine. Only running out while a 65816 guest writes to a page of memory
+// it hasn't touched before still ends the process, as in the tools.
+dolly_context* dolly_context_new(dolly_realloc_fn allocate, void* user);
+void dolly_context_free(dolly_context* ctx);
+// Describes the last call in the context which didn't return DOLLY_OKAY
+const char* dolly_context_error(const dolly_context* ctx);
+
+// Errors in the source are written to diagnostics, which may be NULL, with
+// name standing in for the file name
+dolly_status dolly_assemble(dolly_context* ctx, const char* name,
+                            const char* source, size_t size,
+                            FILE* diagnostics, dolly_program** program);
+// Reads an executable from memory, copying it
+dolly_status dolly_program_read(dolly_context* ctx, const void* data,
+                                size_t size, dolly_program** program);
+// Maps an executable file, so it isn't read in until something needs it
+dolly_status dolly_program_open(dolly_context* ctx, const char* path,
+                                dolly_program** program);
+dolly_status dolly_program_write(dolly_context* ctx,
+                                 const dolly_program* program, int fd);
+// Lists the program's code as dolly-dsm does. Returns DOLLY_INVALID_PROGRAM
+// if the code holds an invalid opcode.
+dolly_status dolly_disassemble(dolly_context* ctx,
+                               const dolly_program* program, FILE* stream);
+// Every machine running the program must be freed first
+void dolly_program_free(dolly_context* ctx, dolly_program* program);
+
+// Machines running one program share its memory until they write to it.
+// Reads come from input and prints go to output, and either may be NULL for
+// none.
+dolly_status dolly_machine_new(dolly_context* ctx,
+                               const dolly_program* program, FILE* input,
+                               FILE* output, dolly_machine** machine);
+// Runs until the guest exits, or for about max_cycles more cycles if that is
+// not 0. Returns DOLLY_GUEST_FAULTED if the guest faulted, on an invalid
+// instruction or a write to read-only memory, and says which in the context's
+// error rather than printing it.
+dolly_status dolly_machine_run(dolly_context* ctx, dolly_machine* machine,
+                               uint64_t max_cycles);
+bool dolly_machine_running(const dolly_machine* machine);
+uint64_t dolly_machine_cycles(const dolly_machine* machine);
+void dolly_machine_free(dolly_context* ctx, dolly_machine* machine);
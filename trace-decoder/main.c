@@ -0,0 +1,120 @@
+#include "disassembler/disassemble.h"
+
+#include "core/core.h"
+
+#include <errno.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool parse_address(const char* text, uint16_t* address)
+{
+    char* end;
+    if (text[0] == '$') ++text;
+    long value = strtol(text, &end, 16);
+    if (*text == '\0' || *end != '\0' || value < 0 || value > 0xFFFF)
+        return false;
+    *address = (uint16_t) value;
+    return true;
+}
+
+static void print_record(const dolly_trace_record* record, uint64_t index,
+                         dolly_6502_variant variant)
+{
+    dolly_dsm_opcode dsm_op = {
+        .op = dolly_resolve_opcode_variant(record->instruction[0], variant),
+        .operand = record->instruction[1]
+    };
+
+    int operand_size = dolly_get_operand_size(dsm_op.op.a_mode);
+    if (operand_size == 2) dsm_op.operand |= record->instruction[2] << 8;
+
+    // Branch operands are shown as their absolute target
+    char target[8];
+    if (dsm_op.op.a_mode == RELATIVE) {
+        sprintf(target, "$%04x", (uint16_t)(record->program_counter + 2
+                                            + (int8_t)record->instruction[1]));
+        dsm_op.operand_label = target;
+    }
+
+    printf("%-10llu 0x%04x  ", (unsigned long long)index,
+           record->program_counter);
+    for (int i = 0; i < 3; ++i) {
+        if (i <= operand_size) printf("%02x ", record->instruction[i]);
+        else printf("   ");
+    }
+    printf(" ");
+    dolly_dsm_opcode_str(&dsm_op, stdout);
+    printf("\tA=%02x X=%02x Y=%02x SP=%02x P=%02x",
+           record->reg_a, record->reg_x, record->reg_y,
+           record->stack_ptr, record->flags_byte);
+    if (record->has_store) {
+        printf("  [$%04x]=%02x", record->store_address, record->store_value);
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        printf("Usage: %s [options] <trace>\n", argv[0]);
+        puts("Options:\n"
+             "\t--from <addr>\tOnly show instructions at or above address\n"
+             "\t--to <addr>\tOnly show instructions at or below address");
+        return 1;
+    }
+
+    const char* trace_path = NULL;
+    uint16_t from = 0x0000, to = 0xFFFF;
+    for (int i = 1; i < argc; ++i) {
+        if ((strcmp(argv[i], "--from") == 0 || strcmp(argv[i], "--to") == 0)
+            && i + 1 < argc) {
+            uint16_t* bound = argv[i][2] == 'f' ? &from : &to;
+            if (!parse_address(argv[++i], bound)) {
+                printf("Invalid address '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (argv[i][0] == '-') {
+            printf("Unrecognised option '%s'\n", argv[i]);
+            return 1;
+        } else {
+            trace_path = argv[i];
+        }
+    }
+
+    if (trace_path == NULL) {
+        printf("No trace given\n");
+        return 1;
+    }
+
+    FILE* file = fopen(trace_path, "rb");
+    if (!file) {
+        printf("Failed to open file '%s': %s\n", trace_path, strerror(errno));
+        return 1;
+    }
+
+    dolly_trace_reader reader;
+    dolly_trace_status status = dolly_trace_reader_open(&reader, file);
+
+    dolly_trace_record record;
+    uint64_t index = 0;
+    while (status == DOLLY_TRACE_OKAY) {
+        status = dolly_trace_reader_next(&reader, &record);
+        if (status != DOLLY_TRACE_OKAY) break;
+        if (record.program_counter >= from && record.program_counter <= to)
+            print_record(&record, index, reader.state.variant);
+        ++index;
+    }
+
+    dolly_trace_reader_destroy(&reader);
+    fclose(file);
+
+    if (status != DOLLY_TRACE_EOF) {
+        printf("Error whilst reading trace: %s\n",
+               dolly_trace_error_msg(status));
+        return 1;
+    }
+
+    return 0;
+}
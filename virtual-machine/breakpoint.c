@@ -0,0 +1,177 @@
+#include "virtual-machine/breakpoint.h"
+
+#include "core/core.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void dolly_breakpoints_patch(dolly_breakpoints* bp, int page);
+static void dolly_breakpoints_rebuild(dolly_breakpoints* bp);
+static void dolly_breakpoints_update_flags(dolly_breakpoints* bp);
+
+// Re-applies the traps on a page freshly copied from memory
+static void dolly_breakpoints_patch(dolly_breakpoints* bp, int page)
+{
+    for (size_t i = 0; i < bp->breakpoint_count; ++i) {
+        if (bp->breakpoints[i] >> 8 == page)
+            bp->shadow[bp->breakpoints[i]] = DOLLY_CPU_TRAP_OPCODE;
+    }
+}
+
+static void dolly_breakpoints_rebuild(dolly_breakpoints* bp)
+{
+    dolly_cpu* cpu = bp->cpu;
+
+    for (size_t i = 0; i < bp->watchpoint_count; ++i) {
+        dolly_watchpoint* watchpoint = &bp->watchpoints[i];
+        watchpoint->value = cpu->memory[watchpoint->address];
+    }
+    cpu->watch_hit = false;
+
+    if (bp->breakpoint_count == 0) return;
+    memcpy(bp->shadow, cpu->memory, DOLLY_CPU_MEMORY_SIZE);
+    for (size_t i = 0; i < bp->breakpoint_count; ++i)
+        bp->shadow[bp->breakpoints[i]] = DOLLY_CPU_TRAP_OPCODE;
+    for (int page = 0; page < DOLLY_CPU_PAGE_COUNT; ++page)
+        cpu->page_flags[page] &= ~DOLLY_CPU_PAGE_STALE;
+}
+
+static void dolly_breakpoints_update_flags(dolly_breakpoints* bp)
+{
+    dolly_cpu* cpu = bp->cpu;
+    bool shadowed = bp->breakpoint_count > 0 && !bp->suspended;
+
+    for (int page = 0; page < DOLLY_CPU_PAGE_COUNT; ++page) {
+        cpu->page_flags[page] &= ~(DOLLY_CPU_PAGE_WATCHED
+                                   | DOLLY_CPU_PAGE_SHADOWED);
+        if (shadowed) cpu->page_flags[page] |= DOLLY_CPU_PAGE_SHADOWED;
+    }
+    for (size_t i = 0; i < bp->watchpoint_count && !bp->suspended; ++i) {
+        cpu->page_flags[bp->watchpoints[i].address >> 8]
+            |= DOLLY_CPU_PAGE_WATCHED;
+    }
+
+    cpu->code = shadowed ? bp->shadow : cpu->memory;
+}
+
+void dolly_breakpoints_init(dolly_breakpoints* bp, dolly_cpu* cpu)
+{
+    memset(bp, 0, sizeof(dolly_breakpoints));
+    bp->cpu = cpu;
+}
+
+void dolly_breakpoints_destroy(dolly_breakpoints* bp)
+{
+    bp->breakpoint_count = 0;
+    bp->watchpoint_count = 0;
+    dolly_breakpoints_update_flags(bp);
+    for (int page = 0; page < DOLLY_CPU_PAGE_COUNT; ++page)
+        bp->cpu->page_flags[page] &= ~DOLLY_CPU_PAGE_STALE;
+    bp->cpu->watch_hit = false;
+    if (bp->shadow) dolly_free(bp->shadow);
+}
+
+bool dolly_breakpoint_add(dolly_breakpoints* bp, uint16_t address)
+{
+    if (bp->breakpoint_count == DOLLY_BREAKPOINTS_MAX) return false;
+    for (size_t i = 0; i < bp->breakpoint_count; ++i) {
+        if (bp->breakpoints[i] == address) return false;
+    }
+
+    if (bp->shadow == NULL) bp->shadow = malloc_or_abort(DOLLY_CPU_MEMORY_SIZE);
+    if (bp->breakpoint_count++ == 0)
+        memcpy(bp->shadow, bp->cpu->memory, DOLLY_CPU_MEMORY_SIZE);
+    bp->breakpoints[bp->breakpoint_count - 1] = address;
+    bp->shadow[address] = DOLLY_CPU_TRAP_OPCODE;
+
+    dolly_breakpoints_update_flags(bp);
+    return true;
+}
+
+bool dolly_breakpoint_remove(dolly_breakpoints* bp, uint16_t address)
+{
+    for (size_t i = 0; i < bp->breakpoint_count; ++i) {
+        if (bp->breakpoints[i] != address) continue;
+
+        bp->breakpoints[i] = bp->breakpoints[--bp->breakpoint_count];
+        bp->shadow[address] = bp->cpu->memory[address];
+        dolly_breakpoints_update_flags(bp);
+        return true;
+    }
+    return false;
+}
+
+bool dolly_watchpoint_add(dolly_breakpoints* bp, uint16_t address)
+{
+    if (bp->watchpoint_count == DOLLY_WATCHPOINTS_MAX) return false;
+    for (size_t i = 0; i < bp->watchpoint_count; ++i) {
+        if (bp->watchpoints[i].address == address) return false;
+    }
+
+    bp->watchpoints[bp->watchpoint_count++] = (dolly_watchpoint) {
+        .address = address, .value = bp->cpu->memory[address]
+    };
+    dolly_breakpoints_update_flags(bp);
+    return true;
+}
+
+bool dolly_watchpoint_remove(dolly_breakpoints* bp, uint16_t address)
+{
+    for (size_t i = 0; i < bp->watchpoint_count; ++i) {
+        if (bp->watchpoints[i].address != address) continue;
+
+        bp->watchpoints[i] = bp->watchpoints[--bp->watchpoint_count];
+        dolly_breakpoints_update_flags(bp);
+        return true;
+    }
+    return false;
+}
+
+const dolly_watchpoint* dolly_breakpoints_sync(dolly_breakpoints* bp,
+                                               uint8_t* old_value)
+{
+    dolly_cpu* cpu = bp->cpu;
+
+    if (bp->breakpoint_count > 0) {
+        for (int page = 0; page < DOLLY_CPU_PAGE_COUNT; ++page) {
+            if (!(cpu->page_flags[page] & DOLLY_CPU_PAGE_STALE)) continue;
+
+            size_t offset = page * DOLLY_CPU_PAGE_SIZE;
+            memcpy(bp->shadow + offset, cpu->memory + offset,
+                   DOLLY_CPU_PAGE_SIZE);
+            dolly_breakpoints_patch(bp, page);
+            cpu->page_flags[page] &= ~DOLLY_CPU_PAGE_STALE;
+        }
+    }
+
+    if (!cpu->watch_hit) return NULL;
+    cpu->watch_hit = false;
+
+    // The CPU only remembers the last address written, so a changed value
+    // also counts in case an instruction wrote more than one byte
+    const dolly_watchpoint* hit = NULL;
+    for (size_t i = 0; i < bp->watchpoint_count; ++i) {
+        dolly_watchpoint* watchpoint = &bp->watchpoints[i];
+        uint8_t value = cpu->memory[watchpoint->address];
+        if (hit == NULL && (watchpoint->address == cpu->watch_address
+                            || watchpoint->value != value)) {
+            hit = watchpoint;
+            *old_value = watchpoint->value;
+        }
+        watchpoint->value = value;
+    }
+    return hit;
+}
+
+void dolly_breakpoints_suspend(dolly_breakpoints* bp)
+{
+    bp->suspended = true;
+    dolly_breakpoints_update_flags(bp);
+}
+
+void dolly_breakpoints_resume(dolly_breakpoints* bp)
+{
+    bp->suspended = false;
+    dolly_breakpoints_rebuild(bp);
+    dolly_breakpoints_update_flags(bp);
+}
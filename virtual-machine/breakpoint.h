@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "virtual-machine/cpu.h"
+
+#define DOLLY_BREAKPOINTS_MAX 64
+#define DOLLY_WATCHPOINTS_MAX 64
+
+// Breakpoints and watchpoints that cost nothing when there are none
+//
+// Breakpoints are patched as DOLLY_CPU_TRAP_OPCODE into a shadow copy of
+// guest memory which the CPU fetches opcodes from instead, so running into
+// one is an ordinary invalid instruction and no per-instruction check is
+// needed. Operands are still read from memory, so a breakpoint on an operand
+// byte never changes what an instruction does. Every page is flagged as
+// shadowed while there are breakpoints, and the shadow is brought up to date
+// with any page written since.
+//
+// Watchpoints flag the page they are on, so only writes to those pages take
+// the slow path in the CPU. A write there sets watch_hit, after which the
+// watchpoints on the page are checked.
+
+struct dolly_watchpoint
+{
+    uint16_t address;
+    uint8_t value; // As of the last check
+};
+
+typedef struct dolly_watchpoint dolly_watchpoint;
+
+struct dolly_breakpoints
+{
+    dolly_cpu* cpu;
+    uint8_t* shadow; // Guest memory with traps patched in, allocated on use
+
+    uint16_t breakpoints[DOLLY_BREAKPOINTS_MAX];
+    size_t breakpoint_count;
+    dolly_watchpoint watchpoints[DOLLY_WATCHPOINTS_MAX];
+    size_t watchpoint_count;
+    bool suspended;
+};
+
+typedef struct dolly_breakpoints dolly_breakpoints;
+
+void dolly_breakpoints_init(dolly_breakpoints* bp, dolly_cpu* cpu);
+// Puts the CPU back to fetching from memory and clears the page flags
+void dolly_breakpoints_destroy(dolly_breakpoints* bp);
+
+// These return false if the point already exists, or doesn't for removal, or
+// there is no room for another
+bool dolly_breakpoint_add(dolly_breakpoints* bp, uint16_t address);
+bool dolly_breakpoint_remove(dolly_breakpoints* bp, uint16_t address);
+bool dolly_watchpoint_add(dolly_breakpoints* bp, uint16_t address);
+bool dolly_watchpoint_remove(dolly_breakpoints* bp, uint16_t address);
+
+// Copies pages written since the last call into the shadow and checks the
+// watchpoints if a watched page was written. Returns the first watchpoint
+// that was written, or NULL, with its value before the write in old_value.
+const dolly_watchpoint* dolly_breakpoints_sync(dolly_breakpoints* bp,
+                                               uint8_t* old_value);
+
+// Stops trapping while memory is changed wholesale, such as by re-executing
+// from a snapshot. Resuming rebuilds the shadow and forgets watchpoint hits.
+void dolly_breakpoints_suspend(dolly_breakpoints* bp);
+void dolly_breakpoints_resume(dolly_breakpoints* bp);
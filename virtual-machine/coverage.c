@@ -0,0 +1,179 @@
+#include "virtual-machine/coverage.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct dolly_coverage_totals
+{
+    uint64_t instructions, executed;
+    uint64_t branch_outcomes, branch_outcomes_hit;
+};
+
+typedef struct dolly_coverage_totals dolly_coverage_totals;
+
+static bool   dolly_coverage_test(const uint64_t* bitmap, uint16_t address);
+static double dolly_coverage_percent(uint64_t count, uint64_t total);
+static void   dolly_coverage_write_section(
+    const dolly_coverage* coverage, const dolly_cpu* cpu,
+    const dolly_coverage_section* section, dolly_coverage_totals* totals,
+    FILE* stream);
+
+static bool dolly_coverage_test(const uint64_t* bitmap, uint16_t address)
+{
+    return (bitmap[address >> 6] >> (address & 63)) & 1;
+}
+
+static double dolly_coverage_percent(uint64_t count, uint64_t total)
+{
+    return total == 0 ? 100.0 : 100.0 * (double)count / (double)total;
+}
+
+void dolly_coverage_init(dolly_coverage* coverage, const dolly_cpu* cpu,
+                         const dolly_executable* exec)
+{
+    memset(coverage->executed, 0, sizeof(coverage->executed));
+    memset(coverage->taken, 0, sizeof(coverage->taken));
+    memset(coverage->not_taken, 0, sizeof(coverage->not_taken));
+    for (int opcode = 0; opcode < 256; ++opcode) {
+        coverage->is_branch[opcode]
+            = dolly_is_branch(dolly_cpu_decode(cpu, opcode).instr);
+    }
+
+    // Only text sections are listed, so only they are copied
+    coverage->section_count = 0;
+    for (size_t i = 0; i < exec->header.section_count; ++i)
+        coverage->section_count += exec->sections[i].type == DOLLY_SECTION_TEXT;
+    coverage->sections = malloc_or_abort(sizeof(dolly_coverage_section)
+                                         * coverage->section_count + 1);
+
+    dolly_coverage_section* copy = coverage->sections;
+    for (size_t i = 0; i < exec->header.section_count; ++i) {
+        const dolly_executable_section* section = &exec->sections[i];
+        if (section->type != DOLLY_SECTION_TEXT) continue;
+        memcpy(copy->name, section->name, sizeof(copy->name));
+        copy->load_address = section->load_address;
+        copy->size = section->size;
+        copy->data = malloc_or_abort(section->size + 1);
+        dolly_executable_load_section(exec, section, copy->data);
+        ++copy;
+    }
+}
+
+void dolly_coverage_destroy(dolly_coverage* coverage)
+{
+    for (size_t i = 0; i < coverage->section_count; ++i)
+        dolly_free(coverage->sections[i].data);
+    dolly_free(coverage->sections);
+}
+
+void dolly_vm_run_coverage(dolly_vm* vm, dolly_coverage* coverage)
+{
+    const dolly_cpu* cpu = &vm->cpu;
+    uint64_t* executed = coverage->executed;
+
+    while (vm->running) {
+        uint16_t pc = cpu->program_counter;
+        uint64_t bit = 1ULL << (pc & 63);
+        executed[pc >> 6] |= bit;
+
+        if (coverage->is_branch[cpu->memory[pc]]) {
+            dolly_instruction branch
+                = dolly_cpu_decode(cpu, cpu->memory[pc]).instr;
+            uint64_t* outcomes = dolly_cpu_should_branch(cpu, branch)
+                               ? coverage->taken : coverage->not_taken;
+            outcomes[pc >> 6] |= bit;
+        }
+
+        dolly_vm_step(vm);
+    }
+}
+
+static void dolly_coverage_write_section(
+    const dolly_coverage* coverage, const dolly_cpu* cpu,
+    const dolly_coverage_section* section, dolly_coverage_totals* totals,
+    FILE* stream)
+{
+    dolly_coverage_totals counts = { 0 };
+    uint32_t end = section->load_address + section->size;
+    if (end > DOLLY_CPU_MEMORY_SIZE) end = DOLLY_CPU_MEMORY_SIZE;
+
+    // First pass for the summary, second for the listing
+    for (int pass = 0; pass < 2; ++pass) {
+        if (pass == 1) {
+            fprintf(stream,
+                    "section %s (0x%04x-0x%04x)\n"
+                    "  instructions: %llu/%llu (%.2f%%)\n"
+                    "  branch outcomes: %llu/%llu (%.2f%%)\n",
+                    section->name, section->load_address,
+                    section->size ? end - 1 : end,
+                    (unsigned long long)counts.executed,
+                    (unsigned long long)counts.instructions,
+                    dolly_coverage_percent(counts.executed,
+                                           counts.instructions),
+                    (unsigned long long)counts.branch_outcomes_hit,
+                    (unsigned long long)counts.branch_outcomes,
+                    dolly_coverage_percent(counts.branch_outcomes_hit,
+                                           counts.branch_outcomes));
+        }
+
+        for (uint32_t address = section->load_address; address < end;) {
+            dolly_opcode op = dolly_cpu_decode(
+                cpu, section->data[address - section->load_address]);
+            bool valid = op.instr != DOLLY_INVALID_INSTRUCTION
+                      && op.a_mode != DOLLY_INVALID_ADDR_MODE;
+            bool executed = dolly_coverage_test(coverage->executed, address);
+            bool is_branch = valid && dolly_is_branch(op.instr);
+            bool taken = dolly_coverage_test(coverage->taken, address);
+            bool not_taken = dolly_coverage_test(coverage->not_taken, address);
+
+            if (pass == 0) {
+                if (valid) {
+                    ++counts.instructions;
+                    counts.executed += executed;
+                }
+                if (is_branch) {
+                    counts.branch_outcomes += 2;
+                    counts.branch_outcomes_hit += taken + not_taken;
+                }
+            } else if (valid) {
+                fprintf(stream, "  0x%04x %c %-3s", address,
+                        executed ? '+' : '-', dolly_get_instr_name(op.instr));
+                if (is_branch) {
+                    fprintf(stream, " %s %s", taken ? "taken" : "-",
+                            not_taken ? "not-taken" : "-");
+                }
+                fprintf(stream, "\n");
+            }
+
+            address += valid ? 1 + dolly_get_operand_size(op.a_mode) : 1;
+        }
+    }
+
+    totals->instructions += counts.instructions;
+    totals->executed += counts.executed;
+    totals->branch_outcomes += counts.branch_outcomes;
+    totals->branch_outcomes_hit += counts.branch_outcomes_hit;
+}
+
+void dolly_coverage_write(const dolly_coverage* coverage,
+                          const dolly_cpu* cpu, FILE* stream)
+{
+    dolly_coverage_totals totals = { 0 };
+
+    for (size_t i = 0; i < coverage->section_count; ++i) {
+        dolly_coverage_write_section(coverage, cpu, &coverage->sections[i],
+                                     &totals, stream);
+    }
+
+    fprintf(stream,
+            "total\n"
+            "  instructions: %llu/%llu (%.2f%%)\n"
+            "  branch outcomes: %llu/%llu (%.2f%%)\n",
+            (unsigned long long)totals.executed,
+            (unsigned long long)totals.instructions,
+            dolly_coverage_percent(totals.executed, totals.instructions),
+            (unsigned long long)totals.branch_outcomes_hit,
+            (unsigned long long)totals.branch_outcomes,
+            dolly_coverage_percent(totals.branch_outcomes_hit,
+                                   totals.branch_outcomes));
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "core/core.h"
+
+#include "virtual-machine/vm.h"
+
+#define DOLLY_COVERAGE_WORDS (DOLLY_CPU_MEMORY_SIZE / 64)
+
+struct dolly_coverage_section
+{
+    char name[DOLLY_EXECUTABLE_SECTION_NAME_MAX_LENGTH];
+    uint32_t load_address, size;
+    uint8_t* data; // As loaded, in case the guest overwrites it
+};
+
+typedef struct dolly_coverage_section dolly_coverage_section;
+
+// One bit per guest address. Branch outcomes are recorded at the address of
+// the branch instruction.
+struct dolly_coverage
+{
+    uint64_t executed[DOLLY_COVERAGE_WORDS];
+    uint64_t taken[DOLLY_COVERAGE_WORDS];
+    uint64_t not_taken[DOLLY_COVERAGE_WORDS];
+    bool     is_branch[256]; // Indexed by opcode byte
+
+    dolly_coverage_section* sections;
+    size_t section_count;
+};
+
+typedef struct dolly_coverage dolly_coverage;
+
+// Keeps a copy of the text sections so the executable can be freed. The CPU
+// must already be set up for the executable's variant.
+void dolly_coverage_init(dolly_coverage* coverage, const dolly_cpu* cpu,
+                         const dolly_executable* exec);
+void dolly_coverage_destroy(dolly_coverage* coverage);
+
+// Equivalent to dolly_vm_run, recording which instructions and branch
+// outcomes were reached
+void dolly_vm_run_coverage(dolly_vm* vm, dolly_coverage* coverage);
+
+// Writes a listing of every instruction in each text section, marked as
+// executed or not, with a summary of the percentages covered. Instructions
+// are decoded as the CPU decodes them.
+void dolly_coverage_write(const dolly_coverage* coverage,
+                          const dolly_cpu* cpu, FILE* stream);
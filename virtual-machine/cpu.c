@@ -6,6 +6,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <sys/mman.h>
+#include <unistd.h>
+
 static uint16_t dolly_cpu_resolve_operand_value(const dolly_cpu* cpu,
                                                 const uint8_t* operand,
                                                 dolly_addressing_mode a_mode,
@@ -16,40 +19,81 @@ static uint8_t* dolly_cpu_resolve_operand_addr(dolly_cpu* cpu,
                                                dolly_addressing_mode a_mode);
 
 static void dolly_cpu_update_flags_arithmetic(dolly_cpu* cpu, uint8_t value);
+// ADC, which is also SBC given the complement of value
+static void dolly_cpu_add_with_carry(dolly_cpu* cpu, uint8_t value);
+// Stores value through target, which may be the accumulator. Returns false if
+// the store faulted, in which case nothing was written.
+static bool dolly_cpu_store(dolly_cpu* cpu, uint8_t* target, uint8_t value);
+static bool dolly_cpu_store_trapped(dolly_cpu* cpu, uint16_t address,
+                                    uint8_t value);
+// Returns false if a write to address must not go ahead
+static bool dolly_cpu_page_trap(dolly_cpu* cpu, uint16_t address);
 
 static void    dolly_cpu_stack_push(dolly_cpu* cpu, uint8_t value);
 static uint8_t dolly_cpu_stack_pull(dolly_cpu* cpu);
-
-static bool dolly_cpu_should_branch(const dolly_cpu* cpu,
-                                    dolly_instruction branch);
+// Pulls the low byte then the high byte. The program counter is assigned in a
+// single store from this so that a profiling sample never sees half of it
+static uint16_t dolly_cpu_stack_pull_word(dolly_cpu* cpu);
 
 void dolly_cpu_init(dolly_cpu* cpu)
 {
-    cpu->memory = malloc_or_abort(DOLLY_CPU_MEMORY_SIZE);
-    memset(cpu->memory, 0, DOLLY_CPU_MEMORY_SIZE);
+    // Memory is mapped rather than allocated so that parts of it can be
+    // remapped later, such as by bank switching. An extra host page lets
+    // operand fetches at the very top of memory run past the end.
+    cpu->memory_mapping_size = DOLLY_CPU_MEMORY_SIZE + sysconf(_SC_PAGESIZE);
+    cpu->memory = mmap(NULL, cpu->memory_mapping_size,
+                       PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                       -1, 0);
+    if (cpu->memory == MAP_FAILED) {
+        perror("mmap");
+        abort();
+    }
+    cpu->code = cpu->memory;
     cpu->reg_a = 0;
     cpu->reg_x = 0;
     cpu->reg_y = 0;
     cpu->stack_ptr = 0xFF;
+    cpu->flags_byte = 0;
     cpu->program_counter = 0;
+    cpu->call_depth = 0;
+    cpu->stopped = false;
+    dolly_cpu_set_variant(cpu, DOLLY_6502_VARIANT_DEFAULT);
+    memset(cpu->page_flags, 0, sizeof(cpu->page_flags));
+    cpu->watch_hit = false;
+    cpu->watch_address = 0;
+    cpu->write_fault = false;
+    cpu->write_fault_address = 0;
+    cpu->io_write = NULL;
+    cpu->io_context = NULL;
 }
 
 void dolly_cpu_destroy(dolly_cpu* cpu)
 {
-    free(cpu->memory);
+    munmap(cpu->memory, cpu->memory_mapping_size);
+}
+
+void dolly_cpu_set_variant(dolly_cpu* cpu, dolly_6502_variant variant)
+{
+    // Decoding from the opcode bits is cheap, but not free on every step
+    cpu->variant = variant;
+    for (int opcode = 0; opcode < 256; ++opcode)
+        cpu->decoded[opcode] = dolly_resolve_opcode_variant(opcode, variant);
 }
 
 int dolly_cpu_read_next_instruction(dolly_cpu* cpu)
 {
+    // Only the opcode comes from the shadow, as a breakpoint set on an
+    // operand byte must not change what the instruction reads
     int advance_by;
     int cycles
-        = dolly_cpu_read_instruction(cpu, &cpu->memory[cpu->program_counter],
+        = dolly_cpu_read_instruction(cpu, cpu->code[cpu->program_counter],
+                                     &cpu->memory[cpu->program_counter + 1],
                                      &advance_by);
-    cpu->program_counter += advance_by;
+    if (cycles != -1) cpu->program_counter += advance_by;
     return cycles;
 }
 
-static bool dolly_cpu_should_branch(const dolly_cpu* cpu, dolly_instruction branch)
+bool dolly_cpu_should_branch(const dolly_cpu* cpu, dolly_instruction branch)
 {
     switch (branch) {
     case BPL: return cpu->flags.negative == false;
@@ -65,16 +109,43 @@ static bool dolly_cpu_should_branch(const dolly_cpu* cpu, dolly_instruction bran
     }
 }
 
-int dolly_cpu_read_instruction(dolly_cpu* cpu, const uint8_t* instruction,
-                               int* advance_by)
+bool dolly_cpu_operand_address(dolly_cpu* cpu, uint16_t* address)
+{
+    const uint8_t* instruction = &cpu->memory[cpu->program_counter];
+    dolly_opcode op = dolly_cpu_decode(cpu, *instruction);
+
+    uint8_t* target
+        = dolly_cpu_resolve_operand_addr(cpu, instruction + 1, op.a_mode);
+    if (target == NULL || target == &cpu->reg_a) return false;
+
+    *address = (uint16_t)(target - cpu->memory);
+    return true;
+}
+
+bool dolly_cpu_store_address(dolly_cpu* cpu, uint16_t* address)
+{
+    dolly_opcode op = dolly_cpu_decode(cpu, cpu->memory[cpu->program_counter]);
+    if (!dolly_writes_memory(op.instr)) return false;
+    return dolly_cpu_operand_address(cpu, address);
+}
+
+int dolly_cpu_read_instruction(dolly_cpu* cpu, uint8_t opcode,
+                               const uint8_t* operand, int* advance_by)
 {
-    dolly_opcode op = dolly_resolve_opcode(*instruction);
+    dolly_opcode op = dolly_cpu_decode(cpu, opcode);
     *advance_by = 1 + dolly_get_operand_size(op.a_mode);
-    bool page_crossed;
+    bool page_crossed = false; // Only the indexed modes can cross a page
     uint8_t* target_addr
-        = dolly_cpu_resolve_operand_addr(cpu, instruction + 1, op.a_mode);
+        = dolly_cpu_resolve_operand_addr(cpu, operand, op.a_mode);
+    // The decoder lets through some combinations with nothing to write to,
+    // such as STA #imm, which must fault rather than dereference NULL
+    if (target_addr == NULL
+        && (dolly_writes_memory(op.instr) || op.instr == JMP
+            || op.instr == JSR)) {
+        return -1;
+    }
     uint16_t target_value
-        = dolly_cpu_resolve_operand_value(cpu, instruction + 1, op.a_mode,
+        = dolly_cpu_resolve_operand_value(cpu, operand, op.a_mode,
                                           &page_crossed);
 
     int8_t relative_target_value = (int8_t) target_value;
@@ -89,26 +160,14 @@ int dolly_cpu_read_instruction(dolly_cpu* cpu, const uint8_t* instruction,
         dolly_cpu_update_flags_arithmetic(cpu, cpu->reg_a);
         return 2 + dolly_get_mode_cycles(op.a_mode, page_crossed);
     case STA:
-        *target_addr = cpu->reg_a;
+        if (!dolly_cpu_store(cpu, target_addr, cpu->reg_a)) return -1;
         return 2 + dolly_get_mode_cycles(op.a_mode, true);
-    case ADC: {
-        int result = (int)cpu->reg_a + target_value + cpu->flags.carry;
-        cpu->flags.carry = result > 0xFF;
-        cpu->flags.overflow
-            = (cpu->reg_a ^ result) & (target_value ^ result) & 0x80;
-        cpu->reg_a = result;
-        dolly_cpu_update_flags_arithmetic(cpu, cpu->reg_a);
+    case ADC:
+        dolly_cpu_add_with_carry(cpu, target_value);
         return 2 + dolly_get_mode_cycles(op.a_mode, page_crossed);
-    }
-    case SBC: {
-        int result = (int)cpu->reg_a + (~target_value) + cpu->flags.carry;
-        cpu->flags.carry = result < 0 ? 0 : 1;
-        cpu->flags.overflow
-            = (cpu->reg_a ^ result) & (target_value ^ result) & 0x80;
-        cpu->reg_a = result;
-        dolly_cpu_update_flags_arithmetic(cpu, cpu->reg_a);
+    case SBC:
+        dolly_cpu_add_with_carry(cpu, ~target_value);
         return 2 + dolly_get_mode_cycles(op.a_mode, page_crossed);
-    }
     case ORA:
         cpu->reg_a |= target_value;
         dolly_cpu_update_flags_arithmetic(cpu, cpu->reg_a);
@@ -126,64 +185,74 @@ int dolly_cpu_read_instruction(dolly_cpu* cpu, const uint8_t* instruction,
         dolly_cpu_update_flags_arithmetic(cpu, cpu->reg_a - target_value);
         return 2 + dolly_get_mode_cycles(op.a_mode, page_crossed);
     /* FAMILY 2 */
-    case ASL:
-        cpu->flags.carry = *target_addr & 0x80;
-        *target_addr <<= 1;
-        dolly_cpu_update_flags_arithmetic(cpu, *target_addr);
+    case ASL: {
+        uint8_t result = *target_addr << 1;
+        if (!dolly_cpu_store(cpu, target_addr, result)) return -1;
+        cpu->flags.carry = target_value & 0x80;
+        dolly_cpu_update_flags_arithmetic(cpu, result);
         return (op.a_mode == ACCUMULATOR ? 2 : 4)
                + dolly_get_mode_cycles(op.a_mode, true);
+    }
     case ROL: {
-        const int old_carry = cpu->flags.carry;
-        cpu->flags.carry = *target_addr & 0x80;
-        *target_addr <<= 1;
-        *target_addr |= old_carry ? 1 : 0;
-        dolly_cpu_update_flags_arithmetic(cpu, *target_addr);
+        uint8_t result = (*target_addr << 1) | (cpu->flags.carry ? 1 : 0);
+        if (!dolly_cpu_store(cpu, target_addr, result)) return -1;
+        cpu->flags.carry = target_value & 0x80;
+        dolly_cpu_update_flags_arithmetic(cpu, result);
         return (op.a_mode == ACCUMULATOR ? 2 : 4)
                + dolly_get_mode_cycles(op.a_mode, true);
     }
     case LSR: {
-        cpu->flags.carry = *target_addr & 0x01;
-        *target_addr >>= 1;
-        dolly_cpu_update_flags_arithmetic(cpu, *target_addr);
+        uint8_t result = *target_addr >> 1;
+        if (!dolly_cpu_store(cpu, target_addr, result)) return -1;
+        cpu->flags.carry = target_value & 0x01;
+        dolly_cpu_update_flags_arithmetic(cpu, result);
         return (op.a_mode == ACCUMULATOR ? 2 : 4)
                + dolly_get_mode_cycles(op.a_mode, true);
     }
     case ROR: {
-        const int old_carry = cpu->flags.carry;
-        cpu->flags.carry = *target_addr & 0x01;
-        *target_addr >>= 1;
-        *target_addr |= old_carry ? 0x80 : 0;
-        dolly_cpu_update_flags_arithmetic(cpu, *target_addr);
+        uint8_t result = (*target_addr >> 1) | (cpu->flags.carry ? 0x80 : 0);
+        if (!dolly_cpu_store(cpu, target_addr, result)) return -1;
+        cpu->flags.carry = target_value & 0x01;
+        dolly_cpu_update_flags_arithmetic(cpu, result);
         return (op.a_mode == ACCUMULATOR ? 2 : 4)
                + dolly_get_mode_cycles(op.a_mode, true);
     }
     case STX:
-        *target_addr = cpu->reg_x;
+        if (!dolly_cpu_store(cpu, target_addr, cpu->reg_x)) return -1;
         return 2 + dolly_get_mode_cycles(op.a_mode, true);
     case LDX:
         cpu->reg_x = target_value;
         dolly_cpu_update_flags_arithmetic(cpu, cpu->reg_x);
         return 2 + dolly_get_mode_cycles(op.a_mode, page_crossed);
-    case DEC:
-        --*target_addr;
-        dolly_cpu_update_flags_arithmetic(cpu, *target_addr);
-        return 4 + dolly_get_mode_cycles(op.a_mode, true);
-    case INC:
-        ++*target_addr;
-        dolly_cpu_update_flags_arithmetic(cpu, *target_addr);
-        return 4 + dolly_get_mode_cycles(op.a_mode, true);
+    case DEC: {
+        uint8_t result = *target_addr - 1;
+        if (!dolly_cpu_store(cpu, target_addr, result)) return -1;
+        dolly_cpu_update_flags_arithmetic(cpu, result);
+        return (op.a_mode == ACCUMULATOR ? 2 : 4)
+               + dolly_get_mode_cycles(op.a_mode, true);
+    }
+    case INC: {
+        uint8_t result = *target_addr + 1;
+        if (!dolly_cpu_store(cpu, target_addr, result)) return -1;
+        dolly_cpu_update_flags_arithmetic(cpu, result);
+        return (op.a_mode == ACCUMULATOR ? 2 : 4)
+               + dolly_get_mode_cycles(op.a_mode, true);
+    }
     /* FAMILY 3 */
     case BIT:
         cpu->flags.zero = (cpu->reg_a & target_value) == 0;
-        cpu->flags.overflow = target_value & 0x40;
-        cpu->flags.negative = target_value & 0x80;
+        // BIT #imm has no memory operand to take N and V from
+        if (op.a_mode != IMMEDIATE) {
+            cpu->flags.overflow = target_value & 0x40;
+            cpu->flags.negative = target_value & 0x80;
+        }
         return 2 + dolly_get_mode_cycles(op.a_mode, page_crossed);
     case JMP:
         *advance_by = 0;
         cpu->program_counter = target_addr - cpu->memory;
         return op.a_mode == ABSOLUTE ? 3 : 5;
     case STY:
-        *target_addr = cpu->reg_y;
+        if (!dolly_cpu_store(cpu, target_addr, cpu->reg_y)) return -1;
         return 2 + dolly_get_mode_cycles(op.a_mode, true);
     case LDY:
         cpu->reg_y = target_value;
@@ -216,15 +285,14 @@ int dolly_cpu_read_instruction(dolly_cpu* cpu, const uint8_t* instruction,
         dolly_cpu_stack_push(cpu, cpu->program_counter >> 8);
         dolly_cpu_stack_push(cpu, cpu->program_counter & 0x00FF);
         dolly_cpu_stack_push(cpu, cpu->flags_byte);
-        cpu->program_counter = cpu->memory[0xFFFE];
-        cpu->program_counter |= ((uint16_t)cpu->memory[0xFFFF] << 8);
+        cpu->program_counter = cpu->memory[0xFFFE]
+                             | ((uint16_t)cpu->memory[0xFFFF] << 8);
         cpu->flags.break_flag = true;
         *advance_by = 0;
         return 7;
     case RTI:
         cpu->flags_byte = dolly_cpu_stack_pull(cpu);
-        cpu->program_counter = dolly_cpu_stack_pull(cpu);
-        cpu->program_counter |= ((uint16_t)dolly_cpu_stack_pull(cpu)) << 8;
+        cpu->program_counter = dolly_cpu_stack_pull_word(cpu);
         *advance_by = 1;
         return 6;
     /* Subroutine-related */
@@ -235,11 +303,12 @@ int dolly_cpu_read_instruction(dolly_cpu* cpu, const uint8_t* instruction,
         dolly_cpu_stack_push(cpu, cpu->program_counter >> 8);
         dolly_cpu_stack_push(cpu, cpu->program_counter & 0x00FF);
         cpu->program_counter = target_addr - cpu->memory;
+        ++cpu->call_depth;
         *advance_by = 0;
         return 6;
     case RTS:
-        cpu->program_counter = dolly_cpu_stack_pull(cpu);
-        cpu->program_counter |= ((uint16_t)dolly_cpu_stack_pull(cpu)) << 8;
+        cpu->program_counter = dolly_cpu_stack_pull_word(cpu);
+        if (cpu->call_depth > 0) --cpu->call_depth;
         *advance_by = 1;
         return 6;
     /* Stack */
@@ -256,6 +325,117 @@ int dolly_cpu_read_instruction(dolly_cpu* cpu, const uint8_t* instruction,
         cpu->reg_a = dolly_cpu_stack_pull(cpu);
         dolly_cpu_update_flags_arithmetic(cpu, cpu->reg_a);
         return 3;
+    case PHX:
+        dolly_cpu_stack_push(cpu, cpu->reg_x);
+        return 3;
+    case PLX:
+        cpu->reg_x = dolly_cpu_stack_pull(cpu);
+        dolly_cpu_update_flags_arithmetic(cpu, cpu->reg_x);
+        return 4;
+    case PHY:
+        dolly_cpu_stack_push(cpu, cpu->reg_y);
+        return 3;
+    case PLY:
+        cpu->reg_y = dolly_cpu_stack_pull(cpu);
+        dolly_cpu_update_flags_arithmetic(cpu, cpu->reg_y);
+        return 4;
+    /* 65C02 memory */
+    case STZ:
+        if (!dolly_cpu_store(cpu, target_addr, 0)) return -1;
+        return 2 + dolly_get_mode_cycles(op.a_mode, true);
+    case TSB:
+    case TRB: {
+        uint8_t result = op.instr == TSB ? target_value | cpu->reg_a
+                                         : target_value & ~cpu->reg_a;
+        if (!dolly_cpu_store(cpu, target_addr, result)) return -1;
+        cpu->flags.zero = (cpu->reg_a & target_value) == 0;
+        return 4 + dolly_get_mode_cycles(op.a_mode, true);
+    }
+    /* Undocumented NMOS, read-modify-write then an accumulator operation */
+    case SLO: {
+        uint8_t result = *target_addr << 1;
+        if (!dolly_cpu_store(cpu, target_addr, result)) return -1;
+        cpu->flags.carry = target_value & 0x80;
+        cpu->reg_a |= result;
+        dolly_cpu_update_flags_arithmetic(cpu, cpu->reg_a);
+        return 4 + dolly_get_mode_cycles(op.a_mode, true);
+    }
+    case RLA: {
+        uint8_t result = (*target_addr << 1) | (cpu->flags.carry ? 1 : 0);
+        if (!dolly_cpu_store(cpu, target_addr, result)) return -1;
+        cpu->flags.carry = target_value & 0x80;
+        cpu->reg_a &= result;
+        dolly_cpu_update_flags_arithmetic(cpu, cpu->reg_a);
+        return 4 + dolly_get_mode_cycles(op.a_mode, true);
+    }
+    case SRE: {
+        uint8_t result = *target_addr >> 1;
+        if (!dolly_cpu_store(cpu, target_addr, result)) return -1;
+        cpu->flags.carry = target_value & 0x01;
+        cpu->reg_a ^= result;
+        dolly_cpu_update_flags_arithmetic(cpu, cpu->reg_a);
+        return 4 + dolly_get_mode_cycles(op.a_mode, true);
+    }
+    case RRA: {
+        uint8_t result = (*target_addr >> 1) | (cpu->flags.carry ? 0x80 : 0);
+        if (!dolly_cpu_store(cpu, target_addr, result)) return -1;
+        cpu->flags.carry = target_value & 0x01;
+        dolly_cpu_add_with_carry(cpu, result);
+        return 4 + dolly_get_mode_cycles(op.a_mode, true);
+    }
+    case DCP: {
+        uint8_t result = *target_addr - 1;
+        if (!dolly_cpu_store(cpu, target_addr, result)) return -1;
+        cpu->flags.carry = cpu->reg_a >= result;
+        dolly_cpu_update_flags_arithmetic(cpu, cpu->reg_a - result);
+        return 4 + dolly_get_mode_cycles(op.a_mode, true);
+    }
+    case ISC: {
+        uint8_t result = *target_addr + 1;
+        if (!dolly_cpu_store(cpu, target_addr, result)) return -1;
+        dolly_cpu_add_with_carry(cpu, ~result);
+        return 4 + dolly_get_mode_cycles(op.a_mode, true);
+    }
+    case SAX:
+        if (!dolly_cpu_store(cpu, target_addr, cpu->reg_a & cpu->reg_x))
+            return -1;
+        return 2 + dolly_get_mode_cycles(op.a_mode, true);
+    case LAX:
+        cpu->reg_a = cpu->reg_x = target_value;
+        dolly_cpu_update_flags_arithmetic(cpu, cpu->reg_a);
+        return 2 + dolly_get_mode_cycles(op.a_mode, page_crossed);
+    /* Undocumented NMOS, immediate */
+    case ANC:
+        cpu->reg_a &= target_value;
+        dolly_cpu_update_flags_arithmetic(cpu, cpu->reg_a);
+        cpu->flags.carry = cpu->flags.negative;
+        return 2;
+    case ALR:
+        cpu->reg_a &= target_value;
+        cpu->flags.carry = cpu->reg_a & 0x01;
+        cpu->reg_a >>= 1;
+        dolly_cpu_update_flags_arithmetic(cpu, cpu->reg_a);
+        return 2;
+    case ARR:
+        cpu->reg_a &= target_value;
+        cpu->reg_a = (cpu->reg_a >> 1) | (cpu->flags.carry ? 0x80 : 0);
+        dolly_cpu_update_flags_arithmetic(cpu, cpu->reg_a);
+        cpu->flags.carry = cpu->reg_a & 0x40;
+        cpu->flags.overflow = ((cpu->reg_a >> 6) ^ (cpu->reg_a >> 5)) & 0x01;
+        return 2;
+    case SBX: {
+        uint8_t masked = cpu->reg_a & cpu->reg_x;
+        cpu->flags.carry = masked >= target_value;
+        cpu->reg_x = masked - target_value;
+        dolly_cpu_update_flags_arithmetic(cpu, cpu->reg_x);
+        return 2;
+    }
+    /* Halting */
+    case WAI:
+    case STP:
+        // Nothing can raise an interrupt to wake WAI, so both stop the VM
+        cpu->stopped = true;
+        return 3;
     /* Increment/decrement X & Y */
     case INY:
         ++(cpu->reg_y);
@@ -316,7 +496,6 @@ int dolly_cpu_read_instruction(dolly_cpu* cpu, const uint8_t* instruction,
     case NOP:
         return 2;
     default:
-        fprintf(stderr, "Unrecognised instruction 0x%02x\n", *instruction);
         return -1;
     }
 }
@@ -327,9 +506,116 @@ static void dolly_cpu_update_flags_arithmetic(dolly_cpu* cpu, uint8_t value)
     cpu->flags.negative = value & 0x80;
 }
 
+static void dolly_cpu_add_with_carry(dolly_cpu* cpu, uint8_t value)
+{
+    int result = (int)cpu->reg_a + value + cpu->flags.carry;
+    cpu->flags.carry = result > 0xFF;
+    cpu->flags.overflow = (cpu->reg_a ^ result) & (value ^ result) & 0x80;
+    cpu->reg_a = result;
+    dolly_cpu_update_flags_arithmetic(cpu, cpu->reg_a);
+}
+
+static bool dolly_cpu_store(dolly_cpu* cpu, uint8_t* target, uint8_t value)
+{
+    if (target == &cpu->reg_a) {
+        cpu->reg_a = value;
+        return true;
+    }
+
+    // Indexed addressing can run past the end of memory, so wrap the address
+    uint16_t address = (uint16_t)(target - cpu->memory);
+    uint8_t* flags = &cpu->page_flags[address >> 8];
+    // Only read-only, memory-mapped and watched pages take the slow path
+    if (*flags & DOLLY_CPU_PAGE_TRAPS)
+        return dolly_cpu_store_trapped(cpu, address, value);
+    *flags |= DOLLY_CPU_PAGE_DIRTY;
+    cpu->memory[address] = value;
+    return true;
+}
+
+static bool dolly_cpu_store_trapped(dolly_cpu* cpu, uint16_t address,
+                                    uint8_t value)
+{
+    if (!dolly_cpu_page_trap(cpu, address)) return false;
+    cpu->page_flags[address >> 8] |= DOLLY_CPU_PAGE_DIRTY;
+    cpu->memory[address] = value;
+    // Devices see the write once it has happened
+    if (cpu->page_flags[address >> 8] & DOLLY_CPU_PAGE_IO)
+        cpu->io_write(cpu->io_context, address, value);
+    return true;
+}
+
+static bool dolly_cpu_page_trap(dolly_cpu* cpu, uint16_t address)
+{
+    uint8_t* flags = &cpu->page_flags[address >> 8];
+    if (*flags & DOLLY_CPU_PAGE_READ_ONLY) {
+        cpu->write_fault = true;
+        cpu->write_fault_address = address;
+        return false;
+    }
+    if (*flags & DOLLY_CPU_PAGE_WATCHED) {
+        cpu->watch_hit = true;
+        cpu->watch_address = address;
+    }
+    if (*flags & DOLLY_CPU_PAGE_SHADOWED) *flags |= DOLLY_CPU_PAGE_STALE;
+    return true;
+}
+
+void dolly_cpu_mark_dirty(dolly_cpu* cpu, uint16_t address, size_t size)
+{
+    if (size == 0) return;
+    size_t last = address + size - 1;
+    if (last >= DOLLY_CPU_MEMORY_SIZE) last = DOLLY_CPU_MEMORY_SIZE - 1;
+    for (size_t page = address >> 8; page <= last >> 8; ++page) {
+        size_t first = page << 8;
+        if (cpu->page_flags[page] & DOLLY_CPU_PAGE_TRAPS)
+            dolly_cpu_page_trap(cpu, first > address ? first : address);
+        cpu->page_flags[page] |= DOLLY_CPU_PAGE_DIRTY;
+    }
+}
+
+bool dolly_cpu_check_writable(dolly_cpu* cpu, uint16_t address, size_t size)
+{
+    if (size == 0) return true;
+    size_t last = address + size - 1;
+    if (last >= DOLLY_CPU_MEMORY_SIZE) last = DOLLY_CPU_MEMORY_SIZE - 1;
+    for (size_t page = address >> 8; page <= last >> 8; ++page) {
+        if (cpu->page_flags[page] & DOLLY_CPU_PAGE_READ_ONLY) {
+            size_t first = page << 8;
+            cpu->write_fault = true;
+            cpu->write_fault_address = first > address ? first : address;
+            return false;
+        }
+    }
+    return true;
+}
+
+void dolly_cpu_protect(dolly_cpu* cpu, uint16_t address, size_t size)
+{
+    if (size == 0) return;
+    size_t last = address + size - 1;
+    if (last >= DOLLY_CPU_MEMORY_SIZE) last = DOLLY_CPU_MEMORY_SIZE - 1;
+    for (size_t page = address >> 8; page <= last >> 8; ++page) {
+        // A push can't be undone part way through an instruction, so the
+        // stack page stays writable
+        if (page == DOLLY_CPU_STACK_PAGE_OFFSET >> 8) continue;
+        cpu->page_flags[page] |= DOLLY_CPU_PAGE_READ_ONLY;
+    }
+}
+
+void dolly_cpu_unprotect(dolly_cpu* cpu, uint16_t address, size_t size)
+{
+    if (size == 0) return;
+    size_t last = address + size - 1;
+    if (last >= DOLLY_CPU_MEMORY_SIZE) last = DOLLY_CPU_MEMORY_SIZE - 1;
+    for (size_t page = address >> 8; page <= last >> 8; ++page)
+        cpu->page_flags[page] &= ~DOLLY_CPU_PAGE_READ_ONLY;
+}
+
 static void dolly_cpu_stack_push(dolly_cpu* cpu, uint8_t value)
 {
-    cpu->memory[DOLLY_CPU_STACK_PAGE_OFFSET + cpu->stack_ptr--] = value;
+    uint16_t address = DOLLY_CPU_STACK_PAGE_OFFSET + cpu->stack_ptr--;
+    dolly_cpu_store(cpu, &cpu->memory[address], value);
 }
 
 static uint8_t dolly_cpu_stack_pull(dolly_cpu* cpu)
@@ -337,6 +623,12 @@ static uint8_t dolly_cpu_stack_pull(dolly_cpu* cpu)
     return cpu->memory[DOLLY_CPU_STACK_PAGE_OFFSET + ++(cpu->stack_ptr)];
 }
 
+static uint16_t dolly_cpu_stack_pull_word(dolly_cpu* cpu)
+{
+    uint16_t lsb = dolly_cpu_stack_pull(cpu);
+    return lsb | ((uint16_t)dolly_cpu_stack_pull(cpu) << 8);
+}
+
 void dolly_cpu_debug(const dolly_cpu* cpu)
 {
     printf("==========\n"
@@ -404,6 +696,11 @@ static uint16_t dolly_cpu_resolve_operand_value(const dolly_cpu* cpu,
         *page_crossed = (int)lsb + cpu->reg_y > 0xFF;
         return cpu->memory[resolved_addr];
     }
+    case ZERO_PAGE_INDIRECT: {
+        uint8_t lsb = cpu->memory[operand[0]];
+        uint8_t msb = cpu->memory[(uint8_t)(operand[0] + 1)];
+        return cpu->memory[(msb << 8) + lsb];
+    }
     default: return 0;
     }
 }
@@ -449,5 +746,10 @@ static uint8_t* dolly_cpu_resolve_operand_addr(dolly_cpu* cpu,
         uint8_t msb = cpu->memory[(uint8_t)(operand[0] + 1)];
         return &cpu->memory[(msb << 8) + lsb + cpu->reg_y];
     }
+    case ZERO_PAGE_INDIRECT: {
+        uint8_t lsb = cpu->memory[operand[0]];
+        uint8_t msb = cpu->memory[(uint8_t)(operand[0] + 1)];
+        return &cpu->memory[(msb << 8) + lsb];
+    }
     }
 }
@@ -1,17 +1,53 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "core/asm6502.h"
+
 #define DOLLY_CPU_STACK_PAGE_OFFSET 0x0100
 #define DOLLY_CPU_MEMORY_SIZE       0x10000
+#define DOLLY_CPU_PAGE_SIZE         0x100
+#define DOLLY_CPU_PAGE_COUNT        (DOLLY_CPU_MEMORY_SIZE / DOLLY_CPU_PAGE_SIZE)
+
+// Patched into the shadow instruction stream at breakpoints. This is one of
+// the NMOS 6502's halting opcodes, so no program runs it on purpose.
+#define DOLLY_CPU_TRAP_OPCODE       0x02
+
+enum dolly_cpu_page_flag
+{
+    DOLLY_CPU_PAGE_DIRTY    = 1 << 0, // Written since the flag was last cleared
+    DOLLY_CPU_PAGE_WATCHED  = 1 << 1, // Writes are reported in watch_hit
+    DOLLY_CPU_PAGE_SHADOWED = 1 << 2, // Writes make the shadow code stale
+    DOLLY_CPU_PAGE_STALE    = 1 << 3, // Shadow code differs from memory
+    // Stores fault, so anything derived from the contents stays valid
+    DOLLY_CPU_PAGE_READ_ONLY = 1 << 4,
+    DOLLY_CPU_PAGE_IO = 1 << 5, // Stores are passed on to io_write
+
+    // Flags that need more than marking the page dirty on a write
+    DOLLY_CPU_PAGE_TRAPS = DOLLY_CPU_PAGE_WATCHED | DOLLY_CPU_PAGE_SHADOWED
+                         | DOLLY_CPU_PAGE_READ_ONLY | DOLLY_CPU_PAGE_IO
+};
+
+// Called after the CPU stores to a page flagged DOLLY_CPU_PAGE_IO
+typedef void (*dolly_cpu_io_write)(void* context, uint16_t address,
+                                   uint8_t value);
 
 struct dolly_cpu
 {
     uint8_t* memory;
+    size_t   memory_mapping_size;
+    // Opcodes are fetched from here, which is memory itself unless a
+    // debugger has swapped in a shadow copy with breakpoint traps
+    uint8_t* code;
     uint8_t  reg_a, reg_x, reg_y;
     uint8_t  stack_ptr;
     uint16_t program_counter;
+    uint16_t call_depth; // JSR nesting, maintained for profiling
+    bool     stopped; // Executed STP, or WAI which nothing can wake
+    dolly_6502_variant variant; // Which opcodes are decoded
+    dolly_opcode decoded[256]; // Every opcode, decoded for the variant
     union
     {
         struct
@@ -27,17 +63,61 @@ struct dolly_cpu
         } flags;
         uint8_t flags_byte;
     };
+    uint8_t page_flags[DOLLY_CPU_PAGE_COUNT]; // dolly_cpu_page_flag bits
+    bool     watch_hit; // Set on a write to a watched page
+    uint16_t watch_address; // Last address written on a watched page
+    bool     write_fault; // Set on a store to a read-only page
+    uint16_t write_fault_address;
+    dolly_cpu_io_write io_write;
+    void* io_context;
 };
 
 typedef struct dolly_cpu dolly_cpu;
 
 void dolly_cpu_init(dolly_cpu* cpu);
 void dolly_cpu_destroy(dolly_cpu* cpu);
+void dolly_cpu_set_variant(dolly_cpu* cpu, dolly_6502_variant variant);
 
-// Returns the number of cycles taken, -1 if invalid instruction
+// Returns the number of cycles taken, -1 if invalid instruction or a store to a
+// read-only page in which case the program counter is left pointing at it
 int dolly_cpu_read_next_instruction(dolly_cpu* cpu);
-int dolly_cpu_read_instruction(dolly_cpu* cpu, const uint8_t* instruction,
-                               int* advance_by);
+// Executes opcode, with its operand bytes read from operand
+int dolly_cpu_read_instruction(dolly_cpu* cpu, uint8_t opcode,
+                               const uint8_t* operand, int* advance_by);
+
+bool dolly_cpu_should_branch(const dolly_cpu* cpu, dolly_instruction branch);
+// Finds the memory address the next instruction's operand refers to, if any
+bool dolly_cpu_operand_address(dolly_cpu* cpu, uint16_t* address);
+// Finds the memory address the next instruction will store to, if any
+bool dolly_cpu_store_address(dolly_cpu* cpu, uint16_t* address);
+
+// Marks the pages covering size bytes from address as written, for writes to
+// guest memory made outside of the CPU
+void dolly_cpu_mark_dirty(dolly_cpu* cpu, uint16_t address, size_t size);
+// Whether none of the size bytes from address are on a read-only page. If
+// not, write_fault is set as though the CPU had stored there.
+bool dolly_cpu_check_writable(dolly_cpu* cpu, uint16_t address, size_t size);
+// Makes the pages covering size bytes from address read-only, other than the
+// stack page
+void dolly_cpu_protect(dolly_cpu* cpu, uint16_t address, size_t size);
+// Makes the pages covering size bytes from address writable again
+void dolly_cpu_unprotect(dolly_cpu* cpu, uint16_t address, size_t size);
 
 void dolly_cpu_debug(const dolly_cpu* cpu);
 
+static inline dolly_opcode dolly_cpu_decode(const dolly_cpu* cpu,
+                                            uint8_t opcode)
+{
+    return cpu->decoded[opcode];
+}
+
+// Whether the next instruction is a breakpoint trap in the shadow code rather
+// than a genuinely invalid instruction
+static inline bool dolly_cpu_at_trap(const dolly_cpu* cpu)
+{
+    uint16_t pc = cpu->program_counter;
+    return cpu->code != cpu->memory
+        && cpu->code[pc] == DOLLY_CPU_TRAP_OPCODE
+        && cpu->memory[pc] != DOLLY_CPU_TRAP_OPCODE;
+}
+
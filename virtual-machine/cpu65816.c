@@ -0,0 +1,962 @@
+#include "virtual-machine/cpu65816.h"
+
+#include "core/core.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum dolly_65816_instruction
+{
+    OP_ADC, OP_AND, OP_ASL, OP_BCC, OP_BCS, OP_BEQ, OP_BIT, OP_BMI, OP_BNE,
+    OP_BPL, OP_BRA, OP_BRK, OP_BRL, OP_BVC, OP_BVS, OP_CLC, OP_CLD, OP_CLI,
+    OP_CLV, OP_CMP, OP_COP, OP_CPX, OP_CPY, OP_DEC, OP_DEX, OP_DEY, OP_EOR,
+    OP_INC, OP_INX, OP_INY, OP_JML, OP_JMP, OP_JSL, OP_JSR, OP_LDA, OP_LDX,
+    OP_LDY, OP_LSR, OP_MVN, OP_MVP, OP_NOP, OP_ORA, OP_PEA, OP_PEI, OP_PER,
+    OP_PHA, OP_PHB, OP_PHD, OP_PHK, OP_PHP, OP_PHX, OP_PHY, OP_PLA, OP_PLB,
+    OP_PLD, OP_PLP, OP_PLX, OP_PLY, OP_REP, OP_ROL, OP_ROR, OP_RTI, OP_RTL,
+    OP_RTS, OP_SBC, OP_SEC, OP_SED, OP_SEI, OP_SEP, OP_STA, OP_STP, OP_STX,
+    OP_STY, OP_STZ, OP_TAX, OP_TAY, OP_TCD, OP_TCS, OP_TDC, OP_TRB, OP_TSB,
+    OP_TSC, OP_TSX, OP_TXA, OP_TXS, OP_TXY, OP_TYA, OP_TYX, OP_WAI, OP_WDM,
+    OP_XBA, OP_XCE
+};
+
+enum dolly_65816_addressing_mode
+{
+    AM_IMPLIED, AM_ACCUMULATOR,
+    AM_IMMEDIATE_M, AM_IMMEDIATE_X, AM_IMMEDIATE_8, // Sized by M, X or 8 bits
+    AM_DIRECT, AM_DIRECT_X, AM_DIRECT_Y,
+    AM_ABSOLUTE, AM_ABSOLUTE_X, AM_ABSOLUTE_Y, AM_LONG, AM_LONG_X,
+    AM_DIRECT_INDIRECT, AM_DIRECT_INDIRECT_X, AM_DIRECT_INDIRECT_Y,
+    AM_DIRECT_INDIRECT_LONG, AM_DIRECT_INDIRECT_LONG_Y,
+    AM_STACK, AM_STACK_INDIRECT_Y,
+    AM_ABSOLUTE_INDIRECT, AM_ABSOLUTE_INDIRECT_X, AM_ABSOLUTE_INDIRECT_LONG,
+    AM_RELATIVE, AM_RELATIVE_LONG, AM_BLOCK_MOVE
+};
+
+struct dolly_65816_opcode
+{
+    uint8_t instr;  // dolly_65816_instruction
+    uint8_t a_mode; // dolly_65816_addressing_mode
+    // With 8-bit registers, the direct page aligned to a page and no page
+    // crossed. The extra cycles for each are added as the instruction runs.
+    uint8_t cycles;
+};
+
+typedef struct dolly_65816_opcode dolly_65816_opcode;
+
+#define OPC(instr, a_mode, cycles) { OP_##instr, AM_##a_mode, cycles }
+
+static const dolly_65816_opcode OPCODES[256] = {
+    /* 0x00 */
+    OPC(BRK, IMMEDIATE_8, 8), OPC(ORA, DIRECT_INDIRECT_X, 6),
+    OPC(COP, IMMEDIATE_8, 8), OPC(ORA, STACK, 4),
+    OPC(TSB, DIRECT, 5), OPC(ORA, DIRECT, 3),
+    OPC(ASL, DIRECT, 5), OPC(ORA, DIRECT_INDIRECT_LONG, 6),
+    OPC(PHP, IMPLIED, 3), OPC(ORA, IMMEDIATE_M, 2),
+    OPC(ASL, ACCUMULATOR, 2), OPC(PHD, IMPLIED, 4),
+    OPC(TSB, ABSOLUTE, 6), OPC(ORA, ABSOLUTE, 4),
+    OPC(ASL, ABSOLUTE, 6), OPC(ORA, LONG, 5),
+    /* 0x10 */
+    OPC(BPL, RELATIVE, 2), OPC(ORA, DIRECT_INDIRECT_Y, 5),
+    OPC(ORA, DIRECT_INDIRECT, 5), OPC(ORA, STACK_INDIRECT_Y, 7),
+    OPC(TRB, DIRECT, 5), OPC(ORA, DIRECT_X, 4),
+    OPC(ASL, DIRECT_X, 6), OPC(ORA, DIRECT_INDIRECT_LONG_Y, 6),
+    OPC(CLC, IMPLIED, 2), OPC(ORA, ABSOLUTE_Y, 4),
+    OPC(INC, ACCUMULATOR, 2), OPC(TCS, IMPLIED, 2),
+    OPC(TRB, ABSOLUTE, 6), OPC(ORA, ABSOLUTE_X, 4),
+    OPC(ASL, ABSOLUTE_X, 7), OPC(ORA, LONG_X, 5),
+    /* 0x20 */
+    OPC(JSR, ABSOLUTE, 6), OPC(AND, DIRECT_INDIRECT_X, 6),
+    OPC(JSL, LONG, 8), OPC(AND, STACK, 4),
+    OPC(BIT, DIRECT, 3), OPC(AND, DIRECT, 3),
+    OPC(ROL, DIRECT, 5), OPC(AND, DIRECT_INDIRECT_LONG, 6),
+    OPC(PLP, IMPLIED, 4), OPC(AND, IMMEDIATE_M, 2),
+    OPC(ROL, ACCUMULATOR, 2), OPC(PLD, IMPLIED, 5),
+    OPC(BIT, ABSOLUTE, 4), OPC(AND, ABSOLUTE, 4),
+    OPC(ROL, ABSOLUTE, 6), OPC(AND, LONG, 5),
+    /* 0x30 */
+    OPC(BMI, RELATIVE, 2), OPC(AND, DIRECT_INDIRECT_Y, 5),
+    OPC(AND, DIRECT_INDIRECT, 5), OPC(AND, STACK_INDIRECT_Y, 7),
+    OPC(BIT, DIRECT_X, 4), OPC(AND, DIRECT_X, 4),
+    OPC(ROL, DIRECT_X, 6), OPC(AND, DIRECT_INDIRECT_LONG_Y, 6),
+    OPC(SEC, IMPLIED, 2), OPC(AND, ABSOLUTE_Y, 4),
+    OPC(DEC, ACCUMULATOR, 2), OPC(TSC, IMPLIED, 2),
+    OPC(BIT, ABSOLUTE_X, 4), OPC(AND, ABSOLUTE_X, 4),
+    OPC(ROL, ABSOLUTE_X, 7), OPC(AND, LONG_X, 5),
+    /* 0x40 */
+    OPC(RTI, IMPLIED, 7), OPC(EOR, DIRECT_INDIRECT_X, 6),
+    OPC(WDM, IMMEDIATE_8, 2), OPC(EOR, STACK, 4),
+    OPC(MVP, BLOCK_MOVE, 7), OPC(EOR, DIRECT, 3),
+    OPC(LSR, DIRECT, 5), OPC(EOR, DIRECT_INDIRECT_LONG, 6),
+    OPC(PHA, IMPLIED, 3), OPC(EOR, IMMEDIATE_M, 2),
+    OPC(LSR, ACCUMULATOR, 2), OPC(PHK, IMPLIED, 3),
+    OPC(JMP, ABSOLUTE, 3), OPC(EOR, ABSOLUTE, 4),
+    OPC(LSR, ABSOLUTE, 6), OPC(EOR, LONG, 5),
+    /* 0x50 */
+    OPC(BVC, RELATIVE, 2), OPC(EOR, DIRECT_INDIRECT_Y, 5),
+    OPC(EOR, DIRECT_INDIRECT, 5), OPC(EOR, STACK_INDIRECT_Y, 7),
+    OPC(MVN, BLOCK_MOVE, 7), OPC(EOR, DIRECT_X, 4),
+    OPC(LSR, DIRECT_X, 6), OPC(EOR, DIRECT_INDIRECT_LONG_Y, 6),
+    OPC(CLI, IMPLIED, 2), OPC(EOR, ABSOLUTE_Y, 4),
+    OPC(PHY, IMPLIED, 3), OPC(TCD, IMPLIED, 2),
+    OPC(JML, LONG, 4), OPC(EOR, ABSOLUTE_X, 4),
+    OPC(LSR, ABSOLUTE_X, 7), OPC(EOR, LONG_X, 5),
+    /* 0x60 */
+    OPC(RTS, IMPLIED, 6), OPC(ADC, DIRECT_INDIRECT_X, 6),
+    OPC(PER, RELATIVE_LONG, 6), OPC(ADC, STACK, 4),
+    OPC(STZ, DIRECT, 3), OPC(ADC, DIRECT, 3),
+    OPC(ROR, DIRECT, 5), OPC(ADC, DIRECT_INDIRECT_LONG, 6),
+    OPC(PLA, IMPLIED, 4), OPC(ADC, IMMEDIATE_M, 2),
+    OPC(ROR, ACCUMULATOR, 2), OPC(RTL, IMPLIED, 6),
+    OPC(JMP, ABSOLUTE_INDIRECT, 5), OPC(ADC, ABSOLUTE, 4),
+    OPC(ROR, ABSOLUTE, 6), OPC(ADC, LONG, 5),
+    /* 0x70 */
+    OPC(BVS, RELATIVE, 2), OPC(ADC, DIRECT_INDIRECT_Y, 5),
+    OPC(ADC, DIRECT_INDIRECT, 5), OPC(ADC, STACK_INDIRECT_Y, 7),
+    OPC(STZ, DIRECT_X, 4), OPC(ADC, DIRECT_X, 4),
+    OPC(ROR, DIRECT_X, 6), OPC(ADC, DIRECT_INDIRECT_LONG_Y, 6),
+    OPC(SEI, IMPLIED, 2), OPC(ADC, ABSOLUTE_Y, 4),
+    OPC(PLY, IMPLIED, 4), OPC(TDC, IMPLIED, 2),
+    OPC(JMP, ABSOLUTE_INDIRECT_X, 6), OPC(ADC, ABSOLUTE_X, 4),
+    OPC(ROR, ABSOLUTE_X, 7), OPC(ADC, LONG_X, 5),
+    /* 0x80 */
+    OPC(BRA, RELATIVE, 2), OPC(STA, DIRECT_INDIRECT_X, 6),
+    OPC(BRL, RELATIVE_LONG, 4), OPC(STA, STACK, 4),
+    OPC(STY, DIRECT, 3), OPC(STA, DIRECT, 3),
+    OPC(STX, DIRECT, 3), OPC(STA, DIRECT_INDIRECT_LONG, 6),
+    OPC(DEY, IMPLIED, 2), OPC(BIT, IMMEDIATE_M, 2),
+    OPC(TXA, IMPLIED, 2), OPC(PHB, IMPLIED, 3),
+    OPC(STY, ABSOLUTE, 4), OPC(STA, ABSOLUTE, 4),
+    OPC(STX, ABSOLUTE, 4), OPC(STA, LONG, 5),
+    /* 0x90 */
+    OPC(BCC, RELATIVE, 2), OPC(STA, DIRECT_INDIRECT_Y, 6),
+    OPC(STA, DIRECT_INDIRECT, 5), OPC(STA, STACK_INDIRECT_Y, 7),
+    OPC(STY, DIRECT_X, 4), OPC(STA, DIRECT_X, 4),
+    OPC(STX, DIRECT_Y, 4), OPC(STA, DIRECT_INDIRECT_LONG_Y, 6),
+    OPC(TYA, IMPLIED, 2), OPC(STA, ABSOLUTE_Y, 5),
+    OPC(TXS, IMPLIED, 2), OPC(TXY, IMPLIED, 2),
+    OPC(STZ, ABSOLUTE, 4), OPC(STA, ABSOLUTE_X, 5),
+    OPC(STZ, ABSOLUTE_X, 5), OPC(STA, LONG_X, 5),
+    /* 0xA0 */
+    OPC(LDY, IMMEDIATE_X, 2), OPC(LDA, DIRECT_INDIRECT_X, 6),
+    OPC(LDX, IMMEDIATE_X, 2), OPC(LDA, STACK, 4),
+    OPC(LDY, DIRECT, 3), OPC(LDA, DIRECT, 3),
+    OPC(LDX, DIRECT, 3), OPC(LDA, DIRECT_INDIRECT_LONG, 6),
+    OPC(TAY, IMPLIED, 2), OPC(LDA, IMMEDIATE_M, 2),
+    OPC(TAX, IMPLIED, 2), OPC(PLB, IMPLIED, 4),
+    OPC(LDY, ABSOLUTE, 4), OPC(LDA, ABSOLUTE, 4),
+    OPC(LDX, ABSOLUTE, 4), OPC(LDA, LONG, 5),
+    /* 0xB0 */
+    OPC(BCS, RELATIVE, 2), OPC(LDA, DIRECT_INDIRECT_Y, 5),
+    OPC(LDA, DIRECT_INDIRECT, 5), OPC(LDA, STACK_INDIRECT_Y, 7),
+    OPC(LDY, DIRECT_X, 4), OPC(LDA, DIRECT_X, 4),
+    OPC(LDX, DIRECT_Y, 4), OPC(LDA, DIRECT_INDIRECT_LONG_Y, 6),
+    OPC(CLV, IMPLIED, 2), OPC(LDA, ABSOLUTE_Y, 4),
+    OPC(TSX, IMPLIED, 2), OPC(TYX, IMPLIED, 2),
+    OPC(LDY, ABSOLUTE_X, 4), OPC(LDA, ABSOLUTE_X, 4),
+    OPC(LDX, ABSOLUTE_Y, 4), OPC(LDA, LONG_X, 5),
+    /* 0xC0 */
+    OPC(CPY, IMMEDIATE_X, 2), OPC(CMP, DIRECT_INDIRECT_X, 6),
+    OPC(REP, IMMEDIATE_8, 3), OPC(CMP, STACK, 4),
+    OPC(CPY, DIRECT, 3), OPC(CMP, DIRECT, 3),
+    OPC(DEC, DIRECT, 5), OPC(CMP, DIRECT_INDIRECT_LONG, 6),
+    OPC(INY, IMPLIED, 2), OPC(CMP, IMMEDIATE_M, 2),
+    OPC(DEX, IMPLIED, 2), OPC(WAI, IMPLIED, 3),
+    OPC(CPY, ABSOLUTE, 4), OPC(CMP, ABSOLUTE, 4),
+    OPC(DEC, ABSOLUTE, 6), OPC(CMP, LONG, 5),
+    /* 0xD0 */
+    OPC(BNE, RELATIVE, 2), OPC(CMP, DIRECT_INDIRECT_Y, 5),
+    OPC(CMP, DIRECT_INDIRECT, 5), OPC(CMP, STACK_INDIRECT_Y, 7),
+    OPC(PEI, DIRECT, 6), OPC(CMP, DIRECT_X, 4),
+    OPC(DEC, DIRECT_X, 6), OPC(CMP, DIRECT_INDIRECT_LONG_Y, 6),
+    OPC(CLD, IMPLIED, 2), OPC(CMP, ABSOLUTE_Y, 4),
+    OPC(PHX, IMPLIED, 3), OPC(STP, IMPLIED, 3),
+    OPC(JML, ABSOLUTE_INDIRECT_LONG, 6), OPC(CMP, ABSOLUTE_X, 4),
+    OPC(DEC, ABSOLUTE_X, 7), OPC(CMP, LONG_X, 5),
+    /* 0xE0 */
+    OPC(CPX, IMMEDIATE_X, 2), OPC(SBC, DIRECT_INDIRECT_X, 6),
+    OPC(SEP, IMMEDIATE_8, 3), OPC(SBC, STACK, 4),
+    OPC(CPX, DIRECT, 3), OPC(SBC, DIRECT, 3),
+    OPC(INC, DIRECT, 5), OPC(SBC, DIRECT_INDIRECT_LONG, 6),
+    OPC(INX, IMPLIED, 2), OPC(SBC, IMMEDIATE_M, 2),
+    OPC(NOP, IMPLIED, 2), OPC(XBA, IMPLIED, 3),
+    OPC(CPX, ABSOLUTE, 4), OPC(SBC, ABSOLUTE, 4),
+    OPC(INC, ABSOLUTE, 6), OPC(SBC, LONG, 5),
+    /* 0xF0 */
+    OPC(BEQ, RELATIVE, 2), OPC(SBC, DIRECT_INDIRECT_Y, 5),
+    OPC(SBC, DIRECT_INDIRECT, 5), OPC(SBC, STACK_INDIRECT_Y, 7),
+    OPC(PEA, ABSOLUTE, 5), OPC(SBC, DIRECT_X, 4),
+    OPC(INC, DIRECT_X, 6), OPC(SBC, DIRECT_INDIRECT_LONG_Y, 6),
+    OPC(SED, IMPLIED, 2), OPC(SBC, ABSOLUTE_Y, 4),
+    OPC(PLX, IMPLIED, 4), OPC(XCE, IMPLIED, 2),
+    OPC(JSR, ABSOLUTE_INDIRECT_X, 8), OPC(SBC, ABSOLUTE_X, 4),
+    OPC(INC, ABSOLUTE_X, 7), OPC(SBC, LONG_X, 5)
+};
+
+#undef OPC
+
+static uint8_t* dolly_cpu65816_page(dolly_cpu65816* cpu, uint32_t address);
+static int dolly_cpu65816_operand_size(const dolly_cpu65816* cpu,
+                                       uint8_t a_mode);
+// Resolves the 24-bit address an operand refers to. page_crossed is set if
+// indexing crossed a page or the index is 16 bits, either of which costs a
+// cycle for reads.
+static uint32_t dolly_cpu65816_resolve_address(const dolly_cpu65816* cpu,
+                                               uint8_t a_mode,
+                                               uint32_t operand,
+                                               bool* page_crossed);
+
+static uint16_t dolly_cpu65816_read_word(const dolly_cpu65816* cpu,
+                                         uint32_t address);
+// Reads or writes 8 or 16 bits depending on wide
+static uint16_t dolly_cpu65816_read_data(const dolly_cpu65816* cpu,
+                                         uint32_t address, bool wide);
+static void     dolly_cpu65816_write_data(dolly_cpu65816* cpu,
+                                          uint32_t address, uint16_t value,
+                                          bool wide);
+
+static void     dolly_cpu65816_update_flags(dolly_cpu65816* cpu,
+                                            uint16_t value, bool wide);
+// Applies the register widths from M, X and the emulation flag
+static void     dolly_cpu65816_update_widths(dolly_cpu65816* cpu);
+static uint16_t dolly_cpu65816_accumulator(const dolly_cpu65816* cpu);
+static void     dolly_cpu65816_set_accumulator(dolly_cpu65816* cpu,
+                                               uint16_t value);
+static uint16_t dolly_cpu65816_index(const dolly_cpu65816* cpu,
+                                     uint16_t value);
+static void     dolly_cpu65816_interrupt(dolly_cpu65816* cpu,
+                                         uint16_t return_address,
+                                         uint16_t vector);
+
+static void     dolly_cpu65816_push(dolly_cpu65816* cpu, uint8_t value);
+static void     dolly_cpu65816_push_word(dolly_cpu65816* cpu, uint16_t value);
+static uint8_t  dolly_cpu65816_pull(dolly_cpu65816* cpu);
+static uint16_t dolly_cpu65816_pull_word(dolly_cpu65816* cpu);
+
+void dolly_cpu65816_init(dolly_cpu65816* cpu)
+{
+    memset(cpu, 0, sizeof(dolly_cpu65816));
+    cpu->stack_ptr = 0x01FF;
+    cpu->flags.accumulator_8 = true;
+    cpu->flags.index_8 = true;
+}
+
+void dolly_cpu65816_destroy(dolly_cpu65816* cpu)
+{
+    for (size_t i = 0; i < DOLLY_CPU65816_PAGE_COUNT; ++i) {
+        if (cpu->pages[i]) dolly_free(cpu->pages[i]);
+    }
+}
+
+uint8_t dolly_cpu65816_read(const dolly_cpu65816* cpu, uint32_t address)
+{
+    address &= DOLLY_CPU65816_ADDRESS_SPACE - 1;
+    const uint8_t* page = cpu->pages[address / DOLLY_CPU65816_PAGE_SIZE];
+    return page ? page[address % DOLLY_CPU65816_PAGE_SIZE] : 0;
+}
+
+// The page holding address, allocated on first use, or NULL if it couldn't be
+static uint8_t* dolly_cpu65816_page(dolly_cpu65816* cpu, uint32_t address)
+{
+    address &= DOLLY_CPU65816_ADDRESS_SPACE - 1;
+    uint8_t** page = &cpu->pages[address / DOLLY_CPU65816_PAGE_SIZE];
+    if (*page == NULL) {
+        *page = dolly_malloc(DOLLY_CPU65816_PAGE_SIZE);
+        if (*page == NULL) return NULL;
+        memset(*page, 0, DOLLY_CPU65816_PAGE_SIZE);
+        ++cpu->page_count;
+    }
+    return *page;
+}
+
+void dolly_cpu65816_write(dolly_cpu65816* cpu, uint32_t address,
+                          uint8_t value)
+{
+    uint8_t* page = dolly_cpu65816_page(cpu, address);
+    if (page == NULL) abort_no_mem();
+    page[address % DOLLY_CPU65816_PAGE_SIZE] = value;
+}
+
+bool dolly_cpu65816_load(dolly_cpu65816* cpu, uint32_t address,
+                         const uint8_t* data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        uint8_t* page = dolly_cpu65816_page(cpu, address + i);
+        if (page == NULL) return false;
+        page[(address + i) % DOLLY_CPU65816_PAGE_SIZE] = data[i];
+    }
+    return true;
+}
+
+void dolly_cpu65816_clear(dolly_cpu65816* cpu, uint32_t address,
+                          size_t size)
+{
+    while (size > 0) {
+        address &= DOLLY_CPU65816_ADDRESS_SPACE - 1;
+        size_t in_page = address % DOLLY_CPU65816_PAGE_SIZE;
+        size_t length = DOLLY_CPU65816_PAGE_SIZE - in_page;
+        if (length > size) length = size;
+
+        uint8_t* page = cpu->pages[address / DOLLY_CPU65816_PAGE_SIZE];
+        if (page) memset(page + in_page, 0, length);
+        address += length;
+        size -= length;
+    }
+}
+
+int dolly_cpu65816_read_next_instruction(dolly_cpu65816* cpu)
+{
+    uint32_t pc_base = (uint32_t)cpu->program_bank << 16;
+    uint16_t pc = cpu->program_counter;
+    const dolly_65816_opcode* op
+        = &OPCODES[dolly_cpu65816_read(cpu, pc_base | pc)];
+
+    int size = 1 + dolly_cpu65816_operand_size(cpu, op->a_mode);
+    uint32_t operand = 0;
+    for (int i = 1; i < size; ++i) {
+        operand |= (uint32_t)dolly_cpu65816_read(cpu, pc_base
+                                                      | (uint16_t)(pc + i))
+                   << (8 * (i - 1));
+    }
+    uint16_t next_pc = pc + size;
+
+    bool page_crossed = false;
+    uint32_t address
+        = dolly_cpu65816_resolve_address(cpu, op->a_mode, operand,
+                                         &page_crossed);
+    bool wide_m = !cpu->flags.accumulator_8;
+    bool wide_x = !cpu->flags.index_8;
+    bool memory_operand = op->a_mode != AM_ACCUMULATOR;
+
+    int cycles = op->cycles;
+    switch (op->a_mode) {
+    case AM_DIRECT: case AM_DIRECT_X: case AM_DIRECT_Y:
+    case AM_DIRECT_INDIRECT: case AM_DIRECT_INDIRECT_X:
+    case AM_DIRECT_INDIRECT_Y: case AM_DIRECT_INDIRECT_LONG:
+    case AM_DIRECT_INDIRECT_LONG_Y:
+        // A direct page not aligned to a page costs an extra cycle
+        if (cpu->direct_page & 0xFF) ++cycles;
+        break;
+    default:
+        break;
+    }
+
+    cpu->program_counter = next_pc;
+
+    switch (op->instr) {
+    /* Loads and stores */
+    case OP_LDA:
+        dolly_cpu65816_set_accumulator(cpu,
+            dolly_cpu65816_read_data(cpu, address, wide_m));
+        dolly_cpu65816_update_flags(cpu, cpu->reg_a, wide_m);
+        return cycles + wide_m + page_crossed;
+    case OP_LDX:
+        cpu->reg_x = dolly_cpu65816_read_data(cpu, address, wide_x);
+        dolly_cpu65816_update_flags(cpu, cpu->reg_x, wide_x);
+        return cycles + wide_x + page_crossed;
+    case OP_LDY:
+        cpu->reg_y = dolly_cpu65816_read_data(cpu, address, wide_x);
+        dolly_cpu65816_update_flags(cpu, cpu->reg_y, wide_x);
+        return cycles + wide_x + page_crossed;
+    case OP_STA:
+        dolly_cpu65816_write_data(cpu, address, cpu->reg_a, wide_m);
+        return cycles + wide_m;
+    case OP_STX:
+        dolly_cpu65816_write_data(cpu, address, cpu->reg_x, wide_x);
+        return cycles + wide_x;
+    case OP_STY:
+        dolly_cpu65816_write_data(cpu, address, cpu->reg_y, wide_x);
+        return cycles + wide_x;
+    case OP_STZ:
+        dolly_cpu65816_write_data(cpu, address, 0, wide_m);
+        return cycles + wide_m;
+    /* Arithmetic and logic */
+    case OP_ADC:
+    case OP_SBC: {
+        uint32_t mask = wide_m ? 0xFFFF : 0xFF;
+        uint32_t sign = wide_m ? 0x8000 : 0x80;
+        uint32_t a = dolly_cpu65816_accumulator(cpu);
+        uint32_t value = dolly_cpu65816_read_data(cpu, address, wide_m);
+        // Subtraction is addition of the one's complement
+        if (op->instr == OP_SBC) value = ~value & mask;
+        uint32_t result = a + value + cpu->flags.carry;
+        cpu->flags.carry = result > mask;
+        cpu->flags.overflow = ~(a ^ value) & (a ^ result) & sign;
+        dolly_cpu65816_set_accumulator(cpu, result);
+        dolly_cpu65816_update_flags(cpu, result, wide_m);
+        return cycles + wide_m + page_crossed;
+    }
+    case OP_ORA:
+    case OP_AND:
+    case OP_EOR: {
+        uint16_t value = dolly_cpu65816_read_data(cpu, address, wide_m);
+        uint16_t a = cpu->reg_a;
+        if (op->instr == OP_ORA) a |= value;
+        else if (op->instr == OP_AND) a &= value;
+        else a ^= value;
+        dolly_cpu65816_set_accumulator(cpu, a);
+        dolly_cpu65816_update_flags(cpu, a, wide_m);
+        return cycles + wide_m + page_crossed;
+    }
+    case OP_CMP:
+    case OP_CPX:
+    case OP_CPY: {
+        bool wide = op->instr == OP_CMP ? wide_m : wide_x;
+        uint16_t reg = op->instr == OP_CMP ? dolly_cpu65816_accumulator(cpu)
+                     : op->instr == OP_CPX ? cpu->reg_x : cpu->reg_y;
+        uint16_t value = dolly_cpu65816_read_data(cpu, address, wide);
+        cpu->flags.carry = reg >= value;
+        dolly_cpu65816_update_flags(cpu, reg - value, wide);
+        return cycles + wide + page_crossed;
+    }
+    case OP_BIT: {
+        uint16_t value = dolly_cpu65816_read_data(cpu, address, wide_m);
+        uint16_t masked = value & cpu->reg_a;
+        cpu->flags.zero = (wide_m ? masked : masked & 0xFF) == 0;
+        // The immediate form only tests, as there's no memory to describe
+        if (op->a_mode != AM_IMMEDIATE_M) {
+            cpu->flags.negative = value & (wide_m ? 0x8000 : 0x80);
+            cpu->flags.overflow = value & (wide_m ? 0x4000 : 0x40);
+        }
+        return cycles + wide_m + page_crossed;
+    }
+    /* Read-modify-write */
+    case OP_ASL:
+    case OP_ROL:
+    case OP_LSR:
+    case OP_ROR:
+    case OP_INC:
+    case OP_DEC:
+    case OP_TSB:
+    case OP_TRB: {
+        uint16_t sign = wide_m ? 0x8000 : 0x80;
+        uint16_t value = memory_operand
+                       ? dolly_cpu65816_read_data(cpu, address, wide_m)
+                       : dolly_cpu65816_accumulator(cpu);
+        uint16_t result;
+        switch (op->instr) {
+        default:
+        case OP_ASL:
+            result = value << 1;
+            cpu->flags.carry = value & sign;
+            break;
+        case OP_ROL:
+            result = (value << 1) | cpu->flags.carry;
+            cpu->flags.carry = value & sign;
+            break;
+        case OP_LSR:
+            result = value >> 1;
+            cpu->flags.carry = value & 1;
+            break;
+        case OP_ROR:
+            result = (value >> 1) | (cpu->flags.carry ? sign : 0);
+            cpu->flags.carry = value & 1;
+            break;
+        case OP_INC:
+            result = value + 1;
+            break;
+        case OP_DEC:
+            result = value - 1;
+            break;
+        case OP_TSB:
+        case OP_TRB: {
+            uint16_t a = dolly_cpu65816_accumulator(cpu);
+            cpu->flags.zero = (value & a) == 0;
+            result = op->instr == OP_TSB ? value | a : value & ~a;
+            break;
+        }
+        }
+        if (op->instr != OP_TSB && op->instr != OP_TRB)
+            dolly_cpu65816_update_flags(cpu, result, wide_m);
+
+        if (!memory_operand) {
+            dolly_cpu65816_set_accumulator(cpu, result);
+            return cycles;
+        }
+        dolly_cpu65816_write_data(cpu, address, result, wide_m);
+        return cycles + 2 * wide_m;
+    }
+    /* Increment/decrement X & Y */
+    case OP_INX:
+    case OP_DEX: {
+        int step = op->instr == OP_INX ? 1 : -1;
+        cpu->reg_x = dolly_cpu65816_index(cpu, cpu->reg_x + step);
+        dolly_cpu65816_update_flags(cpu, cpu->reg_x, wide_x);
+        return cycles;
+    }
+    case OP_INY:
+    case OP_DEY: {
+        int step = op->instr == OP_INY ? 1 : -1;
+        cpu->reg_y = dolly_cpu65816_index(cpu, cpu->reg_y + step);
+        dolly_cpu65816_update_flags(cpu, cpu->reg_y, wide_x);
+        return cycles;
+    }
+    /* Branches */
+    case OP_BPL: case OP_BMI: case OP_BVC: case OP_BVS:
+    case OP_BCC: case OP_BCS: case OP_BNE: case OP_BEQ: case OP_BRA: {
+        bool taken;
+        switch (op->instr) {
+        case OP_BPL: taken = !cpu->flags.negative; break;
+        case OP_BMI: taken = cpu->flags.negative;  break;
+        case OP_BVC: taken = !cpu->flags.overflow; break;
+        case OP_BVS: taken = cpu->flags.overflow;  break;
+        case OP_BCC: taken = !cpu->flags.carry;    break;
+        case OP_BCS: taken = cpu->flags.carry;     break;
+        case OP_BNE: taken = !cpu->flags.zero;     break;
+        case OP_BEQ: taken = cpu->flags.zero;      break;
+        default:     taken = true;                 break;
+        }
+        if (taken) cpu->program_counter = next_pc + (int8_t)operand;
+        return cycles + taken;
+    }
+    case OP_BRL:
+        cpu->program_counter = next_pc + (int16_t)operand;
+        return cycles;
+    /* Jumps and subroutines */
+    case OP_JMP:
+        if (op->a_mode == AM_ABSOLUTE_INDIRECT) {
+            cpu->program_counter = dolly_cpu65816_read_word(cpu, operand);
+        } else if (op->a_mode == AM_ABSOLUTE_INDIRECT_X) {
+            cpu->program_counter = dolly_cpu65816_read_word(cpu, pc_base
+                | (uint16_t)(operand + cpu->reg_x));
+        } else {
+            cpu->program_counter = operand;
+        }
+        return cycles;
+    case OP_JML:
+        if (op->a_mode == AM_ABSOLUTE_INDIRECT_LONG) {
+            operand = dolly_cpu65816_read_word(cpu, operand)
+                    | (uint32_t)dolly_cpu65816_read(cpu, operand + 2) << 16;
+        }
+        cpu->program_bank = operand >> 16;
+        cpu->program_counter = operand;
+        return cycles;
+    case OP_JSR:
+        // As on the 6502, the address of the last byte of the JSR is pushed
+        dolly_cpu65816_push_word(cpu, next_pc - 1);
+        cpu->program_counter = op->a_mode == AM_ABSOLUTE_INDIRECT_X
+            ? dolly_cpu65816_read_word(cpu, pc_base
+                                            | (uint16_t)(operand + cpu->reg_x))
+            : operand;
+        ++cpu->call_depth;
+        return cycles;
+    case OP_JSL:
+        dolly_cpu65816_push(cpu, cpu->program_bank);
+        dolly_cpu65816_push_word(cpu, next_pc - 1);
+        cpu->program_bank = operand >> 16;
+        cpu->program_counter = operand;
+        ++cpu->call_depth;
+        return cycles;
+    case OP_RTS:
+        cpu->program_counter = dolly_cpu65816_pull_word(cpu) + 1;
+        if (cpu->call_depth > 0) --cpu->call_depth;
+        return cycles;
+    case OP_RTL:
+        cpu->program_counter = dolly_cpu65816_pull_word(cpu) + 1;
+        cpu->program_bank = dolly_cpu65816_pull(cpu);
+        if (cpu->call_depth > 0) --cpu->call_depth;
+        return cycles;
+    /* Interrupt-related */
+    case OP_BRK:
+        dolly_cpu65816_interrupt(cpu, next_pc, DOLLY_CPU65816_BRK_VECTOR);
+        cpu->break_flag = true;
+        return cycles - cpu->emulation;
+    case OP_COP:
+        dolly_cpu65816_interrupt(cpu, next_pc, DOLLY_CPU65816_COP_VECTOR);
+        return cycles - cpu->emulation;
+    case OP_RTI:
+        cpu->flags_byte = dolly_cpu65816_pull(cpu);
+        dolly_cpu65816_update_widths(cpu);
+        cpu->program_counter = dolly_cpu65816_pull_word(cpu);
+        if (!cpu->emulation) cpu->program_bank = dolly_cpu65816_pull(cpu);
+        return cycles - cpu->emulation;
+    case OP_STP:
+    case OP_WAI:
+        // Nothing raises interrupts, so a waiting CPU never wakes
+        cpu->program_counter = pc;
+        cpu->stopped = true;
+        return cycles;
+    /* Stack */
+    case OP_PHA:
+        if (wide_m) dolly_cpu65816_push_word(cpu, cpu->reg_a);
+        else dolly_cpu65816_push(cpu, cpu->reg_a);
+        return cycles + wide_m;
+    case OP_PLA:
+        dolly_cpu65816_set_accumulator(cpu, wide_m
+            ? dolly_cpu65816_pull_word(cpu) : dolly_cpu65816_pull(cpu));
+        dolly_cpu65816_update_flags(cpu, cpu->reg_a, wide_m);
+        return cycles + wide_m;
+    case OP_PHX:
+    case OP_PHY: {
+        uint16_t value = op->instr == OP_PHX ? cpu->reg_x : cpu->reg_y;
+        if (wide_x) dolly_cpu65816_push_word(cpu, value);
+        else dolly_cpu65816_push(cpu, value);
+        return cycles + wide_x;
+    }
+    case OP_PLX:
+    case OP_PLY: {
+        uint16_t value = wide_x ? dolly_cpu65816_pull_word(cpu)
+                                : dolly_cpu65816_pull(cpu);
+        if (op->instr == OP_PLX) cpu->reg_x = value;
+        else cpu->reg_y = value;
+        dolly_cpu65816_update_flags(cpu, value, wide_x);
+        return cycles + wide_x;
+    }
+    case OP_PHP:
+        dolly_cpu65816_push(cpu, cpu->flags_byte);
+        return cycles;
+    case OP_PLP:
+        cpu->flags_byte = dolly_cpu65816_pull(cpu);
+        dolly_cpu65816_update_widths(cpu);
+        return cycles;
+    case OP_PHB:
+        dolly_cpu65816_push(cpu, cpu->data_bank);
+        return cycles;
+    case OP_PLB:
+        cpu->data_bank = dolly_cpu65816_pull(cpu);
+        dolly_cpu65816_update_flags(cpu, cpu->data_bank, false);
+        return cycles;
+    case OP_PHK:
+        dolly_cpu65816_push(cpu, cpu->program_bank);
+        return cycles;
+    case OP_PHD:
+        dolly_cpu65816_push_word(cpu, cpu->direct_page);
+        return cycles;
+    case OP_PLD:
+        cpu->direct_page = dolly_cpu65816_pull_word(cpu);
+        dolly_cpu65816_update_flags(cpu, cpu->direct_page, true);
+        return cycles;
+    case OP_PEA:
+        dolly_cpu65816_push_word(cpu, operand);
+        return cycles;
+    case OP_PEI:
+        dolly_cpu65816_push_word(cpu, dolly_cpu65816_read_word(cpu, address));
+        return cycles;
+    case OP_PER:
+        dolly_cpu65816_push_word(cpu, next_pc + (int16_t)operand);
+        return cycles;
+    /* Transfers */
+    case OP_TAX:
+    case OP_TAY: {
+        uint16_t value = dolly_cpu65816_index(cpu, cpu->reg_a);
+        if (op->instr == OP_TAX) cpu->reg_x = value;
+        else cpu->reg_y = value;
+        dolly_cpu65816_update_flags(cpu, value, wide_x);
+        return cycles;
+    }
+    case OP_TXA:
+    case OP_TYA:
+        dolly_cpu65816_set_accumulator(cpu, op->instr == OP_TXA
+                                            ? cpu->reg_x : cpu->reg_y);
+        dolly_cpu65816_update_flags(cpu, cpu->reg_a, wide_m);
+        return cycles;
+    case OP_TXY:
+        cpu->reg_y = cpu->reg_x;
+        dolly_cpu65816_update_flags(cpu, cpu->reg_y, wide_x);
+        return cycles;
+    case OP_TYX:
+        cpu->reg_x = cpu->reg_y;
+        dolly_cpu65816_update_flags(cpu, cpu->reg_x, wide_x);
+        return cycles;
+    case OP_TSX:
+        cpu->reg_x = dolly_cpu65816_index(cpu, cpu->stack_ptr);
+        dolly_cpu65816_update_flags(cpu, cpu->reg_x, wide_x);
+        return cycles;
+    case OP_TXS:
+        cpu->stack_ptr = cpu->emulation ? 0x0100 | (cpu->reg_x & 0xFF)
+                                        : cpu->reg_x;
+        return cycles;
+    case OP_TCS:
+        cpu->stack_ptr = cpu->emulation ? 0x0100 | (cpu->reg_a & 0xFF)
+                                        : cpu->reg_a;
+        return cycles;
+    case OP_TSC:
+        cpu->reg_a = cpu->stack_ptr;
+        dolly_cpu65816_update_flags(cpu, cpu->reg_a, true);
+        return cycles;
+    case OP_TCD:
+        cpu->direct_page = cpu->reg_a;
+        dolly_cpu65816_update_flags(cpu, cpu->direct_page, true);
+        return cycles;
+    case OP_TDC:
+        cpu->reg_a = cpu->direct_page;
+        dolly_cpu65816_update_flags(cpu, cpu->reg_a, true);
+        return cycles;
+    case OP_XBA:
+        cpu->reg_a = (cpu->reg_a << 8) | (cpu->reg_a >> 8);
+        dolly_cpu65816_update_flags(cpu, cpu->reg_a, false);
+        return cycles;
+    /* Block moves, one byte each time the instruction runs */
+    case OP_MVN:
+    case OP_MVP: {
+        uint8_t destination_bank = operand & 0xFF;
+        uint8_t source_bank = operand >> 8;
+        dolly_cpu65816_write(cpu, (uint32_t)destination_bank << 16
+                                  | cpu->reg_y,
+                             dolly_cpu65816_read(cpu, (uint32_t)source_bank
+                                                      << 16 | cpu->reg_x));
+        int step = op->instr == OP_MVN ? 1 : -1;
+        cpu->reg_x = dolly_cpu65816_index(cpu, cpu->reg_x + step);
+        cpu->reg_y = dolly_cpu65816_index(cpu, cpu->reg_y + step);
+        cpu->data_bank = destination_bank;
+        // The count in C is one less than the number of bytes to move
+        if (cpu->reg_a-- != 0) cpu->program_counter = pc;
+        return cycles;
+    }
+    /* Status register */
+    case OP_REP:
+        cpu->flags_byte &= ~operand;
+        dolly_cpu65816_update_widths(cpu);
+        return cycles;
+    case OP_SEP:
+        cpu->flags_byte |= operand;
+        dolly_cpu65816_update_widths(cpu);
+        return cycles;
+    case OP_XCE: {
+        bool carry = cpu->flags.carry;
+        cpu->flags.carry = cpu->emulation;
+        cpu->emulation = carry;
+        dolly_cpu65816_update_widths(cpu);
+        return cycles;
+    }
+    case OP_CLC: cpu->flags.carry = false;             return cycles;
+    case OP_SEC: cpu->flags.carry = true;              return cycles;
+    case OP_CLI: cpu->flags.interrupt_disable = false; return cycles;
+    case OP_SEI: cpu->flags.interrupt_disable = true;  return cycles;
+    case OP_CLV: cpu->flags.overflow = false;          return cycles;
+    case OP_CLD: cpu->flags.decimal = false;           return cycles;
+    case OP_SED: cpu->flags.decimal = true;            return cycles;
+    case OP_NOP:
+    case OP_WDM:
+        return cycles;
+    default:
+        cpu->program_counter = pc;
+        return -1;
+    }
+}
+
+void dolly_cpu65816_debug(const dolly_cpu65816* cpu)
+{
+    printf("==========\n"
+           "A = 0x%04x | X = 0x%04x | Y = 0x%04x\n"
+           "SP = 0x%04x | D = 0x%04x | DB = 0x%02x | PC = 0x%02x:%04x\n"
+           "%c%c%c%c%c%c%c%c %s\n"
+           "Pages: %zu (%zu KB)\n"
+           "==========\n",
+           cpu->reg_a, cpu->reg_x, cpu->reg_y,
+           cpu->stack_ptr, cpu->direct_page, cpu->data_bank,
+           cpu->program_bank, cpu->program_counter,
+           cpu->flags.carry             ? 'C' : 'c',
+           cpu->flags.zero              ? 'Z' : 'z',
+           cpu->flags.interrupt_disable ? 'I' : 'i',
+           cpu->flags.decimal           ? 'D' : 'd',
+           cpu->flags.index_8           ? 'X' : 'x',
+           cpu->flags.accumulator_8     ? 'M' : 'm',
+           cpu->flags.overflow          ? 'O' : 'o',
+           cpu->flags.negative          ? 'N' : 'n',
+           cpu->emulation ? "emulation" : "native",
+           cpu->page_count,
+           cpu->page_count * DOLLY_CPU65816_PAGE_SIZE / 1024);
+}
+
+static int dolly_cpu65816_operand_size(const dolly_cpu65816* cpu,
+                                       uint8_t a_mode)
+{
+    switch (a_mode) {
+    case AM_IMPLIED:
+    case AM_ACCUMULATOR:
+        return 0;
+    case AM_IMMEDIATE_M:
+        return cpu->flags.accumulator_8 ? 1 : 2;
+    case AM_IMMEDIATE_X:
+        return cpu->flags.index_8 ? 1 : 2;
+    case AM_ABSOLUTE:
+    case AM_ABSOLUTE_X:
+    case AM_ABSOLUTE_Y:
+    case AM_ABSOLUTE_INDIRECT:
+    case AM_ABSOLUTE_INDIRECT_X:
+    case AM_ABSOLUTE_INDIRECT_LONG:
+    case AM_RELATIVE_LONG:
+    case AM_BLOCK_MOVE:
+        return 2;
+    case AM_LONG:
+    case AM_LONG_X:
+        return 3;
+    default:
+        return 1;
+    }
+}
+
+static uint32_t dolly_cpu65816_resolve_address(const dolly_cpu65816* cpu,
+                                               uint8_t a_mode,
+                                               uint32_t operand,
+                                               bool* page_crossed)
+{
+    uint32_t data_base = (uint32_t)cpu->data_bank << 16;
+    bool wide_x = !cpu->flags.index_8;
+    // Direct page and stack relative addresses are always in bank 0
+    uint16_t direct = cpu->direct_page + operand;
+
+    switch (a_mode) {
+    default:
+        return 0;
+    case AM_IMMEDIATE_M:
+    case AM_IMMEDIATE_X:
+    case AM_IMMEDIATE_8:
+        return (uint32_t)cpu->program_bank << 16
+             | (uint16_t)(cpu->program_counter + 1);
+    case AM_DIRECT:
+        return direct;
+    case AM_DIRECT_X:
+        return (uint16_t)(direct + cpu->reg_x);
+    case AM_DIRECT_Y:
+        return (uint16_t)(direct + cpu->reg_y);
+    case AM_ABSOLUTE:
+        return data_base | operand;
+    case AM_ABSOLUTE_X:
+    case AM_ABSOLUTE_Y: {
+        uint16_t index = a_mode == AM_ABSOLUTE_X ? cpu->reg_x : cpu->reg_y;
+        *page_crossed = wide_x || (operand & 0xFF) + index > 0xFF;
+        return (data_base | operand) + index;
+    }
+    case AM_LONG:
+        return operand;
+    case AM_LONG_X:
+        return operand + cpu->reg_x;
+    case AM_DIRECT_INDIRECT:
+        return data_base | dolly_cpu65816_read_word(cpu, direct);
+    case AM_DIRECT_INDIRECT_X:
+        return data_base
+             | dolly_cpu65816_read_word(cpu, (uint16_t)(direct + cpu->reg_x));
+    case AM_DIRECT_INDIRECT_Y: {
+        uint16_t pointer = dolly_cpu65816_read_word(cpu, direct);
+        *page_crossed = wide_x || (pointer & 0xFF) + cpu->reg_y > 0xFF;
+        return (data_base | pointer) + cpu->reg_y;
+    }
+    case AM_DIRECT_INDIRECT_LONG:
+    case AM_DIRECT_INDIRECT_LONG_Y: {
+        uint32_t pointer = dolly_cpu65816_read_word(cpu, direct)
+                         | (uint32_t)dolly_cpu65816_read(cpu, direct + 2)
+                           << 16;
+        return a_mode == AM_DIRECT_INDIRECT_LONG ? pointer
+                                                 : pointer + cpu->reg_y;
+    }
+    case AM_STACK:
+        return (uint16_t)(cpu->stack_ptr + operand);
+    case AM_STACK_INDIRECT_Y:
+        return (data_base
+                | dolly_cpu65816_read_word(cpu, (uint16_t)(cpu->stack_ptr
+                                                           + operand)))
+             + cpu->reg_y;
+    }
+}
+
+static uint16_t dolly_cpu65816_read_word(const dolly_cpu65816* cpu,
+                                         uint32_t address)
+{
+    return dolly_cpu65816_read(cpu, address)
+         | (uint16_t)dolly_cpu65816_read(cpu, address + 1) << 8;
+}
+
+static uint16_t dolly_cpu65816_read_data(const dolly_cpu65816* cpu,
+                                         uint32_t address, bool wide)
+{
+    return wide ? dolly_cpu65816_read_word(cpu, address)
+                : dolly_cpu65816_read(cpu, address);
+}
+
+static void dolly_cpu65816_write_data(dolly_cpu65816* cpu, uint32_t address,
+                                      uint16_t value, bool wide)
+{
+    dolly_cpu65816_write(cpu, address, value & 0xFF);
+    if (wide) dolly_cpu65816_write(cpu, address + 1, value >> 8);
+}
+
+static void dolly_cpu65816_update_flags(dolly_cpu65816* cpu, uint16_t value,
+                                        bool wide)
+{
+    if (!wide) value &= 0xFF;
+    cpu->flags.zero = value == 0;
+    cpu->flags.negative = value & (wide ? 0x8000 : 0x80);
+}
+
+static void dolly_cpu65816_update_widths(dolly_cpu65816* cpu)
+{
+    if (cpu->emulation) {
+        cpu->flags.accumulator_8 = true;
+        cpu->flags.index_8 = true;
+        cpu->stack_ptr = 0x0100 | (cpu->stack_ptr & 0xFF);
+    }
+    if (cpu->flags.index_8) {
+        cpu->reg_x &= 0xFF;
+        cpu->reg_y &= 0xFF;
+    }
+}
+
+static uint16_t dolly_cpu65816_accumulator(const dolly_cpu65816* cpu)
+{
+    return cpu->flags.accumulator_8 ? cpu->reg_a & 0xFF : cpu->reg_a;
+}
+
+static void dolly_cpu65816_set_accumulator(dolly_cpu65816* cpu,
+                                           uint16_t value)
+{
+    // B keeps its value while the accumulator is 8 bits wide
+    if (cpu->flags.accumulator_8)
+        cpu->reg_a = (cpu->reg_a & 0xFF00) | (value & 0xFF);
+    else
+        cpu->reg_a = value;
+}
+
+static uint16_t dolly_cpu65816_index(const dolly_cpu65816* cpu,
+                                     uint16_t value)
+{
+    return cpu->flags.index_8 ? value & 0xFF : value;
+}
+
+static void dolly_cpu65816_interrupt(dolly_cpu65816* cpu,
+                                     uint16_t return_address,
+                                     uint16_t vector)
+{
+    // Emulation mode has a single vector for BRK and IRQ, as on the 6502
+    if (cpu->emulation) {
+        dolly_cpu65816_push_word(cpu, return_address);
+        dolly_cpu65816_push(cpu, cpu->flags_byte | 0x10);
+        vector = vector == DOLLY_CPU65816_COP_VECTOR ? 0xFFF4 : 0xFFFE;
+    } else {
+        dolly_cpu65816_push(cpu, cpu->program_bank);
+        dolly_cpu65816_push_word(cpu, return_address);
+        dolly_cpu65816_push(cpu, cpu->flags_byte);
+    }
+    cpu->flags.interrupt_disable = true;
+    cpu->flags.decimal = false;
+    cpu->program_bank = 0;
+    cpu->program_counter = dolly_cpu65816_read_word(cpu, vector);
+}
+
+static void dolly_cpu65816_push(dolly_cpu65816* cpu, uint8_t value)
+{
+    dolly_cpu65816_write(cpu, cpu->stack_ptr, value);
+    --cpu->stack_ptr;
+    if (cpu->emulation) cpu->stack_ptr = 0x0100 | (cpu->stack_ptr & 0xFF);
+}
+
+static void dolly_cpu65816_push_word(dolly_cpu65816* cpu, uint16_t value)
+{
+    dolly_cpu65816_push(cpu, value >> 8);
+    dolly_cpu65816_push(cpu, value & 0xFF);
+}
+
+static uint8_t dolly_cpu65816_pull(dolly_cpu65816* cpu)
+{
+    ++cpu->stack_ptr;
+    if (cpu->emulation) cpu->stack_ptr = 0x0100 | (cpu->stack_ptr & 0xFF);
+    return dolly_cpu65816_read(cpu, cpu->stack_ptr);
+}
+
+static uint16_t dolly_cpu65816_pull_word(dolly_cpu65816* cpu)
+{
+    uint16_t lsb = dolly_cpu65816_pull(cpu);
+    return lsb | ((uint16_t)dolly_cpu65816_pull(cpu) << 8);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DOLLY_CPU65816_ADDRESS_SPACE 0x1000000
+#define DOLLY_CPU65816_PAGE_SIZE     0x1000
+#define DOLLY_CPU65816_PAGE_COUNT    (DOLLY_CPU65816_ADDRESS_SPACE \
+                                      / DOLLY_CPU65816_PAGE_SIZE)
+
+#define DOLLY_CPU65816_COP_VECTOR    0xFFE4
+#define DOLLY_CPU65816_BRK_VECTOR    0xFFE6
+
+// 65816 core, running in native mode
+//
+// The 16MB address space is a page table of 4KB pages which are only
+// allocated when first written. Reads from a page that was never written
+// return zero, so a guest costs only as much memory as it touches.
+//
+// The core starts in native mode with 8-bit registers, as after REP/SEP have
+// yet to be used. XCE switches to emulation mode, where the registers stay 8
+// bits wide and the stack is confined to page 1.
+
+struct dolly_cpu65816
+{
+    uint8_t* pages[DOLLY_CPU65816_PAGE_COUNT]; // NULL until first written
+    size_t   page_count; // Allocated
+    // A is the full 16 bits, whose high byte is B while the accumulator is 8
+    // bits wide. X and Y have their high byte cleared while 8 bits wide.
+    uint16_t reg_a, reg_x, reg_y;
+    uint16_t stack_ptr;
+    uint16_t direct_page;
+    uint8_t  data_bank, program_bank;
+    uint16_t program_counter;
+    uint16_t call_depth; // JSR and JSL nesting
+    bool     emulation;
+    union
+    {
+        struct
+        {
+            bool carry             : 1;
+            bool zero              : 1;
+            bool interrupt_disable : 1;
+            bool decimal           : 1;
+            bool index_8           : 1; // X, the break flag in emulation mode
+            bool accumulator_8     : 1; // M
+            bool overflow          : 1;
+            bool negative          : 1;
+        } flags;
+        uint8_t flags_byte;
+    };
+    // P has no room for a break flag in native mode, so BRK raises this
+    // instead for the VM to service the syscall
+    bool break_flag;
+    bool stopped; // Executed STP, or WAI which nothing can wake
+};
+
+typedef struct dolly_cpu65816 dolly_cpu65816;
+
+void dolly_cpu65816_init(dolly_cpu65816* cpu);
+void dolly_cpu65816_destroy(dolly_cpu65816* cpu);
+
+// Returns the number of cycles taken
+int dolly_cpu65816_read_next_instruction(dolly_cpu65816* cpu);
+
+uint8_t dolly_cpu65816_read(const dolly_cpu65816* cpu, uint32_t address);
+// Ends the process if the page written to can't be allocated, as running out
+// in the middle of an instruction can't be undone
+void    dolly_cpu65816_write(dolly_cpu65816* cpu, uint32_t address,
+                             uint8_t value);
+// Copies size bytes of data into guest memory at address. Returns false if a
+// page couldn't be allocated, leaving the copy partly done.
+bool    dolly_cpu65816_load(dolly_cpu65816* cpu, uint32_t address,
+                            const uint8_t* data, size_t size);
+// Zeroes size bytes at address, which allocates nothing as only pages
+// already written need clearing
+void    dolly_cpu65816_clear(dolly_cpu65816* cpu, uint32_t address,
+                             size_t size);
+
+void dolly_cpu65816_debug(const dolly_cpu65816* cpu);
@@ -0,0 +1,256 @@
+#include "virtual-machine/debugger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DOLLY_DEBUGGER_MAX_ARGS 3
+
+static void dolly_debugger_print_location(const dolly_debugger* debugger);
+static bool dolly_debugger_parse_count(const char* text, uint64_t* count);
+static bool dolly_debugger_parse_address(const char* text, uint16_t* address);
+static bool dolly_debugger_step(dolly_debugger* debugger,
+                                bool over_breakpoint);
+static void dolly_debugger_execute(dolly_debugger* debugger, int argc,
+                                   char** argv);
+
+static void dolly_debugger_print_location(const dolly_debugger* debugger)
+{
+    const dolly_vm* vm = debugger->vm;
+    const dolly_cpu* cpu = &vm->cpu;
+    uint16_t pc = cpu->program_counter;
+    dolly_opcode op = dolly_cpu_decode(cpu, cpu->memory[pc]);
+    int operand_size = dolly_get_operand_size(op.a_mode);
+
+    printf("[%llu] 0x%04x  ", (unsigned long long)vm->instructions, pc);
+    for (int i = 0; i < 3; ++i) {
+        if (i <= operand_size)
+            printf("%02x ", cpu->memory[(uint16_t)(pc + i)]);
+        else
+            printf("   ");
+    }
+    printf(" %s", dolly_get_instr_name(op.instr));
+    if (!vm->running) printf(vm->faulted ? "  (faulted)" : "  (exited)");
+    printf("\n");
+}
+
+static bool dolly_debugger_parse_count(const char* text, uint64_t* count)
+{
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (*text == '\0' || *end != '\0' || value == 0) return false;
+    *count = value;
+    return true;
+}
+
+static bool dolly_debugger_parse_address(const char* text, uint16_t* address)
+{
+    char* end;
+    if (text[0] == '$') ++text;
+    long value = strtol(text, &end, 16);
+    if (*text == '\0' || *end != '\0' || value < 0 || value > 0xFFFF)
+        return false;
+    *address = (uint16_t) value;
+    return true;
+}
+
+// Executes one instruction, stepping over a breakpoint under the program
+// counter if asked. Returns false if execution should stop, having said why.
+static bool dolly_debugger_step(dolly_debugger* debugger,
+                                bool over_breakpoint)
+{
+    dolly_vm* vm = debugger->vm;
+    dolly_cpu* cpu = &vm->cpu;
+    dolly_breakpoints* bp = &debugger->breakpoints;
+
+    // Run the real instruction from memory rather than the trap
+    bool at_trap = over_breakpoint && dolly_cpu_at_trap(cpu);
+    uint8_t* code = cpu->code;
+    if (at_trap) cpu->code = cpu->memory;
+    bool running = dolly_history_step(&debugger->history, vm);
+    cpu->code = code;
+
+    uint8_t old_value;
+    const dolly_watchpoint* watchpoint = dolly_breakpoints_sync(bp, &old_value);
+    if (watchpoint) {
+        printf("Watchpoint $%04x: %02x -> %02x\n", watchpoint->address,
+               old_value, watchpoint->value);
+        return false;
+    }
+
+    if (!running && vm->running) {
+        printf("Breakpoint at $%04x\n", cpu->program_counter);
+        return false;
+    }
+    return running;
+}
+
+static void dolly_debugger_execute(dolly_debugger* debugger, int argc,
+                                   char** argv)
+{
+    dolly_vm* vm = debugger->vm;
+    dolly_history* history = &debugger->history;
+    dolly_breakpoints* bp = &debugger->breakpoints;
+    const char* command = argv[0];
+    uint64_t count = 1;
+    uint16_t address;
+
+    if (strcmp(command, "step") == 0 || strcmp(command, "s") == 0) {
+        if (argc > 1 && !dolly_debugger_parse_count(argv[1], &count)) {
+            printf("Invalid count '%s'\n", argv[1]);
+            return;
+        }
+        while (count-- > 0 && dolly_debugger_step(debugger, true));
+        dolly_debugger_print_location(debugger);
+    } else if (strcmp(command, "continue") == 0
+               || strcmp(command, "c") == 0) {
+        if (dolly_debugger_step(debugger, true))
+            while (dolly_debugger_step(debugger, false));
+        dolly_debugger_print_location(debugger);
+    } else if (strcmp(command, "reverse-step") == 0
+               || strcmp(command, "rs") == 0) {
+        if (argc > 1 && !dolly_debugger_parse_count(argv[1], &count)) {
+            printf("Invalid count '%s'\n", argv[1]);
+            return;
+        }
+        uint64_t target = count > vm->instructions
+                        ? 0 : vm->instructions - count;
+        dolly_breakpoints_suspend(bp);
+        bool reached = dolly_history_seek(history, vm, target);
+        dolly_breakpoints_resume(bp);
+        if (!reached) {
+            printf("History only reaches back to instruction %llu\n",
+                   (unsigned long long)dolly_history_oldest(history));
+        }
+        dolly_debugger_print_location(debugger);
+    } else if (strcmp(command, "last-write") == 0
+               || strcmp(command, "lw") == 0) {
+        if (argc < 2 || !dolly_debugger_parse_address(argv[1], &address)) {
+            printf("Usage: last-write <address>\n");
+            return;
+        }
+        dolly_breakpoints_suspend(bp);
+        bool found = dolly_history_find_last_write(history, vm, address);
+        dolly_breakpoints_resume(bp);
+        if (!found) {
+            printf("No write to $%04x since instruction %llu\n", address,
+                   (unsigned long long)dolly_history_oldest(history));
+            return;
+        }
+        dolly_debugger_print_location(debugger);
+    } else if (strcmp(command, "break") == 0 || strcmp(command, "b") == 0
+               || strcmp(command, "delete") == 0 || strcmp(command, "d") == 0
+               || strcmp(command, "watch") == 0 || strcmp(command, "w") == 0
+               || strcmp(command, "unwatch") == 0) {
+        if (argc < 2 || !dolly_debugger_parse_address(argv[1], &address)) {
+            printf("Usage: %s <address>\n", command);
+            return;
+        }
+        switch (command[0]) {
+        case 'b':
+            if (!dolly_breakpoint_add(bp, address))
+                printf("Breakpoint already at $%04x or too many\n", address);
+            break;
+        case 'd':
+            if (!dolly_breakpoint_remove(bp, address))
+                printf("No breakpoint at $%04x\n", address);
+            break;
+        case 'w':
+            if (!dolly_watchpoint_add(bp, address))
+                printf("Already watching $%04x or too many\n", address);
+            break;
+        default:
+            if (!dolly_watchpoint_remove(bp, address))
+                printf("Not watching $%04x\n", address);
+            break;
+        }
+    } else if (strcmp(command, "info") == 0 || strcmp(command, "i") == 0) {
+        for (size_t i = 0; i < bp->breakpoint_count; ++i)
+            printf("Breakpoint at $%04x\n", bp->breakpoints[i]);
+        for (size_t i = 0; i < bp->watchpoint_count; ++i) {
+            printf("Watchpoint on $%04x = %02x\n",
+                   bp->watchpoints[i].address, bp->watchpoints[i].value);
+        }
+        if (bp->breakpoint_count == 0 && bp->watchpoint_count == 0)
+            printf("No breakpoints or watchpoints\n");
+    } else if (strcmp(command, "regs") == 0 || strcmp(command, "r") == 0) {
+        printf("Instructions: %llu, cycles: %llu\n",
+               (unsigned long long)vm->instructions,
+               (unsigned long long)vm->cycles);
+        dolly_cpu_debug(&vm->cpu);
+    } else if (strcmp(command, "x") == 0) {
+        if (argc < 2 || !dolly_debugger_parse_address(argv[1], &address)
+            || (argc > 2 && !dolly_debugger_parse_count(argv[2], &count))) {
+            printf("Usage: x <address> [count]\n");
+            return;
+        }
+        for (uint64_t i = 0; i < count && address + i <= 0xFFFF; ++i) {
+            if (i % 16 == 0) printf(i ? "\n$%04x:" : "$%04x:",
+                                    (unsigned)(address + i));
+            printf(" %02x", vm->cpu.memory[address + i]);
+        }
+        printf("\n");
+    } else if (strcmp(command, "history") == 0
+               || strcmp(command, "h") == 0) {
+        printf("%zu snapshots, %zu of %zu bytes, back to instruction %llu\n",
+               history->count, history->memory_used, history->budget,
+               (unsigned long long)dolly_history_oldest(history));
+    } else if (strcmp(command, "quit") == 0 || strcmp(command, "q") == 0) {
+        debugger->quit = true;
+    } else if (strcmp(command, "help") == 0) {
+        puts("Commands:\n"
+             "\tstep, s [n]\t\tExecute n instructions\n"
+             "\tcontinue, c\t\tRun until a breakpoint, watchpoint or exit\n"
+             "\treverse-step, rs [n]\tGo back n instructions\n"
+             "\tlast-write, lw <addr>\tGo back to the last write of addr\n"
+             "\tbreak, b <addr>\t\tStop before executing addr\n"
+             "\tdelete, d <addr>\tRemove the breakpoint at addr\n"
+             "\twatch, w <addr>\t\tStop after writes to addr\n"
+             "\tunwatch <addr>\t\tRemove the watchpoint on addr\n"
+             "\tinfo, i\t\t\tList breakpoints and watchpoints\n"
+             "\tregs, r\t\t\tShow registers\n"
+             "\tx <addr> [n]\t\tShow n bytes of memory\n"
+             "\thistory, h\t\tShow snapshot usage\n"
+             "\tquit, q\t\t\tExit the debugger");
+    } else {
+        printf("Unknown command '%s', try 'help'\n", command);
+    }
+}
+
+void dolly_debugger_init(dolly_debugger* debugger, dolly_vm* vm,
+                         uint64_t snapshot_interval, size_t history_budget)
+{
+    debugger->vm = vm;
+    debugger->quit = false;
+    dolly_history_init(&debugger->history, vm, snapshot_interval,
+                       history_budget);
+    dolly_breakpoints_init(&debugger->breakpoints, &vm->cpu);
+}
+
+void dolly_debugger_destroy(dolly_debugger* debugger)
+{
+    dolly_breakpoints_destroy(&debugger->breakpoints);
+    debugger->vm->history = NULL;
+    dolly_history_destroy(&debugger->history);
+}
+
+void dolly_debugger_run(dolly_debugger* debugger)
+{
+    char line[256];
+
+    dolly_debugger_print_location(debugger);
+    while (!debugger->quit) {
+        printf("(dolly) ");
+        fflush(stdout);
+        if (!fgets(line, sizeof(line), stdin)) break;
+
+        char* argv[DOLLY_DEBUGGER_MAX_ARGS];
+        int argc = 0;
+        for (char* token = strtok(line, " \t\n");
+             token && argc < DOLLY_DEBUGGER_MAX_ARGS;
+             token = strtok(NULL, " \t\n")) {
+            argv[argc++] = token;
+        }
+        if (argc > 0) dolly_debugger_execute(debugger, argc, argv);
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "virtual-machine/breakpoint.h"
+#include "virtual-machine/history.h"
+#include "virtual-machine/vm.h"
+
+struct dolly_debugger
+{
+    dolly_vm* vm;
+    dolly_history history;
+    dolly_breakpoints breakpoints;
+    bool quit;
+};
+
+typedef struct dolly_debugger dolly_debugger;
+
+void dolly_debugger_init(dolly_debugger* debugger, dolly_vm* vm,
+                         uint64_t snapshot_interval, size_t history_budget);
+void dolly_debugger_destroy(dolly_debugger* debugger);
+
+// Reads commands from standard input until the user quits
+void dolly_debugger_run(dolly_debugger* debugger);
@@ -1,9 +1,21 @@
 #pragma once
 
+// The syscall number is passed in A. Syscalls that take a buffer use the
+// address stored little-endian at $FE. On the 65816, that is $FE in the direct
+// page and the buffer is in the data bank.
 enum dolly_vm_syscall
 {
     DOLLY_SYSCALL_EXIT = 0,
-    DOLLY_SYSCALL_PRINT = 1
+    DOLLY_SYSCALL_PRINT = 1, // Prints the NUL-terminated string at the buffer
+    DOLLY_SYSCALL_READ = 2,  // Reads a line of up to X - 1 bytes (X = 0 for
+                             // 255) into the buffer, NUL-terminated. A is set
+                             // to the number of bytes read, 0 at end of input
+    DOLLY_SYSCALL_TIME = 3,  // Stores the host time in seconds since the Unix
+                             // epoch at the buffer as a 32-bit integer
+    DOLLY_SYSCALL_CHECKPOINT = 4 // Saves the machine to the state file, if
+                                 // any, for later runs to resume from here
 };
 
+#define DOLLY_SYSCALL_COUNT 5
+
 typedef enum dolly_vm_syscall dolly_vm_syscall;
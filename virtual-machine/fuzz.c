@@ -0,0 +1,504 @@
+#include "virtual-machine/fuzz.h"
+
+#include "core/core.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+enum dolly_fuzz_result
+{
+    DOLLY_FUZZ_RESULT_OKAY, DOLLY_FUZZ_RESULT_CRASH, DOLLY_FUZZ_RESULT_HANG
+};
+
+typedef enum dolly_fuzz_result dolly_fuzz_result;
+
+static const uint8_t DOLLY_FUZZ_INTERESTING_8[]
+    = { 0x00, 0x01, 0x02, 0x0A, 0x0D, 0x10, 0x20, 0x40, 0x7F, 0x80, 0xFE,
+        0xFF };
+static const uint16_t DOLLY_FUZZ_INTERESTING_16[]
+    = { 0x0000, 0x0080, 0x00FF, 0x0100, 0x7FFF, 0x8000, 0xFF00, 0xFFFF };
+
+#define DOLLY_FUZZ_ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+
+// Hit counts are compared in buckets so that loops which run a few more times
+// are not each treated as new behaviour
+static uint8_t dolly_fuzz_count_class[256];
+
+static volatile sig_atomic_t dolly_fuzz_stop = 0;
+
+static void     dolly_fuzz_handle_signal(int signal);
+static void     dolly_fuzz_init_count_class(void);
+static uint64_t dolly_fuzz_rand(dolly_fuzzer* fuzzer);
+static void     dolly_fuzzer_reset(dolly_fuzzer* fuzzer);
+static dolly_fuzz_result dolly_fuzzer_execute(dolly_fuzzer* fuzzer,
+                                              const uint8_t* data,
+                                              size_t size);
+static void     dolly_fuzzer_classify(dolly_fuzzer* fuzzer);
+static int      dolly_fuzzer_check_bits(const dolly_fuzzer* fuzzer,
+                                        uint8_t* virgin);
+static size_t   dolly_fuzzer_mutate(dolly_fuzzer* fuzzer, size_t size);
+static void     dolly_fuzzer_add_input(dolly_fuzzer* fuzzer,
+                                       const uint8_t* data, size_t size);
+static void     dolly_fuzzer_save(const dolly_fuzzer* fuzzer,
+                                  const char* kind, uint64_t id,
+                                  const uint8_t* data, size_t size);
+static bool     dolly_fuzzer_load_corpus(dolly_fuzzer* fuzzer);
+static size_t   dolly_fuzzer_edge_count(const dolly_fuzzer* fuzzer);
+static void     dolly_fuzzer_print_status(const dolly_fuzzer* fuzzer,
+                                          double seconds);
+
+static void dolly_fuzz_handle_signal(int signal)
+{
+    (void) signal;
+    dolly_fuzz_stop = 1;
+}
+
+static void dolly_fuzz_init_count_class(void)
+{
+    for (int count = 0; count < 256; ++count) {
+        uint8_t class;
+        if (count <= 2) class = count;
+        else if (count == 3) class = 4;
+        else if (count < 8) class = 8;
+        else if (count < 16) class = 16;
+        else if (count < 32) class = 32;
+        else if (count < 128) class = 64;
+        else class = 128;
+        dolly_fuzz_count_class[count] = class;
+    }
+}
+
+static uint64_t dolly_fuzz_rand(dolly_fuzzer* fuzzer)
+{
+    // xorshift64*
+    fuzzer->rng ^= fuzzer->rng >> 12;
+    fuzzer->rng ^= fuzzer->rng << 25;
+    fuzzer->rng ^= fuzzer->rng >> 27;
+    return fuzzer->rng * 0x2545F4914F6CDD1DULL;
+}
+
+// Copies back only the pages the last execution wrote to
+static void dolly_fuzzer_reset(dolly_fuzzer* fuzzer)
+{
+    dolly_vm* vm = fuzzer->vm;
+    dolly_cpu* cpu = &vm->cpu;
+
+    for (int page = 0; page < DOLLY_CPU_PAGE_COUNT; ++page) {
+        if (cpu->page_flags[page] & DOLLY_CPU_PAGE_DIRTY) {
+            size_t offset = page * DOLLY_CPU_PAGE_SIZE;
+            memcpy(cpu->memory + offset, fuzzer->pristine + offset,
+                   DOLLY_CPU_PAGE_SIZE);
+        }
+    }
+
+    // The pristine copy has every page flag clear
+    *cpu = fuzzer->pristine_cpu;
+    vm->cycles = 0;
+    vm->instructions = 0;
+    vm->running = true;
+    vm->faulted = false;
+    vm->exited = false;
+}
+
+static dolly_fuzz_result dolly_fuzzer_execute(dolly_fuzzer* fuzzer,
+                                              const uint8_t* data,
+                                              size_t size)
+{
+    dolly_vm* vm = fuzzer->vm;
+    dolly_cpu* cpu = &vm->cpu;
+    uint8_t* trace_bits = fuzzer->trace_bits;
+    const bool* control_flow = fuzzer->control_flow;
+    uint64_t timeout = fuzzer->config.timeout;
+
+    dolly_fuzzer_reset(fuzzer);
+    memcpy(cpu->memory + fuzzer->config.buffer_address, data, size);
+    dolly_cpu_mark_dirty(cpu, fuzzer->config.buffer_address, size);
+    cpu->reg_x = size & 0xFF;
+    cpu->reg_y = size >> 8;
+
+    // Only the touched bits need clearing, which keeps short executions from
+    // being dominated by the size of the map
+    for (size_t i = 0; i < fuzzer->touched_count; ++i)
+        trace_bits[fuzzer->touched[i]] = 0;
+    uint16_t* touched = fuzzer->touched;
+    size_t touched_count = 0;
+    uint16_t previous = 0;
+    ++fuzzer->execs;
+
+    while (vm->running) {
+        if (vm->cycles >= timeout) break;
+
+        bool ends_edge = control_flow[cpu->memory[cpu->program_counter]];
+        dolly_vm_step(vm);
+        if (ends_edge) {
+            uint16_t location
+                = (uint16_t)((cpu->program_counter * 0x9E3779B1u) >> 16);
+            uint16_t edge = location ^ previous;
+            uint8_t hits = trace_bits[edge];
+            if (hits == 0) touched[touched_count++] = edge;
+            trace_bits[edge] = hits + (hits != 0xFF);
+            previous = location >> 1;
+        }
+    }
+
+    fuzzer->touched_count = touched_count;
+    if (vm->running) return DOLLY_FUZZ_RESULT_HANG;
+    return vm->faulted ? DOLLY_FUZZ_RESULT_CRASH : DOLLY_FUZZ_RESULT_OKAY;
+}
+
+static void dolly_fuzzer_classify(dolly_fuzzer* fuzzer)
+{
+    for (size_t i = 0; i < fuzzer->touched_count; ++i) {
+        uint8_t* bits = &fuzzer->trace_bits[fuzzer->touched[i]];
+        *bits = dolly_fuzz_count_class[*bits];
+    }
+}
+
+// Returns 2 if the trace reaches a new edge, 1 if it only reaches a new hit
+// count bucket and 0 otherwise, clearing the newly seen bits from virgin
+static int dolly_fuzzer_check_bits(const dolly_fuzzer* fuzzer,
+                                   uint8_t* virgin)
+{
+    int result = 0;
+
+    for (size_t i = 0; i < fuzzer->touched_count; ++i) {
+        uint16_t edge = fuzzer->touched[i];
+        uint8_t trace = fuzzer->trace_bits[edge];
+        if ((trace & virgin[edge]) == 0) continue;
+
+        if (virgin[edge] == 0xFF) result = 2;
+        else if (result == 0) result = 1;
+        virgin[edge] &= ~trace;
+    }
+
+    return result;
+}
+
+// Applies a stack of random mutations to the scratch buffer
+static size_t dolly_fuzzer_mutate(dolly_fuzzer* fuzzer, size_t size)
+{
+    uint8_t* data = fuzzer->scratch;
+    size_t max_length = fuzzer->config.max_length;
+    int stack = 1 << (1 + dolly_fuzz_rand(fuzzer) % 4);
+
+    for (int i = 0; i < stack; ++i) {
+        if (size == 0) {
+            data[size++] = dolly_fuzz_rand(fuzzer);
+            continue;
+        }
+
+        size_t at = dolly_fuzz_rand(fuzzer) % size;
+        switch (dolly_fuzz_rand(fuzzer) % 8) {
+        case 0:
+            data[at] ^= 1 << (dolly_fuzz_rand(fuzzer) % 8);
+            break;
+        case 1:
+            data[at] = dolly_fuzz_rand(fuzzer);
+            break;
+        case 2:
+            data[at] = DOLLY_FUZZ_INTERESTING_8[
+                dolly_fuzz_rand(fuzzer)
+                % DOLLY_FUZZ_ARRAY_SIZE(DOLLY_FUZZ_INTERESTING_8)];
+            break;
+        case 3: {
+            uint8_t delta = 1 + dolly_fuzz_rand(fuzzer) % 35;
+            data[at] += (dolly_fuzz_rand(fuzzer) & 1) ? delta : -delta;
+            break;
+        }
+        case 4: {
+            if (at + 1 >= size) break;
+            uint16_t value = DOLLY_FUZZ_INTERESTING_16[
+                dolly_fuzz_rand(fuzzer)
+                % DOLLY_FUZZ_ARRAY_SIZE(DOLLY_FUZZ_INTERESTING_16)];
+            data[at] = value & 0xFF;
+            data[at + 1] = value >> 8;
+            break;
+        }
+        case 5: { // Delete a block
+            if (size < 2) break;
+            size_t length = 1 + dolly_fuzz_rand(fuzzer) % (size - at);
+            if (length >= size) length = size - 1;
+            memmove(data + at, data + at + length, size - at - length);
+            size -= length;
+            break;
+        }
+        case 6: { // Duplicate a block
+            if (size >= max_length) break;
+            size_t from = dolly_fuzz_rand(fuzzer) % size;
+            size_t length = 1 + dolly_fuzz_rand(fuzzer) % (size - from);
+            if (length > max_length - size) length = max_length - size;
+            memmove(data + at + length, data + at, size - at);
+            memmove(data + at, data + (from >= at ? from + length : from),
+                    length);
+            size += length;
+            break;
+        }
+        case 7: { // Splice in part of another input
+            const dolly_fuzz_input* other
+                = &fuzzer->queue[dolly_fuzz_rand(fuzzer)
+                                 % fuzzer->queue_count];
+            if (other->size == 0) break;
+            size_t from = dolly_fuzz_rand(fuzzer) % other->size;
+            size_t length = other->size - from;
+            if (length > size - at) length = size - at;
+            memcpy(data + at, other->data + from, length);
+            break;
+        }
+        }
+    }
+
+    return size;
+}
+
+static void dolly_fuzzer_add_input(dolly_fuzzer* fuzzer, const uint8_t* data,
+                                   size_t size)
+{
+    if (fuzzer->queue_count == fuzzer->queue_capacity) {
+        fuzzer->queue_capacity = fuzzer->queue_capacity
+                               ? fuzzer->queue_capacity * 2 : 64;
+        fuzzer->queue
+            = realloc_or_abort(fuzzer->queue, fuzzer->queue_capacity
+                                              * sizeof(dolly_fuzz_input));
+    }
+
+    dolly_fuzz_input* input = &fuzzer->queue[fuzzer->queue_count++];
+    input->data = malloc_or_abort(size > 0 ? size : 1);
+    memcpy(input->data, data, size);
+    input->size = size;
+}
+
+static void dolly_fuzzer_save(const dolly_fuzzer* fuzzer, const char* kind,
+                              uint64_t id, const uint8_t* data, size_t size)
+{
+    if (fuzzer->config.output_dir == NULL) return;
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s/id-%06llu", fuzzer->config.output_dir,
+             kind, (unsigned long long)id);
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        printf("Failed to open file '%s': %s\n", path, strerror(errno));
+        return;
+    }
+    if (size > 0) fwrite(data, size, 1, file);
+    fclose(file);
+}
+
+static bool dolly_fuzzer_load_corpus(dolly_fuzzer* fuzzer)
+{
+    DIR* dir = opendir(fuzzer->config.corpus_dir);
+    if (!dir) return false;
+
+    char path[4096];
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s/%s", fuzzer->config.corpus_dir,
+                 entry->d_name);
+
+        struct stat info;
+        if (stat(path, &info) != 0 || !S_ISREG(info.st_mode)) continue;
+
+        FILE* file = fopen(path, "rb");
+        if (!file) continue;
+        size_t size = fread(fuzzer->scratch, 1, fuzzer->config.max_length,
+                            file);
+        fclose(file);
+        dolly_fuzzer_add_input(fuzzer, fuzzer->scratch, size);
+    }
+
+    closedir(dir);
+    return true;
+}
+
+static size_t dolly_fuzzer_edge_count(const dolly_fuzzer* fuzzer)
+{
+    size_t edges = 0;
+    for (size_t i = 0; i < DOLLY_FUZZ_MAP_SIZE; ++i)
+        edges += fuzzer->virgin_bits[i] != 0xFF;
+    return edges;
+}
+
+static void dolly_fuzzer_print_status(const dolly_fuzzer* fuzzer,
+                                      double seconds)
+{
+    printf("execs: %llu (%.0f/s), queue: %zu, edges: %zu, "
+           "crashes: %llu (%llu saved), hangs: %llu (%llu saved)\n",
+           (unsigned long long)fuzzer->execs,
+           seconds > 0.0 ? (double)fuzzer->execs / seconds : 0.0,
+           fuzzer->queue_count, dolly_fuzzer_edge_count(fuzzer),
+           (unsigned long long)fuzzer->crashes,
+           (unsigned long long)fuzzer->saved_crashes,
+           (unsigned long long)fuzzer->hangs,
+           (unsigned long long)fuzzer->saved_hangs);
+    fflush(stdout);
+}
+
+dolly_fuzz_status dolly_fuzzer_init(dolly_fuzzer* fuzzer, dolly_vm* vm,
+                                    const dolly_fuzz_config* config)
+{
+    memset(fuzzer, 0, sizeof(dolly_fuzzer));
+    fuzzer->vm = vm;
+    fuzzer->config = *config;
+
+    size_t space = DOLLY_CPU_MEMORY_SIZE - config->buffer_address;
+    if (config->max_length == 0 || config->max_length > space)
+        return DOLLY_FUZZ_INVALID_BUFFER;
+
+    if (config->output_dir) {
+        const char* subdirs[] = { "", "/queue", "/crashes", "/hangs" };
+        char path[4096];
+        for (size_t i = 0; i < DOLLY_FUZZ_ARRAY_SIZE(subdirs); ++i) {
+            snprintf(path, sizeof(path), "%s%s", config->output_dir,
+                     subdirs[i]);
+            if (mkdir(path, 0755) != 0 && errno != EEXIST)
+                return DOLLY_FUZZ_OUTPUT_ERROR;
+        }
+    }
+
+    dolly_fuzz_init_count_class();
+    for (int opcode = 0; opcode < 256; ++opcode) {
+        dolly_instruction instr = dolly_cpu_decode(&vm->cpu, opcode).instr;
+        fuzzer->control_flow[opcode]
+            = dolly_is_branch(instr) || instr == JMP || instr == JSR
+           || instr == RTS || instr == RTI || instr == BRK;
+    }
+
+    // Executions depend only on the input, never on the host's stdin or
+    // clock
+    vm->silent = true;
+    vm->input = NULL;
+    vm->fixed_time = true;
+    fuzzer->pristine = malloc_or_abort(DOLLY_CPU_MEMORY_SIZE);
+    memcpy(fuzzer->pristine, vm->cpu.memory, DOLLY_CPU_MEMORY_SIZE);
+    for (int page = 0; page < DOLLY_CPU_PAGE_COUNT; ++page)
+        vm->cpu.page_flags[page] &= ~DOLLY_CPU_PAGE_DIRTY;
+    fuzzer->pristine_cpu = vm->cpu;
+
+    fuzzer->trace_bits = malloc_or_abort(DOLLY_FUZZ_MAP_SIZE);
+    memset(fuzzer->trace_bits, 0, DOLLY_FUZZ_MAP_SIZE);
+    fuzzer->touched = malloc_or_abort(DOLLY_FUZZ_MAP_SIZE * sizeof(uint16_t));
+    fuzzer->virgin_bits = malloc_or_abort(DOLLY_FUZZ_MAP_SIZE);
+    fuzzer->virgin_crash_bits = malloc_or_abort(DOLLY_FUZZ_MAP_SIZE);
+    fuzzer->virgin_hang_bits = malloc_or_abort(DOLLY_FUZZ_MAP_SIZE);
+    memset(fuzzer->virgin_bits, 0xFF, DOLLY_FUZZ_MAP_SIZE);
+    memset(fuzzer->virgin_crash_bits, 0xFF, DOLLY_FUZZ_MAP_SIZE);
+    memset(fuzzer->virgin_hang_bits, 0xFF, DOLLY_FUZZ_MAP_SIZE);
+    fuzzer->scratch = malloc_or_abort(config->max_length);
+    fuzzer->rng = (uint64_t) time(NULL) * 0x9E3779B97F4A7C15ULL | 1;
+
+    if (config->corpus_dir && !dolly_fuzzer_load_corpus(fuzzer))
+        return DOLLY_FUZZ_CORPUS_ERROR;
+    if (fuzzer->queue_count == 0) {
+        uint8_t seed = 0;
+        dolly_fuzzer_add_input(fuzzer, &seed, 1);
+    }
+
+    return DOLLY_FUZZ_OKAY;
+}
+
+void dolly_fuzzer_run(dolly_fuzzer* fuzzer)
+{
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    double last_status = 0.0;
+
+    struct sigaction action = { .sa_handler = dolly_fuzz_handle_signal };
+    struct sigaction old_action;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &old_action);
+    dolly_fuzz_stop = 0;
+
+    // Seeds establish the initial coverage
+    size_t seeds = fuzzer->queue_count;
+    for (size_t i = 0; i < seeds; ++i) {
+        dolly_fuzzer_execute(fuzzer, fuzzer->queue[i].data,
+                             fuzzer->queue[i].size);
+        dolly_fuzzer_classify(fuzzer);
+        dolly_fuzzer_check_bits(fuzzer, fuzzer->virgin_bits);
+    }
+
+    uint64_t runs = fuzzer->config.runs;
+    while (!dolly_fuzz_stop && (runs == 0 || fuzzer->execs < runs)) {
+        const dolly_fuzz_input* parent
+            = &fuzzer->queue[dolly_fuzz_rand(fuzzer) % fuzzer->queue_count];
+        memcpy(fuzzer->scratch, parent->data, parent->size);
+        size_t size = dolly_fuzzer_mutate(fuzzer, parent->size);
+
+        dolly_fuzz_result result
+            = dolly_fuzzer_execute(fuzzer, fuzzer->scratch, size);
+        dolly_fuzzer_classify(fuzzer);
+
+        switch (result) {
+        case DOLLY_FUZZ_RESULT_OKAY:
+            if (dolly_fuzzer_check_bits(fuzzer, fuzzer->virgin_bits)) {
+                dolly_fuzzer_save(fuzzer, "queue", fuzzer->queue_count,
+                                  fuzzer->scratch, size);
+                dolly_fuzzer_add_input(fuzzer, fuzzer->scratch, size);
+            }
+            break;
+        case DOLLY_FUZZ_RESULT_CRASH:
+            ++fuzzer->crashes;
+            if (dolly_fuzzer_check_bits(fuzzer, fuzzer->virgin_crash_bits)) {
+                dolly_fuzzer_save(fuzzer, "crashes", fuzzer->saved_crashes++,
+                                  fuzzer->scratch, size);
+            }
+            break;
+        case DOLLY_FUZZ_RESULT_HANG:
+            ++fuzzer->hangs;
+            if (dolly_fuzzer_check_bits(fuzzer, fuzzer->virgin_hang_bits)) {
+                dolly_fuzzer_save(fuzzer, "hangs", fuzzer->saved_hangs++,
+                                  fuzzer->scratch, size);
+            }
+            break;
+        }
+
+        if ((fuzzer->execs & 0xFFF) == 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            double seconds = (double)(now.tv_sec - start.tv_sec)
+                           + (double)(now.tv_nsec - start.tv_nsec) / 1e9;
+            if (seconds - last_status >= 1.0) {
+                dolly_fuzzer_print_status(fuzzer, seconds);
+                last_status = seconds;
+            }
+        }
+    }
+
+    sigaction(SIGINT, &old_action, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    dolly_fuzzer_print_status(fuzzer,
+                              (double)(now.tv_sec - start.tv_sec)
+                              + (double)(now.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+void dolly_fuzzer_destroy(dolly_fuzzer* fuzzer)
+{
+    for (size_t i = 0; i < fuzzer->queue_count; ++i)
+        dolly_free(fuzzer->queue[i].data);
+    if (fuzzer->queue) dolly_free(fuzzer->queue);
+    if (fuzzer->pristine) dolly_free(fuzzer->pristine);
+    if (fuzzer->trace_bits) dolly_free(fuzzer->trace_bits);
+    if (fuzzer->touched) dolly_free(fuzzer->touched);
+    if (fuzzer->virgin_bits) dolly_free(fuzzer->virgin_bits);
+    if (fuzzer->virgin_crash_bits) dolly_free(fuzzer->virgin_crash_bits);
+    if (fuzzer->virgin_hang_bits) dolly_free(fuzzer->virgin_hang_bits);
+    if (fuzzer->scratch) dolly_free(fuzzer->scratch);
+}
+
+const char* dolly_fuzz_error_msg(dolly_fuzz_status status)
+{
+    switch (status) {
+    default: case DOLLY_FUZZ_OKAY: return "";
+    case DOLLY_FUZZ_INVALID_BUFFER:
+        return "input buffer does not fit in guest memory";
+    case DOLLY_FUZZ_CORPUS_ERROR: return "failed to read corpus directory";
+    case DOLLY_FUZZ_OUTPUT_ERROR: return "failed to create output directory";
+    }
+}
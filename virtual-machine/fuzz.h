@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "virtual-machine/vm.h"
+
+#define DOLLY_FUZZ_MAP_SIZE            0x10000
+#define DOLLY_FUZZ_DEFAULT_MAX_LENGTH  256
+#define DOLLY_FUZZ_DEFAULT_TIMEOUT     1000000 // Cycles
+
+// In-process coverage-guided fuzzer
+//
+// The executable is loaded once and the state just after load is kept. Each
+// execution copies back only the pages the previous one dirtied, writes the
+// input to the guest buffer and starts the program with the input length in
+// X (low byte) and Y (high byte). Edges between control flow targets are
+// counted in an AFL-style bitmap, and inputs that reach new edges or new hit
+// count buckets are added to the queue for further mutation.
+//
+// An execution crashes if it reaches an invalid instruction and hangs if it
+// runs for longer than the timeout. The read syscall sees end of file and the
+// time syscall always gives 0, so an input always runs the same way.
+
+struct dolly_fuzz_config
+{
+    uint16_t    buffer_address;
+    size_t      max_length;
+    uint64_t    timeout;    // Cycles
+    uint64_t    runs;       // 0 to run until interrupted
+    const char* corpus_dir; // Seed inputs, optional
+    const char* output_dir; // Queue, crashes and hangs, optional
+};
+
+typedef struct dolly_fuzz_config dolly_fuzz_config;
+
+struct dolly_fuzz_input
+{
+    uint8_t* data;
+    size_t size;
+};
+
+typedef struct dolly_fuzz_input dolly_fuzz_input;
+
+struct dolly_fuzzer
+{
+    dolly_vm* vm;
+    dolly_fuzz_config config;
+
+    uint8_t* pristine; // Guest memory just after load
+    dolly_cpu pristine_cpu;
+    bool control_flow[256]; // Opcodes that end an edge
+
+    uint8_t* trace_bits;
+    uint16_t* touched; // Indices of the nonzero trace bits
+    size_t touched_count;
+    uint8_t* virgin_bits; // Bits not yet seen by any input
+    uint8_t* virgin_crash_bits;
+    uint8_t* virgin_hang_bits;
+
+    dolly_fuzz_input* queue;
+    size_t queue_count, queue_capacity;
+    uint8_t* scratch;
+    uint64_t rng;
+
+    uint64_t execs, crashes, hangs;
+    uint64_t saved_crashes, saved_hangs;
+};
+
+typedef struct dolly_fuzzer dolly_fuzzer;
+
+enum dolly_fuzz_status
+{
+    DOLLY_FUZZ_OKAY, DOLLY_FUZZ_INVALID_BUFFER, DOLLY_FUZZ_CORPUS_ERROR,
+    DOLLY_FUZZ_OUTPUT_ERROR
+};
+
+typedef enum dolly_fuzz_status dolly_fuzz_status;
+
+// The VM must be freshly loaded
+dolly_fuzz_status dolly_fuzzer_init(dolly_fuzzer* fuzzer, dolly_vm* vm,
+                                    const dolly_fuzz_config* config);
+// Runs until the configured number of executions or SIGINT
+void dolly_fuzzer_run(dolly_fuzzer* fuzzer);
+void dolly_fuzzer_destroy(dolly_fuzzer* fuzzer);
+
+const char* dolly_fuzz_error_msg(dolly_fuzz_status status);
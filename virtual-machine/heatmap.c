@@ -0,0 +1,224 @@
+#include "virtual-machine/heatmap.h"
+
+#include "core/core.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+const uint8_t DOLLY_HEATMAP_MAGIC[7] = { 0x7F, 'D', 'H', 'E', 'A', 'T', 'M' };
+
+enum dolly_heatmap_access
+{
+    DOLLY_HEATMAP_NONE = 0,
+    DOLLY_HEATMAP_READ = 1 << 0,
+    DOLLY_HEATMAP_WRITE = 1 << 1
+};
+
+struct dolly_heatmap_entry
+{
+    uint16_t address;
+    uint64_t reads, writes;
+};
+
+typedef struct dolly_heatmap_entry dolly_heatmap_entry;
+
+static int  dolly_heatmap_access(dolly_opcode op);
+static int  dolly_heatmap_class_of(dolly_addressing_mode a_mode);
+static int  dolly_heatmap_compare_entries(const void* a, const void* b);
+static void dolly_heatmap_write_u64(uint8_t* out, uint64_t value);
+
+// Which accesses an instruction makes through its operand
+static int dolly_heatmap_access(dolly_opcode op)
+{
+    switch (op.instr) {
+    case STA: case STX: case STY: case STZ: case SAX:
+        return DOLLY_HEATMAP_WRITE;
+    case TRB: case TSB: case SLO: case RLA: case SRE: case RRA: case DCP:
+    case ISC:
+        return DOLLY_HEATMAP_READ | DOLLY_HEATMAP_WRITE;
+    case ASL: case LSR: case ROL: case ROR: case INC: case DEC:
+        return op.a_mode == ACCUMULATOR
+             ? DOLLY_HEATMAP_NONE : DOLLY_HEATMAP_READ | DOLLY_HEATMAP_WRITE;
+    case JMP: case JSR:
+        return DOLLY_HEATMAP_NONE;
+    default:
+        return DOLLY_HEATMAP_READ;
+    }
+}
+
+static int dolly_heatmap_class_of(dolly_addressing_mode a_mode)
+{
+    switch (a_mode) {
+    case ZERO_PAGE: case ZERO_PAGE_X: case ZERO_PAGE_Y:
+        return DOLLY_HEATMAP_ZERO_PAGE;
+    case ABSOLUTE: case ABSOLUTE_X: case ABSOLUTE_Y:
+        return DOLLY_HEATMAP_ABSOLUTE;
+    case INDIRECT_X: case INDIRECT_Y: case ZERO_PAGE_INDIRECT:
+        return DOLLY_HEATMAP_INDIRECT;
+    default:
+        return -1;
+    }
+}
+
+dolly_heatmap* dolly_heatmap_new(void)
+{
+    dolly_heatmap* heatmap = malloc_or_abort(sizeof(dolly_heatmap));
+    memset(heatmap, 0, sizeof(dolly_heatmap));
+    return heatmap;
+}
+
+void dolly_heatmap_free(dolly_heatmap* heatmap)
+{
+    dolly_free(heatmap);
+}
+
+void dolly_vm_run_heatmap(dolly_vm* vm, dolly_heatmap* heatmap)
+{
+    dolly_cpu* cpu = &vm->cpu;
+
+    while (vm->running) {
+        const uint8_t* instruction = &cpu->memory[cpu->program_counter];
+        dolly_opcode op = dolly_cpu_decode(cpu, instruction[0]);
+        uint8_t operand = instruction[1];
+
+        // Pointer fetches happen before the access they lead to
+        switch (op.a_mode) {
+        case INDIRECT_X:
+            ++heatmap->reads[DOLLY_HEATMAP_ZERO_PAGE]
+                            [(uint8_t)(operand + cpu->reg_x)];
+            ++heatmap->reads[DOLLY_HEATMAP_ZERO_PAGE]
+                            [(uint8_t)(operand + cpu->reg_x + 1)];
+            break;
+        case INDIRECT_Y:
+        case ZERO_PAGE_INDIRECT:
+            ++heatmap->reads[DOLLY_HEATMAP_ZERO_PAGE][operand];
+            ++heatmap->reads[DOLLY_HEATMAP_ZERO_PAGE][(uint8_t)(operand + 1)];
+            break;
+        case INDIRECT: {
+            uint16_t pointer = operand | (instruction[2] << 8);
+            ++heatmap->reads[DOLLY_HEATMAP_ABSOLUTE][pointer];
+            ++heatmap->reads[DOLLY_HEATMAP_ABSOLUTE][(uint16_t)(pointer + 1)];
+            break;
+        }
+        default:
+            break;
+        }
+
+        int class = dolly_heatmap_class_of(op.a_mode);
+        int access = dolly_heatmap_access(op);
+        uint16_t address;
+        if (class >= 0 && access != DOLLY_HEATMAP_NONE
+            && dolly_cpu_operand_address(cpu, &address)) {
+            if (access & DOLLY_HEATMAP_READ) ++heatmap->reads[class][address];
+            if (access & DOLLY_HEATMAP_WRITE) ++heatmap->writes[class][address];
+        }
+
+        dolly_vm_step(vm);
+    }
+}
+
+static int dolly_heatmap_compare_entries(const void* a, const void* b)
+{
+    const dolly_heatmap_entry* entry_a = a;
+    const dolly_heatmap_entry* entry_b = b;
+    uint64_t total_a = entry_a->reads + entry_a->writes;
+    uint64_t total_b = entry_b->reads + entry_b->writes;
+    if (total_a != total_b) return total_a < total_b ? 1 : -1;
+    return (int)entry_a->address - (int)entry_b->address;
+}
+
+void dolly_heatmap_write(const dolly_heatmap* heatmap, FILE* stream)
+{
+    static const char* CLASS_NAMES[DOLLY_HEATMAP_CLASS_COUNT]
+        = { "zero page", "absolute", "indirect" };
+
+    fprintf(stream, "Accesses by addressing mode:\n");
+    for (int class = 0; class < DOLLY_HEATMAP_CLASS_COUNT; ++class) {
+        uint64_t reads = 0, writes = 0;
+        for (size_t i = 0; i < DOLLY_CPU_MEMORY_SIZE; ++i) {
+            reads += heatmap->reads[class][i];
+            writes += heatmap->writes[class][i];
+        }
+        fprintf(stream, "  %-10s %12llu reads %12llu writes\n",
+                CLASS_NAMES[class], (unsigned long long)reads,
+                (unsigned long long)writes);
+    }
+
+    size_t entry_count = 0;
+    dolly_heatmap_entry* entries
+        = malloc_or_abort(sizeof(dolly_heatmap_entry) * DOLLY_CPU_MEMORY_SIZE);
+    for (size_t i = 0; i < DOLLY_CPU_MEMORY_SIZE; ++i) {
+        uint64_t reads = heatmap->reads[DOLLY_HEATMAP_ABSOLUTE][i];
+        uint64_t writes = heatmap->writes[DOLLY_HEATMAP_ABSOLUTE][i];
+        if (reads + writes == 0) continue;
+        entries[entry_count++] = (dolly_heatmap_entry) {
+            .address = i, .reads = reads, .writes = writes
+        };
+    }
+    qsort(entries, entry_count, sizeof(dolly_heatmap_entry),
+          dolly_heatmap_compare_entries);
+
+    fprintf(stream, "\nHottest absolute-addressed locations:\n"
+                    "  address        reads       writes\n");
+    for (size_t i = 0; i < entry_count && i < DOLLY_HEATMAP_HOTTEST; ++i) {
+        fprintf(stream, "  0x%04x  %12llu %12llu%s\n", entries[i].address,
+                (unsigned long long)entries[i].reads,
+                (unsigned long long)entries[i].writes,
+                entries[i].address < 0x100 ? "  (in zero page)" : "");
+    }
+    dolly_free(entries);
+
+    // Ranges of zero-page bytes nothing touched by any addressing mode
+    fprintf(stream, "\nUnused zero-page bytes:\n");
+    int unused = 0;
+    int range_start = -1;
+    for (int i = 0; i <= 0x100; ++i) {
+        bool used = i == 0x100;
+        for (int class = 0; !used && class < DOLLY_HEATMAP_CLASS_COUNT;
+             ++class) {
+            used = heatmap->reads[class][i] || heatmap->writes[class][i];
+        }
+
+        if (!used && range_start < 0) range_start = i;
+        if (used && range_start >= 0) {
+            if (range_start == i - 1)
+                fprintf(stream, "  0x%02x\n", range_start);
+            else
+                fprintf(stream, "  0x%02x-0x%02x\n", range_start, i - 1);
+            unused += i - range_start;
+            range_start = -1;
+        }
+    }
+    fprintf(stream, "  %d of 256 bytes unused\n", unused);
+}
+
+static void dolly_heatmap_write_u64(uint8_t* out, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i) out[i] = (value >> (8 * i)) & 0xFF;
+}
+
+bool dolly_heatmap_dump(const dolly_heatmap* heatmap, FILE* stream)
+{
+    uint8_t header[sizeof(DOLLY_HEATMAP_MAGIC) + 1];
+    memcpy(header, DOLLY_HEATMAP_MAGIC, sizeof(DOLLY_HEATMAP_MAGIC));
+    header[sizeof(DOLLY_HEATMAP_MAGIC)] = DOLLY_HEATMAP_VERSION;
+    if (fwrite(header, sizeof(header), 1, stream) != 1) return false;
+
+    uint8_t buffer[8 * 256];
+    for (int class = 0; class < DOLLY_HEATMAP_CLASS_COUNT; ++class) {
+        const uint64_t* counts[2]
+            = { heatmap->reads[class], heatmap->writes[class] };
+        for (int kind = 0; kind < 2; ++kind) {
+            for (size_t i = 0; i < DOLLY_CPU_MEMORY_SIZE; i += 256) {
+                for (size_t j = 0; j < 256; ++j) {
+                    dolly_heatmap_write_u64(buffer + 8 * j,
+                                            counts[kind][i + j]);
+                }
+                if (fwrite(buffer, sizeof(buffer), 1, stream) != 1)
+                    return false;
+            }
+        }
+    }
+
+    return true;
+}
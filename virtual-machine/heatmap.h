@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "virtual-machine/vm.h"
+
+#define DOLLY_HEATMAP_VERSION 1
+#define DOLLY_HEATMAP_HOTTEST 32
+
+extern const uint8_t DOLLY_HEATMAP_MAGIC[7];
+
+// How an access reached memory. Pointer fetches made by the indirect modes
+// count as zero-page (or, for JMP, absolute) reads of the pointer bytes, so
+// that zero-page usage includes pointers. Instruction fetches and the stack
+// are not counted.
+enum dolly_heatmap_class
+{
+    DOLLY_HEATMAP_ZERO_PAGE, DOLLY_HEATMAP_ABSOLUTE, DOLLY_HEATMAP_INDIRECT,
+    DOLLY_HEATMAP_CLASS_COUNT
+};
+
+typedef enum dolly_heatmap_class dolly_heatmap_class;
+
+struct dolly_heatmap
+{
+    uint64_t reads[DOLLY_HEATMAP_CLASS_COUNT][DOLLY_CPU_MEMORY_SIZE];
+    uint64_t writes[DOLLY_HEATMAP_CLASS_COUNT][DOLLY_CPU_MEMORY_SIZE];
+};
+
+typedef struct dolly_heatmap dolly_heatmap;
+
+// The heatmap is large, so these allocate it
+dolly_heatmap* dolly_heatmap_new(void);
+void dolly_heatmap_free(dolly_heatmap* heatmap);
+
+// Equivalent to dolly_vm_run, counting memory accesses as it goes
+void dolly_vm_run_heatmap(dolly_vm* vm, dolly_heatmap* heatmap);
+
+// Reports the hottest absolute-addressed locations and the zero-page bytes
+// that were never accessed
+void dolly_heatmap_write(const dolly_heatmap* heatmap, FILE* stream);
+
+// Binary dump: DOLLY_HEATMAP_MAGIC, a version byte, then for each class in
+// order the read counts and the write counts of every address, each as a
+// little-endian 64-bit integer
+bool dolly_heatmap_dump(const dolly_heatmap* heatmap, FILE* stream);
@@ -0,0 +1,300 @@
+#include "virtual-machine/history.h"
+
+#include "core/core.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static dolly_snapshot* dolly_history_at(const dolly_history* history,
+                                        size_t index);
+static size_t dolly_snapshot_size(const dolly_snapshot* snapshot);
+static void   dolly_history_take_snapshot(dolly_history* history,
+                                          dolly_vm* vm);
+static void   dolly_history_drop_oldest(dolly_history* history);
+static void   dolly_history_restore(dolly_history* history, dolly_vm* vm,
+                                    size_t index);
+
+static dolly_snapshot* dolly_history_at(const dolly_history* history,
+                                        size_t index)
+{
+    return history->ring[(history->first + index)
+                         % DOLLY_HISTORY_MAX_SNAPSHOTS];
+}
+
+static size_t dolly_snapshot_size(const dolly_snapshot* snapshot)
+{
+    return sizeof(dolly_snapshot)
+         + (size_t)snapshot->page_count * DOLLY_CPU_PAGE_SIZE;
+}
+
+static void dolly_history_take_snapshot(dolly_history* history, dolly_vm* vm)
+{
+    dolly_cpu* cpu = &vm->cpu;
+    dolly_snapshot* snapshot = malloc_or_abort(sizeof(dolly_snapshot));
+
+    snapshot->instructions = vm->instructions;
+    snapshot->cycles = vm->cycles;
+    snapshot->reg_a = cpu->reg_a;
+    snapshot->reg_x = cpu->reg_x;
+    snapshot->reg_y = cpu->reg_y;
+    snapshot->stack_ptr = cpu->stack_ptr;
+    snapshot->flags_byte = cpu->flags_byte;
+    snapshot->program_counter = cpu->program_counter;
+    snapshot->call_depth = cpu->call_depth;
+    snapshot->stopped = cpu->stopped;
+    snapshot->running = vm->running;
+    snapshot->faulted = vm->faulted;
+    snapshot->exited = vm->exited;
+    snapshot->input_cursor = history->input_cursor;
+
+    snapshot->page_count = 0;
+    for (int page = 0; page < DOLLY_CPU_PAGE_COUNT; ++page) {
+        if (cpu->page_flags[page] & DOLLY_CPU_PAGE_DIRTY)
+            snapshot->pages[snapshot->page_count++] = page;
+    }
+
+    snapshot->page_data = NULL;
+    if (snapshot->page_count > 0) {
+        snapshot->page_data
+            = malloc_or_abort(snapshot->page_count * DOLLY_CPU_PAGE_SIZE);
+    }
+
+    for (int i = 0; i < snapshot->page_count; ++i) {
+        size_t offset = snapshot->pages[i] * DOLLY_CPU_PAGE_SIZE;
+        memcpy(snapshot->page_data + i * DOLLY_CPU_PAGE_SIZE,
+               history->shadow + offset, DOLLY_CPU_PAGE_SIZE);
+        memcpy(history->shadow + offset, cpu->memory + offset,
+               DOLLY_CPU_PAGE_SIZE);
+        cpu->page_flags[snapshot->pages[i]] &= ~DOLLY_CPU_PAGE_DIRTY;
+    }
+
+    if (history->count == DOLLY_HISTORY_MAX_SNAPSHOTS)
+        dolly_history_drop_oldest(history);
+
+    history->ring[(history->first + history->count)
+                  % DOLLY_HISTORY_MAX_SNAPSHOTS] = snapshot;
+    ++history->count;
+    history->memory_used += dolly_snapshot_size(snapshot);
+
+    while (history->memory_used > history->budget && history->count > 1)
+        dolly_history_drop_oldest(history);
+
+    history->next_snapshot_cycles = vm->cycles + history->interval;
+}
+
+static void dolly_history_drop_oldest(dolly_history* history)
+{
+    dolly_snapshot* oldest = dolly_history_at(history, 0);
+    history->memory_used -= dolly_snapshot_size(oldest);
+    if (oldest->page_data) dolly_free(oldest->page_data);
+    dolly_free(oldest);
+
+    history->first = (history->first + 1) % DOLLY_HISTORY_MAX_SNAPSHOTS;
+    --history->count;
+
+    // Undo pages only lead further back, which is now out of reach
+    dolly_snapshot* next = dolly_history_at(history, 0);
+    if (next->page_data) {
+        history->memory_used -= next->page_count * DOLLY_CPU_PAGE_SIZE;
+        dolly_free(next->page_data);
+        next->page_data = NULL;
+        next->page_count = 0;
+    }
+}
+
+static void dolly_history_restore(dolly_history* history, dolly_vm* vm,
+                                  size_t index)
+{
+    dolly_cpu* cpu = &vm->cpu;
+
+    // The shadow holds every page written since the newest snapshot
+    for (int page = 0; page < DOLLY_CPU_PAGE_COUNT; ++page) {
+        if (cpu->page_flags[page] & DOLLY_CPU_PAGE_DIRTY) {
+            size_t offset = page * DOLLY_CPU_PAGE_SIZE;
+            memcpy(cpu->memory + offset, history->shadow + offset,
+                   DOLLY_CPU_PAGE_SIZE);
+            cpu->page_flags[page] &= ~DOLLY_CPU_PAGE_DIRTY;
+        }
+    }
+
+    while (history->count > index + 1) {
+        dolly_snapshot* newest = dolly_history_at(history, history->count - 1);
+        for (int i = 0; i < newest->page_count; ++i) {
+            memcpy(cpu->memory + newest->pages[i] * DOLLY_CPU_PAGE_SIZE,
+                   newest->page_data + i * DOLLY_CPU_PAGE_SIZE,
+                   DOLLY_CPU_PAGE_SIZE);
+        }
+        history->memory_used -= dolly_snapshot_size(newest);
+        if (newest->page_data) dolly_free(newest->page_data);
+        dolly_free(newest);
+        --history->count;
+    }
+
+    memcpy(history->shadow, cpu->memory, DOLLY_CPU_MEMORY_SIZE);
+
+    const dolly_snapshot* snapshot = dolly_history_at(history, index);
+    vm->instructions = snapshot->instructions;
+    vm->cycles = snapshot->cycles;
+    cpu->reg_a = snapshot->reg_a;
+    cpu->reg_x = snapshot->reg_x;
+    cpu->reg_y = snapshot->reg_y;
+    cpu->stack_ptr = snapshot->stack_ptr;
+    cpu->flags_byte = snapshot->flags_byte;
+    cpu->program_counter = snapshot->program_counter;
+    cpu->call_depth = snapshot->call_depth;
+    cpu->stopped = snapshot->stopped;
+    vm->running = snapshot->running;
+    vm->faulted = snapshot->faulted;
+    vm->exited = snapshot->exited;
+    history->input_cursor = snapshot->input_cursor;
+    history->next_snapshot_cycles = snapshot->cycles + history->interval;
+}
+
+void dolly_history_init(dolly_history* history, dolly_vm* vm,
+                        uint64_t interval, size_t budget)
+{
+    memset(history, 0, sizeof(dolly_history));
+    history->interval = interval;
+    history->budget = budget;
+    history->frontier = vm->instructions;
+
+    history->shadow = malloc_or_abort(DOLLY_CPU_MEMORY_SIZE);
+    memcpy(history->shadow, vm->cpu.memory, DOLLY_CPU_MEMORY_SIZE);
+    for (int page = 0; page < DOLLY_CPU_PAGE_COUNT; ++page)
+        vm->cpu.page_flags[page] &= ~DOLLY_CPU_PAGE_DIRTY;
+
+    dolly_history_take_snapshot(history, vm);
+    vm->history = history;
+}
+
+void dolly_history_destroy(dolly_history* history)
+{
+    while (history->count > 0) {
+        dolly_snapshot* newest = dolly_history_at(history, --history->count);
+        if (newest->page_data) dolly_free(newest->page_data);
+        dolly_free(newest);
+    }
+    for (size_t i = 0; i < history->input_count; ++i) {
+        if (history->inputs[i].data) dolly_free(history->inputs[i].data);
+    }
+    if (history->inputs) dolly_free(history->inputs);
+    dolly_free(history->shadow);
+}
+
+bool dolly_history_step(dolly_history* history, dolly_vm* vm)
+{
+    bool running = dolly_vm_step(vm);
+    if (vm->instructions > history->frontier)
+        history->frontier = vm->instructions;
+    if (vm->cycles >= history->next_snapshot_cycles)
+        dolly_history_take_snapshot(history, vm);
+    return running;
+}
+
+bool dolly_history_seek(dolly_history* history, dolly_vm* vm,
+                        uint64_t instruction)
+{
+    if (instruction < vm->instructions) {
+        size_t index = history->count;
+        while (index > 0
+               && dolly_history_at(history, index - 1)->instructions
+                  > instruction) {
+            --index;
+        }
+        if (index == 0) {
+            dolly_history_restore(history, vm, 0);
+            return false;
+        }
+        dolly_history_restore(history, vm, index - 1);
+    }
+
+    while (vm->instructions < instruction && vm->running)
+        dolly_history_step(history, vm);
+    return true;
+}
+
+bool dolly_history_find_last_write(dolly_history* history, dolly_vm* vm,
+                                   uint16_t address)
+{
+    dolly_cpu* cpu = &vm->cpu;
+    uint64_t origin = vm->instructions;
+    uint64_t end = origin;
+
+    // Search one snapshot interval at a time, newest first
+    for (size_t index = history->count; index-- > 0;) {
+        uint64_t start = dolly_history_at(history, index)->instructions;
+        if (start >= end) continue;
+
+        dolly_history_restore(history, vm, index);
+        uint64_t found = UINT64_MAX;
+        while (vm->instructions < end && vm->running) {
+            uint64_t at = vm->instructions;
+            uint16_t store_address;
+            bool stores = dolly_cpu_store_address(cpu, &store_address);
+            uint8_t before = cpu->memory[address];
+
+            dolly_history_step(history, vm);
+            // Changed values also catch stack pushes and syscall buffers
+            if ((stores && store_address == address)
+                || cpu->memory[address] != before) {
+                found = at;
+            }
+        }
+
+        if (found != UINT64_MAX) {
+            dolly_history_seek(history, vm, found);
+            return true;
+        }
+        end = start;
+    }
+
+    dolly_history_seek(history, vm, origin);
+    return false;
+}
+
+uint64_t dolly_history_oldest(const dolly_history* history)
+{
+    return dolly_history_at(history, 0)->instructions;
+}
+
+bool dolly_history_replay_input(dolly_history* history,
+                                dolly_replay_event kind, uint64_t instruction,
+                                uint8_t* data, size_t capacity, size_t* size)
+{
+    if (history->input_cursor >= history->input_count) return false;
+
+    const dolly_history_input* input = &history->inputs[history->input_cursor];
+    if (input->instruction != instruction || input->kind != kind
+        || input->size > capacity) {
+        return false;
+    }
+
+    if (input->size > 0) memcpy(data, input->data, input->size);
+    *size = input->size;
+    ++history->input_cursor;
+    return true;
+}
+
+void dolly_history_record_input(dolly_history* history,
+                                dolly_replay_event kind, uint64_t instruction,
+                                const uint8_t* data, size_t size)
+{
+    if (history->input_count == history->input_capacity) {
+        history->input_capacity = history->input_capacity
+                                ? history->input_capacity * 2 : 16;
+        history->inputs
+            = realloc_or_abort(history->inputs, history->input_capacity
+                                                * sizeof(dolly_history_input));
+    }
+
+    dolly_history_input* input = &history->inputs[history->input_count++];
+    input->instruction = instruction;
+    input->kind = kind;
+    input->size = size;
+    input->data = NULL;
+    if (size > 0) {
+        input->data = malloc_or_abort(size);
+        memcpy(input->data, data, size);
+    }
+    history->input_cursor = history->input_count;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "virtual-machine/vm.h"
+
+#define DOLLY_HISTORY_MAX_SNAPSHOTS     1024
+#define DOLLY_HISTORY_DEFAULT_INTERVAL  100000      // Cycles
+#define DOLLY_HISTORY_DEFAULT_BUDGET    (16 << 20)  // Bytes
+
+// Execution history for time-travel debugging
+//
+// A snapshot is taken every interval cycles. Each holds the registers at that
+// point and an undo copy of every page dirtied since the previous snapshot,
+// so it costs only as much as the guest wrote. Moving back restores memory by
+// applying undo pages newest first, then re-executes forward from the
+// snapshot. Execution is deterministic because every input the guest
+// consumed is journaled and fed back when re-executing.
+//
+// The oldest snapshots are dropped to keep within the memory budget, which
+// limits how far back the history reaches.
+
+struct dolly_snapshot
+{
+    uint64_t instructions, cycles;
+    uint8_t  reg_a, reg_x, reg_y, stack_ptr, flags_byte;
+    uint16_t program_counter;
+    uint16_t call_depth;
+    bool     stopped, running, faulted, exited;
+    size_t   input_cursor;
+
+    // Pages dirtied since the previous snapshot and their contents at it
+    uint16_t page_count;
+    uint8_t  pages[DOLLY_CPU_PAGE_COUNT];
+    uint8_t* page_data;
+};
+
+typedef struct dolly_snapshot dolly_snapshot;
+
+struct dolly_history_input
+{
+    uint64_t instruction;
+    dolly_replay_event kind;
+    size_t size;
+    uint8_t* data;
+};
+
+typedef struct dolly_history_input dolly_history_input;
+
+struct dolly_history
+{
+    dolly_snapshot* ring[DOLLY_HISTORY_MAX_SNAPSHOTS];
+    size_t first, count;
+    uint64_t interval;
+    uint64_t next_snapshot_cycles;
+    size_t budget, memory_used;
+
+    uint8_t* shadow; // Guest memory as of the newest snapshot
+
+    dolly_history_input* inputs;
+    size_t input_count, input_capacity;
+    size_t input_cursor; // Next journaled input to feed back
+
+    uint64_t frontier; // Furthest instruction count ever executed
+};
+
+typedef struct dolly_history dolly_history;
+
+// Takes the first snapshot of a freshly loaded VM and attaches to it
+void dolly_history_init(dolly_history* history, dolly_vm* vm,
+                        uint64_t interval, size_t budget);
+void dolly_history_destroy(dolly_history* history);
+
+// Executes one instruction, taking a snapshot when one is due
+bool dolly_history_step(dolly_history* history, dolly_vm* vm);
+
+// Moves the VM to the point where the given number of instructions had
+// retired. Returns false if that is further back than the history reaches,
+// leaving the VM at the oldest snapshot.
+bool dolly_history_seek(dolly_history* history, dolly_vm* vm,
+                        uint64_t instruction);
+
+// Moves the VM back to just before the most recent instruction that wrote
+// address. Returns false, leaving the VM where it was, if no write to it is
+// within reach.
+bool dolly_history_find_last_write(dolly_history* history, dolly_vm* vm,
+                                   uint16_t address);
+
+// The oldest instruction count the history can return to
+uint64_t dolly_history_oldest(const dolly_history* history);
+
+// Journaled input for re-execution. Returns false once past the journal.
+bool dolly_history_replay_input(dolly_history* history,
+                                dolly_replay_event kind, uint64_t instruction,
+                                uint8_t* data, size_t capacity, size_t* size);
+void dolly_history_record_input(dolly_history* history,
+                                dolly_replay_event kind, uint64_t instruction,
+                                const uint8_t* data, size_t size);
+
+// Whether the VM is re-executing instructions it has already run once
+static inline bool dolly_history_in_past(const dolly_history* history,
+                                         uint64_t instruction)
+{
+    return instruction <= history->frontier;
+}
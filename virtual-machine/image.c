@@ -0,0 +1,61 @@
+#define _GNU_SOURCE // memfd_create
+
+#include "virtual-machine/image.h"
+
+#include "virtual-machine/cpu.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+dolly_image_status dolly_image_init(dolly_image* image,
+                                    const dolly_executable* exec)
+{
+    image->exec = exec;
+    image->fd = -1;
+    if (!dolly_executable_is_6502(exec)) return DOLLY_IMAGE_OKAY;
+
+    int fd = memfd_create("dolly-image", 0);
+    if (fd == -1) return DOLLY_IMAGE_MAP_FAILED;
+    if (ftruncate(fd, DOLLY_CPU_MEMORY_SIZE) == -1) {
+        close(fd);
+        return DOLLY_IMAGE_MAP_FAILED;
+    }
+
+    uint8_t* memory = mmap(NULL, DOLLY_CPU_MEMORY_SIZE,
+                           PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        close(fd);
+        return DOLLY_IMAGE_MAP_FAILED;
+    }
+
+    // Sections that don't fit are left for dolly_vm_load to report
+    for (size_t i = 0; i < exec->header.section_count; ++i) {
+        const dolly_executable_section* section = &exec->sections[i];
+        if (!dolly_section_is_loaded(section)
+            || (uint64_t)section->load_address + section->size
+               > DOLLY_CPU_MEMORY_SIZE) {
+            continue;
+        }
+        dolly_executable_load_section(exec, section,
+                                      memory + section->load_address);
+    }
+
+    munmap(memory, DOLLY_CPU_MEMORY_SIZE);
+    image->fd = fd;
+    return DOLLY_IMAGE_OKAY;
+}
+
+void dolly_image_destroy(dolly_image* image)
+{
+    // VMs keep their own references to the file
+    if (image->fd != -1) close(image->fd);
+    image->fd = -1;
+}
+
+const char* dolly_image_error_msg(dolly_image_status status)
+{
+    switch (status) {
+    default: case DOLLY_IMAGE_OKAY: return "";
+    case DOLLY_IMAGE_MAP_FAILED: return "couldn't map image memory";
+    }
+}
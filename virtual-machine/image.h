@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core/core.h"
+
+// Guest memory images shared between VMs in one process
+//
+// An image is guest memory as an executable loads it, held in a memory file.
+// Each VM loaded from the image maps the file privately over its memory, so
+// every page is shared by all of them until one writes to it, and the writer
+// then gets a copy of just that page. Loading maps 64KB rather than copying
+// each section in, and a text page costs host memory once however many VMs
+// run it.
+//
+// Only bank 0 is in the image. Banked sections and 65816 executables are
+// loaded into each VM as usual.
+
+struct dolly_image
+{
+    const dolly_executable* exec; // Must outlive the image and its VMs
+    int fd; // -1 if nothing can be shared
+};
+
+typedef struct dolly_image dolly_image;
+
+enum dolly_image_status
+{
+    DOLLY_IMAGE_OKAY, DOLLY_IMAGE_MAP_FAILED
+};
+
+typedef enum dolly_image_status dolly_image_status;
+
+dolly_image_status dolly_image_init(dolly_image* image,
+                                    const dolly_executable* exec);
+void dolly_image_destroy(dolly_image* image);
+
+const char* dolly_image_error_msg(dolly_image_status status);
@@ -1,113 +1,481 @@
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-#include <unistd.h>
 #include <errno.h>
 
 #include "core/core.h"
 
-#include "virtual-machine/cpu.h"
-#include "virtual-machine/env.h"
+#include "virtual-machine/coverage.h"
+#include "virtual-machine/heatmap.h"
+#include "virtual-machine/mapper.h"
+#include "virtual-machine/debugger.h"
+#include "virtual-machine/fuzz.h"
+#include "virtual-machine/profiler.h"
+#include "virtual-machine/replay.h"
+#include "virtual-machine/state.h"
+#include "virtual-machine/stats.h"
+#include "virtual-machine/trace.h"
+#include "virtual-machine/vm.h"
 
 int main(int argc, char** argv)
 {
     if (argc < 2) {
         printf("Usage: %s [options] <executable>\n", argv[0]);
-        puts("Options:\n\t-d\tPrint debug information after execution");
+        puts("Options:\n"
+             "\t-d\t\t\tPrint debug information after execution\n"
+             "\t--protect-text\t\tFault on stores to text sections\n"
+             "\t--bank-window <base>:<size>:<register>\n"
+             "\t\t\t\tSwitch the bank behind a range of memory by\n"
+             "\t\t\t\twriting to register (hexadecimal)\n"
+             "\t--sample-rate <hz>\tSample the guest PC at the given rate\n"
+             "\t--profile-output <file>\tWrite the sample histogram to file\n"
+             "\t\t\t\t(default: dolly-vm.prof)\n"
+             "\t--stats\t\t\tPrint execution statistics after execution\n"
+             "\t--stats-json <file>\tWrite execution statistics as JSON\n"
+             "\t\t\t\t('-' for standard output)\n"
+             "\t--coverage <file>\tWrite instruction and branch coverage to file\n"
+             "\t--heatmap <file>\tWrite a memory access report to file\n"
+             "\t--heatmap-dump <file>\tWrite raw memory access counts to file\n"
+             "\t--trace <file>\t\tWrite a binary execution trace to file\n"
+             "\t--trace-compress\tCompress the execution trace\n"
+             "\t--record <file>\t\tRecord the run's inputs to file\n"
+             "\t--replay <file>\t\tReplay a run using inputs recorded to file\n"
+             "\t--debug\t\t\tRun under the time-travel debugger\n"
+             "\t--snapshot-interval <cycles>\n"
+             "\t\t\t\tCycles between debugger snapshots\n"
+             "\t--history-budget <kb>\tMemory limit for debugger snapshots\n"
+             "\t--fuzz <addr>\t\tFuzz the program with inputs written to addr\n"
+             "\t--fuzz-max-length <n>\tLongest input to generate (default: 256)\n"
+             "\t--fuzz-timeout <cycles>\tCycles before an input counts as a hang\n"
+             "\t--fuzz-runs <n>\t\tStop after n executions\n"
+             "\t--fuzz-corpus <dir>\tRead seed inputs from dir\n"
+             "\t--fuzz-output <dir>\tSave new inputs, crashes and hangs to dir\n"
+             "\t--state <file>\t\tKeep guest memory and registers in file,\n"
+             "\t\t\t\tresuming from any state saved there");
         return 0;
     }
 
+    const char* exec_path = NULL;
+    const char* profile_path = "dolly-vm.prof";
+    const char* stats_json_path = NULL;
+    const char* trace_path = NULL;
+    const char* coverage_path = NULL;
+    const char* heatmap_path = NULL;
+    const char* heatmap_dump_path = NULL;
+    const char* replay_path = NULL;
+    const char* state_path = NULL;
+    dolly_replay_mode replay_mode = DOLLY_REPLAY_RECORD;
+    bool compress_trace = false;
     bool print_debug_at_end = false;
-    for (char* const* arg = &argv[0]; *arg; ++arg) {
-        if (strcmp(*arg, "-d") == 0) print_debug_at_end = true;
+    bool protect_text = false;
+    dolly_bank_window windows[DOLLY_MAPPER_MAX_WINDOWS];
+    size_t window_count = 0;
+    bool print_stats = false;
+    bool debug = false;
+    uint64_t snapshot_interval = DOLLY_HISTORY_DEFAULT_INTERVAL;
+    size_t history_budget = DOLLY_HISTORY_DEFAULT_BUDGET;
+    bool fuzz = false;
+    dolly_fuzz_config fuzz_config = {
+        .max_length = DOLLY_FUZZ_DEFAULT_MAX_LENGTH,
+        .timeout = DOLLY_FUZZ_DEFAULT_TIMEOUT
+    };
+    int sample_rate = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-d") == 0) {
+            print_debug_at_end = true;
+        } else if (strcmp(argv[i], "--protect-text") == 0) {
+            protect_text = true;
+        } else if (strcmp(argv[i], "--bank-window") == 0 && i + 1 < argc) {
+            unsigned base, size, register_address;
+            char end;
+            if (window_count == DOLLY_MAPPER_MAX_WINDOWS
+                || sscanf(argv[++i], "%x:%x:%x%c", &base, &size,
+                          &register_address, &end) != 3
+                || base > 0xFFFF || register_address > 0xFFFF) {
+                printf("Invalid bank window '%s'\n", argv[i]);
+                return 1;
+            }
+            windows[window_count++] = (dolly_bank_window) {
+                .base = base, .size = size,
+                .register_address = register_address
+            };
+        } else if (strcmp(argv[i], "--sample-rate") == 0 && i + 1 < argc) {
+            sample_rate = atoi(argv[++i]);
+            if (sample_rate <= 0) {
+                printf("Invalid sample rate '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--profile-output") == 0 && i + 1 < argc) {
+            profile_path = argv[++i];
+            if (sample_rate == 0) sample_rate = DOLLY_PROFILER_DEFAULT_RATE;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            print_stats = true;
+        } else if (strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc) {
+            stats_json_path = argv[++i];
+        } else if (strcmp(argv[i], "--coverage") == 0 && i + 1 < argc) {
+            coverage_path = argv[++i];
+        } else if (strcmp(argv[i], "--heatmap") == 0 && i + 1 < argc) {
+            heatmap_path = argv[++i];
+        } else if (strcmp(argv[i], "--heatmap-dump") == 0 && i + 1 < argc) {
+            heatmap_dump_path = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--trace-compress") == 0) {
+            compress_trace = true;
+        } else if ((strcmp(argv[i], "--record") == 0
+                    || strcmp(argv[i], "--replay") == 0) && i + 1 < argc) {
+            if (replay_path) {
+                printf("Only one of --record and --replay may be given\n");
+                return 1;
+            }
+            replay_mode = strcmp(argv[i], "--record") == 0
+                        ? DOLLY_REPLAY_RECORD : DOLLY_REPLAY_PLAY;
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--debug") == 0) {
+            debug = true;
+        } else if (strcmp(argv[i], "--snapshot-interval") == 0
+                   && i + 1 < argc) {
+            snapshot_interval = strtoull(argv[++i], NULL, 10);
+            if (snapshot_interval == 0) {
+                printf("Invalid snapshot interval '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--history-budget") == 0 && i + 1 < argc) {
+            history_budget = strtoull(argv[++i], NULL, 10) * 1024;
+            if (history_budget == 0) {
+                printf("Invalid history budget '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--fuzz") == 0 && i + 1 < argc) {
+            char* end;
+            const char* text = argv[++i];
+            if (text[0] == '$') ++text;
+            long address = strtol(text, &end, 16);
+            if (*text == '\0' || *end != '\0' || address < 0
+                || address > 0xFFFF) {
+                printf("Invalid fuzz buffer address '%s'\n", argv[i]);
+                return 1;
+            }
+            fuzz_config.buffer_address = (uint16_t) address;
+            fuzz = true;
+        } else if (strcmp(argv[i], "--fuzz-max-length") == 0 && i + 1 < argc) {
+            fuzz_config.max_length = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--fuzz-timeout") == 0 && i + 1 < argc) {
+            fuzz_config.timeout = strtoull(argv[++i], NULL, 10);
+            if (fuzz_config.timeout == 0) {
+                printf("Invalid fuzz timeout '%s'\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--fuzz-runs") == 0 && i + 1 < argc) {
+            fuzz_config.runs = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--fuzz-corpus") == 0 && i + 1 < argc) {
+            fuzz_config.corpus_dir = argv[++i];
+        } else if (strcmp(argv[i], "--fuzz-output") == 0 && i + 1 < argc) {
+            fuzz_config.output_dir = argv[++i];
+        } else if (strcmp(argv[i], "--state") == 0 && i + 1 < argc) {
+            state_path = argv[++i];
+        } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            printf("Unrecognised option '%s'\n", argv[i]);
+            return 1;
+        } else {
+            exec_path = argv[i];
+        }
+    }
+
+    if (exec_path == NULL) {
+        printf("No executable given\n");
+        return 1;
+    }
+
+    // Each of these has its own run loop
+    int run_modes = (trace_path != NULL) + (print_stats || stats_json_path)
+                  + (coverage_path != NULL)
+                  + (heatmap_path || heatmap_dump_path) + debug + fuzz;
+    if (run_modes > 1) {
+        printf("Only one of --trace, --stats, --coverage, --heatmap, --debug "
+               "and --fuzz may be given\n");
+        return 1;
     }
 
-    FILE* file = fopen(argv[1], "r");
-    if (!file) {
-        printf("Failed to open file '%s': %s\n", argv[1], strerror(errno));
+    // Snapshots and resets only cover the banks currently mapped
+    if (window_count > 0 && (debug || fuzz)) {
+        printf("Bank windows cannot be combined with --debug or --fuzz\n");
         return 1;
     }
 
-    tb_streambuf file_buf = tb_streambuf_new(128);
-    tb_streambuf_status sb_status = tb_streambuf_read_all(&file_buf, file);
-    fclose(file);
+    if (fuzz && replay_path) {
+        printf("Fuzzing cannot be combined with record or replay\n");
+        return 1;
+    }
 
-    if (sb_status != TB_STREAMBUF_OKAY) {
-        printf("Failed to read file '%s': %s\n", argv[1], strerror(errno));
+    // These all assume the guest starts from the beginning, in memory of
+    // its own
+    if (state_path && (window_count > 0 || debug || fuzz || replay_path)) {
+        printf("--state cannot be combined with bank windows, --debug, "
+               "--fuzz, --record or --replay\n");
         return 1;
     }
 
+    // Mapped rather than read so only the pages loaded are brought in, and
+    // section data is copied once, straight into guest memory
     dolly_executable exec;
     dolly_executable_init(&exec);
-    dolly_executable_status de_status
-        = dolly_executable_read(&exec, (const uint8_t*) file_buf.data,
-                                file_buf.size);
-    tb_streambuf_destroy(&file_buf);
+    dolly_executable_status de_status = dolly_executable_map(&exec, exec_path);
 
     if (de_status != DOLLY_EXEC_OKAY) {
-        printf("Failed to read binary '%s': %s\n", argv[1],
-               dolly_executable_error_msg(de_status));
+        printf("Failed to read binary '%s': %s\n", exec_path,
+               de_status == DOLLY_EXEC_IO_ERROR
+               ? strerror(errno) : dolly_executable_error_msg(de_status));
+        dolly_executable_destroy(&exec);
         return 1;
     }
 
-    dolly_cpu cpu;
-    dolly_cpu_init(&cpu);
+    // The instrumented run loops and memory tools only know the 6502 core
+    if (!dolly_executable_is_6502(&exec)
+        && (run_modes > 0 || sample_rate > 0 || window_count > 0
+            || protect_text || state_path)) {
+        printf("Only plain runs, -d and --record/--replay are supported for "
+               "65816 executables\n");
+        dolly_executable_destroy(&exec);
+        return 1;
+    }
 
-    bool found_start = false;
+    dolly_vm vm;
+    dolly_vm_init(&vm);
+    vm.protect_text = protect_text;
 
-    for (uint8_t i = 0; i < exec.header.section_count; ++i) {
-        dolly_executable_section* section = &exec.sections[i];
-        if (section->load_address + section->size > DOLLY_CPU_MEMORY_SIZE) {
-            continue;
+    dolly_mapper mapper;
+    if (window_count > 0) {
+        dolly_mapper_status mapper_status = dolly_mapper_init(&mapper, &vm.cpu);
+        if (mapper_status == DOLLY_MAPPER_OKAY) vm.mapper = &mapper;
+        for (size_t i = 0; i < window_count
+                           && mapper_status == DOLLY_MAPPER_OKAY; ++i) {
+            mapper_status
+                = dolly_mapper_add_window(&mapper, windows[i].base,
+                                          windows[i].size,
+                                          windows[i].register_address);
         }
-        memcpy(cpu.memory + section->load_address,
-               exec.program_data + section->offset,
-               section->size);
-        if (strcmp(section->name, "_start") == 0
-            && section->type == DOLLY_SECTION_TEXT) {
-            cpu.program_counter = (uint16_t) section->load_address;
-            found_start = true;
+        if (mapper_status != DOLLY_MAPPER_OKAY) {
+            printf("Couldn't set up bank windows: %s\n",
+                   dolly_mapper_error_msg(mapper_status));
+            dolly_executable_destroy(&exec);
+            dolly_vm_destroy(&vm);
+            return 1;
         }
     }
 
-    dolly_executable_destroy(&exec);
+    dolly_state state;
+    if (state_path) {
+        dolly_state_status state_status
+            = dolly_state_open(&state, state_path, &vm, &exec);
+        if (state_status != DOLLY_STATE_OKAY) {
+            printf("Failed to open state '%s': %s\n", state_path,
+                   state_status == DOLLY_STATE_IO_ERROR
+                   ? strerror(errno) : dolly_state_error_msg(state_status));
+            dolly_executable_destroy(&exec);
+            dolly_vm_destroy(&vm);
+            return 1;
+        }
+    }
 
-    if (!found_start) {
-        printf("Couldn't run executable: text section '_start' not found\n");
-        dolly_cpu_destroy(&cpu);
+    dolly_vm_status vm_status = state_path && state.resumed
+                              ? dolly_vm_resume(&vm, &exec)
+                              : dolly_vm_load(&vm, &exec);
+    if (vm_status != DOLLY_VM_OKAY) {
+        printf("Couldn't run executable: %s\n", dolly_vm_error_msg(vm_status));
+        dolly_executable_destroy(&exec);
+        dolly_vm_destroy(&vm);
         return 1;
     }
 
-    int cycles = 0;
-    bool run = true;
-    while (run) {
-        int delay = dolly_cpu_read_next_instruction(&cpu);
-        if (delay == -1) break;
-        if (cpu.flags.break_flag) {
-            switch (cpu.reg_a) {
-            case DOLLY_SYSCALL_EXIT:
-                run = false;
-                break;
-            case DOLLY_SYSCALL_PRINT: {
-                uint16_t print_vec = cpu.memory[0xFE]
-                                   + ((uint16_t)cpu.memory[0xFF] << 8);
-                printf("%s", (const char*)cpu.memory + print_vec);
-                break;
+    dolly_coverage coverage;
+    if (coverage_path) dolly_coverage_init(&coverage, &vm.cpu, &exec);
+
+    FILE* replay_file = NULL;
+    dolly_replay_log replay;
+    if (replay_path) {
+        bool recording = replay_mode == DOLLY_REPLAY_RECORD;
+        replay_file = fopen(replay_path, recording ? "wb" : "rb");
+        if (!replay_file) {
+            printf("Failed to open file '%s': %s\n", replay_path,
+                   strerror(errno));
+            dolly_executable_destroy(&exec);
+            dolly_vm_destroy(&vm);
+            return 1;
+        }
+        dolly_replay_status replay_status
+            = dolly_replay_open(&replay, replay_file, replay_mode);
+        if (replay_status != DOLLY_REPLAY_OKAY) {
+            printf("Failed to open replay log '%s': %s\n", replay_path,
+                   dolly_replay_error_msg(replay_status));
+            fclose(replay_file);
+            dolly_executable_destroy(&exec);
+            dolly_vm_destroy(&vm);
+            return 1;
+        }
+        vm.replay = &replay;
+    }
+
+    dolly_profiler profiler;
+    if (sample_rate > 0) {
+        dolly_profiler_status prof_status
+            = dolly_profiler_start(&profiler, &vm.cpu, sample_rate);
+        if (prof_status != DOLLY_PROFILER_OKAY) {
+            printf("Failed to start profiler: %s\n",
+                   dolly_profiler_error_msg(prof_status));
+            dolly_executable_destroy(&exec);
+            dolly_vm_destroy(&vm);
+            return 1;
+        }
+    }
+
+    dolly_vm_stats stats;
+    dolly_heatmap* heatmap = NULL;
+    if (fuzz) {
+        dolly_fuzzer fuzzer;
+        dolly_fuzz_status fuzz_status
+            = dolly_fuzzer_init(&fuzzer, &vm, &fuzz_config);
+        if (fuzz_status != DOLLY_FUZZ_OKAY) {
+            printf("Failed to start fuzzer: %s\n",
+                   dolly_fuzz_error_msg(fuzz_status));
+            dolly_fuzzer_destroy(&fuzzer);
+            dolly_executable_destroy(&exec);
+            dolly_vm_destroy(&vm);
+            return 1;
+        }
+        dolly_fuzzer_run(&fuzzer);
+        dolly_fuzzer_destroy(&fuzzer);
+    } else if (debug) {
+        dolly_debugger debugger;
+        dolly_debugger_init(&debugger, &vm, snapshot_interval, history_budget);
+        dolly_debugger_run(&debugger);
+        dolly_debugger_destroy(&debugger);
+    } else if (trace_path) {
+        FILE* trace_file = fopen(trace_path, "wb");
+        dolly_trace_writer writer;
+        if (!trace_file
+            || !dolly_trace_writer_open(&writer, trace_file, compress_trace,
+                                        vm.cpu.variant)) {
+            printf("Failed to open trace '%s': %s\n", trace_path,
+                   strerror(errno));
+            if (trace_file) fclose(trace_file);
+            dolly_executable_destroy(&exec);
+            dolly_vm_destroy(&vm);
+            return 1;
+        }
+        dolly_vm_run_trace(&vm, &writer);
+        if (!dolly_trace_writer_close(&writer))
+            printf("Failed to write trace '%s'\n", trace_path);
+        fclose(trace_file);
+    } else if (print_stats || stats_json_path) {
+        dolly_vm_stats_init(&stats);
+        dolly_vm_run_stats(&vm, &stats);
+    } else if (coverage_path) {
+        dolly_vm_run_coverage(&vm, &coverage);
+    } else if (heatmap_path || heatmap_dump_path) {
+        heatmap = dolly_heatmap_new();
+        dolly_vm_run_heatmap(&vm, heatmap);
+    } else {
+        dolly_vm_run(&vm);
+    }
+
+    int exit_code = 0;
+    if (state_path && !dolly_state_close(&state, &vm)) {
+        printf("Failed to save state '%s': %s\n", state_path,
+               strerror(errno));
+        exit_code = 1;
+    }
+
+    if (replay_path) {
+        dolly_replay_status replay_status = dolly_replay_finish(&replay);
+        if (replay_status != DOLLY_REPLAY_OKAY) {
+            printf("Replay of '%s' failed after %llu inputs: %s\n",
+                   replay_path, (unsigned long long)replay.events,
+                   dolly_replay_error_msg(replay_status));
+            exit_code = 1;
+        }
+        fclose(replay_file);
+    }
+
+    if (sample_rate > 0) {
+        dolly_profiler_stop(&profiler);
+        FILE* profile_file = fopen(profile_path, "w");
+        if (!profile_file) {
+            printf("Failed to open file '%s': %s\n", profile_path,
+                   strerror(errno));
+        } else {
+            // Only needed here, so only looked up here
+            dolly_symbols symbols;
+            dolly_symbols_open(&symbols, &exec);
+            dolly_profiler_write_histogram(&profiler, &symbols, &exec,
+                                           profile_file);
+            dolly_symbols_close(&symbols);
+            fclose(profile_file);
+        }
+        dolly_profiler_destroy(&profiler);
+    }
+
+    if (print_stats) dolly_vm_stats_write(&stats, stdout);
+
+    if (coverage_path) {
+        FILE* coverage_file = fopen(coverage_path, "w");
+        if (!coverage_file) {
+            printf("Failed to open file '%s': %s\n", coverage_path,
+                   strerror(errno));
+        } else {
+            dolly_coverage_write(&coverage, &vm.cpu, coverage_file);
+            fclose(coverage_file);
+        }
+        dolly_coverage_destroy(&coverage);
+    }
+
+    if (heatmap) {
+        if (heatmap_path) {
+            FILE* heatmap_file = fopen(heatmap_path, "w");
+            if (!heatmap_file) {
+                printf("Failed to open file '%s': %s\n", heatmap_path,
+                       strerror(errno));
+            } else {
+                dolly_heatmap_write(heatmap, heatmap_file);
+                fclose(heatmap_file);
             }
-            default:
-                puts("Invalid syscall, exiting");
-                run = false;
-                break;
+        }
+        if (heatmap_dump_path) {
+            FILE* dump_file = fopen(heatmap_dump_path, "wb");
+            if (!dump_file) {
+                printf("Failed to open file '%s': %s\n", heatmap_dump_path,
+                       strerror(errno));
+            } else {
+                if (!dolly_heatmap_dump(heatmap, dump_file))
+                    printf("Failed to write '%s'\n", heatmap_dump_path);
+                fclose(dump_file);
             }
-            cpu.flags.break_flag = 0;
         }
-        cycles += delay;
+        dolly_heatmap_free(heatmap);
+    }
+
+    if (stats_json_path) {
+        FILE* json_file = strcmp(stats_json_path, "-") == 0
+                        ? stdout : fopen(stats_json_path, "w");
+        if (!json_file) {
+            printf("Failed to open file '%s': %s\n", stats_json_path,
+                   strerror(errno));
+        } else {
+            dolly_vm_stats_write_json(&stats, json_file);
+            if (json_file != stdout) fclose(json_file);
+        }
     }
 
     if (print_debug_at_end) {
-        printf("\n\nExecution done: %d cycles\nProcessor status:\n", cycles);
-        dolly_cpu_debug(&cpu);
+        printf("\n\nExecution done: %llu cycles\nProcessor status:\n",
+               (unsigned long long)vm.cycles);
+        if (vm.cpu65816) dolly_cpu65816_debug(vm.cpu65816);
+        else dolly_cpu_debug(&vm.cpu);
     }
-    return 0;
+
+    dolly_vm_destroy(&vm);
+    dolly_executable_destroy(&exec);
+    return exit_code;
 }
@@ -0,0 +1,183 @@
+#define _GNU_SOURCE // memfd_create
+
+#include "virtual-machine/mapper.h"
+
+#include "core/core.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define DOLLY_MAPPER_PHYSICAL_SIZE \
+    ((size_t) DOLLY_MAPPER_BANK_COUNT * DOLLY_CPU_MEMORY_SIZE)
+
+static void dolly_mapper_io_write(void* context, uint16_t address,
+                                  uint8_t value);
+static void dolly_mapper_populate(dolly_mapper* mapper, uint8_t bank);
+
+static void dolly_mapper_io_write(void* context, uint16_t address,
+                                  uint8_t value)
+{
+    dolly_mapper* mapper = context;
+    for (size_t i = 0; i < mapper->window_count; ++i) {
+        if (mapper->windows[i].register_address == address)
+            dolly_mapper_select(mapper, &mapper->windows[i], value);
+    }
+}
+
+static void dolly_mapper_populate(dolly_mapper* mapper, uint8_t bank)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < mapper->pending_count; ++i) {
+        const dolly_bank_segment* segment = &mapper->pending[i];
+        if (dolly_section_bank(segment->section) == bank) {
+            dolly_executable_load_section(segment->exec, segment->section,
+                mapper->physical + segment->section->load_address);
+        } else {
+            mapper->pending[kept++] = *segment;
+        }
+    }
+    mapper->pending_count = kept;
+    mapper->populated[bank] = true;
+}
+
+dolly_mapper_status dolly_mapper_init(dolly_mapper* mapper, dolly_cpu* cpu)
+{
+    memset(mapper, 0, sizeof(dolly_mapper));
+    mapper->cpu = cpu;
+
+    mapper->fd = memfd_create("dolly-banks", 0);
+    if (mapper->fd == -1) return DOLLY_MAPPER_MAP_FAILED;
+    if (ftruncate(mapper->fd, DOLLY_MAPPER_PHYSICAL_SIZE) == -1) {
+        close(mapper->fd);
+        return DOLLY_MAPPER_MAP_FAILED;
+    }
+
+    mapper->physical = mmap(NULL, DOLLY_MAPPER_PHYSICAL_SIZE,
+                            PROT_READ | PROT_WRITE, MAP_SHARED, mapper->fd, 0);
+    if (mapper->physical == MAP_FAILED) {
+        close(mapper->fd);
+        return DOLLY_MAPPER_MAP_FAILED;
+    }
+
+    memcpy(mapper->physical, cpu->memory, DOLLY_CPU_MEMORY_SIZE);
+    if (mmap(cpu->memory, DOLLY_CPU_MEMORY_SIZE, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_FIXED, mapper->fd, 0) == MAP_FAILED) {
+        munmap(mapper->physical, DOLLY_MAPPER_PHYSICAL_SIZE);
+        close(mapper->fd);
+        return DOLLY_MAPPER_MAP_FAILED;
+    }
+
+    mapper->populated[0] = true; // Guest memory as it was
+    cpu->io_write = dolly_mapper_io_write;
+    cpu->io_context = mapper;
+    return DOLLY_MAPPER_OKAY;
+}
+
+void dolly_mapper_destroy(dolly_mapper* mapper)
+{
+    // Guest memory keeps its own reference to the file until the CPU goes
+    for (size_t i = 0; i < mapper->window_count; ++i) {
+        mapper->cpu->page_flags[mapper->windows[i].register_address >> 8]
+            &= ~DOLLY_CPU_PAGE_IO;
+    }
+    mapper->cpu->io_write = NULL;
+    mapper->cpu->io_context = NULL;
+    munmap(mapper->physical, DOLLY_MAPPER_PHYSICAL_SIZE);
+    close(mapper->fd);
+    if (mapper->pending) dolly_free(mapper->pending);
+}
+
+dolly_mapper_status dolly_mapper_add_window(dolly_mapper* mapper,
+                                            uint16_t base, uint32_t size,
+                                            uint16_t register_address)
+{
+    long host_page_size = sysconf(_SC_PAGESIZE);
+
+    if (mapper->window_count == DOLLY_MAPPER_MAX_WINDOWS)
+        return DOLLY_MAPPER_TOO_MANY_WINDOWS;
+    if (size == 0 || base % host_page_size != 0 || size % host_page_size != 0
+        || base + size > DOLLY_CPU_MEMORY_SIZE) {
+        return DOLLY_MAPPER_UNALIGNED_WINDOW;
+    }
+    for (size_t i = 0; i < mapper->window_count; ++i) {
+        const dolly_bank_window* other = &mapper->windows[i];
+        if (base < other->base + other->size && other->base < base + size)
+            return DOLLY_MAPPER_OVERLAPPING_WINDOWS;
+    }
+
+    mapper->windows[mapper->window_count++] = (dolly_bank_window) {
+        .base = base, .size = size, .register_address = register_address,
+        .bank = 0
+    };
+    mapper->cpu->page_flags[register_address >> 8] |= DOLLY_CPU_PAGE_IO;
+    return DOLLY_MAPPER_OKAY;
+}
+
+dolly_bank_window* dolly_mapper_find_window(dolly_mapper* mapper,
+                                            uint16_t address, uint32_t size)
+{
+    for (size_t i = 0; i < mapper->window_count; ++i) {
+        dolly_bank_window* window = &mapper->windows[i];
+        if (address >= window->base
+            && address + size <= window->base + window->size) {
+            return window;
+        }
+    }
+    return NULL;
+}
+
+void dolly_mapper_select(dolly_mapper* mapper, dolly_bank_window* window,
+                         uint8_t bank)
+{
+    if (window->bank == bank) return;
+    if (!mapper->populated[bank]) dolly_mapper_populate(mapper, bank);
+
+    off_t offset = (off_t) bank * DOLLY_CPU_MEMORY_SIZE + window->base;
+    if (mmap(mapper->cpu->memory + window->base, window->size,
+             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, mapper->fd,
+             offset) == MAP_FAILED) {
+        // The old mapping may be gone, so there's nothing safe to run
+        perror("mmap");
+        abort();
+    }
+    window->bank = bank;
+    // The contents changed underneath anything tracking the pages
+    dolly_cpu_mark_dirty(mapper->cpu, window->base, window->size);
+}
+
+void dolly_mapper_load(dolly_mapper* mapper, const dolly_executable* exec,
+                       const dolly_executable_section* section)
+{
+    if (mapper->populated[dolly_section_bank(section)]) {
+        dolly_executable_load_section(exec, section,
+            mapper->physical + section->load_address);
+        return;
+    }
+
+    if (mapper->pending_count == mapper->pending_capacity) {
+        mapper->pending_capacity = mapper->pending_capacity
+                                 ? mapper->pending_capacity * 2 : 8;
+        mapper->pending
+            = realloc_or_abort(mapper->pending, mapper->pending_capacity
+                                                * sizeof(dolly_bank_segment));
+    }
+    mapper->pending[mapper->pending_count++] = (dolly_bank_segment) {
+        .exec = exec, .section = section
+    };
+}
+
+const char* dolly_mapper_error_msg(dolly_mapper_status status)
+{
+    switch (status) {
+    default: case DOLLY_MAPPER_OKAY: return "";
+    case DOLLY_MAPPER_MAP_FAILED: return "couldn't map banked memory";
+    case DOLLY_MAPPER_TOO_MANY_WINDOWS: return "too many bank windows";
+    case DOLLY_MAPPER_UNALIGNED_WINDOW: return "bank window isn't aligned to "
+                                               "host pages";
+    case DOLLY_MAPPER_OVERLAPPING_WINDOWS: return "bank windows overlap";
+    }
+}
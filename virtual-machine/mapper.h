@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core/core.h"
+
+#include "virtual-machine/cpu.h"
+
+#define DOLLY_MAPPER_MAX_WINDOWS 8
+#define DOLLY_MAPPER_BANK_COUNT  256
+
+// Bank switching for guest images larger than 64KB
+//
+// Physical memory is 256 banks of 64KB each, held in one sparse memory file
+// so untouched banks cost nothing. A section's bank is the top byte of its
+// 24-bit load address and the bytes live at that address in physical memory.
+// Bank 0 backs all of guest memory to begin with.
+//
+// A bank window is a range of guest memory with a register. Writing a bank
+// number to the register remaps the window onto the same range of that bank,
+// which changes the host page table rather than copying anything. Windows
+// must therefore be aligned to and a multiple of the host page size.
+//
+// Banks are populated on demand. Sections loaded into a bank other than 0
+// are only recorded, and copied in the first time the bank is selected, so a
+// large image costs only as much memory and load time as the banks the guest
+// actually uses.
+
+struct dolly_bank_window
+{
+    uint16_t base;
+    uint32_t size;
+    uint16_t register_address;
+    uint8_t  bank; // Currently mapped
+};
+
+typedef struct dolly_bank_window dolly_bank_window;
+
+struct dolly_bank_segment
+{
+    const dolly_executable* exec;
+    const dolly_executable_section* section;
+};
+
+typedef struct dolly_bank_segment dolly_bank_segment;
+
+struct dolly_mapper
+{
+    dolly_cpu* cpu;
+    int fd;
+    uint8_t* physical; // All banks
+    dolly_bank_window windows[DOLLY_MAPPER_MAX_WINDOWS];
+    size_t window_count;
+
+    bool populated[DOLLY_MAPPER_BANK_COUNT];
+    dolly_bank_segment* pending; // Segments of banks not yet populated
+    size_t pending_count, pending_capacity;
+};
+
+typedef struct dolly_mapper dolly_mapper;
+
+enum dolly_mapper_status
+{
+    DOLLY_MAPPER_OKAY, DOLLY_MAPPER_MAP_FAILED, DOLLY_MAPPER_TOO_MANY_WINDOWS,
+    DOLLY_MAPPER_UNALIGNED_WINDOW, DOLLY_MAPPER_OVERLAPPING_WINDOWS
+};
+
+typedef enum dolly_mapper_status dolly_mapper_status;
+
+// Moves the CPU's memory into bank 0, keeping its contents
+dolly_mapper_status dolly_mapper_init(dolly_mapper* mapper, dolly_cpu* cpu);
+void dolly_mapper_destroy(dolly_mapper* mapper);
+
+dolly_mapper_status dolly_mapper_add_window(dolly_mapper* mapper,
+                                            uint16_t base, uint32_t size,
+                                            uint16_t register_address);
+
+// The window covering size bytes from address, or NULL if none does
+dolly_bank_window* dolly_mapper_find_window(dolly_mapper* mapper,
+                                            uint16_t address, uint32_t size);
+void dolly_mapper_select(dolly_mapper* mapper, dolly_bank_window* window,
+                         uint8_t bank);
+
+// Loads a section at its 24-bit load address in physical memory, deferring
+// the copy until the bank is first selected. The executable must stay valid
+// until then.
+void dolly_mapper_load(dolly_mapper* mapper, const dolly_executable* exec,
+                       const dolly_executable_section* section);
+
+const char* dolly_mapper_error_msg(dolly_mapper_status status);
@@ -0,0 +1,268 @@
+#include "virtual-machine/profiler.h"
+
+#include "core/core.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct dolly_profiler_entry
+{
+    uint16_t program_counter;
+    uint64_t samples;
+};
+
+typedef struct dolly_profiler_entry dolly_profiler_entry;
+
+static void  dolly_profiler_handle_signal(int signal);
+static void  dolly_profiler_drain(dolly_profiler* profiler);
+static void* dolly_profiler_drain_loop(void* arg);
+static int   dolly_profiler_compare_entries(const void* a, const void* b);
+
+// Signal handlers cannot be passed any context
+static dolly_profiler* volatile active_profiler = NULL;
+
+static void dolly_profiler_handle_signal(int signal)
+{
+    (void) signal;
+    dolly_profiler* profiler = active_profiler;
+    if (profiler == NULL) return;
+
+    unsigned head = atomic_load_explicit(&profiler->ring_head,
+                                         memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&profiler->ring_tail,
+                                         memory_order_acquire);
+    if (head - tail >= DOLLY_PROFILER_RING_SIZE) {
+        atomic_fetch_add_explicit(&profiler->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    // The signal is delivered to the thread running the guest (the drain
+    // thread blocks it), so the CPU state cannot change underneath us here
+    dolly_profiler_sample* sample
+        = &profiler->ring[head & (DOLLY_PROFILER_RING_SIZE - 1)];
+    sample->program_counter = profiler->cpu->program_counter;
+    sample->call_depth = profiler->cpu->call_depth;
+    atomic_store_explicit(&profiler->ring_head, head + 1,
+                          memory_order_release);
+}
+
+static void dolly_profiler_drain(dolly_profiler* profiler)
+{
+    unsigned tail = atomic_load_explicit(&profiler->ring_tail,
+                                         memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&profiler->ring_head,
+                                         memory_order_acquire);
+
+    for (; tail != head; ++tail) {
+        const dolly_profiler_sample* sample
+            = &profiler->ring[tail & (DOLLY_PROFILER_RING_SIZE - 1)];
+        uint16_t depth = sample->call_depth;
+        if (depth > DOLLY_PROFILER_MAX_DEPTH) depth = DOLLY_PROFILER_MAX_DEPTH;
+        ++profiler->pc_histogram[sample->program_counter];
+        ++profiler->depth_histogram[depth];
+        ++profiler->samples;
+    }
+
+    atomic_store_explicit(&profiler->ring_tail, tail, memory_order_release);
+}
+
+static void* dolly_profiler_drain_loop(void* arg)
+{
+    dolly_profiler* profiler = arg;
+
+    // Wake up often enough that the ring is never more than a quarter full
+    long interval_ns = (long)((DOLLY_PROFILER_RING_SIZE / 4) * 1e9
+                              / profiler->sample_rate);
+    if (interval_ns > 10000000) interval_ns = 10000000;
+    if (interval_ns < 1000000) interval_ns = 1000000;
+    const struct timespec interval = {
+        .tv_sec = 0,
+        .tv_nsec = interval_ns
+    };
+
+    while (atomic_load(&profiler->draining)) {
+        dolly_profiler_drain(profiler);
+        nanosleep(&interval, NULL);
+    }
+
+    return NULL;
+}
+
+dolly_profiler_status dolly_profiler_start(dolly_profiler* profiler,
+                                           const dolly_cpu* cpu,
+                                           int sample_rate)
+{
+    if (sample_rate <= 0 || sample_rate > 1000000)
+        return DOLLY_PROFILER_INVALID_RATE;
+
+    memset(profiler, 0, sizeof(dolly_profiler));
+    profiler->cpu = cpu;
+    profiler->sample_rate = sample_rate;
+    profiler->pc_histogram
+        = malloc_or_abort(DOLLY_CPU_MEMORY_SIZE * sizeof(uint64_t));
+    memset(profiler->pc_histogram, 0,
+           DOLLY_CPU_MEMORY_SIZE * sizeof(uint64_t));
+    atomic_init(&profiler->ring_head, 0);
+    atomic_init(&profiler->ring_tail, 0);
+    atomic_init(&profiler->dropped, 0);
+    atomic_init(&profiler->draining, true);
+
+    struct sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_SIGNAL;
+    event.sigev_signo = SIGPROF;
+    // CPU-time clocks are only checked on scheduler ticks, which would cap
+    // the usable rate at a few hundred Hz, so a high resolution clock is used
+    if (timer_create(CLOCK_MONOTONIC, &event, &profiler->timer) != 0)
+        return DOLLY_PROFILER_TIMER_ERROR;
+
+    // The drain thread inherits this mask, leaving SIGPROF to the guest thread
+    sigset_t prof_set, old_set;
+    sigemptyset(&prof_set);
+    sigaddset(&prof_set, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &prof_set, &old_set);
+    int thread_error = pthread_create(&profiler->drain_thread, NULL,
+                                      dolly_profiler_drain_loop, profiler);
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+    if (thread_error != 0) {
+        timer_delete(profiler->timer);
+        return DOLLY_PROFILER_THREAD_ERROR;
+    }
+
+    active_profiler = profiler;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = dolly_profiler_handle_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+
+    long period_ns = 1000000000L / sample_rate;
+    struct itimerspec spec = {
+        .it_interval = {
+            .tv_sec = period_ns / 1000000000L,
+            .tv_nsec = period_ns % 1000000000L
+        }
+    };
+    spec.it_value = spec.it_interval;
+
+    if (timer_settime(profiler->timer, 0, &spec, NULL) != 0) {
+        dolly_profiler_stop(profiler);
+        return DOLLY_PROFILER_TIMER_ERROR;
+    }
+
+    return DOLLY_PROFILER_OKAY;
+}
+
+void dolly_profiler_stop(dolly_profiler* profiler)
+{
+    if (active_profiler != profiler) return;
+
+    const struct itimerspec disarm = {0};
+    timer_settime(profiler->timer, 0, &disarm, NULL);
+    timer_delete(profiler->timer);
+    signal(SIGPROF, SIG_IGN);
+    active_profiler = NULL;
+
+    atomic_store(&profiler->draining, false);
+    pthread_join(profiler->drain_thread, NULL);
+    dolly_profiler_drain(profiler);
+}
+
+static int dolly_profiler_compare_entries(const void* a, const void* b)
+{
+    const dolly_profiler_entry* entry_a = a;
+    const dolly_profiler_entry* entry_b = b;
+    if (entry_a->samples != entry_b->samples)
+        return entry_a->samples < entry_b->samples ? 1 : -1;
+    return (int)entry_a->program_counter - (int)entry_b->program_counter;
+}
+
+void dolly_profiler_write_histogram(const dolly_profiler* profiler,
+                                    const dolly_symbols* symbols,
+                                    const dolly_executable* exec,
+                                    FILE* stream)
+{
+    size_t entry_count = 0;
+    for (size_t pc = 0; pc < DOLLY_CPU_MEMORY_SIZE; ++pc) {
+        if (profiler->pc_histogram[pc]) ++entry_count;
+    }
+
+    dolly_profiler_entry* entries
+        = malloc_or_abort((entry_count ? entry_count : 1)
+                          * sizeof(dolly_profiler_entry));
+    size_t index = 0;
+    for (size_t pc = 0; pc < DOLLY_CPU_MEMORY_SIZE; ++pc) {
+        if (profiler->pc_histogram[pc] == 0) continue;
+        entries[index].program_counter = pc;
+        entries[index].samples = profiler->pc_histogram[pc];
+        ++index;
+    }
+    qsort(entries, entry_count, sizeof(dolly_profiler_entry),
+          dolly_profiler_compare_entries);
+
+    double total = profiler->samples ? (double)profiler->samples : 1.0;
+
+    fprintf(stream, "# dolly-vm sampling profile\n"
+                    "# rate: %d Hz, samples: %llu, dropped: %lu\n"
+                    "#\n"
+                    "# address   samples   percent   symbol\n",
+            profiler->sample_rate, (unsigned long long)profiler->samples,
+            atomic_load(&profiler->dropped));
+    for (size_t i = 0; i < entry_count; ++i) {
+        fprintf(stream, "0x%04x      %-9llu %6.2f%%",
+                entries[i].program_counter,
+                (unsigned long long)entries[i].samples,
+                100.0 * entries[i].samples / total);
+
+        uint32_t offset = 0;
+        const char* name
+            = symbols ? dolly_symbols_nearest(symbols,
+                                              entries[i].program_counter,
+                                              &offset)
+                      : NULL;
+        if (name == NULL && exec) {
+            // Executables without symbols still have their section names
+            const dolly_executable_section* section
+                = dolly_executable_find(exec, entries[i].program_counter);
+            if (section) {
+                name = section->name;
+                offset = entries[i].program_counter - section->load_address;
+            }
+        }
+        if (name && offset) fprintf(stream, "   %s+%u", name, offset);
+        else if (name) fprintf(stream, "   %s", name);
+        fputc('\n', stream);
+    }
+
+    fprintf(stream, "#\n# call depth   samples   percent\n");
+    for (size_t depth = 0; depth <= DOLLY_PROFILER_MAX_DEPTH; ++depth) {
+        if (profiler->depth_histogram[depth] == 0) continue;
+        fprintf(stream, "%s%-11zu %-9llu %6.2f%%\n",
+                depth == DOLLY_PROFILER_MAX_DEPTH ? ">=" : "", depth,
+                (unsigned long long)profiler->depth_histogram[depth],
+                100.0 * profiler->depth_histogram[depth] / total);
+    }
+
+    dolly_free(entries);
+}
+
+void dolly_profiler_destroy(dolly_profiler* profiler)
+{
+    dolly_profiler_stop(profiler);
+    if (profiler->pc_histogram) dolly_free(profiler->pc_histogram);
+    profiler->pc_histogram = NULL;
+}
+
+const char* dolly_profiler_error_msg(dolly_profiler_status status)
+{
+    switch (status) {
+    default: case DOLLY_PROFILER_OKAY: return "";
+    case DOLLY_PROFILER_INVALID_RATE: return "sample rate must be between "
+                                             "1 and 1000000 Hz";
+    case DOLLY_PROFILER_TIMER_ERROR: return "failed to create profiling timer";
+    case DOLLY_PROFILER_THREAD_ERROR: return "failed to create drain thread";
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "core/symbols.h"
+#include "virtual-machine/cpu.h"
+
+#define DOLLY_PROFILER_RING_SIZE     4096 // Must be a power of two
+#define DOLLY_PROFILER_MAX_DEPTH     64
+#define DOLLY_PROFILER_DEFAULT_RATE  1000
+
+struct dolly_profiler_sample
+{
+    uint16_t program_counter;
+    uint16_t call_depth;
+};
+
+typedef struct dolly_profiler_sample dolly_profiler_sample;
+
+// Samples are pushed by the SIGPROF handler and popped by a drain thread,
+// so the ring is single-producer single-consumer and needs no locking
+struct dolly_profiler
+{
+    const dolly_cpu* cpu;
+    dolly_profiler_sample ring[DOLLY_PROFILER_RING_SIZE];
+    atomic_uint ring_head, ring_tail;
+    atomic_ulong dropped;
+    atomic_bool draining;
+
+    uint64_t* pc_histogram; // One bucket per guest address
+    uint64_t depth_histogram[DOLLY_PROFILER_MAX_DEPTH + 1];
+    uint64_t samples;
+
+    int sample_rate;
+    timer_t timer;
+    pthread_t drain_thread;
+};
+
+typedef struct dolly_profiler dolly_profiler;
+
+enum dolly_profiler_status
+{
+    DOLLY_PROFILER_OKAY, DOLLY_PROFILER_INVALID_RATE,
+    DOLLY_PROFILER_TIMER_ERROR, DOLLY_PROFILER_THREAD_ERROR
+};
+
+typedef enum dolly_profiler_status dolly_profiler_status;
+
+// Only one profiler may be running at a time
+dolly_profiler_status dolly_profiler_start(dolly_profiler* profiler,
+                                           const dolly_cpu* cpu,
+                                           int sample_rate);
+void dolly_profiler_stop(dolly_profiler* profiler);
+// Addresses are named after the nearest label below them, if symbols isn't
+// NULL, or else after the bank 0 section they fall in, if exec isn't NULL
+void dolly_profiler_write_histogram(const dolly_profiler* profiler,
+                                    const dolly_symbols* symbols,
+                                    const dolly_executable* exec,
+                                    FILE* stream);
+void dolly_profiler_destroy(dolly_profiler* profiler);
+
+const char* dolly_profiler_error_msg(dolly_profiler_status status);
@@ -0,0 +1,116 @@
+#include "virtual-machine/replay.h"
+
+#include <string.h>
+
+const uint8_t DOLLY_REPLAY_MAGIC[7] = { 0x7F, 'D', 'R', 'E', 'P', 'L', 'Y' };
+
+static void dolly_replay_write_varint(FILE* file, uint64_t value);
+static bool dolly_replay_read_varint(FILE* file, uint64_t* value);
+
+static void dolly_replay_write_varint(FILE* file, uint64_t value)
+{
+    for (; value >= 0x80; value >>= 7) fputc((value & 0x7F) | 0x80, file);
+    fputc((int) value, file);
+}
+
+static bool dolly_replay_read_varint(FILE* file, uint64_t* value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(file);
+        if (byte == EOF) return false;
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+dolly_replay_status dolly_replay_open(dolly_replay_log* log, FILE* file,
+                                      dolly_replay_mode mode)
+{
+    memset(log, 0, sizeof(dolly_replay_log));
+    log->file = file;
+    log->mode = mode;
+
+    uint8_t header[sizeof(DOLLY_REPLAY_MAGIC) + 1];
+    if (mode == DOLLY_REPLAY_RECORD) {
+        memcpy(header, DOLLY_REPLAY_MAGIC, sizeof(DOLLY_REPLAY_MAGIC));
+        header[sizeof(DOLLY_REPLAY_MAGIC)] = DOLLY_REPLAY_VERSION;
+        if (fwrite(header, sizeof(header), 1, file) != 1)
+            log->status = DOLLY_REPLAY_IO_ERROR;
+    } else if (fread(header, sizeof(header), 1, file) != 1
+               || memcmp(header, DOLLY_REPLAY_MAGIC,
+                         sizeof(DOLLY_REPLAY_MAGIC)) != 0
+               || header[sizeof(DOLLY_REPLAY_MAGIC)] != DOLLY_REPLAY_VERSION) {
+        log->status = DOLLY_REPLAY_INVALID_FORMAT;
+    }
+
+    return log->status;
+}
+
+void dolly_replay_record(dolly_replay_log* log, dolly_replay_event kind,
+                         uint64_t instruction, const uint8_t* data,
+                         size_t size)
+{
+    if (log->status != DOLLY_REPLAY_OKAY) return;
+
+    fputc(kind, log->file);
+    dolly_replay_write_varint(log->file, instruction - log->last_instruction);
+    dolly_replay_write_varint(log->file, size);
+    if (size > 0 && fwrite(data, size, 1, log->file) != 1)
+        log->status = DOLLY_REPLAY_IO_ERROR;
+
+    log->last_instruction = instruction;
+    ++log->events;
+}
+
+bool dolly_replay_play(dolly_replay_log* log, dolly_replay_event kind,
+                       uint64_t instruction, uint8_t* data, size_t capacity,
+                       size_t* size)
+{
+    if (log->status != DOLLY_REPLAY_OKAY) return false;
+
+    uint64_t delta, logged_size;
+    int logged_kind = fgetc(log->file);
+    if (logged_kind != (int) kind
+        || !dolly_replay_read_varint(log->file, &delta)
+        || log->last_instruction + delta != instruction
+        || !dolly_replay_read_varint(log->file, &logged_size)
+        || logged_size > capacity
+        || (logged_size > 0
+            && fread(data, logged_size, 1, log->file) != 1)) {
+        log->status = DOLLY_REPLAY_DIVERGED;
+        return false;
+    }
+
+    *size = logged_size;
+    log->last_instruction = instruction;
+    ++log->events;
+    return true;
+}
+
+dolly_replay_status dolly_replay_finish(dolly_replay_log* log)
+{
+    if (log->status != DOLLY_REPLAY_OKAY) return log->status;
+
+    if (log->mode == DOLLY_REPLAY_PLAY) {
+        if (fgetc(log->file) != EOF) log->status = DOLLY_REPLAY_UNUSED_EVENTS;
+    } else if (fflush(log->file) != 0) {
+        log->status = DOLLY_REPLAY_IO_ERROR;
+    }
+
+    return log->status;
+}
+
+const char* dolly_replay_error_msg(dolly_replay_status status)
+{
+    switch (status) {
+    default: case DOLLY_REPLAY_OKAY: return "";
+    case DOLLY_REPLAY_INVALID_FORMAT: return "not a dolly replay log";
+    case DOLLY_REPLAY_DIVERGED:
+        return "run diverged from the recording";
+    case DOLLY_REPLAY_UNUSED_EVENTS:
+        return "run ended before consuming every recorded input";
+    case DOLLY_REPLAY_IO_ERROR: return "failed to write replay log";
+    }
+}
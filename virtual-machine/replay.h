@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Record/replay log of the nondeterministic inputs to a run
+//
+// The log starts with DOLLY_REPLAY_MAGIC and a version byte, followed by one
+// event per input the guest consumed:
+//   kind         dolly_replay_event
+//   instruction  varint count of instructions retired since the last event
+//   size         varint number of data bytes
+//   data         the input exactly as the guest received it
+//
+// Everything else the VM does is a function of the executable and these
+// inputs, so feeding them back reproduces the run exactly.
+
+#define DOLLY_REPLAY_VERSION 1
+
+extern const uint8_t DOLLY_REPLAY_MAGIC[7];
+
+enum dolly_replay_mode
+{
+    DOLLY_REPLAY_RECORD, DOLLY_REPLAY_PLAY
+};
+
+typedef enum dolly_replay_mode dolly_replay_mode;
+
+enum dolly_replay_event
+{
+    DOLLY_REPLAY_EVENT_READ = 1, // Result of the read syscall
+    DOLLY_REPLAY_EVENT_TIME = 2  // Result of the time syscall
+};
+
+typedef enum dolly_replay_event dolly_replay_event;
+
+enum dolly_replay_status
+{
+    DOLLY_REPLAY_OKAY, DOLLY_REPLAY_INVALID_FORMAT, DOLLY_REPLAY_DIVERGED,
+    DOLLY_REPLAY_UNUSED_EVENTS, DOLLY_REPLAY_IO_ERROR
+};
+
+typedef enum dolly_replay_status dolly_replay_status;
+
+struct dolly_replay_log
+{
+    FILE* file;
+    dolly_replay_mode mode;
+    dolly_replay_status status;
+    uint64_t last_instruction;
+    uint64_t events;
+};
+
+typedef struct dolly_replay_log dolly_replay_log;
+
+dolly_replay_status dolly_replay_open(dolly_replay_log* log, FILE* file,
+                                      dolly_replay_mode mode);
+
+// Appends an input the guest received at the given instruction count
+void dolly_replay_record(dolly_replay_log* log, dolly_replay_event kind,
+                         uint64_t instruction, const uint8_t* data,
+                         size_t size);
+
+// Fetches the next logged input into data, which holds at most capacity
+// bytes. Returns false and sets DOLLY_REPLAY_DIVERGED if the guest asked for
+// a different input, or at a different point, than the recorded run did.
+bool dolly_replay_play(dolly_replay_log* log, dolly_replay_event kind,
+                       uint64_t instruction, uint8_t* data, size_t capacity,
+                       size_t* size);
+
+// Checks that a replay consumed every event, or flushes a recording
+dolly_replay_status dolly_replay_finish(dolly_replay_log* log);
+
+const char* dolly_replay_error_msg(dolly_replay_status status);
@@ -0,0 +1,242 @@
+#include "virtual-machine/state.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Header layout, all fields little-endian:
+//
+//   magic[6]  version:u8  valid:u8  exec_hash:u64  cycles:u64
+//   instructions:u64  pc:u16  a:u8  x:u8  y:u8  sp:u8  flags:u8
+//   stopped:u8  call_depth:u16  exited:u8
+//
+// valid is cleared while a save is under way, so an interrupted one is
+// never resumed. exited is set when the state was saved at the exit syscall
+// rather than a checkpoint.
+#define DOLLY_STATE_MAGIC         "DOLLYS"
+#define DOLLY_STATE_VERSION       2
+#define DOLLY_STATE_HEADER_SIZE   DOLLY_CPU_MEMORY_SIZE
+#define DOLLY_STATE_MEMORY_OFFSET DOLLY_STATE_HEADER_SIZE
+#define DOLLY_STATE_FILE_SIZE     (DOLLY_STATE_MEMORY_OFFSET \
+                                   + DOLLY_CPU_MEMORY_SIZE)
+
+#define DOLLY_STATE_VALID_OFFSET  7
+
+static uint64_t dolly_state_read_le(const uint8_t* src, int size);
+static void     dolly_state_write_le(uint8_t* dest, uint64_t value, int size);
+static uint64_t dolly_state_hash(const dolly_executable* exec);
+static bool     dolly_state_map_memory(dolly_state* state,
+                                       uint8_t* memory, bool shared);
+static void     dolly_state_restore(dolly_state* state, dolly_vm* vm);
+
+static uint64_t dolly_state_read_le(const uint8_t* src, int size)
+{
+    uint64_t value = 0;
+    for (int i = size - 1; i >= 0; --i) value = (value << 8) | src[i];
+    return value;
+}
+
+static void dolly_state_write_le(uint8_t* dest, uint64_t value, int size)
+{
+    for (int i = 0; i < size; ++i) dest[i] = (value >> (8 * i)) & 0xFF;
+}
+
+// FNV-1a over everything that decides what the guest runs
+static uint64_t dolly_state_hash(const dolly_executable* exec)
+{
+    uint64_t hash = 0xCBF29CE484222325;
+    uint8_t fields[12];
+    dolly_state_write_le(fields, exec->header.arch, 4);
+    for (int i = 0; i < 4; ++i) hash = (hash ^ fields[i]) * 0x100000001B3;
+
+    for (size_t i = 0; i < exec->header.section_count; ++i) {
+        const dolly_executable_section* section = &exec->sections[i];
+        dolly_state_write_le(fields, section->type, 4);
+        dolly_state_write_le(fields + 4, section->size, 4);
+        dolly_state_write_le(fields + 8, section->load_address, 4);
+        for (int j = 0; j < 12; ++j)
+            hash = (hash ^ fields[j]) * 0x100000001B3;
+    }
+    for (size_t i = 0; i < exec->program_size; ++i)
+        hash = (hash ^ exec->program_data[i]) * 0x100000001B3;
+    return hash;
+}
+
+static bool dolly_state_map_memory(dolly_state* state, uint8_t* memory,
+                                   bool shared)
+{
+    if (mmap(memory, DOLLY_CPU_MEMORY_SIZE, PROT_READ | PROT_WRITE,
+             (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_FIXED, state->fd,
+             DOLLY_STATE_MEMORY_OFFSET) == MAP_FAILED) {
+        return false;
+    }
+    state->shared = shared;
+    return true;
+}
+
+static void dolly_state_restore(dolly_state* state, dolly_vm* vm)
+{
+    const uint8_t* fields = state->header + 16;
+    // The registers at an exit are no use, as the guest starts over
+    state->exited = fields[26];
+    if (state->exited) return;
+
+    dolly_cpu* cpu = &vm->cpu;
+    vm->cycles = dolly_state_read_le(fields, 8);
+    vm->instructions = dolly_state_read_le(fields + 8, 8);
+    cpu->program_counter = dolly_state_read_le(fields + 16, 2);
+    cpu->reg_a = fields[18];
+    cpu->reg_x = fields[19];
+    cpu->reg_y = fields[20];
+    cpu->stack_ptr = fields[21];
+    cpu->flags_byte = fields[22];
+    cpu->stopped = fields[23];
+    cpu->call_depth = dolly_state_read_le(fields + 24, 2);
+}
+
+dolly_state_status dolly_state_open(dolly_state* state, const char* path,
+                                    dolly_vm* vm,
+                                    const dolly_executable* exec)
+{
+    memset(state, 0, sizeof(dolly_state));
+    state->exec_hash = dolly_state_hash(exec);
+
+    state->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (state->fd == -1) return DOLLY_STATE_IO_ERROR;
+
+    struct stat info;
+    if (fstat(state->fd, &info) == -1) {
+        close(state->fd);
+        return DOLLY_STATE_IO_ERROR;
+    }
+    // Anything else is left alone rather than overwritten
+    if (info.st_size != 0 && info.st_size != DOLLY_STATE_FILE_SIZE) {
+        close(state->fd);
+        return DOLLY_STATE_INVALID_FILE;
+    }
+    if (info.st_size == 0
+        && ftruncate(state->fd, DOLLY_STATE_FILE_SIZE) == -1) {
+        close(state->fd);
+        return DOLLY_STATE_IO_ERROR;
+    }
+
+    state->header = mmap(NULL, DOLLY_STATE_HEADER_SIZE,
+                         PROT_READ | PROT_WRITE, MAP_SHARED, state->fd, 0);
+    if (state->header == MAP_FAILED) {
+        close(state->fd);
+        return DOLLY_STATE_IO_ERROR;
+    }
+
+    dolly_state_status status = DOLLY_STATE_OKAY;
+    if (info.st_size == 0) {
+        memcpy(state->header, DOLLY_STATE_MAGIC, sizeof(DOLLY_STATE_MAGIC) - 1);
+        state->header[6] = DOLLY_STATE_VERSION;
+    } else if (memcmp(state->header, DOLLY_STATE_MAGIC,
+                      sizeof(DOLLY_STATE_MAGIC) - 1) != 0
+               || state->header[6] != DOLLY_STATE_VERSION) {
+        status = DOLLY_STATE_INVALID_FILE;
+    } else if (state->header[DOLLY_STATE_VALID_OFFSET]
+               && dolly_state_read_le(state->header + 8, 8)
+                  != state->exec_hash) {
+        status = DOLLY_STATE_WRONG_EXECUTABLE;
+    } else if (state->header[DOLLY_STATE_VALID_OFFSET]) {
+        state->resumed = true;
+    }
+
+    if (status == DOLLY_STATE_OKAY && !state->resumed) {
+        // Left over from a run that never saved, so start from zeroes
+        void* memory = mmap(NULL, DOLLY_CPU_MEMORY_SIZE,
+                            PROT_READ | PROT_WRITE, MAP_SHARED, state->fd,
+                            DOLLY_STATE_MEMORY_OFFSET);
+        if (memory == MAP_FAILED) {
+            status = DOLLY_STATE_IO_ERROR;
+        } else {
+            memset(memory, 0, DOLLY_CPU_MEMORY_SIZE);
+            munmap(memory, DOLLY_CPU_MEMORY_SIZE);
+        }
+    }
+    if (status == DOLLY_STATE_OKAY
+        && !dolly_state_map_memory(state, vm->cpu.memory, !state->resumed)) {
+        status = DOLLY_STATE_IO_ERROR;
+    }
+
+    if (status != DOLLY_STATE_OKAY) {
+        int error = errno;
+        munmap(state->header, DOLLY_STATE_HEADER_SIZE);
+        close(state->fd);
+        errno = error;
+        return status;
+    }
+
+    if (state->resumed) dolly_state_restore(state, vm);
+    vm->state = state;
+    return DOLLY_STATE_OKAY;
+}
+
+bool dolly_state_save(dolly_state* state, const dolly_vm* vm)
+{
+    uint8_t* header = state->header;
+    header[DOLLY_STATE_VALID_OFFSET] = 0;
+
+    // Shared memory is already in the file
+    if (!state->shared) {
+        size_t written = 0;
+        while (written < DOLLY_CPU_MEMORY_SIZE) {
+            ssize_t result = pwrite(state->fd, vm->cpu.memory + written,
+                                    DOLLY_CPU_MEMORY_SIZE - written,
+                                    DOLLY_STATE_MEMORY_OFFSET + written);
+            if (result < 0 && errno == EINTR) continue;
+            if (result <= 0) return false;
+            written += result;
+        }
+    }
+
+    const dolly_cpu* cpu = &vm->cpu;
+    uint8_t* fields = header + 16;
+    dolly_state_write_le(header + 8, state->exec_hash, 8);
+    dolly_state_write_le(fields, vm->cycles, 8);
+    dolly_state_write_le(fields + 8, vm->instructions, 8);
+    dolly_state_write_le(fields + 16, cpu->program_counter, 2);
+    fields[18] = cpu->reg_a;
+    fields[19] = cpu->reg_x;
+    fields[20] = cpu->reg_y;
+    fields[21] = cpu->stack_ptr;
+    fields[22] = cpu->flags_byte;
+    fields[23] = cpu->stopped;
+    dolly_state_write_le(fields + 24, cpu->call_depth, 2);
+    fields[26] = vm->exited;
+    header[DOLLY_STATE_VALID_OFFSET] = 1;
+    state->saved = true;
+
+    // The same pages, but from now on the guest's writes stay its own
+    if (state->shared
+        && !dolly_state_map_memory(state, vm->cpu.memory, false)) {
+        return false;
+    }
+    return true;
+}
+
+bool dolly_state_close(dolly_state* state, const dolly_vm* vm)
+{
+    bool saved = true;
+    if (!state->resumed && !state->saved && vm->exited)
+        saved = dolly_state_save(state, vm);
+
+    munmap(state->header, DOLLY_STATE_HEADER_SIZE);
+    close(state->fd);
+    return saved;
+}
+
+const char* dolly_state_error_msg(dolly_state_status status)
+{
+    switch (status) {
+    default: case DOLLY_STATE_OKAY: return "";
+    case DOLLY_STATE_IO_ERROR: return "couldn't map state file";
+    case DOLLY_STATE_INVALID_FILE: return "not a state file";
+    case DOLLY_STATE_WRONG_EXECUTABLE: return "state was saved by a different "
+                                              "executable";
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core/core.h"
+
+#include "virtual-machine/vm.h"
+
+// Guest state kept in a file, so later runs carry on where one saved
+//
+// The file holds the registers in its first 64KB and guest memory in the
+// next 64KB, both mapped shared. A fresh run loads the executable straight
+// into the file, so whatever the guest sets up lands on disk without being
+// copied. Saving writes the registers, at the checkpoint syscall or, if the
+// file had no state and the guest never checkpointed, once the guest exits.
+// Any other end to the run leaves the file with no state to resume. A state
+// saved at the exit is resumed from _start, with memory as the guest left it.
+//
+// After a save, and when resuming, memory is mapped privately instead, so
+// the file keeps the saved state however the run goes on. Saving again
+// writes memory back to it. A saved state is only resumed by the
+// executable that saved it.
+
+struct dolly_state
+{
+    int fd;
+    uint8_t* header; // Mapped shared
+    uint64_t exec_hash;
+    bool shared; // Guest memory is mapped onto the file
+    bool resumed; // The file had a saved state, now in the VM
+    bool exited; // The resumed state was saved at the exit syscall
+    bool saved; // Saved during this run
+};
+
+typedef struct dolly_state dolly_state;
+
+enum dolly_state_status
+{
+    DOLLY_STATE_OKAY, DOLLY_STATE_IO_ERROR, DOLLY_STATE_INVALID_FILE,
+    DOLLY_STATE_WRONG_EXECUTABLE
+};
+
+typedef enum dolly_state_status dolly_state_status;
+
+// Creates the file if need be and maps it over the VM's memory, restoring
+// the registers if it holds a state saved by exec. Unless state->resumed is
+// set, the VM still needs exec loading. Bank windows aren't supported. On
+// DOLLY_STATE_IO_ERROR, errno is set.
+dolly_state_status dolly_state_open(dolly_state* state, const char* path,
+                                    dolly_vm* vm,
+                                    const dolly_executable* exec);
+// Returns false, with errno set, if memory couldn't be written back or
+// remapped
+bool dolly_state_save(dolly_state* state, const dolly_vm* vm);
+// Saves the finished run as described above, then closes the file. Guest
+// memory stays mapped until the VM is destroyed.
+bool dolly_state_close(dolly_state* state, const dolly_vm* vm);
+
+const char* dolly_state_error_msg(dolly_state_status status);
@@ -0,0 +1,207 @@
+#include "virtual-machine/stats.h"
+
+#include <string.h>
+#include <time.h>
+
+static int    dolly_vm_stats_amode_index(dolly_addressing_mode a_mode);
+static bool   dolly_vm_stats_page_crossed(const dolly_cpu* cpu,
+                                          dolly_opcode op,
+                                          bool branch_taken);
+static double dolly_vm_stats_per_second(const dolly_vm_stats* stats,
+                                        uint64_t count);
+
+static int dolly_vm_stats_amode_index(dolly_addressing_mode a_mode)
+{
+    // Addressing modes are single bit flags
+    return a_mode == DOLLY_INVALID_ADDR_MODE ? -1 : __builtin_ctz(a_mode);
+}
+
+// Whether the instruction about to execute will cross a page boundary. This
+// mirrors the operand resolution in cpu.c rather than changing it, so that
+// the uninstrumented interpreter does not pay for reporting it.
+static bool dolly_vm_stats_page_crossed(const dolly_cpu* cpu,
+                                        dolly_opcode op,
+                                        bool branch_taken)
+{
+    uint16_t pc = cpu->program_counter;
+    uint8_t operand = cpu->memory[(uint16_t)(pc + 1)];
+
+    switch (op.a_mode) {
+    case ABSOLUTE_X:
+        return (int)operand + cpu->reg_x > 0xFF;
+    case ABSOLUTE_Y:
+        return (int)operand + cpu->reg_y > 0xFF;
+    case INDIRECT_Y:
+        return (int)cpu->memory[operand] + cpu->reg_y > 0xFF;
+    case RELATIVE: {
+        if (!branch_taken) return false;
+        uint16_t next = pc + 2;
+        return ((next + (int8_t)operand) & 0xFF00) != (next & 0xFF00);
+    }
+    default:
+        return false;
+    }
+}
+
+static double dolly_vm_stats_per_second(const dolly_vm_stats* stats,
+                                        uint64_t count)
+{
+    if (stats->wall_seconds <= 0.0) return 0.0;
+    return (double)count / stats->wall_seconds;
+}
+
+void dolly_vm_stats_init(dolly_vm_stats* stats)
+{
+    memset(stats, 0, sizeof(dolly_vm_stats));
+}
+
+void dolly_vm_run_stats(dolly_vm* vm, dolly_vm_stats* stats)
+{
+    const dolly_cpu* cpu = &vm->cpu;
+    uint64_t start_instructions = vm->instructions;
+    uint64_t start_cycles = vm->cycles;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    stats->variant = cpu->variant;
+
+    while (vm->running) {
+        uint8_t opcode_byte = cpu->memory[cpu->program_counter];
+        dolly_opcode op = dolly_cpu_decode(cpu, opcode_byte);
+
+        bool is_branch = dolly_is_branch(op.instr);
+        bool taken = is_branch && dolly_cpu_should_branch(cpu, op.instr);
+        if (dolly_vm_stats_page_crossed(cpu, op, taken))
+            ++stats->page_crossings;
+        if (taken) ++stats->branches_taken[opcode_byte];
+        if (op.instr == BRK) {
+            uint8_t syscall = cpu->reg_a;
+            ++stats->syscalls[syscall < DOLLY_SYSCALL_COUNT
+                              ? syscall : DOLLY_SYSCALL_COUNT];
+        }
+
+        dolly_vm_step(vm);
+        if (vm->faulted) break;
+
+        ++stats->opcodes[opcode_byte];
+        int amode_index = dolly_vm_stats_amode_index(op.a_mode);
+        if (amode_index >= 0) ++stats->addressing_modes[amode_index];
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    stats->wall_seconds += (double)(end.tv_sec - start.tv_sec)
+                         + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    stats->instructions += vm->instructions - start_instructions;
+    stats->cycles += vm->cycles - start_cycles;
+}
+
+void dolly_vm_stats_write(const dolly_vm_stats* stats, FILE* stream)
+{
+    double total = stats->instructions ? (double)stats->instructions : 1.0;
+
+    fprintf(stream, "== Execution statistics ==\n"
+                    "Instructions retired: %llu\n"
+                    "Cycles:               %llu\n"
+                    "Host wall time:       %.6f s\n"
+                    "Effective clock:      %.3f MHz\n"
+                    "MIPS:                 %.3f\n"
+                    "Page crossings:       %llu\n",
+            (unsigned long long)stats->instructions,
+            (unsigned long long)stats->cycles,
+            stats->wall_seconds,
+            dolly_vm_stats_per_second(stats, stats->cycles) / 1e6,
+            dolly_vm_stats_per_second(stats, stats->instructions) / 1e6,
+            (unsigned long long)stats->page_crossings);
+
+    fprintf(stream, "\nAddressing modes:\n");
+    for (int i = 0; i < DOLLY_ADDRESSING_MODE_COUNT; ++i) {
+        if (stats->addressing_modes[i] == 0) continue;
+        fprintf(stream, "  %-30s %-12llu %6.2f%%\n",
+                dolly_get_amode_name(1 << i),
+                (unsigned long long)stats->addressing_modes[i],
+                100.0 * stats->addressing_modes[i] / total);
+    }
+
+    fprintf(stream, "\nBranches (taken / executed):\n");
+    for (int i = 0; i < 256; ++i) {
+        dolly_opcode op = dolly_resolve_opcode_variant(i, stats->variant);
+        if (!dolly_is_branch(op.instr) || stats->opcodes[i] == 0) continue;
+        fprintf(stream, "  %s  %-12llu / %-12llu %6.2f%%\n",
+                dolly_get_instr_name(op.instr),
+                (unsigned long long)stats->branches_taken[i],
+                (unsigned long long)stats->opcodes[i],
+                100.0 * stats->branches_taken[i] / stats->opcodes[i]);
+    }
+
+    fprintf(stream, "\nSyscalls:\n");
+    for (int i = 0; i <= DOLLY_SYSCALL_COUNT; ++i) {
+        if (stats->syscalls[i] == 0) continue;
+        fprintf(stream, "  %-10s %llu\n", dolly_vm_syscall_str(i),
+                (unsigned long long)stats->syscalls[i]);
+    }
+
+    fprintf(stream, "\nOpcodes:\n");
+    for (int i = 0; i < 256; ++i) {
+        if (stats->opcodes[i] == 0) continue;
+        dolly_opcode op = dolly_resolve_opcode_variant(i, stats->variant);
+        fprintf(stream, "  $%02x %s %-30s %-12llu %6.2f%%\n", i,
+                dolly_get_instr_name(op.instr),
+                dolly_get_amode_name(op.a_mode),
+                (unsigned long long)stats->opcodes[i],
+                100.0 * stats->opcodes[i] / total);
+    }
+}
+
+void dolly_vm_stats_write_json(const dolly_vm_stats* stats, FILE* stream)
+{
+    fprintf(stream, "{\n"
+                    "  \"instructions\": %llu,\n"
+                    "  \"cycles\": %llu,\n"
+                    "  \"wall_seconds\": %.9f,\n"
+                    "  \"mhz\": %.6f,\n"
+                    "  \"mips\": %.6f,\n"
+                    "  \"page_crossings\": %llu,\n",
+            (unsigned long long)stats->instructions,
+            (unsigned long long)stats->cycles,
+            stats->wall_seconds,
+            dolly_vm_stats_per_second(stats, stats->cycles) / 1e6,
+            dolly_vm_stats_per_second(stats, stats->instructions) / 1e6,
+            (unsigned long long)stats->page_crossings);
+
+    fprintf(stream, "  \"addressing_modes\": {");
+    for (int i = 0; i < DOLLY_ADDRESSING_MODE_COUNT; ++i) {
+        fprintf(stream, "%s\n    \"%s\": %llu", i ? "," : "",
+                dolly_get_amode_name(1 << i),
+                (unsigned long long)stats->addressing_modes[i]);
+    }
+    fprintf(stream, "\n  },\n");
+
+    fprintf(stream, "  \"branches\": [");
+    bool first = true;
+    for (int i = 0; i < 256; ++i) {
+        dolly_opcode op = dolly_resolve_opcode_variant(i, stats->variant);
+        if (!dolly_is_branch(op.instr)) continue;
+        fprintf(stream, "%s\n    { \"opcode\": %d, \"mnemonic\": \"%s\", "
+                        "\"executed\": %llu, \"taken\": %llu }",
+                first ? "" : ",", i, dolly_get_instr_name(op.instr),
+                (unsigned long long)stats->opcodes[i],
+                (unsigned long long)stats->branches_taken[i]);
+        first = false;
+    }
+    fprintf(stream, "\n  ],\n");
+
+    fprintf(stream, "  \"syscalls\": {");
+    for (int i = 0; i <= DOLLY_SYSCALL_COUNT; ++i) {
+        fprintf(stream, "%s\n    \"%s\": %llu", i ? "," : "",
+                i < DOLLY_SYSCALL_COUNT ? dolly_vm_syscall_str(i) : "invalid",
+                (unsigned long long)stats->syscalls[i]);
+    }
+    fprintf(stream, "\n  },\n");
+
+    fprintf(stream, "  \"opcodes\": [");
+    for (int i = 0; i < 256; ++i) {
+        fprintf(stream, "%s%s%llu", i ? "," : "", i % 16 ? " " : "\n    ",
+                (unsigned long long)stats->opcodes[i]);
+    }
+    fprintf(stream, "\n  ]\n}\n");
+}
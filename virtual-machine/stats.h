@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "virtual-machine/vm.h"
+
+struct dolly_vm_stats
+{
+    uint64_t instructions;
+    uint64_t cycles;
+    double   wall_seconds;
+
+    uint64_t opcodes[256];
+    uint64_t branches_taken[256]; // Indexed by opcode like the histogram
+    uint64_t addressing_modes[DOLLY_ADDRESSING_MODE_COUNT];
+    uint64_t page_crossings;
+    uint64_t syscalls[DOLLY_SYSCALL_COUNT + 1]; // Last bucket is invalid ones
+    dolly_6502_variant variant; // Of the CPU run, to name the opcodes
+};
+
+typedef struct dolly_vm_stats dolly_vm_stats;
+
+void dolly_vm_stats_init(dolly_vm_stats* stats);
+
+// Equivalent to dolly_vm_run, gathering statistics as it goes. Kept separate
+// so that uninstrumented runs pay nothing for it.
+void dolly_vm_run_stats(dolly_vm* vm, dolly_vm_stats* stats);
+
+void dolly_vm_stats_write(const dolly_vm_stats* stats, FILE* stream);
+void dolly_vm_stats_write_json(const dolly_vm_stats* stats, FILE* stream);
@@ -0,0 +1,180 @@
+#include "virtual-machine/trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void* dolly_trace_writer_loop(void* arg);
+static bool  dolly_trace_writer_write_block(dolly_trace_writer* writer,
+                                            const uint8_t* data, size_t size);
+static void  dolly_trace_writer_flush(dolly_trace_writer* writer);
+static void  dolly_trace_write_u32(uint8_t* out, uint32_t value);
+
+static void dolly_trace_write_u32(uint8_t* out, uint32_t value)
+{
+    out[0] = value & 0xFF;
+    out[1] = (value >> 8) & 0xFF;
+    out[2] = (value >> 16) & 0xFF;
+    out[3] = value >> 24;
+}
+
+static bool dolly_trace_writer_write_block(dolly_trace_writer* writer,
+                                           const uint8_t* data, size_t size)
+{
+    const uint8_t* stored = data;
+    size_t stored_size = size;
+
+    if (writer->compress) {
+        size_t compressed
+            = tb_lz_compress(data, size, writer->compress_buffer,
+                             tb_lz_compress_bound(DOLLY_TRACE_BLOCK_SIZE));
+        // Equal sizes mean a raw block, so only keep strictly smaller output
+        if (compressed != 0 && compressed < size) {
+            stored = writer->compress_buffer;
+            stored_size = compressed;
+        }
+    }
+
+    uint8_t header[8];
+    dolly_trace_write_u32(header, (uint32_t) size);
+    dolly_trace_write_u32(header + 4, (uint32_t) stored_size);
+    return fwrite(header, sizeof(header), 1, writer->file) == 1
+        && fwrite(stored, stored_size, 1, writer->file) == 1;
+}
+
+static void* dolly_trace_writer_loop(void* arg)
+{
+    dolly_trace_writer* writer = arg;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;) {
+        while (writer->pending_buffer < 0 && !writer->stopping)
+            pthread_cond_wait(&writer->cond, &writer->lock);
+        if (writer->pending_buffer < 0) break;
+
+        int index = writer->pending_buffer;
+        pthread_mutex_unlock(&writer->lock);
+
+        bool ok = dolly_trace_writer_write_block(writer,
+                                                 writer->buffers[index],
+                                                 writer->buffer_sizes[index]);
+
+        pthread_mutex_lock(&writer->lock);
+        if (!ok) writer->io_error = true;
+        writer->buffer_sizes[index] = 0;
+        writer->pending_buffer = -1;
+        pthread_cond_broadcast(&writer->cond);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return NULL;
+}
+
+// Hands the active buffer to the writer thread and switches to the other one
+static void dolly_trace_writer_flush(dolly_trace_writer* writer)
+{
+    if (writer->buffer_sizes[writer->active_buffer] == 0) return;
+
+    pthread_mutex_lock(&writer->lock);
+    while (writer->pending_buffer >= 0)
+        pthread_cond_wait(&writer->cond, &writer->lock);
+    writer->pending_buffer = writer->active_buffer;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+
+    writer->active_buffer ^= 1;
+    dolly_trace_state_reset(&writer->state);
+}
+
+bool dolly_trace_writer_open(dolly_trace_writer* writer, FILE* file,
+                             bool compress, dolly_6502_variant variant)
+{
+    memset(writer, 0, sizeof(dolly_trace_writer));
+    writer->file = file;
+    writer->compress = compress;
+    writer->pending_buffer = -1;
+    for (int i = 0; i < 2; ++i)
+        writer->buffers[i] = malloc_or_abort(DOLLY_TRACE_BLOCK_SIZE);
+    if (compress) {
+        writer->compress_buffer
+            = malloc_or_abort(tb_lz_compress_bound(DOLLY_TRACE_BLOCK_SIZE));
+    }
+    writer->state.variant = variant;
+    dolly_trace_state_reset(&writer->state);
+
+    uint8_t header[sizeof(DOLLY_TRACE_MAGIC) + 2];
+    memcpy(header, DOLLY_TRACE_MAGIC, sizeof(DOLLY_TRACE_MAGIC));
+    header[sizeof(DOLLY_TRACE_MAGIC)] = DOLLY_TRACE_VERSION;
+    header[sizeof(DOLLY_TRACE_MAGIC) + 1] = variant;
+    if (fwrite(header, sizeof(header), 1, file) != 1) return false;
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    if (pthread_create(&writer->thread, NULL, dolly_trace_writer_loop,
+                       writer) != 0) {
+        pthread_mutex_destroy(&writer->lock);
+        pthread_cond_destroy(&writer->cond);
+        return false;
+    }
+
+    return true;
+}
+
+bool dolly_trace_writer_close(dolly_trace_writer* writer)
+{
+    dolly_trace_writer_flush(writer);
+
+    pthread_mutex_lock(&writer->lock);
+    writer->stopping = true;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->cond);
+    for (int i = 0; i < 2; ++i) dolly_free(writer->buffers[i]);
+    if (writer->compress_buffer) dolly_free(writer->compress_buffer);
+
+    return !writer->io_error && fflush(writer->file) == 0;
+}
+
+void dolly_vm_run_trace(dolly_vm* vm, dolly_trace_writer* writer)
+{
+    dolly_cpu* cpu = &vm->cpu;
+    dolly_trace_record record;
+
+    while (vm->running) {
+        record.program_counter = cpu->program_counter;
+        for (int i = 0; i < 3; ++i) {
+            record.instruction[i]
+                = cpu->memory[(uint16_t)(record.program_counter + i)];
+        }
+
+        uint16_t store_address = 0;
+        bool stores = dolly_cpu_store_address(cpu, &store_address);
+        uint8_t old_value = stores ? cpu->memory[store_address] : 0;
+
+        dolly_vm_step(vm);
+        if (vm->faulted) break;
+
+        record.reg_a = cpu->reg_a;
+        record.reg_x = cpu->reg_x;
+        record.reg_y = cpu->reg_y;
+        record.stack_ptr = cpu->stack_ptr;
+        record.flags_byte = cpu->flags_byte;
+        record.has_store = stores && cpu->memory[store_address] != old_value;
+        record.store_address = store_address;
+        record.store_value = record.has_store ? cpu->memory[store_address] : 0;
+
+        int active = writer->active_buffer;
+        writer->buffer_sizes[active]
+            += dolly_trace_encode(&writer->state, &record,
+                                  writer->buffers[active]
+                                  + writer->buffer_sizes[active]);
+        ++writer->records;
+
+        if (writer->buffer_sizes[active]
+            > DOLLY_TRACE_BLOCK_SIZE - DOLLY_TRACE_MAX_RECORD_SIZE) {
+            dolly_trace_writer_flush(writer);
+        }
+    }
+}
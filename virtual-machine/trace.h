@@ -0,0 +1,47 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "core/core.h"
+
+#include "virtual-machine/vm.h"
+
+#define DOLLY_TRACE_BLOCK_SIZE (256 * 1024)
+
+// Records are encoded into one buffer while a writer thread compresses and
+// writes out the other, so the guest only stalls if the disk falls behind
+struct dolly_trace_writer
+{
+    FILE* file;
+    bool compress;
+    bool io_error;
+
+    uint8_t* buffers[2];
+    size_t buffer_sizes[2];
+    int active_buffer;
+    uint8_t* compress_buffer;
+    dolly_trace_state state;
+    uint64_t records;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int pending_buffer; // -1 when the writer thread is idle
+    bool stopping;
+};
+
+typedef struct dolly_trace_writer dolly_trace_writer;
+
+// Records are sized by decoding their opcode as the variant, which must be
+// the one the VM runs as
+bool dolly_trace_writer_open(dolly_trace_writer* writer, FILE* file,
+                             bool compress, dolly_6502_variant variant);
+// Flushes outstanding records and stops the writer thread. Returns false if
+// any write failed.
+bool dolly_trace_writer_close(dolly_trace_writer* writer);
+
+// Equivalent to dolly_vm_run, tracing every retired instruction
+void dolly_vm_run_trace(dolly_vm* vm, dolly_trace_writer* writer);
@@ -0,0 +1,506 @@
+#include "virtual-machine/vm.h"
+
+#include "virtual-machine/history.h"
+#include "virtual-machine/image.h"
+#include "virtual-machine/mapper.h"
+#include "virtual-machine/state.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/mman.h>
+
+static bool dolly_vm_input(dolly_vm* vm, dolly_replay_event kind,
+                           uint8_t* data, size_t capacity, size_t* size);
+static void dolly_vm_read_host_input(dolly_vm* vm, dolly_replay_event kind,
+                                     uint8_t* data, size_t capacity,
+                                     size_t* size);
+static dolly_vm_status dolly_vm_load_65816(dolly_vm* vm,
+                                           const dolly_executable* exec);
+static dolly_vm_status dolly_vm_load_6502(dolly_vm* vm,
+                                          const dolly_executable* exec,
+                                          bool preloaded);
+static void dolly_vm_protect_text(dolly_vm* vm, const dolly_executable* exec);
+static void dolly_vm_handle_syscall_65816(dolly_vm* vm);
+static bool dolly_vm_step_65816(dolly_vm* vm);
+
+// Produces a nondeterministic input for the guest: from the host when running
+// normally or recording, from the log when replaying, and from the history
+// when re-executing in the debugger
+static bool dolly_vm_input(dolly_vm* vm, dolly_replay_event kind,
+                           uint8_t* data, size_t capacity, size_t* size)
+{
+    if (vm->history
+        && dolly_history_replay_input(vm->history, kind, vm->instructions,
+                                      data, capacity, size)) {
+        return true;
+    }
+
+    if (vm->replay && vm->replay->mode == DOLLY_REPLAY_PLAY) {
+        if (!dolly_replay_play(vm->replay, kind, vm->instructions, data,
+                               capacity, size)) {
+            return false;
+        }
+    } else {
+        dolly_vm_read_host_input(vm, kind, data, capacity, size);
+        if (vm->replay) {
+            dolly_replay_record(vm->replay, kind, vm->instructions, data,
+                                *size);
+        }
+    }
+
+    if (vm->history) {
+        dolly_history_record_input(vm->history, kind, vm->instructions, data,
+                                   *size);
+    }
+    return true;
+}
+
+static void dolly_vm_read_host_input(dolly_vm* vm, dolly_replay_event kind,
+                                     uint8_t* data, size_t capacity,
+                                     size_t* size)
+{
+    switch (kind) {
+    case DOLLY_REPLAY_EVENT_READ:
+        // data has room for a terminator past capacity
+        if (vm->output) fflush(vm->output);
+        *size = vm->input && fgets((char*) data, (int) capacity + 1, vm->input)
+              ? strlen((const char*) data) : 0;
+        break;
+    case DOLLY_REPLAY_EVENT_TIME: {
+        uint32_t now = vm->fixed_time ? 0 : (uint32_t) time(NULL);
+        for (int i = 0; i < 4; ++i) data[i] = (now >> (8 * i)) & 0xFF;
+        *size = 4;
+        break;
+    }
+    }
+}
+
+static dolly_vm_status dolly_vm_load_65816(dolly_vm* vm,
+                                           const dolly_executable* exec)
+{
+    dolly_cpu65816* cpu = dolly_malloc(sizeof(dolly_cpu65816));
+    if (cpu == NULL) return DOLLY_VM_OUT_OF_MEMORY;
+    dolly_cpu65816_init(cpu);
+    vm->cpu65816 = cpu;
+
+    bool found_start = false;
+    for (size_t i = 0; i < exec->header.section_count; ++i) {
+        const dolly_executable_section* section = &exec->sections[i];
+        if (!dolly_section_is_loaded(section)) continue;
+        if ((uint64_t)section->load_address + section->size
+            > DOLLY_CPU65816_ADDRESS_SPACE) {
+            return DOLLY_VM_SECTION_OUT_OF_RANGE;
+        }
+        if (!dolly_section_has_data(section)) {
+            dolly_cpu65816_clear(cpu, section->load_address, section->size);
+        } else if (section->flags & DOLLY_SECTION_FLAG_COMPRESSED) {
+            // Guest memory is made of separate pages, so there is no one
+            // place to decompress into
+            uint8_t* data = dolly_malloc(section->size);
+            if (data == NULL) return DOLLY_VM_OUT_OF_MEMORY;
+            dolly_executable_load_section(exec, section, data);
+            bool loaded = dolly_cpu65816_load(cpu, section->load_address,
+                                              data, section->size);
+            dolly_free(data);
+            if (!loaded) return DOLLY_VM_OUT_OF_MEMORY;
+        } else if (!dolly_cpu65816_load(cpu, section->load_address,
+                                        exec->program_data + section->offset,
+                                        section->size)) {
+            return DOLLY_VM_OUT_OF_MEMORY;
+        }
+
+        if (strcmp(section->name, "_start") == 0
+            && section->type == DOLLY_SECTION_TEXT) {
+            cpu->program_bank = dolly_section_bank(section);
+            cpu->data_bank = cpu->program_bank;
+            cpu->program_counter = dolly_section_address(section);
+            found_start = true;
+        }
+    }
+
+    if (!found_start) return DOLLY_VM_NO_START_SECTION;
+
+    vm->running = true;
+    return DOLLY_VM_OKAY;
+}
+
+static void dolly_vm_handle_syscall_65816(dolly_vm* vm)
+{
+    dolly_cpu65816* cpu = vm->cpu65816;
+    uint16_t buffer_vec_address = cpu->direct_page + 0xFE;
+    uint32_t buffer = (uint32_t)cpu->data_bank << 16
+                    | dolly_cpu65816_read(cpu, buffer_vec_address)
+                    | (uint16_t)dolly_cpu65816_read(cpu, (uint16_t)
+                                                    (buffer_vec_address + 1))
+                      << 8;
+
+    switch (cpu->reg_a & 0xFF) {
+    case DOLLY_SYSCALL_EXIT:
+        vm->running = false;
+        vm->exited = true;
+        break;
+    case DOLLY_SYSCALL_PRINT:
+        for (uint32_t i = 0; i < DOLLY_CPU_MEMORY_SIZE; ++i) {
+            uint8_t c = dolly_cpu65816_read(cpu, buffer + i);
+            if (c == '\0') break;
+            if (!vm->silent) fputc(c, vm->output);
+        }
+        break;
+    case DOLLY_SYSCALL_READ: {
+        uint8_t data[257];
+        size_t capacity = (cpu->reg_x & 0xFF) == 0 ? 256 : cpu->reg_x & 0xFF;
+        size_t size = 0;
+        if (capacity > 1
+            && !dolly_vm_input(vm, DOLLY_REPLAY_EVENT_READ, data,
+                               capacity - 1, &size)) {
+            vm->running = false;
+            break;
+        }
+        data[size] = 0;
+        // A guest store, so running out ends the process as stores do
+        if (!dolly_cpu65816_load(cpu, buffer, data, size + 1)) abort_no_mem();
+        cpu->reg_a = (cpu->reg_a & 0xFF00) | size;
+        break;
+    }
+    case DOLLY_SYSCALL_TIME: {
+        uint8_t now[4];
+        size_t size;
+        if (!dolly_vm_input(vm, DOLLY_REPLAY_EVENT_TIME, now, sizeof(now),
+                            &size) || size != sizeof(now)) {
+            vm->running = false;
+            break;
+        }
+        if (!dolly_cpu65816_load(cpu, buffer, now, sizeof(now)))
+            abort_no_mem();
+        break;
+    }
+    case DOLLY_SYSCALL_CHECKPOINT:
+        break; // State files only hold 6502 machines
+    default:
+        if (!vm->silent) fputs("Invalid syscall, exiting\n", vm->output);
+        vm->running = false;
+        break;
+    }
+    cpu->break_flag = false;
+}
+
+static bool dolly_vm_step_65816(dolly_vm* vm)
+{
+    int delay = dolly_cpu65816_read_next_instruction(vm->cpu65816);
+    if (delay == -1) {
+        dolly_vm_fault(vm);
+        return false;
+    }
+
+    vm->cycles += delay;
+    ++vm->instructions;
+
+    if (vm->cpu65816->break_flag) dolly_vm_handle_syscall_65816(vm);
+    if (vm->cpu65816->stopped) vm->running = false;
+    return vm->running;
+}
+
+void dolly_vm_init(dolly_vm* vm)
+{
+    vm->arch = DOLLY_ARCH_6502;
+    dolly_cpu_init(&vm->cpu);
+    vm->cpu65816 = NULL;
+    vm->cycles = 0;
+    vm->instructions = 0;
+    vm->running = false;
+    vm->faulted = false;
+    vm->exited = false;
+    vm->replay = NULL;
+    vm->history = NULL;
+    vm->state = NULL;
+    vm->mapper = NULL;
+    vm->silent = false;
+    vm->input = stdin;
+    vm->output = stdout;
+    vm->errors = stderr;
+    vm->fixed_time = false;
+    vm->protect_text = false;
+}
+
+dolly_vm_status dolly_vm_load(dolly_vm* vm, const dolly_executable* exec)
+{
+    vm->arch = exec->header.arch;
+    if (vm->arch == DOLLY_ARCH_65816) return dolly_vm_load_65816(vm, exec);
+    return dolly_vm_load_6502(vm, exec, false);
+}
+
+dolly_vm_status dolly_vm_load_image(dolly_vm* vm, const dolly_image* image)
+{
+    // The mapper already has guest memory mapped onto its own file
+    if (image->fd == -1 || vm->mapper) return dolly_vm_load(vm, image->exec);
+
+    if (mmap(vm->cpu.memory, DOLLY_CPU_MEMORY_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_FIXED, image->fd, 0) == MAP_FAILED) {
+        return DOLLY_VM_MAP_FAILED;
+    }
+    vm->arch = image->exec->header.arch;
+    return dolly_vm_load_6502(vm, image->exec, true);
+}
+
+// With preloaded set, bank 0 is already in guest memory from an image
+static dolly_vm_status dolly_vm_load_6502(dolly_vm* vm,
+                                          const dolly_executable* exec,
+                                          bool preloaded)
+{
+    if (!dolly_executable_is_6502(exec)) return DOLLY_VM_UNSUPPORTED_ARCH;
+    dolly_cpu_set_variant(&vm->cpu, dolly_executable_variant(exec));
+
+    bool found_start = false;
+
+    for (size_t i = 0; i < exec->header.section_count; ++i) {
+        const dolly_executable_section* section = &exec->sections[i];
+        if (!dolly_section_is_loaded(section)) continue;
+        uint8_t bank = dolly_section_bank(section);
+        uint16_t address = dolly_section_address(section);
+        if (section->load_address >= DOLLY_MAPPER_BANK_COUNT
+                                     * DOLLY_CPU_MEMORY_SIZE
+            || (uint64_t)address + section->size > DOLLY_CPU_MEMORY_SIZE) {
+            return DOLLY_VM_SECTION_OUT_OF_RANGE;
+        }
+
+        // Banked sections load into physical memory behind their window,
+        // once the bank is first selected
+        dolly_bank_window* window = NULL;
+        if (bank != 0) {
+            if (vm->mapper)
+                window = dolly_mapper_find_window(vm->mapper, address,
+                                                  section->size);
+            if (window == NULL) return DOLLY_VM_NO_BANK_WINDOW;
+            dolly_mapper_load(vm->mapper, exec, section);
+        } else if (!preloaded) {
+            dolly_executable_load_section(exec, section,
+                                          vm->cpu.memory + address);
+        }
+
+        if (strcmp(section->name, "_start") == 0
+            && section->type == DOLLY_SECTION_TEXT) {
+            if (window) dolly_mapper_select(vm->mapper, window, bank);
+            vm->cpu.program_counter = address;
+            found_start = true;
+        }
+    }
+
+    if (!found_start) return DOLLY_VM_NO_START_SECTION;
+
+    // Only once everything is loaded, as data may share a page with text
+    if (vm->protect_text) dolly_vm_protect_text(vm, exec);
+
+    vm->running = true;
+    return DOLLY_VM_OKAY;
+}
+
+static void dolly_vm_protect_text(dolly_vm* vm, const dolly_executable* exec)
+{
+    for (size_t i = 0; i < exec->header.section_count; ++i) {
+        const dolly_executable_section* section = &exec->sections[i];
+        // Protection is per guest page, which a window shares between banks
+        if (section->type != DOLLY_SECTION_TEXT
+            || dolly_section_bank(section) != 0) {
+            continue;
+        }
+        dolly_cpu_protect(&vm->cpu, section->load_address, section->size);
+    }
+
+    // Protection is per page too, so a page that text shares with data or
+    // BSS is left writable rather than faulting on the data
+    for (size_t i = 0; i < exec->header.section_count; ++i) {
+        const dolly_executable_section* section = &exec->sections[i];
+        if (section->type == DOLLY_SECTION_TEXT
+            || !dolly_section_is_loaded(section)) {
+            continue;
+        }
+        dolly_cpu_unprotect(&vm->cpu, dolly_section_address(section),
+                            section->size);
+    }
+}
+
+dolly_vm_status dolly_vm_resume(dolly_vm* vm, const dolly_executable* exec)
+{
+    if (!dolly_executable_is_6502(exec)) return DOLLY_VM_UNSUPPORTED_ARCH;
+    vm->arch = exec->header.arch;
+    dolly_cpu_set_variant(&vm->cpu, dolly_executable_variant(exec));
+
+    // There's nowhere to carry on from after an exit, so the guest starts
+    // over with the memory it left
+    if (vm->state && vm->state->exited) {
+        const dolly_executable_section* start = NULL;
+        for (size_t i = 0; i < exec->header.section_count; ++i) {
+            const dolly_executable_section* section = &exec->sections[i];
+            if (strcmp(section->name, "_start") == 0
+                && section->type == DOLLY_SECTION_TEXT) {
+                start = section;
+            }
+        }
+        if (start == NULL) return DOLLY_VM_NO_START_SECTION;
+        vm->cpu.program_counter = dolly_section_address(start);
+    }
+
+    if (vm->protect_text) dolly_vm_protect_text(vm, exec);
+
+    vm->running = true;
+    return DOLLY_VM_OKAY;
+}
+
+void dolly_vm_handle_syscall(dolly_vm* vm)
+{
+    dolly_cpu* cpu = &vm->cpu;
+    uint16_t buffer_vec = cpu->memory[0xFE]
+                        + ((uint16_t)cpu->memory[0xFF] << 8);
+    size_t buffer_space = DOLLY_CPU_MEMORY_SIZE - buffer_vec;
+
+    switch (cpu->reg_a) {
+    case DOLLY_SYSCALL_EXIT:
+        vm->running = false;
+        vm->exited = true;
+        break;
+    case DOLLY_SYSCALL_PRINT:
+        // Output was already printed the first time through
+        if (!vm->silent
+            && (!vm->history
+                || !dolly_history_in_past(vm->history, vm->instructions))) {
+            fputs((const char*)cpu->memory + buffer_vec, vm->output);
+        }
+        break;
+    case DOLLY_SYSCALL_READ: {
+        size_t capacity = cpu->reg_x == 0 ? 256 : cpu->reg_x;
+        if (capacity > buffer_space) capacity = buffer_space;
+        size_t size = 0;
+        if (!dolly_cpu_check_writable(cpu, buffer_vec, capacity)) {
+            dolly_vm_fault(vm);
+            break;
+        }
+        // Leave room for the terminator, which isn't part of the input
+        if (capacity > 1
+            && !dolly_vm_input(vm, DOLLY_REPLAY_EVENT_READ,
+                               cpu->memory + buffer_vec, capacity - 1,
+                               &size)) {
+            vm->running = false;
+            break;
+        }
+        cpu->memory[buffer_vec + size] = 0;
+        dolly_cpu_mark_dirty(cpu, buffer_vec, size + 1);
+        cpu->reg_a = (uint8_t) size;
+        break;
+    }
+    case DOLLY_SYSCALL_TIME: {
+        uint8_t now[4];
+        size_t size;
+        if (!dolly_cpu_check_writable(cpu, buffer_vec, sizeof(now))) {
+            dolly_vm_fault(vm);
+            break;
+        }
+        if (!dolly_vm_input(vm, DOLLY_REPLAY_EVENT_TIME, now, sizeof(now),
+                            &size) || size != sizeof(now)) {
+            vm->running = false;
+            break;
+        }
+        for (size_t i = 0; i < sizeof(now) && i < buffer_space; ++i)
+            cpu->memory[buffer_vec + i] = now[i];
+        dolly_cpu_mark_dirty(cpu, buffer_vec, sizeof(now));
+        break;
+    }
+    case DOLLY_SYSCALL_CHECKPOINT:
+        if (vm->state && !dolly_state_save(vm->state, vm)) {
+            if (!vm->silent) perror("Couldn't save state");
+            vm->running = false;
+        }
+        break;
+    default:
+        if (!vm->silent) fputs("Invalid syscall, exiting\n", vm->output);
+        vm->running = false;
+        break;
+    }
+    cpu->flags.break_flag = 0;
+}
+
+void dolly_vm_fault(dolly_vm* vm)
+{
+    // A breakpoint only stops the run loop, leaving the VM able to continue
+    if (dolly_cpu_at_trap(&vm->cpu)) return;
+
+    if (!vm->silent && vm->errors) {
+        char message[64];
+        dolly_vm_describe_fault(vm, message, sizeof(message));
+        fprintf(vm->errors, "%s\n", message);
+    }
+    vm->faulted = true;
+    vm->running = false;
+}
+
+void dolly_vm_describe_fault(const dolly_vm* vm, char* buffer, size_t size)
+{
+    if (vm->cpu65816) {
+        const dolly_cpu65816* cpu = vm->cpu65816;
+        snprintf(buffer, size, "Unrecognised instruction 0x%02x",
+                 dolly_cpu65816_read(cpu, (uint32_t)cpu->program_bank << 16
+                                          | cpu->program_counter));
+    } else if (vm->cpu.write_fault) {
+        snprintf(buffer, size, "Write to read-only memory at $%04x",
+                 vm->cpu.write_fault_address);
+    } else {
+        snprintf(buffer, size, "Unrecognised instruction 0x%02x",
+                 vm->cpu.memory[vm->cpu.program_counter]);
+    }
+}
+
+void dolly_vm_run(dolly_vm* vm)
+{
+    if (vm->arch == DOLLY_ARCH_65816) {
+        while (dolly_vm_step_65816(vm));
+        return;
+    }
+    while (dolly_vm_step(vm));
+}
+
+void dolly_vm_run_until(dolly_vm* vm, uint64_t cycles)
+{
+    if (vm->arch == DOLLY_ARCH_65816) {
+        while (vm->cycles < cycles && dolly_vm_step_65816(vm));
+        return;
+    }
+    while (vm->cycles < cycles && dolly_vm_step(vm));
+}
+
+void dolly_vm_destroy(dolly_vm* vm)
+{
+    if (vm->mapper) dolly_mapper_destroy(vm->mapper);
+    dolly_cpu_destroy(&vm->cpu);
+    if (vm->cpu65816) {
+        dolly_cpu65816_destroy(vm->cpu65816);
+        dolly_free(vm->cpu65816);
+    }
+}
+
+const char* dolly_vm_error_msg(dolly_vm_status status)
+{
+    switch (status) {
+    default: case DOLLY_VM_OKAY: return "";
+    case DOLLY_VM_NO_START_SECTION: return "text section '_start' not found";
+    case DOLLY_VM_SECTION_OUT_OF_RANGE: return "section doesn't fit in memory";
+    case DOLLY_VM_NO_BANK_WINDOW: return "banked section isn't within a bank "
+                                         "window";
+    case DOLLY_VM_UNSUPPORTED_ARCH: return "unsupported architecture";
+    case DOLLY_VM_MAP_FAILED: return "couldn't map image into guest memory";
+    case DOLLY_VM_OUT_OF_MEMORY: return "out of memory";
+    }
+}
+
+const char* dolly_vm_syscall_str(int syscall)
+{
+    switch (syscall) {
+    case DOLLY_SYSCALL_EXIT: return "exit";
+    case DOLLY_SYSCALL_PRINT: return "print";
+    case DOLLY_SYSCALL_READ: return "read";
+    case DOLLY_SYSCALL_TIME: return "time";
+    case DOLLY_SYSCALL_CHECKPOINT: return "checkpoint";
+    default: return "(invalid)";
+    }
+}
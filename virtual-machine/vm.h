@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "core/core.h"
+
+#include "virtual-machine/cpu.h"
+#include "virtual-machine/cpu65816.h"
+#include "virtual-machine/env.h"
+#include "virtual-machine/replay.h"
+
+struct dolly_history;
+struct dolly_image;
+struct dolly_mapper;
+struct dolly_state;
+
+struct dolly_vm
+{
+    dolly_architecture arch; // Which core runs the guest
+    dolly_cpu cpu;
+    dolly_cpu65816* cpu65816; // Only for 65816 executables
+    uint64_t cycles;
+    uint64_t instructions;
+    bool running;
+    bool faulted; // Stopped on an invalid instruction
+    bool exited; // Stopped at the exit syscall
+    dolly_replay_log* replay; // Optional, records or supplies syscall inputs
+    struct dolly_history* history; // Optional, set while time-travel debugging
+    // Optional, needed for banked sections and destroyed along with the VM
+    struct dolly_mapper* mapper;
+    struct dolly_state* state; // Optional, saved to at checkpoints
+    bool silent; // Suppresses guest output and fault messages
+    // Where the read and print syscalls go, stdin and stdout by default. A
+    // NULL input reads as end of file, and a silent VM needs no output.
+    FILE* input;
+    FILE* output;
+    FILE* errors; // Where faults are reported, stderr by default, or NULL
+    bool fixed_time; // The time syscall always gives 0, for repeatable runs
+    bool protect_text; // Make pages holding only text read-only
+};
+
+typedef struct dolly_vm dolly_vm;
+
+enum dolly_vm_status
+{
+    DOLLY_VM_OKAY, DOLLY_VM_NO_START_SECTION, DOLLY_VM_SECTION_OUT_OF_RANGE,
+    DOLLY_VM_NO_BANK_WINDOW, DOLLY_VM_UNSUPPORTED_ARCH, DOLLY_VM_MAP_FAILED,
+    DOLLY_VM_OUT_OF_MEMORY
+};
+
+typedef enum dolly_vm_status dolly_vm_status;
+
+void            dolly_vm_init(dolly_vm* vm);
+// Banked sections are copied in when their bank is first selected, so the
+// executable must outlive the VM
+dolly_vm_status dolly_vm_load(dolly_vm* vm, const dolly_executable* exec);
+// As dolly_vm_load, but sharing unwritten pages with every other VM loaded
+// from the image. Any mapper must be set up first.
+dolly_vm_status dolly_vm_load_image(dolly_vm* vm,
+                                    const struct dolly_image* image);
+// Prepares to carry on running exec from memory and registers restored from
+// elsewhere, which are left as they are. A state saved once the guest had
+// exited starts over from _start instead, keeping its memory.
+dolly_vm_status dolly_vm_resume(dolly_vm* vm, const dolly_executable* exec);
+void            dolly_vm_handle_syscall(dolly_vm* vm);
+void            dolly_vm_fault(dolly_vm* vm);
+// Says why a VM which has faulted stopped, as reported on its errors stream
+void            dolly_vm_describe_fault(const dolly_vm* vm, char* buffer,
+                                        size_t size);
+void            dolly_vm_run(dolly_vm* vm);
+// Stops early, with the VM still running, once it has used cycles in all
+void            dolly_vm_run_until(dolly_vm* vm, uint64_t cycles);
+void            dolly_vm_destroy(dolly_vm* vm);
+
+const char* dolly_vm_error_msg(dolly_vm_status status);
+const char* dolly_vm_syscall_str(int syscall);
+
+// Executes a single instruction and services any syscall it raised, on the
+// 6502 core. This is inline so that instrumented run loops elsewhere compile
+// down to the same code as dolly_vm_run plus their own bookkeeping.
+static inline bool dolly_vm_step(dolly_vm* vm)
+{
+    int delay = dolly_cpu_read_next_instruction(&vm->cpu);
+    if (delay == -1) {
+        dolly_vm_fault(vm);
+        return false;
+    }
+
+    vm->cycles += delay;
+    ++vm->instructions;
+
+    if (vm->cpu.flags.break_flag) dolly_vm_handle_syscall(vm);
+    if (vm->cpu.stopped) vm->running = false;
+    return vm->running;
+}